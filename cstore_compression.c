@@ -0,0 +1,645 @@
+/*-------------------------------------------------------------------------
+ *
+ * cstore_compression.c
+ *
+ * This file contains type-specific encodings for cstore value streams. Unlike
+ * general purpose compression, these encodings know the layout of the values
+ * in the stream, and decode them in a single pass without a dictionary. We
+ * have Gorilla XOR encoding for floats, and delta-of-delta encoding for
+ * integers, dates and timestamps.
+ *
+ * Copyright (c) 2014, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+
+#include "postgres.h"
+#include "cstore_fdw.h"
+#include "utils/memutils.h"
+
+
+/*
+ * Encoded streams are followed by this many zero bytes, so that the bit reader
+ * can always load a full 64-bit word without checking for the end of buffer.
+ */
+#define BIT_STREAM_PADDING 8
+
+/*
+ * Gorilla encoded streams start with the number of values, followed by the bit
+ * stream. Leading zero counts are stored in 5 bits, so we cap them at 31.
+ */
+#define GORILLA_LEADING_ZEROS_MAXIMUM 31
+
+/*
+ * Delta encoded streams bit-pack their delta-of-deltas in frames of this many
+ * values, and each frame uses the bit width of its largest value.
+ */
+#define DELTA_FRAME_VALUE_COUNT 128
+
+
+/*
+ * DeltaCompressHeader starts delta encoded streams. It is followed by one frame
+ * for each DELTA_FRAME_VALUE_COUNT values after the first one; each frame is a
+ * bit width byte followed by the frame's bit-packed values.
+ */
+typedef struct DeltaCompressHeader {
+    uint32 valueCount;
+    uint32 valueWidth;
+    int64 firstValue;
+
+} DeltaCompressHeader;
+
+
+/* BitWriter appends bits to a buffer, most significant bit first */
+typedef struct BitWriter {
+    StringInfo buffer;
+    uint64 bitBuffer;
+    uint32 bitCount;
+
+} BitWriter;
+
+
+/* BitReader reads bits from a padded buffer, most significant bit first */
+typedef struct BitReader {
+    const uint8 *data;
+    uint64 bitOffset;
+    uint64 bitLength;
+
+} BitReader;
+
+
+/* local functions forward declarations */
+static void WriteBits(BitWriter *bitWriter, uint64 value, uint32 bitCount);
+static void FlushBits(BitWriter *bitWriter);
+static inline uint64 ReadBits(BitReader *bitReader, uint32 bitCount);
+static inline uint64 LoadBigEndian64(const uint8 *data);
+static inline int64 LoadIntegerValue(const char *data, uint32 valueWidth);
+static inline void StoreIntegerValue(char *data, uint32 valueIndex, uint32 valueWidth,
+                                     uint64 value);
+static void PackFrame(StringInfo buffer, const uint64 *valueArray, uint32 valueCount,
+                      uint32 bitWidth);
+static void UnpackFrame(const uint8 *data, uint32 valueCount, uint32 bitWidth,
+                        uint64 *valueArray);
+static inline uint64 LoadLittleEndian64(const uint8 *data);
+
+
+/*
+ * GorillaCompress encodes the given stream of 8-byte values with the XOR scheme
+ * of Facebook's Gorilla paper. Each value is XORed with the previous one; equal
+ * values take a single bit, and other values only store the bits between the
+ * XOR's leading and trailing zeros, reusing the previous window when the new
+ * bits fit in it. Slowly changing float8 series compress well this way. The
+ * function returns false if the source isn't a stream of 8-byte values, or if
+ * the encoded stream isn't smaller than the source.
+ */
+bool
+GorillaCompress(const char *source, uint32 sourceLength, StringInfo compressedBuffer) {
+    BitWriter bitWriter;
+    uint32 valueCount = sourceLength / sizeof(uint64);
+    uint32 valueIndex = 0;
+    uint64 previousValue = 0;
+    uint32 previousLeadingZeros = 0;
+    uint32 previousTrailingZeros = 0;
+    bool previousWindowValid = false;
+
+    if (valueCount == 0 || sourceLength % sizeof(uint64) != 0) {
+        return false;
+    }
+
+    resetStringInfo(compressedBuffer);
+    appendBinaryStringInfo(compressedBuffer, (char *) &valueCount, sizeof(uint32));
+
+    bitWriter.buffer = compressedBuffer;
+    bitWriter.bitBuffer = 0;
+    bitWriter.bitCount = 0;
+
+    memcpy(&previousValue, source, sizeof(uint64));
+    WriteBits(&bitWriter, previousValue, 64);
+
+    for (valueIndex = 1; valueIndex < valueCount; valueIndex++) {
+        uint64 value = 0;
+        uint64 xorValue = 0;
+        uint32 leadingZeros = 0;
+        uint32 trailingZeros = 0;
+
+        memcpy(&value, source + valueIndex * sizeof(uint64), sizeof(uint64));
+        xorValue = value ^ previousValue;
+        previousValue = value;
+
+        if (xorValue == 0) {
+            WriteBits(&bitWriter, 0, 1);
+            continue;
+        }
+
+        leadingZeros = Min(__builtin_clzll(xorValue), GORILLA_LEADING_ZEROS_MAXIMUM);
+        trailingZeros = __builtin_ctzll(xorValue);
+
+        if (previousWindowValid && leadingZeros >= previousLeadingZeros &&
+            trailingZeros >= previousTrailingZeros) {
+            uint32 significantBitCount = 64 - previousLeadingZeros - previousTrailingZeros;
+
+            WriteBits(&bitWriter, 0x2, 2);
+            WriteBits(&bitWriter, xorValue >> previousTrailingZeros, significantBitCount);
+        } else {
+            uint32 significantBitCount = 64 - leadingZeros - trailingZeros;
+
+            /* 64 significant bits don't fit in 6 bits, and are stored as zero */
+            WriteBits(&bitWriter, 0x3, 2);
+            WriteBits(&bitWriter, leadingZeros, 5);
+            WriteBits(&bitWriter, significantBitCount & 0x3F, 6);
+            WriteBits(&bitWriter, xorValue >> trailingZeros, significantBitCount);
+
+            previousLeadingZeros = leadingZeros;
+            previousTrailingZeros = trailingZeros;
+            previousWindowValid = true;
+        }
+
+        /* give up early if the encoding doesn't pay off */
+        if ((uint32) compressedBuffer->len >= sourceLength) {
+            return false;
+        }
+    }
+
+    FlushBits(&bitWriter);
+
+    return ((uint32) compressedBuffer->len < sourceLength);
+}
+
+
+/*
+ * GorillaDecompress decodes the given Gorilla encoded stream into a stream of
+ * 8-byte values in the decompressed buffer. The function errors out if the
+ * encoded stream is malformed.
+ */
+void
+GorillaDecompress(StringInfo buffer, StringInfo decompressedBuffer) {
+    BitReader bitReader;
+    uint32 valueCount = 0;
+    uint32 valueIndex = 0;
+    uint64 *valueArray = NULL;
+    uint64 value = 0;
+    uint32 leadingZeros = 0;
+    uint32 trailingZeros = 0;
+    uint32 significantBitCount = 0;
+
+    if ((uint32) buffer->len < sizeof(uint32) + BIT_STREAM_PADDING) {
+        ereport(ERROR, (errmsg("cannot decompress the buffer"),
+                errdetail("Gorilla encoded buffer is too short")));
+    }
+
+    memcpy(&valueCount, buffer->data, sizeof(uint32));
+
+    bitReader.data = (const uint8 *) buffer->data + sizeof(uint32);
+    bitReader.bitOffset = 0;
+    bitReader.bitLength = (uint64) (buffer->len - sizeof(uint32) - BIT_STREAM_PADDING) * 8;
+
+    /* each value after the first one takes at least one bit */
+    if (valueCount == 0 || valueCount - 1 > bitReader.bitLength ||
+        valueCount > MaxAllocSize / sizeof(uint64)) {
+        ereport(ERROR, (errmsg("cannot decompress the buffer"),
+                errdetail("Invalid value count %u in Gorilla encoded buffer",
+                          valueCount)));
+    }
+
+    resetStringInfo(decompressedBuffer);
+    enlargeStringInfo(decompressedBuffer, valueCount * sizeof(uint64));
+    valueArray = (uint64 *) decompressedBuffer->data;
+
+    value = ReadBits(&bitReader, 64);
+    valueArray[0] = value;
+
+    for (valueIndex = 1; valueIndex < valueCount; valueIndex++) {
+        if (ReadBits(&bitReader, 1) != 0) {
+            if (ReadBits(&bitReader, 1) != 0) {
+                leadingZeros = (uint32) ReadBits(&bitReader, 5);
+                significantBitCount = (uint32) ReadBits(&bitReader, 6);
+                if (significantBitCount == 0) {
+                    significantBitCount = 64;
+                }
+
+                if (leadingZeros + significantBitCount > 64) {
+                    ereport(ERROR, (errmsg("cannot decompress the buffer"),
+                            errdetail("Invalid bit window in Gorilla encoded buffer")));
+                }
+
+                trailingZeros = 64 - leadingZeros - significantBitCount;
+            } else if (significantBitCount == 0) {
+                ereport(ERROR, (errmsg("cannot decompress the buffer"),
+                        errdetail("Missing bit window in Gorilla encoded buffer")));
+            }
+
+            value ^= ReadBits(&bitReader, significantBitCount) << trailingZeros;
+        }
+
+        valueArray[valueIndex] = value;
+    }
+
+    decompressedBuffer->len = valueCount * sizeof(uint64);
+    decompressedBuffer->data[decompressedBuffer->len] = '\0';
+}
+
+
+/*
+ * DeltaCompress encodes the given stream of 2, 4 or 8-byte integers with
+ * delta-of-delta encoding. Nearly monotonic values, such as timestamps and
+ * sequential ids, have delta-of-deltas close to zero. We zigzag encode these so
+ * that small negative values also get small, and bit-pack them in frames with
+ * the frame's largest bit width. Arithmetic is done on unsigned integers, so
+ * overflowing differences wrap around and decode back to the same values. The
+ * function returns false if the encoded stream isn't smaller than the source.
+ */
+bool
+DeltaCompress(const char *source, uint32 sourceLength, uint32 valueWidth,
+              StringInfo compressedBuffer) {
+    DeltaCompressHeader compressHeader;
+    uint64 frameValueArray[DELTA_FRAME_VALUE_COUNT];
+    uint32 valueCount = 0;
+    uint32 valueIndex = 0;
+    uint64 previousValue = 0;
+    uint64 previousDelta = 0;
+    uint32 paddingIndex = 0;
+
+    Assert(valueWidth == sizeof(int16) || valueWidth == sizeof(int32) ||
+           valueWidth == sizeof(int64));
+
+    valueCount = sourceLength / valueWidth;
+    if (valueCount == 0 || sourceLength % valueWidth != 0) {
+        return false;
+    }
+
+    memset(&compressHeader, 0, sizeof(DeltaCompressHeader));
+    compressHeader.valueCount = valueCount;
+    compressHeader.valueWidth = valueWidth;
+    compressHeader.firstValue = LoadIntegerValue(source, valueWidth);
+
+    resetStringInfo(compressedBuffer);
+    appendBinaryStringInfo(compressedBuffer, (char *) &compressHeader,
+                           sizeof(DeltaCompressHeader));
+
+    previousValue = (uint64) compressHeader.firstValue;
+    for (valueIndex = 1; valueIndex < valueCount; valueIndex += DELTA_FRAME_VALUE_COUNT) {
+        uint32 frameValueCount = Min(DELTA_FRAME_VALUE_COUNT, valueCount - valueIndex);
+        uint32 frameIndex = 0;
+        uint64 frameBits = 0;
+        uint32 bitWidth = 0;
+
+        for (frameIndex = 0; frameIndex < frameValueCount; frameIndex++) {
+            const char *valuePointer = source + (valueIndex + frameIndex) * valueWidth;
+            uint64 value = (uint64) LoadIntegerValue(valuePointer, valueWidth);
+            uint64 delta = value - previousValue;
+            int64 deltaOfDelta = (int64) (delta - previousDelta);
+            uint64 zigzagValue = (((uint64) deltaOfDelta) << 1) ^
+                                 ((uint64) (deltaOfDelta >> 63));
+
+            frameValueArray[frameIndex] = zigzagValue;
+            frameBits |= zigzagValue;
+
+            previousValue = value;
+            previousDelta = delta;
+        }
+
+        if (frameBits != 0) {
+            bitWidth = 64 - __builtin_clzll(frameBits);
+        }
+
+        appendStringInfoCharMacro(compressedBuffer, (char) bitWidth);
+        PackFrame(compressedBuffer, frameValueArray, frameValueCount, bitWidth);
+
+        /* give up early if the encoding doesn't pay off */
+        if ((uint32) compressedBuffer->len >= sourceLength) {
+            return false;
+        }
+    }
+
+    for (paddingIndex = 0; paddingIndex < BIT_STREAM_PADDING; paddingIndex++) {
+        appendStringInfoCharMacro(compressedBuffer, 0);
+    }
+
+    return ((uint32) compressedBuffer->len < sourceLength);
+}
+
+
+/*
+ * DeltaDecompress decodes the given delta encoded stream into a stream of
+ * integers of the encoded width. Each frame is unpacked into an array first, so
+ * that the unpacking loop has no dependencies between values, and the prefix
+ * sums then run over the unpacked array. The function errors out if the
+ * encoded stream is malformed.
+ */
+void
+DeltaDecompress(StringInfo buffer, StringInfo decompressedBuffer) {
+    DeltaCompressHeader compressHeader;
+    uint64 frameValueArray[DELTA_FRAME_VALUE_COUNT];
+    const uint8 *frameData = NULL;
+    const uint8 *dataEnd = NULL;
+    uint32 valueCount = 0;
+    uint32 valueWidth = 0;
+    uint32 valueIndex = 0;
+    uint64 value = 0;
+    uint64 delta = 0;
+    char *valueData = NULL;
+
+    if ((uint32) buffer->len < sizeof(DeltaCompressHeader) + BIT_STREAM_PADDING) {
+        ereport(ERROR, (errmsg("cannot decompress the buffer"),
+                errdetail("Delta encoded buffer is too short")));
+    }
+
+    memcpy(&compressHeader, buffer->data, sizeof(DeltaCompressHeader));
+    valueCount = compressHeader.valueCount;
+    valueWidth = compressHeader.valueWidth;
+
+    frameData = (const uint8 *) buffer->data + sizeof(DeltaCompressHeader);
+    dataEnd = (const uint8 *) buffer->data + buffer->len - BIT_STREAM_PADDING;
+
+    /* each frame takes at least one byte */
+    if ((valueWidth != sizeof(int16) && valueWidth != sizeof(int32) &&
+         valueWidth != sizeof(int64)) || valueCount == 0 ||
+        valueCount > MaxAllocSize / valueWidth ||
+        (valueCount - 1) / DELTA_FRAME_VALUE_COUNT > (uint32) (dataEnd - frameData)) {
+        ereport(ERROR, (errmsg("cannot decompress the buffer"),
+                errdetail("Invalid header in delta encoded buffer")));
+    }
+
+    resetStringInfo(decompressedBuffer);
+    enlargeStringInfo(decompressedBuffer, valueCount * valueWidth);
+    valueData = decompressedBuffer->data;
+
+    value = (uint64) compressHeader.firstValue;
+    StoreIntegerValue(valueData, 0, valueWidth, value);
+
+    for (valueIndex = 1; valueIndex < valueCount; valueIndex += DELTA_FRAME_VALUE_COUNT) {
+        uint32 frameValueCount = Min(DELTA_FRAME_VALUE_COUNT, valueCount - valueIndex);
+        uint32 frameIndex = 0;
+        uint32 bitWidth = 0;
+        uint32 frameLength = 0;
+
+        if (frameData >= dataEnd) {
+            ereport(ERROR, (errmsg("cannot decompress the buffer"),
+                    errdetail("Unexpected end of delta encoded buffer")));
+        }
+
+        bitWidth = *frameData;
+        frameData++;
+
+        frameLength = (frameValueCount * bitWidth + 7) / 8;
+        if (bitWidth > 64 || frameLength > (uint32) (dataEnd - frameData)) {
+            ereport(ERROR, (errmsg("cannot decompress the buffer"),
+                    errdetail("Invalid frame in delta encoded buffer")));
+        }
+
+        UnpackFrame(frameData, frameValueCount, bitWidth, frameValueArray);
+        frameData += frameLength;
+
+        for (frameIndex = 0; frameIndex < frameValueCount; frameIndex++) {
+            uint64 zigzagValue = frameValueArray[frameIndex];
+            uint64 deltaOfDelta = (zigzagValue >> 1) ^ (~(zigzagValue & 1) + 1);
+
+            delta += deltaOfDelta;
+            value += delta;
+            StoreIntegerValue(valueData, valueIndex + frameIndex, valueWidth, value);
+        }
+    }
+
+    decompressedBuffer->len = valueCount * valueWidth;
+    decompressedBuffer->data[decompressedBuffer->len] = '\0';
+}
+
+
+/* WriteBits appends the lowest bitCount bits of the given value to the stream. */
+static void
+WriteBits(BitWriter *bitWriter, uint64 value, uint32 bitCount) {
+    Assert(bitCount > 0 && bitCount <= 64);
+
+    while (bitCount > 0) {
+        uint32 chunkBitCount = Min(64 - bitWriter->bitCount, bitCount);
+        uint64 chunk = value >> (bitCount - chunkBitCount);
+
+        if (chunkBitCount == 64) {
+            bitWriter->bitBuffer = chunk;
+        } else {
+            chunk &= (((uint64) 1) << chunkBitCount) - 1;
+            bitWriter->bitBuffer = (bitWriter->bitBuffer << chunkBitCount) | chunk;
+        }
+
+        bitWriter->bitCount += chunkBitCount;
+        bitCount -= chunkBitCount;
+
+        if (bitWriter->bitCount == 64) {
+            int byteIndex = 0;
+            for (byteIndex = 7; byteIndex >= 0; byteIndex--) {
+                appendStringInfoCharMacro(bitWriter->buffer,
+                                          (char) (bitWriter->bitBuffer >> (byteIndex * 8)));
+            }
+
+            bitWriter->bitBuffer = 0;
+            bitWriter->bitCount = 0;
+        }
+    }
+}
+
+
+/*
+ * FlushBits writes out the remaining bits, padded with zeros to a byte boundary,
+ * and appends the zero padding the bit reader relies on.
+ */
+static void
+FlushBits(BitWriter *bitWriter) {
+    uint32 paddingIndex = 0;
+
+    if (bitWriter->bitCount > 0) {
+        uint64 bitBuffer = bitWriter->bitBuffer << (64 - bitWriter->bitCount);
+        uint32 byteCount = (bitWriter->bitCount + 7) / 8;
+        uint32 byteIndex = 0;
+
+        for (byteIndex = 0; byteIndex < byteCount; byteIndex++) {
+            appendStringInfoCharMacro(bitWriter->buffer,
+                                      (char) (bitBuffer >> (56 - byteIndex * 8)));
+        }
+
+        bitWriter->bitBuffer = 0;
+        bitWriter->bitCount = 0;
+    }
+
+    for (paddingIndex = 0; paddingIndex < BIT_STREAM_PADDING; paddingIndex++) {
+        appendStringInfoCharMacro(bitWriter->buffer, 0);
+    }
+}
+
+
+/*
+ * ReadBits reads the next bitCount bits from the stream. The stream is padded,
+ * so we can load the 64-bit word at the current byte, and only need one more
+ * byte when the bits straddle it.
+ */
+static inline uint64
+ReadBits(BitReader *bitReader, uint32 bitCount) {
+    uint64 byteOffset = bitReader->bitOffset >> 3;
+    uint32 bitShift = bitReader->bitOffset & 0x7;
+    uint64 word = 0;
+
+    Assert(bitCount > 0 && bitCount <= 64);
+
+    if (bitReader->bitOffset + bitCount > bitReader->bitLength) {
+        ereport(ERROR, (errmsg("cannot decompress the buffer"),
+                errdetail("Unexpected end of encoded bit stream")));
+    }
+
+    word = LoadBigEndian64(bitReader->data + byteOffset) << bitShift;
+    if (bitCount > 64 - bitShift) {
+        word |= bitReader->data[byteOffset + 8] >> (8 - bitShift);
+    }
+
+    bitReader->bitOffset += bitCount;
+
+    return (bitCount == 64) ? word : (word >> (64 - bitCount));
+}
+
+
+/* LoadBigEndian64 loads 8 bytes from the given address as a big endian word. */
+static inline uint64
+LoadBigEndian64(const uint8 *data) {
+    uint64 word = 0;
+
+    memcpy(&word, data, sizeof(uint64));
+
+#ifdef WORDS_BIGENDIAN
+    return word;
+#else
+    return __builtin_bswap64(word);
+#endif
+}
+
+
+/*
+ * LoadIntegerValue loads a signed integer of the given width from the given
+ * address, and sign extends it to 64 bits.
+ */
+static inline int64
+LoadIntegerValue(const char *data, uint32 valueWidth) {
+    int64 value = 0;
+
+    if (valueWidth == sizeof(int64)) {
+        int64 value64 = 0;
+        memcpy(&value64, data, sizeof(int64));
+        value = value64;
+    } else if (valueWidth == sizeof(int32)) {
+        int32 value32 = 0;
+        memcpy(&value32, data, sizeof(int32));
+        value = value32;
+    } else {
+        int16 value16 = 0;
+        memcpy(&value16, data, sizeof(int16));
+        value = value16;
+    }
+
+    return value;
+}
+
+
+/*
+ * StoreIntegerValue stores the given value at the given index of an aligned
+ * array of integers of the given width, truncating it to that width.
+ */
+static inline void
+StoreIntegerValue(char *data, uint32 valueIndex, uint32 valueWidth, uint64 value) {
+    if (valueWidth == sizeof(int64)) {
+        ((int64 *) data)[valueIndex] = (int64) value;
+    } else if (valueWidth == sizeof(int32)) {
+        ((int32 *) data)[valueIndex] = (int32) value;
+    } else {
+        ((int16 *) data)[valueIndex] = (int16) value;
+    }
+}
+
+
+/*
+ * PackFrame appends the lowest bitWidth bits of each given value to the buffer,
+ * least significant bit first. Values are collected into a 64-bit word, and
+ * values that straddle two words are split between them.
+ */
+static void
+PackFrame(StringInfo buffer, const uint64 *valueArray, uint32 valueCount,
+          uint32 bitWidth) {
+    uint64 bitBuffer = 0;
+    uint32 bitCount = 0;
+    uint32 valueIndex = 0;
+    uint32 byteIndex = 0;
+
+    if (bitWidth == 0) {
+        return;
+    }
+
+    for (valueIndex = 0; valueIndex < valueCount; valueIndex++) {
+        uint64 value = valueArray[valueIndex];
+
+        bitBuffer |= value << bitCount;
+
+        if (bitCount + bitWidth >= 64) {
+            uint32 overflowBitCount = bitCount + bitWidth - 64;
+
+            for (byteIndex = 0; byteIndex < sizeof(uint64); byteIndex++) {
+                appendStringInfoCharMacro(buffer, (char) (bitBuffer >> (byteIndex * 8)));
+            }
+
+            bitBuffer = (overflowBitCount > 0) ? (value >> (64 - bitCount)) : 0;
+            bitCount = overflowBitCount;
+        } else {
+            bitCount += bitWidth;
+        }
+    }
+
+    for (byteIndex = 0; byteIndex < (bitCount + 7) / 8; byteIndex++) {
+        appendStringInfoCharMacro(buffer, (char) (bitBuffer >> (byteIndex * 8)));
+    }
+}
+
+
+/*
+ * UnpackFrame unpacks the given number of bitWidth-bit values from the given
+ * frame data. Each value is extracted independently from the 64-bit word at
+ * its first byte, so the compiler can vectorize the loop. Encoded streams are
+ * padded, which makes it safe to load words past the end of the frame.
+ */
+static void
+UnpackFrame(const uint8 *data, uint32 valueCount, uint32 bitWidth,
+            uint64 *valueArray) {
+    uint64 valueMask = (bitWidth == 64) ? ~((uint64) 0) : ((((uint64) 1) << bitWidth) - 1);
+    uint32 valueIndex = 0;
+
+    if (bitWidth == 0) {
+        memset(valueArray, 0, valueCount * sizeof(uint64));
+        return;
+    }
+
+    for (valueIndex = 0; valueIndex < valueCount; valueIndex++) {
+        uint64 bitOffset = (uint64) valueIndex * bitWidth;
+        uint64 byteOffset = bitOffset >> 3;
+        uint32 bitShift = bitOffset & 0x7;
+        uint64 word = LoadLittleEndian64(data + byteOffset) >> bitShift;
+
+        /* only widths above 56 bits can spill into a ninth byte */
+        if (bitWidth + bitShift > 64) {
+            word |= ((uint64) data[byteOffset + 8]) << (64 - bitShift);
+        }
+
+        valueArray[valueIndex] = word & valueMask;
+    }
+}
+
+
+/* LoadLittleEndian64 loads 8 bytes from the given address as a little endian word. */
+static inline uint64
+LoadLittleEndian64(const uint8 *data) {
+    uint64 word = 0;
+
+    memcpy(&word, data, sizeof(uint64));
+
+#ifdef WORDS_BIGENDIAN
+    return __builtin_bswap64(word);
+#else
+    return word;
+#endif
+}
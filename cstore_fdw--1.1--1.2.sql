@@ -0,0 +1,87 @@
+/* cstore_fdw/cstore_fdw--1.1--1.2.sql */
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION UPDATE
+\echo Use "ALTER EXTENSION cstore_fdw UPDATE TO '1.2'" to load this file. \quit
+
+CREATE FUNCTION cstore_drop_stripes_before(relation regclass, column_name text, value text)
+    RETURNS bigint
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+-- Partial aggregates return their transition states instead of final values,
+-- and combine aggregates merge these states and compute the final values. In
+-- distributed queries, shards run partial aggregates, and the coordinator runs
+-- combine aggregates over their results. Partial aggregates use the regular
+-- transition functions, so they are vectorized like the regular aggregates.
+-- Partial float states hold N, sum(X), and sum(X*X), so they also feed the
+-- variance and standard deviation combine aggregates.
+
+CREATE FUNCTION cstore_int4_avg_combine(bigint[], bigint[])
+    RETURNS bigint[]
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION cstore_float8_accum_combine(double precision[], double precision[])
+    RETURNS double precision[]
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE AGGREGATE cstore_partial_avg(int) (
+    SFUNC = int4_avg_accum,
+    STYPE = bigint[],
+    INITCOND = '{0,0}'
+);
+
+CREATE AGGREGATE cstore_partial_avg(real) (
+    SFUNC = float4_accum,
+    STYPE = double precision[],
+    INITCOND = '{0,0,0}'
+);
+
+CREATE AGGREGATE cstore_partial_avg(double precision) (
+    SFUNC = float8_accum,
+    STYPE = double precision[],
+    INITCOND = '{0,0,0}'
+);
+
+CREATE AGGREGATE cstore_combine_count(bigint) (
+    SFUNC = int8pl,
+    STYPE = bigint,
+    INITCOND = '0'
+);
+
+CREATE AGGREGATE cstore_combine_sum(bigint) (
+    SFUNC = int8pl,
+    STYPE = bigint
+);
+
+CREATE AGGREGATE cstore_combine_avg(bigint[]) (
+    SFUNC = cstore_int4_avg_combine,
+    STYPE = bigint[],
+    FINALFUNC = int8_avg,
+    INITCOND = '{0,0}'
+);
+
+CREATE AGGREGATE cstore_combine_avg(double precision[]) (
+    SFUNC = cstore_float8_accum_combine,
+    STYPE = double precision[],
+    FINALFUNC = float8_avg,
+    INITCOND = '{0,0,0}'
+);
+
+CREATE AGGREGATE cstore_combine_var_samp(double precision[]) (
+    SFUNC = cstore_float8_accum_combine,
+    STYPE = double precision[],
+    FINALFUNC = float8_var_samp,
+    INITCOND = '{0,0,0}'
+);
+
+CREATE AGGREGATE cstore_combine_stddev_samp(double precision[]) (
+    SFUNC = cstore_float8_accum_combine,
+    STYPE = double precision[],
+    FINALFUNC = float8_stddev_samp,
+    INITCOND = '{0,0,0}'
+);
@@ -0,0 +1,183 @@
+/* cstore_fdw/cstore_fdw--1.2.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION cstore_fdw" to load this file. \quit
+
+CREATE FUNCTION cstore_fdw_handler()
+    RETURNS fdw_handler
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION cstore_fdw_validator(text[], oid)
+    RETURNS void
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FOREIGN DATA WRAPPER cstore_fdw
+    HANDLER cstore_fdw_handler
+    VALIDATOR cstore_fdw_validator;
+
+CREATE FUNCTION cstore_ddl_event_end_trigger()
+    RETURNS event_trigger
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE EVENT TRIGGER cstore_ddl_event_end
+    ON ddl_command_end
+EXECUTE PROCEDURE cstore_ddl_event_end_trigger();
+
+CREATE FUNCTION cstore_table_size(relation regclass)
+    RETURNS bigint
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION cstore_drop_stripes_before(relation regclass, column_name text, value text)
+    RETURNS bigint
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+-- We declare transition functions here. Note that these functions' declarations
+-- and their definitions don't actually match. We manually set the arguments to
+-- pass to these functions in vectorized_aggregates.c.
+
+CREATE FUNCTION int4_sum_vec(bigint, int)
+    RETURNS bigint
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION int8_sum_vec(numeric, bigint)
+    RETURNS numeric
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION int4_avg_accum_vec(bigint[], int)
+    RETURNS bigint[]
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION int8_avg_accum_vec(numeric[], bigint)
+    RETURNS numeric[]
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION int8inc_vec(bigint)
+    RETURNS bigint
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION int8inc_any_vec(bigint, "any")
+    RETURNS bigint
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION float4pl_vec(real, real)
+    RETURNS real
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION float8pl_vec(double precision, double precision)
+    RETURNS double precision
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION float8_accum_vec(double precision[], double precision)
+    RETURNS double precision[]
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION float4_accum_vec(double precision[], real)
+    RETURNS double precision[]
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+-- Partial aggregates return their transition states instead of final values,
+-- and combine aggregates merge these states and compute the final values. In
+-- distributed queries, shards run partial aggregates, and the coordinator runs
+-- combine aggregates over their results. Partial aggregates use the regular
+-- transition functions, so they are vectorized like the regular aggregates.
+-- Partial float states hold N, sum(X), and sum(X*X), so they also feed the
+-- variance and standard deviation combine aggregates.
+
+CREATE FUNCTION cstore_int4_avg_combine(bigint[], bigint[])
+    RETURNS bigint[]
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION cstore_float8_accum_combine(double precision[], double precision[])
+    RETURNS double precision[]
+AS
+'MODULE_PATHNAME'
+    LANGUAGE C STRICT;
+
+CREATE AGGREGATE cstore_partial_avg(int) (
+    SFUNC = int4_avg_accum,
+    STYPE = bigint[],
+    INITCOND = '{0,0}'
+);
+
+CREATE AGGREGATE cstore_partial_avg(real) (
+    SFUNC = float4_accum,
+    STYPE = double precision[],
+    INITCOND = '{0,0,0}'
+);
+
+CREATE AGGREGATE cstore_partial_avg(double precision) (
+    SFUNC = float8_accum,
+    STYPE = double precision[],
+    INITCOND = '{0,0,0}'
+);
+
+CREATE AGGREGATE cstore_combine_count(bigint) (
+    SFUNC = int8pl,
+    STYPE = bigint,
+    INITCOND = '0'
+);
+
+CREATE AGGREGATE cstore_combine_sum(bigint) (
+    SFUNC = int8pl,
+    STYPE = bigint
+);
+
+CREATE AGGREGATE cstore_combine_avg(bigint[]) (
+    SFUNC = cstore_int4_avg_combine,
+    STYPE = bigint[],
+    FINALFUNC = int8_avg,
+    INITCOND = '{0,0}'
+);
+
+CREATE AGGREGATE cstore_combine_avg(double precision[]) (
+    SFUNC = cstore_float8_accum_combine,
+    STYPE = double precision[],
+    FINALFUNC = float8_avg,
+    INITCOND = '{0,0,0}'
+);
+
+CREATE AGGREGATE cstore_combine_var_samp(double precision[]) (
+    SFUNC = cstore_float8_accum_combine,
+    STYPE = double precision[],
+    FINALFUNC = float8_var_samp,
+    INITCOND = '{0,0,0}'
+);
+
+CREATE AGGREGATE cstore_combine_stddev_samp(double precision[]) (
+    SFUNC = cstore_float8_accum_combine,
+    STYPE = double precision[],
+    FINALFUNC = float8_stddev_samp,
+    INITCOND = '{0,0,0}'
+);
@@ -20,31 +20,42 @@
 
 #include <sys/stat.h>
 #include <unistd.h>
+#include <ctype.h>
 #include <limits.h>
 #include "access/htup_details.h"
 #include "access/reloptions.h"
 #include "access/sysattr.h"
 #include "catalog/namespace.h"
 #include "catalog/pg_foreign_table.h"
+#include "catalog/pg_type.h"
 #include "commands/copy.h"
 #include "commands/defrem.h"
 #include "commands/event_trigger.h"
 #include "commands/explain.h"
 #include "commands/vacuum.h"
+#include "executor/executor.h"
 #include "foreign/fdwapi.h"
 #include "foreign/foreign.h"
 #include "miscadmin.h"
 #include "nodes/makefuncs.h"
+#include "optimizer/clauses.h"
 #include "optimizer/cost.h"
 #include "optimizer/pathnode.h"
 #include "optimizer/planmain.h"
+#include "optimizer/planner.h"
 #include "optimizer/restrictinfo.h"
 #include "optimizer/var.h"
+#include "storage/lmgr.h"
 #include "tcop/utility.h"
+#include "utils/acl.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
 #include "utils/rel.h"
+#include "utils/syscache.h"
 
 
 /* local functions forward declarations */
@@ -53,7 +64,10 @@ static void CStoreProcessUtility(Node *parseTree, const char *queryString,
                                  ParamListInfo paramListInfo,
                                  DestReceiver *destReceiver, char *completionTag);
 
-static bool CStoreTable(Oid relationId);
+static PlannedStmt *CStorePlanner(Query *parse, int cursorOptions,
+                                  ParamListInfo boundParams);
+
+static bool CStoreTableNoCache(Oid relationId);
 
 static uint64 CopyIntoCStoreTable(const CopyStmt *copyStatement,
                                   const char *queryString);
@@ -70,12 +84,38 @@ static StringInfo OptionNamesString(Oid currentContextId);
 
 static CStoreFdwOptions *CStoreGetOptions(Oid foreignTableId);
 
+static CStoreFdwOptions *CStoreGetOptionsNoCache(Oid foreignTableId);
+
+static CStoreFdwOptions *CopyCStoreFdwOptions(CStoreFdwOptions *cstoreFdwOptions);
+
+static CStoreTableCacheEntry *CStoreTableCacheEnter(Oid relationId);
+
+static void InitializeCStoreTableCache(void);
+
+static void InvalidateCStoreTableCacheEntry(Oid relationId);
+
+static void CStoreTableCacheRelcacheCallback(Datum argument, Oid relationId);
+
+static void CStoreTableCacheSyscacheCallback(Datum argument, int cacheId,
+                                             uint32 hashValue);
+
 static char *CStoreGetOptionValue(Oid foreignTableId, const char *optionName);
 
 static void ValidateForeignTableOptions(char *filename, char *compressionTypeString,
                                         char *stripeRowCountString,
                                         char *blockRowCountString);
 
+static void ValidateColumnOptions(char *compressionTypeString, char *shredString);
+
+static CompressionType *ColumnCompressionTypes(Relation relation,
+                                               CompressionType tableCompressionType);
+
+static List *ShreddedColumns(Relation relation);
+
+static List *ShreddedPathList(char *shredString);
+
+static bool DeltaCompressionSupported(Oid typeId);
+
 static char *CStoreDefaultFilePath(Oid foreignTableId);
 
 static CompressionType ParseCompressionType(const char *compressionTypeString);
@@ -96,6 +136,8 @@ static BlockNumber PageCount(const char *filename);
 
 static List *ColumnList(RelOptInfo *baserel);
 
+static bool RowIdNeeded(RelOptInfo *baserel);
+
 static void CStoreExplainForeignScan(ForeignScanState *scanState,
                                      ExplainState *explainState);
 
@@ -115,6 +157,26 @@ static int CStoreAcquireSampleRows(Relation relation, int logLevel,
                                    HeapTuple *sampleRows, int targetRowCount,
                                    double *totalRowCount, double *totalDeadRowCount);
 
+static void CStoreAddForeignUpdateTargets(Query *parseTree,
+                                          RangeTblEntry *targetRangeTableEntry,
+                                          Relation targetRelation);
+
+static List *CStorePlanForeignModify(PlannerInfo *root, ModifyTable *modifyPlan,
+                                     Index resultRelation, int subplanIndex);
+
+static void CStoreBeginForeignModify(ModifyTableState *modifyTableState,
+                                     ResultRelInfo *resultRelInfo, List *fdwPrivate,
+                                     int subplanIndex, int executorFlags);
+
+static TupleTableSlot *CStoreExecForeignDelete(EState *executorState,
+                                               ResultRelInfo *resultRelInfo,
+                                               TupleTableSlot *tupleSlot,
+                                               TupleTableSlot *planSlot);
+
+static void CStoreEndForeignModify(EState *executorState, ResultRelInfo *resultRelInfo);
+
+static int CStoreIsForeignRelUpdatable(Relation relation);
+
 
 /* declarations for dynamic loading */
 //PG_MODULE_MAGIC;
@@ -123,6 +185,8 @@ PG_FUNCTION_INFO_V1(cstore_ddl_event_end_trigger);
 
 PG_FUNCTION_INFO_V1(cstore_table_size);
 
+PG_FUNCTION_INFO_V1(cstore_drop_stripes_before);
+
 PG_FUNCTION_INFO_V1(cstore_fdw_handler);
 
 PG_FUNCTION_INFO_V1(cstore_fdw_validator);
@@ -130,20 +194,36 @@ PG_FUNCTION_INFO_V1(cstore_fdw_validator);
 
 /* saved hook value in case of unload */
 static ProcessUtility_hook_type PreviousProcessUtilityHook = NULL;
-static ExecutorRun_hook_type PreviousExecutorRunHook = NULL;
+static planner_hook_type PreviousPlannerHook = NULL;
+
+/*
+ * Backend-local cache of cstore table flags and options, keyed by relation id.
+ * CStoreTableCacheInvalidationCount is advanced on every invalidation, so that
+ * we don't cache values which were computed while an invalidation arrived.
+ */
+static HTAB *CStoreTableCache = NULL;
+static MemoryContext CStoreTableCacheContext = NULL;
+static uint64 CStoreTableCacheInvalidationCount = 0;
 
 
 /*
  * _PG_init is called when the module is loaded. In this function we save the
  * previous utility hook, and then install our hook to pre-intercept calls to
- * the copy command.
+ * the copy command. We also install our planner hook, which plans aggregates
+ * over cstore tables as vectorized aggregate custom scans.
  */
 void _PG_init(void) {
     PreviousProcessUtilityHook = ProcessUtility_hook;
     ProcessUtility_hook = CStoreProcessUtility;
 
-    PreviousExecutorRunHook = ExecutorRun_hook;
-    ExecutorRun_hook = vectorized_ExecutorRun;
+    PreviousPlannerHook = planner_hook;
+    planner_hook = CStorePlanner;
+
+    DefineCustomBoolVariable("cstore_fdw.enable_vectorization",
+                             "Enables vectorized execution of aggregates over "
+                             "cstore tables.",
+                             NULL, &EnableVectorization, true, PGC_USERSET, 0,
+                             NULL, NULL, NULL);
 }
 
 
@@ -153,7 +233,30 @@ void _PG_init(void) {
  */
 void _PG_fini(void) {
     ProcessUtility_hook = PreviousProcessUtilityHook;
-    ExecutorRun_hook = PreviousExecutorRunHook;
+    planner_hook = PreviousPlannerHook;
+}
+
+
+/*
+ * CStorePlanner plans the query with the previous planner hook or the standard
+ * planner. It then replaces the aggregates over cstore tables that we can
+ * vectorize with vectorized aggregate custom scans.
+ */
+static PlannedStmt *
+CStorePlanner(Query *parse, int cursorOptions, ParamListInfo boundParams) {
+    PlannedStmt *plannedStmt = NULL;
+
+    if (PreviousPlannerHook != NULL) {
+        plannedStmt = PreviousPlannerHook(parse, cursorOptions, boundParams);
+    } else {
+        plannedStmt = standard_planner(parse, cursorOptions, boundParams);
+    }
+
+    if (EnableVectorization) {
+        plannedStmt = VectorizeAggregatePlans(plannedStmt);
+    }
+
+    return plannedStmt;
 }
 
 
@@ -201,9 +304,11 @@ cstore_ddl_event_end_trigger(PG_FUNCTION_ARGS) {
              */
             writeState = CStoreBeginWrite(cstoreFdwOptions->filename,
                                           cstoreFdwOptions->compressionType,
+                                          ColumnCompressionTypes(relation,
+                                                  cstoreFdwOptions->compressionType),
                                           cstoreFdwOptions->stripeRowCount,
                                           cstoreFdwOptions->blockRowCount,
-                                          tupleDescriptor);
+                                          tupleDescriptor, ShreddedColumns(relation));
             CStoreEndWrite(writeState);
 
             heap_close(relation, ExclusiveLock);
@@ -289,10 +394,48 @@ CStoreProcessUtility(Node *parseTree, const char *queryString,
 
 /*
  * CStoreTable checks if the given table name belongs to a foreign columnar store
- * table. If it does, the function returns true. Otherwise, it returns false.
+ * table. If it does, the function returns true. Otherwise, it returns false. The
+ * result is cached for the relation until the relation is invalidated.
  */
-static bool
+bool
 CStoreTable(Oid relationId) {
+    CStoreTableCacheEntry *cacheEntry = NULL;
+    uint64 invalidationCount = 0;
+    bool cstoreTable = false;
+
+    if (relationId == InvalidOid) {
+        return false;
+    }
+
+    if (CStoreTableCache == NULL) {
+        InitializeCStoreTableCache();
+    }
+
+    cacheEntry = hash_search(CStoreTableCache, &relationId, HASH_FIND, NULL);
+    if (cacheEntry != NULL && cacheEntry->cstoreTableValid) {
+        return cacheEntry->cstoreTable;
+    }
+
+    invalidationCount = CStoreTableCacheInvalidationCount;
+    cstoreTable = CStoreTableNoCache(relationId);
+
+    /* catalog lookups may have processed invalidations; if so, don't cache */
+    if (invalidationCount == CStoreTableCacheInvalidationCount) {
+        cacheEntry = CStoreTableCacheEnter(relationId);
+        cacheEntry->cstoreTable = cstoreTable;
+        cacheEntry->cstoreTableValid = true;
+    }
+
+    return cstoreTable;
+}
+
+
+/*
+ * CStoreTableNoCache looks up the relation's foreign data wrapper in the system
+ * catalogs, and checks if it is cstore_fdw.
+ */
+static bool
+CStoreTableNoCache(Oid relationId) {
     bool cstoreTable = false;
     char relationKind = 0;
 
@@ -400,9 +543,11 @@ CopyIntoCStoreTable(const CopyStmt *copyStatement, const char *queryString) {
     /* init state to write to the cstore file */
     writeState = CStoreBeginWrite(cstoreFdwOptions->filename,
                                   cstoreFdwOptions->compressionType,
+                                  ColumnCompressionTypes(relation,
+                                          cstoreFdwOptions->compressionType),
                                   cstoreFdwOptions->stripeRowCount,
                                   cstoreFdwOptions->blockRowCount,
-                                  tupleDescriptor);
+                                  tupleDescriptor, ShreddedColumns(relation));
 
     while (nextRowFound) {
         /* read the next row in tupleContext */
@@ -499,16 +644,20 @@ CreateDirectory(StringInfo directoryName) {
 
 
 /*
- * DeleteCStoreTableFiles deletes the data and footer files for a cstore table
- * whose data filename is given.
+ * DeleteCStoreTableFiles deletes the data, footer, and deletion files for a
+ * cstore table whose data filename is given. Tables without deleted rows don't
+ * have a deletion file.
  */
 static void
 DeleteCStoreTableFiles(char *filename) {
     int dataFileRemoved = 0;
     int footerFileRemoved = 0;
+    int deletionFileRemoved = 0;
 
     StringInfo tableFooterFilename = makeStringInfo();
+    StringInfo deletionFilename = makeStringInfo();
     appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
+    appendStringInfo(deletionFilename, "%s%s", filename, CSTORE_DELETION_FILE_SUFFIX);
 
     /* delete the footer file */
     footerFileRemoved = unlink(tableFooterFilename->data);
@@ -525,12 +674,20 @@ DeleteCStoreTableFiles(char *filename) {
                 errmsg("could not delete file \"%s\": %m",
                        filename)));
     }
+
+    /* delete the deletion file, if any */
+    deletionFileRemoved = unlink(deletionFilename->data);
+    if (deletionFileRemoved != 0 && errno != ENOENT) {
+        ereport(WARNING, (errcode_for_file_access(),
+                errmsg("could not delete file \"%s\": %m",
+                       deletionFilename->data)));
+    }
 }
 
 
 /*
  * cstore_table_size returns the total on-disk size of a cstore table in bytes.
- * The result includes the sizes of data file and footer file.
+ * The result includes the sizes of data file, footer file, and deletion file.
  */
 Datum
 cstore_table_size(PG_FUNCTION_ARGS) {
@@ -540,10 +697,12 @@ cstore_table_size(PG_FUNCTION_ARGS) {
     CStoreFdwOptions *cstoreFdwOptions = NULL;
     char *dataFilename = NULL;
     StringInfo footerFilename = NULL;
+    StringInfo deletionFilename = NULL;
     int dataFileStatResult = 0;
     int footerFileStatResult = 0;
     struct stat dataFileStatBuffer;
     struct stat footerFileStatBuffer;
+    struct stat deletionFileStatBuffer;
 
     bool cstoreTable = CStoreTable(relationId);
     if (!cstoreTable) {
@@ -573,10 +732,80 @@ cstore_table_size(PG_FUNCTION_ARGS) {
     tableSize += dataFileStatBuffer.st_size;
     tableSize += footerFileStatBuffer.st_size;
 
+    /* the deletion file only exists after rows have been deleted */
+    deletionFilename = makeStringInfo();
+    appendStringInfo(deletionFilename, "%s%s", dataFilename,
+                     CSTORE_DELETION_FILE_SUFFIX);
+
+    if (stat(deletionFilename->data, &deletionFileStatBuffer) == 0) {
+        tableSize += deletionFileStatBuffer.st_size;
+    }
+
     PG_RETURN_INT64(tableSize);
 }
 
 
+/*
+ * cstore_drop_stripes_before drops the stripes of a cstore table in which all
+ * values of the given column are less than the given value, and returns the
+ * number of dropped stripes. The value is given as text, and is converted to
+ * the column's type. Stripes that are only partially before the value are kept
+ * as they are, so this function is meant for retention on columns like load
+ * timestamps, where stripes cover increasing value ranges.
+ */
+Datum
+cstore_drop_stripes_before(PG_FUNCTION_ARGS) {
+    Oid relationId = PG_GETARG_OID(0);
+    char *columnName = text_to_cstring(PG_GETARG_TEXT_P(1));
+    char *valueString = text_to_cstring(PG_GETARG_TEXT_P(2));
+
+    Relation relation = NULL;
+    TupleDesc tupleDescriptor = NULL;
+    Form_pg_attribute attributeForm = NULL;
+    CStoreFdwOptions *cstoreFdwOptions = NULL;
+    AttrNumber attributeNumber = InvalidAttrNumber;
+    Oid inputFunctionId = InvalidOid;
+    Oid typeIOParam = InvalidOid;
+    Datum value = 0;
+    uint64 droppedStripeCount = 0;
+
+    bool cstoreTable = CStoreTable(relationId);
+    if (!cstoreTable) {
+        ereport(ERROR, (errmsg("relation is not a cstore table")));
+    }
+
+    /* concurrent scans could still read the stripes, so also block readers */
+    relation = relation_open(relationId, AccessExclusiveLock);
+    if (!pg_class_ownercheck(relationId, GetUserId())) {
+        aclcheck_error(ACLCHECK_NOT_OWNER, ACL_KIND_CLASS,
+                       RelationGetRelationName(relation));
+    }
+
+    attributeNumber = get_attnum(relationId, columnName);
+    if (attributeNumber <= 0) {
+        ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+                errmsg("column \"%s\" of relation \"%s\" does not exist",
+                       columnName, RelationGetRelationName(relation))));
+    }
+
+    tupleDescriptor = RelationGetDescr(relation);
+    attributeForm = tupleDescriptor->attrs[attributeNumber - 1];
+
+    getTypeInputInfo(attributeForm->atttypid, &inputFunctionId, &typeIOParam);
+    value = OidInputFunctionCall(inputFunctionId, valueString, typeIOParam,
+                                 attributeForm->atttypmod);
+
+    cstoreFdwOptions = CStoreGetOptions(relationId);
+    droppedStripeCount = CStoreDropStripesBefore(cstoreFdwOptions->filename,
+                                                 tupleDescriptor,
+                                                 attributeNumber - 1, value);
+
+    relation_close(relation, NoLock);
+
+    PG_RETURN_INT64(droppedStripeCount);
+}
+
+
 /*
  * cstore_fdw_handler creates and returns a struct with pointers to foreign
  * table callback functions.
@@ -594,6 +823,12 @@ cstore_fdw_handler(PG_FUNCTION_ARGS) {
     fdwRoutine->ReScanForeignScan = CStoreReScanForeignScan;
     fdwRoutine->EndForeignScan = CStoreEndForeignScan;
     fdwRoutine->AnalyzeForeignTable = CStoreAnalyzeForeignTable;
+    fdwRoutine->AddForeignUpdateTargets = CStoreAddForeignUpdateTargets;
+    fdwRoutine->PlanForeignModify = CStorePlanForeignModify;
+    fdwRoutine->BeginForeignModify = CStoreBeginForeignModify;
+    fdwRoutine->ExecForeignDelete = CStoreExecForeignDelete;
+    fdwRoutine->EndForeignModify = CStoreEndForeignModify;
+    fdwRoutine->IsForeignRelUpdatable = CStoreIsForeignRelUpdatable;
 
     PG_RETURN_POINTER(fdwRoutine);
 }
@@ -614,6 +849,7 @@ cstore_fdw_validator(PG_FUNCTION_ARGS) {
     char *compressionTypeString = NULL;
     char *stripeRowCountString = NULL;
     char *blockRowCountString = NULL;
+    char *shredString = NULL;
 
     foreach(optionCell, optionList) {
         DefElem *optionDef = (DefElem *) lfirst(optionCell);
@@ -649,12 +885,16 @@ cstore_fdw_validator(PG_FUNCTION_ARGS) {
             stripeRowCountString = defGetString(optionDef);
         } else if (strncmp(optionName, OPTION_NAME_BLOCK_ROW_COUNT, NAMEDATALEN) == 0) {
             blockRowCountString = defGetString(optionDef);
+        } else if (strncmp(optionName, OPTION_NAME_SHRED, NAMEDATALEN) == 0) {
+            shredString = defGetString(optionDef);
         }
     }
 
     if (optionContextId == ForeignTableRelationId) {
         ValidateForeignTableOptions(filename, compressionTypeString,
                                     stripeRowCountString, blockRowCountString);
+    } else if (optionContextId == AttributeRelationId) {
+        ValidateColumnOptions(compressionTypeString, shredString);
     }
 
     PG_RETURN_VOID();
@@ -692,12 +932,51 @@ OptionNamesString(Oid currentContextId) {
 
 /*
  * CStoreGetOptions returns the option values to be used when reading and writing
- * the cstore file. To resolve these values, the function checks options for the
- * foreign table, and if not present, falls back to default values. This function
- * errors out if given option values are considered invalid.
+ * the cstore file. Parsed options are kept in a backend-local cache, so that we
+ * only walk and validate the option lists once per table until the table or its
+ * server changes. The function returns a copy allocated in the current memory
+ * context, which stays valid even if the cache entry gets invalidated.
  */
 static CStoreFdwOptions *
 CStoreGetOptions(Oid foreignTableId) {
+    CStoreTableCacheEntry *cacheEntry = NULL;
+    CStoreFdwOptions *cstoreFdwOptions = NULL;
+    uint64 invalidationCount = 0;
+
+    if (CStoreTableCache == NULL) {
+        InitializeCStoreTableCache();
+    }
+
+    cacheEntry = hash_search(CStoreTableCache, &foreignTableId, HASH_FIND, NULL);
+    if (cacheEntry != NULL && cacheEntry->cstoreFdwOptions != NULL) {
+        return CopyCStoreFdwOptions(cacheEntry->cstoreFdwOptions);
+    }
+
+    invalidationCount = CStoreTableCacheInvalidationCount;
+    cstoreFdwOptions = CStoreGetOptionsNoCache(foreignTableId);
+
+    /* catalog lookups may have processed invalidations; if so, don't cache */
+    if (invalidationCount == CStoreTableCacheInvalidationCount) {
+        MemoryContext oldContext = MemoryContextSwitchTo(CStoreTableCacheContext);
+        CStoreFdwOptions *cachedOptions = CopyCStoreFdwOptions(cstoreFdwOptions);
+        MemoryContextSwitchTo(oldContext);
+
+        cacheEntry = CStoreTableCacheEnter(foreignTableId);
+        cacheEntry->cstoreFdwOptions = cachedOptions;
+    }
+
+    return cstoreFdwOptions;
+}
+
+
+/*
+ * CStoreGetOptionsNoCache resolves the option values to be used when reading and
+ * writing the cstore file. To resolve these values, the function checks options
+ * for the foreign table, and if not present, falls back to default values. This
+ * function errors out if given option values are considered invalid.
+ */
+static CStoreFdwOptions *
+CStoreGetOptionsNoCache(Oid foreignTableId) {
     CStoreFdwOptions *cstoreFdwOptions = NULL;
     char *filename = NULL;
     CompressionType compressionType = DEFAULT_COMPRESSION_TYPE;
@@ -744,6 +1023,122 @@ CStoreGetOptions(Oid foreignTableId) {
 }
 
 
+/* Returns a copy of the given options in the current memory context. */
+static CStoreFdwOptions *
+CopyCStoreFdwOptions(CStoreFdwOptions *cstoreFdwOptions) {
+    CStoreFdwOptions *optionsCopy = palloc0(sizeof(CStoreFdwOptions));
+    optionsCopy->filename = pstrdup(cstoreFdwOptions->filename);
+    optionsCopy->compressionType = cstoreFdwOptions->compressionType;
+    optionsCopy->stripeRowCount = cstoreFdwOptions->stripeRowCount;
+    optionsCopy->blockRowCount = cstoreFdwOptions->blockRowCount;
+
+    return optionsCopy;
+}
+
+
+/*
+ * CStoreTableCacheEnter returns the cache entry for the given relation, and
+ * creates an empty entry if the relation isn't in the cache yet.
+ */
+static CStoreTableCacheEntry *
+CStoreTableCacheEnter(Oid relationId) {
+    bool entryFound = false;
+    CStoreTableCacheEntry *cacheEntry = hash_search(CStoreTableCache, &relationId,
+                                                    HASH_ENTER, &entryFound);
+    if (!entryFound) {
+        cacheEntry->cstoreTableValid = false;
+        cacheEntry->cstoreTable = false;
+        cacheEntry->cstoreFdwOptions = NULL;
+    }
+
+    return cacheEntry;
+}
+
+
+/*
+ * InitializeCStoreTableCache creates the backend-local cstore table cache, and
+ * registers callbacks to invalidate its entries. Relcache invalidations cover
+ * ALTER FOREIGN TABLE and DROP FOREIGN TABLE. Foreign server options are also
+ * consulted when resolving table options, so any change to pg_foreign_server
+ * flushes the whole cache.
+ */
+static void
+InitializeCStoreTableCache(void) {
+    HASHCTL info;
+    int hashFlags = 0;
+
+    CStoreTableCacheContext = AllocSetContextCreate(CacheMemoryContext,
+                                                    "CStore Table Cache Context",
+                                                    ALLOCSET_SMALL_MINSIZE,
+                                                    ALLOCSET_SMALL_INITSIZE,
+                                                    ALLOCSET_SMALL_MAXSIZE);
+
+    memset(&info, 0, sizeof(info));
+    info.keysize = sizeof(Oid);
+    info.entrysize = sizeof(CStoreTableCacheEntry);
+    info.hash = oid_hash;
+    info.hcxt = CStoreTableCacheContext;
+    hashFlags = HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT;
+
+    CStoreTableCache = hash_create("CStore Table Cache", 32, &info, hashFlags);
+
+    CacheRegisterRelcacheCallback(CStoreTableCacheRelcacheCallback, (Datum) 0);
+    CacheRegisterSyscacheCallback(FOREIGNSERVEROID, CStoreTableCacheSyscacheCallback,
+                                  (Datum) 0);
+}
+
+
+/*
+ * InvalidateCStoreTableCacheEntry removes the given relation's entry from the
+ * cstore table cache. If the relation id is invalid, the function removes all
+ * entries.
+ */
+static void
+InvalidateCStoreTableCacheEntry(Oid relationId) {
+    CStoreTableCacheEntry *cacheEntry = NULL;
+
+    CStoreTableCacheInvalidationCount++;
+
+    if (relationId != InvalidOid) {
+        cacheEntry = hash_search(CStoreTableCache, &relationId, HASH_FIND, NULL);
+        if (cacheEntry != NULL) {
+            if (cacheEntry->cstoreFdwOptions != NULL) {
+                pfree(cacheEntry->cstoreFdwOptions->filename);
+                pfree(cacheEntry->cstoreFdwOptions);
+            }
+
+            hash_search(CStoreTableCache, &relationId, HASH_REMOVE, NULL);
+        }
+    } else {
+        HASH_SEQ_STATUS status;
+
+        hash_seq_init(&status, CStoreTableCache);
+        while ((cacheEntry = hash_seq_search(&status)) != NULL) {
+            if (cacheEntry->cstoreFdwOptions != NULL) {
+                pfree(cacheEntry->cstoreFdwOptions->filename);
+                pfree(cacheEntry->cstoreFdwOptions);
+            }
+
+            hash_search(CStoreTableCache, &cacheEntry->relationId, HASH_REMOVE, NULL);
+        }
+    }
+}
+
+
+/* Relcache invalidation callback for the cstore table cache. */
+static void
+CStoreTableCacheRelcacheCallback(Datum argument, Oid relationId) {
+    InvalidateCStoreTableCacheEntry(relationId);
+}
+
+
+/* Foreign server syscache invalidation callback for the cstore table cache. */
+static void
+CStoreTableCacheSyscacheCallback(Datum argument, int cacheId, uint32 hashValue) {
+    InvalidateCStoreTableCacheEntry(InvalidOid);
+}
+
+
 /*
  * CStoreGetOptionValue walks over foreign table and foreign server options, and
  * looks for the option with the given name. If found, the function returns the
@@ -788,10 +1183,12 @@ ValidateForeignTableOptions(char *filename, char *compressionTypeString,
     /* we currently do not have any checks for filename */
     (void) filename;
 
-    /* check if the provided compression type is valid */
+    /* check if the provided compression type is valid; typed encodings are per column */
     if (compressionTypeString != NULL) {
         CompressionType compressionType = ParseCompressionType(compressionTypeString);
-        if (compressionType == COMPRESSION_TYPE_INVALID) {
+        if (compressionType == COMPRESSION_TYPE_INVALID ||
+            compressionType == COMPRESSION_GORILLA ||
+            compressionType == COMPRESSION_DELTA) {
             ereport(ERROR, (errmsg("invalid compression type"),
                     errhint("Valid options are: %s",
                             COMPRESSION_STRING_DELIMITED_LIST)));
@@ -826,6 +1223,216 @@ ValidateForeignTableOptions(char *filename, char *compressionTypeString,
 }
 
 
+/*
+ * ValidateColumnOptions verifies if given options are valid cstore_fdw column
+ * options. This function errors out if given option value is considered invalid.
+ * We check that shredded columns are json or jsonb when we write to the table.
+ */
+static void
+ValidateColumnOptions(char *compressionTypeString, char *shredString) {
+    if (compressionTypeString != NULL) {
+        CompressionType compressionType = ParseCompressionType(compressionTypeString);
+        if (compressionType == COMPRESSION_TYPE_INVALID) {
+            ereport(ERROR, (errmsg("invalid compression type"),
+                    errhint("Valid options are: %s",
+                            COLUMN_COMPRESSION_STRING_DELIMITED_LIST)));
+        }
+    }
+
+    /* ShreddedPathList() errors out if the given key list has empty keys */
+    if (shredString != NULL) {
+        ShreddedPathList(shredString);
+    }
+}
+
+
+/*
+ * ColumnCompressionTypes returns the compression type of each column of the
+ * given relation. Columns use the table's compression type, unless they have a
+ * compression option of their own. Gorilla compression encodes 8-byte floats,
+ * and delta compression encodes integers, dates and timestamps, so the function
+ * errors out if they are set for columns of other types.
+ */
+static CompressionType *
+ColumnCompressionTypes(Relation relation, CompressionType tableCompressionType) {
+    TupleDesc tupleDescriptor = RelationGetDescr(relation);
+    uint32 columnCount = tupleDescriptor->natts;
+    uint32 columnIndex = 0;
+    CompressionType *columnCompressionTypeArray =
+            palloc0(columnCount * sizeof(CompressionType));
+
+    for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
+        Form_pg_attribute attributeForm = tupleDescriptor->attrs[columnIndex];
+        CompressionType compressionType = tableCompressionType;
+        List *optionList = NIL;
+        ListCell *optionCell = NULL;
+
+        columnCompressionTypeArray[columnIndex] = tableCompressionType;
+        if (attributeForm->attisdropped) {
+            continue;
+        }
+
+        optionList = GetForeignColumnOptions(RelationGetRelid(relation),
+                                             attributeForm->attnum);
+        foreach(optionCell, optionList) {
+            DefElem *optionDef = (DefElem *) lfirst(optionCell);
+
+            if (strncmp(optionDef->defname, OPTION_NAME_COMPRESSION_TYPE,
+                        NAMEDATALEN) == 0) {
+                compressionType = ParseCompressionType(defGetString(optionDef));
+            }
+        }
+
+        if (compressionType == COMPRESSION_GORILLA &&
+            attributeForm->atttypid != FLOAT8OID) {
+            ereport(ERROR, (errmsg("gorilla compression is only supported for "
+                                   "float8 columns"),
+                    errdetail("Column \"%s\" is of type %s.",
+                              NameStr(attributeForm->attname),
+                              format_type_be(attributeForm->atttypid))));
+        }
+
+        if (compressionType == COMPRESSION_DELTA &&
+            !DeltaCompressionSupported(attributeForm->atttypid)) {
+            ereport(ERROR, (errmsg("delta compression is only supported for "
+                                   "integer, date and timestamp columns"),
+                    errdetail("Column \"%s\" is of type %s.",
+                              NameStr(attributeForm->attname),
+                              format_type_be(attributeForm->atttypid))));
+        }
+
+        columnCompressionTypeArray[columnIndex] = compressionType;
+    }
+
+    return columnCompressionTypeArray;
+}
+
+
+/*
+ * ShreddedColumns returns the json keys that columns of the given relation
+ * shred into separate columns. These keys are given as comma separated lists in
+ * the columns' shred options. The function errors out if such an option is set
+ * for a column that is neither json nor jsonb.
+ */
+static List *
+ShreddedColumns(Relation relation) {
+    TupleDesc tupleDescriptor = RelationGetDescr(relation);
+    uint32 columnCount = tupleDescriptor->natts;
+    uint32 columnIndex = 0;
+    List *shreddedColumnList = NIL;
+
+    for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
+        Form_pg_attribute attributeForm = tupleDescriptor->attrs[columnIndex];
+        List *optionList = NIL;
+        ListCell *optionCell = NULL;
+        List *pathList = NIL;
+        ListCell *pathCell = NULL;
+
+        if (attributeForm->attisdropped) {
+            continue;
+        }
+
+        optionList = GetForeignColumnOptions(RelationGetRelid(relation),
+                                             attributeForm->attnum);
+        foreach(optionCell, optionList) {
+            DefElem *optionDef = (DefElem *) lfirst(optionCell);
+
+            if (strncmp(optionDef->defname, OPTION_NAME_SHRED, NAMEDATALEN) == 0) {
+                pathList = ShreddedPathList(defGetString(optionDef));
+            }
+        }
+
+        if (pathList == NIL) {
+            continue;
+        }
+
+        if (attributeForm->atttypid != JSONOID && attributeForm->atttypid != JSONBOID) {
+            ereport(ERROR, (errmsg("shredding is only supported for json and jsonb "
+                                   "columns"),
+                    errdetail("Column \"%s\" is of type %s.",
+                              NameStr(attributeForm->attname),
+                              format_type_be(attributeForm->atttypid))));
+        }
+
+        foreach(pathCell, pathList) {
+            ShreddedColumn *shreddedColumn = palloc0(sizeof(ShreddedColumn));
+            shreddedColumn->attributeNumber = attributeForm->attnum;
+            shreddedColumn->path = (char *) lfirst(pathCell);
+
+            shreddedColumnList = lappend(shreddedColumnList, shreddedColumn);
+        }
+    }
+
+    return shreddedColumnList;
+}
+
+
+/*
+ * ShreddedPathList splits the given comma separated list of json keys, and
+ * returns the distinct keys. Whitespace around keys is ignored, and the function
+ * errors out if a key is empty.
+ */
+static List *
+ShreddedPathList(char *shredString) {
+    List *pathList = NIL;
+    char *pathStart = shredString;
+
+    while (pathStart != NULL) {
+        char *pathEnd = strchr(pathStart, ',');
+        char *nextPathStart = NULL;
+        char *path = NULL;
+        ListCell *pathCell = NULL;
+        bool pathExists = false;
+
+        if (pathEnd != NULL) {
+            nextPathStart = pathEnd + 1;
+        } else {
+            pathEnd = pathStart + strlen(pathStart);
+        }
+
+        while (pathStart < pathEnd && isspace((unsigned char) *pathStart)) {
+            pathStart++;
+        }
+
+        while (pathEnd > pathStart && isspace((unsigned char) *(pathEnd - 1))) {
+            pathEnd--;
+        }
+
+        if (pathStart == pathEnd) {
+            ereport(ERROR, (errmsg("invalid shredded json key list"),
+                    errhint("Shredded json keys must be non-empty, and separated "
+                            "by commas.")));
+        }
+
+        path = pnstrdup(pathStart, pathEnd - pathStart);
+        foreach(pathCell, pathList) {
+            if (strcmp((char *) lfirst(pathCell), path) == 0) {
+                pathExists = true;
+            }
+        }
+
+        if (!pathExists) {
+            pathList = lappend(pathList, path);
+        }
+
+        pathStart = nextPathStart;
+    }
+
+    return pathList;
+}
+
+
+/*
+ * DeltaCompressionSupported returns true if columns of the given type can use
+ * delta compression. These types are stored as 2, 4 or 8-byte integers.
+ */
+static bool
+DeltaCompressionSupported(Oid typeId) {
+    return (typeId == INT2OID || typeId == INT4OID || typeId == INT8OID ||
+            typeId == DATEOID || typeId == TIMESTAMPOID || typeId == TIMESTAMPTZOID);
+}
+
+
 /*
  * CStoreDefaultFilePath constructs the default file path to use for a cstore_fdw
  * table. The path is of the form $PGDATA/cstore_fdw/{databaseOid}/{relfilenode}.
@@ -863,6 +1470,10 @@ ParseCompressionType(const char *compressionTypeString) {
     }
     else if (strncmp(compressionTypeString, COMPRESSION_STRING_ENC_LZ4, NAMEDATALEN) == 0) {
         compressionType = COMPRESSION_ENC_LZ4;
+    } else if (strncmp(compressionTypeString, COMPRESSION_STRING_GORILLA, NAMEDATALEN) == 0) {
+        compressionType = COMPRESSION_GORILLA;
+    } else if (strncmp(compressionTypeString, COMPRESSION_STRING_DELTA, NAMEDATALEN) == 0) {
+        compressionType = COMPRESSION_DELTA;
     }
 
     return compressionType;
@@ -958,16 +1569,29 @@ CStoreGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId,
     ForeignScan *foreignScan = NULL;
     List *columnList = NULL;
     List *foreignPrivateList = NIL;
+    List *qualList = NIL;
+    List *scanFilterList = NIL;
+    ListCell *scanClauseCell = NULL;
 
     /*
-     * Although we skip row blocks that are refuted by the WHERE clause, but
-     * we have no native ability to evaluate restriction clauses and make sure
-     * that all non-related rows are filtered out. So we just put all of the
+     * Although we skip row blocks that are refuted by the WHERE clause, we can
+     * only evaluate text equality and simple LIKE clauses on every row we read.
+     * We keep these clauses in the scan node's expressions, and put all other
      * scanClauses into the plan node's qual list for the executor to check.
      */
     scanClauses = extract_actual_clauses(scanClauses,
                                          false); /* extract regular clauses */
 
+    foreach(scanClauseCell, scanClauses) {
+        Node *scanClause = lfirst(scanClauseCell);
+
+        if (StringFilterClause(scanClause)) {
+            scanFilterList = lappend(scanFilterList, scanClause);
+        } else {
+            qualList = lappend(qualList, scanClause);
+        }
+    }
+
     /*
      * As an optimization, we only read columns that are present in the query.
      * To find these columns, we need baserel. We don't have access to baserel
@@ -975,11 +1599,11 @@ CStoreGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId,
      * it into foreign scan node's private list.
      */
     columnList = ColumnList(baserel);
-    foreignPrivateList = list_make1(columnList);
+    foreignPrivateList = list_make2(columnList, makeInteger(RowIdNeeded(baserel)));
 
     /* create the foreign scan node */
-    foreignScan = make_foreignscan(targetList, scanClauses, baserel->relid,
-                                   NIL, /* no expressions to evaluate */
+    foreignScan = make_foreignscan(targetList, qualList, baserel->relid,
+                                   scanFilterList, /* clauses the scan evaluates */
                                    foreignPrivateList);
 
     return foreignScan;
@@ -1106,11 +1730,47 @@ ColumnList(RelOptInfo *baserel) {
 }
 
 
+/*
+ * RowIdNeeded checks if the query reads the table's ctid column. DELETE adds
+ * this column to find the rows to delete, and we then return each row's row id
+ * as its ctid.
+ */
+static bool
+RowIdNeeded(RelOptInfo *baserel) {
+    ListCell *targetColumnCell = NULL;
+
+    foreach(targetColumnCell, baserel->reltargetlist) {
+        Var *targetColumn = (Var *) lfirst(targetColumnCell);
+        if (IsA(targetColumn, Var) &&
+            targetColumn->varattno == SelfItemPointerAttributeNumber) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
 /* CStoreExplainForeignScan produces extra output for the Explain command. */
 static void
 CStoreExplainForeignScan(ForeignScanState *scanState, ExplainState *explainState) {
     Oid foreignTableId = RelationGetRelid(scanState->ss.ss_currentRelation);
     CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(foreignTableId);
+    ForeignScan *foreignScan = (ForeignScan *) scanState->ss.ps.plan;
+
+    /* show the clauses the scan evaluates, which don't appear as the filter */
+    if (foreignScan->fdw_exprs != NIL) {
+        Node *scanFilter = (Node *) make_ands_explicit(foreignScan->fdw_exprs);
+        bool useColumnPrefix = (list_length(explainState->rtable) > 1 ||
+                                explainState->verbose);
+        List *deparseContext = deparse_context_for_planstate((Node *) scanState, NIL,
+                                                             explainState->rtable,
+                                                             explainState->rtable_names);
+        char *scanFilterString = deparse_expression(scanFilter, deparseContext,
+                                                    useColumnPrefix, false);
+
+        ExplainPropertyText("CStore Filter", scanFilterString, explainState);
+    }
 
     ExplainPropertyText("CStore File", cstoreFdwOptions->filename, explainState);
 
@@ -1150,9 +1810,10 @@ CStoreBeginForeignScan(ForeignScanState *scanState, int executorFlags) {
 
     foreignScan = (ForeignScan *) scanState->ss.ps.plan;
     foreignPrivateList = (List *) foreignScan->fdw_private;
-    whereClauseList = foreignScan->scan.plan.qual;
-
     columnList = (List *) linitial(foreignPrivateList);
+    whereClauseList = list_concat(list_copy(foreignScan->scan.plan.qual),
+                                  list_copy(foreignScan->fdw_exprs));
+
     readState = CStoreBeginRead(cstoreFdwOptions->filename, tupleDescriptor,
                                 columnList, whereClauseList);
 
@@ -1163,12 +1824,15 @@ CStoreBeginForeignScan(ForeignScanState *scanState, int executorFlags) {
 /*
  * CStoreIterateForeignScan reads the next record from the cstore file, converts
  * it to a Postgres tuple, and stores the converted tuple into the ScanTupleSlot
- * as a virtual tuple.
+ * as a virtual tuple. If the query needs row ids, we instead store a heap tuple
+ * whose ctid is the row's row id.
  */
 static TupleTableSlot *
 CStoreIterateForeignScan(ForeignScanState *scanState) {
     TableReadState *readState = (TableReadState *) scanState->fdw_state;
     TupleTableSlot *tupleSlot = scanState->ss.ss_ScanTupleSlot;
+    ForeignScan *foreignScan = (ForeignScan *) scanState->ss.ps.plan;
+    bool rowIdNeeded = intVal(lsecond(foreignScan->fdw_private));
     bool nextRowFound = false;
 
     TupleDesc tupleDescriptor = tupleSlot->tts_tupleDescriptor;
@@ -1183,7 +1847,14 @@ CStoreIterateForeignScan(ForeignScanState *scanState) {
     ExecClearTuple(tupleSlot);
 
     nextRowFound = CStoreReadNextRow(readState, columnValues, columnNulls);
-    if (nextRowFound) {
+    if (nextRowFound && rowIdNeeded) {
+        HeapTuple heapTuple = heap_form_tuple(tupleDescriptor, columnValues,
+                                              columnNulls);
+        uint64 rowId = CStoreCurrentRowId(readState);
+
+        CSTORE_ROW_ID_SET_ITEM_POINTER(&heapTuple->t_self, rowId);
+        ExecStoreTuple(heapTuple, tupleSlot, InvalidBuffer, true);
+    } else if (nextRowFound) {
         ExecStoreVirtualTuple(tupleSlot);
     }
 
@@ -1285,7 +1956,7 @@ CStoreAcquireSampleRows(Relation relation, int logLevel,
     }
 
     /* setup foreign scan plan node */
-    foreignPrivateList = list_make1(columnList);
+    foreignPrivateList = list_make2(columnList, makeInteger(false));
     foreignScan = makeNode(ForeignScan);
     foreignScan->fdw_private = foreignPrivateList;
 
@@ -1396,3 +2067,130 @@ CStoreAcquireSampleRows(Relation relation, int logLevel,
 
     return sampleRowCount;
 }
+
+
+/*
+ * CStoreAddForeignUpdateTargets adds the ctid column to the target list of
+ * DELETE commands. The scan fills this column with each row's row id, which we
+ * then use to find the rows to delete.
+ */
+static void
+CStoreAddForeignUpdateTargets(Query *parseTree, RangeTblEntry *targetRangeTableEntry,
+                              Relation targetRelation) {
+    Var *rowIdColumn = NULL;
+    TargetEntry *rowIdTargetEntry = NULL;
+    const char *rowIdColumnName = "ctid";
+
+    rowIdColumn = makeVar(parseTree->resultRelation, SelfItemPointerAttributeNumber,
+                          TIDOID, -1, InvalidOid, 0);
+    rowIdTargetEntry = makeTargetEntry((Expr *) rowIdColumn,
+                                       list_length(parseTree->targetList) + 1,
+                                       pstrdup(rowIdColumnName), true);
+
+    parseTree->targetList = lappend(parseTree->targetList, rowIdTargetEntry);
+}
+
+
+/*
+ * CStorePlanForeignModify checks that we can run the modify command on the
+ * cstore table. We only support DELETE, and since the scan doesn't read all
+ * columns, we can't return deleted rows.
+ */
+static List *
+CStorePlanForeignModify(PlannerInfo *root, ModifyTable *modifyPlan,
+                        Index resultRelation, int subplanIndex) {
+    if (modifyPlan->operation != CMD_DELETE) {
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                errmsg("operation is not supported for cstore tables")));
+    }
+
+    if (modifyPlan->returningLists != NIL) {
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                errmsg("DELETE with RETURNING is not supported for cstore tables")));
+    }
+
+    return NIL;
+}
+
+
+/*
+ * CStoreBeginForeignModify locks the table against concurrent writes, finds the
+ * row id column in the scan's output, and starts the delete operation.
+ */
+static void
+CStoreBeginForeignModify(ModifyTableState *modifyTableState,
+                         ResultRelInfo *resultRelInfo, List *fdwPrivate,
+                         int subplanIndex, int executorFlags) {
+    Relation relation = resultRelInfo->ri_RelationDesc;
+    Plan *subplan = modifyTableState->mt_plans[subplanIndex]->plan;
+    CStoreFdwOptions *cstoreFdwOptions = NULL;
+    CStoreModifyState *modifyState = NULL;
+
+    /* if Explain with no Analyze, do nothing */
+    if (executorFlags & EXEC_FLAG_EXPLAIN_ONLY) {
+        return;
+    }
+
+    /* like COPY, we allow concurrent reads, but block concurrent writes */
+    LockRelation(relation, ExclusiveLock);
+
+    cstoreFdwOptions = CStoreGetOptions(RelationGetRelid(relation));
+
+    modifyState = palloc0(sizeof(CStoreModifyState));
+    modifyState->rowIdAttributeNumber =
+            ExecFindJunkAttributeInTlist(subplan->targetlist, "ctid");
+    if (!AttributeNumberIsValid(modifyState->rowIdAttributeNumber)) {
+        ereport(ERROR, (errmsg("could not find junk ctid column")));
+    }
+
+    modifyState->deleteState = CStoreBeginDelete(cstoreFdwOptions->filename);
+
+    resultRelInfo->ri_FdwState = (void *) modifyState;
+}
+
+
+/* CStoreExecForeignDelete marks the row the plan slot's ctid refers to deleted. */
+static TupleTableSlot *
+CStoreExecForeignDelete(EState *executorState, ResultRelInfo *resultRelInfo,
+                        TupleTableSlot *tupleSlot, TupleTableSlot *planSlot) {
+    CStoreModifyState *modifyState = (CStoreModifyState *) resultRelInfo->ri_FdwState;
+    ItemPointer rowItemPointer = NULL;
+    bool rowIdIsNull = false;
+    Datum rowIdDatum = 0;
+
+    rowIdDatum = ExecGetJunkAttribute(planSlot, modifyState->rowIdAttributeNumber,
+                                      &rowIdIsNull);
+    if (rowIdIsNull) {
+        ereport(ERROR, (errmsg("ctid is NULL")));
+    }
+
+    rowItemPointer = (ItemPointer) DatumGetPointer(rowIdDatum);
+    CStoreDeleteRow(modifyState->deleteState, CSTORE_ITEM_POINTER_ROW_ID(rowItemPointer));
+
+    return tupleSlot;
+}
+
+
+/*
+ * CStoreEndForeignModify writes the rows deleted by the command to the deletion
+ * file. Like data loads, deletes take effect immediately, and aren't rolled
+ * back if the transaction aborts.
+ */
+static void
+CStoreEndForeignModify(EState *executorState, ResultRelInfo *resultRelInfo) {
+    CStoreModifyState *modifyState = (CStoreModifyState *) resultRelInfo->ri_FdwState;
+
+    /* nothing to do if Explain with no Analyze */
+    if (modifyState == NULL) {
+        return;
+    }
+
+    CStoreEndDelete(modifyState->deleteState);
+}
+
+
+/* CStoreIsForeignRelUpdatable reports that cstore tables only support DELETE. */
+static int
+CStoreIsForeignRelUpdatable(Relation relation) {
+    return (1 << CMD_DELETE);
+}
@@ -16,9 +16,11 @@
 
 #include "access/tupdesc.h"
 #include "fmgr.h"
+#include "catalog/pg_attribute.h"
 #include "catalog/pg_foreign_server.h"
 #include "catalog/pg_foreign_table.h"
 #include "lib/stringinfo.h"
+#include "storage/itemptr.h"
 #include "lz4.h"
 #include "untrusted/extensions/stdafx.h"
 #include "untrusted/interface/interface.h"
@@ -30,6 +32,7 @@
 #define OPTION_NAME_COMPRESSION_TYPE "compression"
 #define OPTION_NAME_STRIPE_ROW_COUNT "stripe_row_count"
 #define OPTION_NAME_BLOCK_ROW_COUNT "block_row_count"
+#define OPTION_NAME_SHRED "shred"
 
 /* Default values for option parameters */
 #define DEFAULT_COMPRESSION_TYPE COMPRESSION_NONE
@@ -42,26 +45,52 @@
 #define BLOCK_ROW_COUNT_MINIMUM 1000
 #define BLOCK_ROW_COUNT_MAXIMUM 100000
 
+/* longest variable-length min/max value, in bytes, we keep in skip lists */
+#define SKIP_NODE_VALUE_LENGTH_MAXIMUM 64
+
 /* String representations of compression types */
 #define COMPRESSION_STRING_NONE "none"
 #define COMPRESSION_STRING_PG_LZ "pglz"
 #define COMPRESSION_STRING_LZ4 "lz4"
 #define COMPRESSION_STRING_ENC_LZ4 "enc_lz4"
+#define COMPRESSION_STRING_GORILLA "gorilla"
+#define COMPRESSION_STRING_DELTA "delta"
 #define COMPRESSION_STRING_DELIMITED_LIST "none, pglz, lz4, enc_lz4"
+#define COLUMN_COMPRESSION_STRING_DELIMITED_LIST "none, pglz, lz4, enc_lz4, gorilla, delta"
 
 /* CStore file signature */
 #define CSTORE_MAGIC_NUMBER "citus_cstore"
 #define CSTORE_VERSION_MAJOR 1
-#define CSTORE_VERSION_MINOR 1
+#define CSTORE_VERSION_MINOR 11
 
 /* miscellaneous defines */
 #define CSTORE_FDW_NAME "cstore_fdw"
 #define CSTORE_FOOTER_FILE_SUFFIX ".footer"
+#define CSTORE_DELETION_FILE_SUFFIX ".deleted"
 #define CSTORE_TEMP_FILE_SUFFIX ".tmp"
 #define CSTORE_TUPLE_COST_MULTIPLIER 10
 #define CSTORE_POSTSCRIPT_SIZE_LENGTH 1
 #define CSTORE_POSTSCRIPT_SIZE_MAX 256
 
+/*
+ * Row ids identify a row by its stripe index and its position in the stripe.
+ * Stripes have at most STRIPE_ROW_COUNT_MAXIMUM rows, so positions fit in the
+ * lower 24 bits. DELETE passes row ids from the scan as the rows' ctids, so we
+ * also map them to and from item pointers. Offset numbers start from 1.
+ */
+#define CSTORE_ROW_INDEX_BITS 24
+#define CSTORE_ROW_ID(stripeIndex, rowIndex) \
+    ((((uint64) (stripeIndex)) << CSTORE_ROW_INDEX_BITS) | ((uint64) (rowIndex)))
+#define CSTORE_ROW_ID_STRIPE_INDEX(rowId) ((uint32) ((rowId) >> CSTORE_ROW_INDEX_BITS))
+#define CSTORE_ROW_ID_ROW_INDEX(rowId) \
+    ((uint32) ((rowId) & ((UINT64CONST(1) << CSTORE_ROW_INDEX_BITS) - 1)))
+#define CSTORE_ROW_ID_SET_ITEM_POINTER(itemPointer, rowId) \
+    ItemPointerSet((itemPointer), (BlockNumber) ((rowId) >> 15), \
+                   (OffsetNumber) (((rowId) & 0x7FFF) + 1))
+#define CSTORE_ITEM_POINTER_ROW_ID(itemPointer) \
+    ((((uint64) ItemPointerGetBlockNumber(itemPointer)) << 15) | \
+     ((uint64) (ItemPointerGetOffsetNumber(itemPointer) - 1)))
+
 
 /*
  * CStoreValidOption keeps an option name and a context. When an option is passed
@@ -76,14 +105,18 @@ typedef struct CStoreValidOption {
 
 
 /* Array of options that are valid for cstore_fdw */
-static const uint32 ValidOptionCount = 4;
+static const uint32 ValidOptionCount = 6;
 static const CStoreValidOption ValidOptionArray[] =
         {
                 /* foreign table options */
                 {OPTION_NAME_FILENAME,         ForeignTableRelationId},
                 {OPTION_NAME_COMPRESSION_TYPE, ForeignTableRelationId},
                 {OPTION_NAME_STRIPE_ROW_COUNT, ForeignTableRelationId},
-                {OPTION_NAME_BLOCK_ROW_COUNT,  ForeignTableRelationId}
+                {OPTION_NAME_BLOCK_ROW_COUNT,  ForeignTableRelationId},
+
+                /* column options */
+                {OPTION_NAME_COMPRESSION_TYPE, AttributeRelationId},
+                {OPTION_NAME_SHRED,            AttributeRelationId}
         };
 
 
@@ -95,11 +128,74 @@ typedef enum {
     COMPRESSION_LZ4 = 2,
     COMPRESSION_ENC_LZ4 = 3,
     COMPRESSION_ENC_NONE = 4,
+    COMPRESSION_GORILLA = 5,
+    COMPRESSION_DELTA = 6,
 
     COMPRESSION_COUNT
 
 } CompressionType;
 
+
+/*
+ * Enumaration for layouts of value streams. Aligned streams pad each value to
+ * its type's alignment, so that values can be used in place. Packed streams
+ * drop this padding; pass-by-value datums are copied out, varlenas are stored
+ * with short headers when they fit, and only varlenas with 4-byte headers are
+ * still aligned. Offset streams are packed streams of variable-length values,
+ * prefixed with an array of each row's value offset, so that values can be
+ * found without walking the stream. Dictionary streams store each distinct
+ * variable-length value of a block once, and a code per row that tells which
+ * of these values the row has.
+ */
+typedef enum {
+    VALUE_FORMAT_ALIGNED = 0,
+    VALUE_FORMAT_PACKED = 1,
+    VALUE_FORMAT_OFFSETS = 2,
+    VALUE_FORMAT_DICTIONARY = 3
+
+} ValueFormat;
+
+/*
+ * Offset value streams start with rowCount + 1 uint32 offsets, padded to
+ * MAXALIGN, followed by the packed values. Offsets are relative to the start of
+ * the packed values. Null rows get the length of the values before them, and
+ * the last offset is the length of all values.
+ */
+#define VALUE_OFFSET_ARRAY_LENGTH(rowCount) \
+    MAXALIGN(((rowCount) + 1) * sizeof(uint32))
+
+/*
+ * Varlena values longer than BLOB_VALUE_LENGTH_MINIMUM are stored out of line,
+ * in a blob area that follows the block's value stream in the file. Their
+ * offsets have the VALUE_OFFSET_BLOB bit set, and point to a BlobReference that
+ * takes the value's place in the stream. Blobs are compressed one at a time,
+ * and are only read for rows that scans return.
+ */
+#define BLOB_VALUE_LENGTH_MINIMUM 8192
+#define VALUE_OFFSET_BLOB ((uint32) 1 << 31)
+
+typedef struct BlobReference {
+    uint64 blobOffset;
+    uint64 blobLength;
+
+} BlobReference;
+
+/*
+ * Dictionary value streams start with a DictionaryHeader and a uint16 code for
+ * each row, padded to MAXALIGN, followed by an offset value stream of the
+ * block's distinct values. Null rows get code zero. We only use dictionaries
+ * for blocks that have at most one distinct value for every two rows.
+ */
+typedef struct DictionaryHeader {
+    uint32 entryCount;
+    uint32 rowCount;
+
+} DictionaryHeader;
+
+#define DICTIONARY_CODE_ARRAY_LENGTH(rowCount) \
+    MAXALIGN(sizeof(DictionaryHeader) + (rowCount) * sizeof(uint16))
+#define DICTIONARY_ENTRY_COUNT_MAXIMUM (1 << 16)
+
 typedef struct LZ4CompressHeader {
     size_t src_len; // original string length
     size_t comp_len; // length of compressed string
@@ -124,15 +220,35 @@ typedef struct CStoreFdwOptions {
 } CStoreFdwOptions;
 
 
+/*
+ * CStoreTableCacheEntry is a backend-local cache entry for a relation. The entry
+ * remembers whether the relation is a cstore table, and the table's parsed
+ * options once they have been resolved. Entries are removed when the relation
+ * is invalidated in the relcache, and all entries are removed when a foreign
+ * server changes.
+ */
+typedef struct CStoreTableCacheEntry {
+    Oid relationId;
+    bool cstoreTableValid;
+    bool cstoreTable;
+    CStoreFdwOptions *cstoreFdwOptions;
+
+} CStoreTableCacheEntry;
+
+
 /*
  * StripeMetadata represents information about a stripe. This information is
- * stored in the cstore file's footer.
+ * stored in the cstore file's footer. If rows of the stripe were deleted, the
+ * metadata also points to a bitmap of the deleted rows in the deletion file.
  */
 typedef struct StripeMetadata {
     uint64 fileOffset;
     uint64 skipListLength;
     uint64 dataLength;
     uint64 footerLength;
+    uint64 deletedRowCount;
+    uint64 deletionBitmapOffset;
+    uint64 deletionBitmapLength;
 
 } StripeMetadata;
 
@@ -153,17 +269,35 @@ typedef struct ColumnBlockSkipNode {
     Datum maximumValue;
     uint64 rowCount;
 
+    /*
+     * Aggregates precomputed when writing the block, so that unfiltered blocks
+     * can be aggregated without reading their data. We keep non-null counts for
+     * all columns, integer sums for int2 and int4 columns, and float sums and
+     * sums of squares for float4 and float8 columns. Blocks written by older
+     * versions don't have these, and their flags are false.
+     */
+    bool hasNonNullCount;
+    uint64 nonNullCount;
+    bool hasIntegerSum;
+    int64 integerSum;
+    bool hasFloatSum;
+    float8 floatSum;
+    float8 sumOfSquares;
+
     /*
      * Offsets and sizes of value and exists streams in the column data.
      * These enable us to skip reading suppressed row blocks, and start reading
-     * a block without reading previous blocks.
+     * a block without reading previous blocks. The block's blob area, if any,
+     * takes blobLength bytes right after its value stream.
      */
     uint64 valueBlockOffset;
     uint64 valueLength;
+    uint64 blobLength;
     uint64 existsBlockOffset;
     uint64 existsLength;
 
     CompressionType valueCompressionType;
+    ValueFormat valueFormat;
 
 } ColumnBlockSkipNode;
 
@@ -185,10 +319,24 @@ typedef struct StripeSkipList {
  * ColumnBlockData represents a block of data in a column. valueArray stores
  * the values of data, and existsArray stores whether a value is present.
  * There is a one-to-one correspondence between valueArray and existsArray.
+ * valueBuffer holds the block's uncompressed value stream; values of
+ * pass-by-reference types in valueArray point into this buffer. For packed
+ * value streams, fixed-length pass-by-reference values that aren't aligned in
+ * valueBuffer are copied into alignedValueBuffer instead. For dictionary value
+ * streams, dictionaryEntryArray holds the block's distinct values, and
+ * dictionaryCodeArray points to each row's index into them; dictionaryCodeArray
+ * is NULL for blocks with other value streams. Out-of-line values that we read
+ * are kept in blobBuffer.
  */
 typedef struct ColumnBlockData {
     bool *existsArray;
     Datum *valueArray;
+    StringInfo valueBuffer;
+    StringInfo alignedValueBuffer;
+    StringInfo blobBuffer;
+    Datum *dictionaryEntryArray;
+    uint16 *dictionaryCodeArray;
+    uint32 dictionaryEntryCount;
 
 } ColumnBlockData;
 
@@ -203,19 +351,99 @@ typedef struct ColumnData {
 } ColumnData;
 
 
-/* StripeData represents data for a row stripe in a cstore file. */
+/*
+ * StripeData represents data for a row stripe in a cstore file. Rows of blocks
+ * skipped by block filtering and deleted rows are not loaded, so we also keep
+ * each loaded row's position within the stripe.
+ */
 typedef struct StripeData {
     uint32 columnCount;
     uint32 rowCount;
     ColumnData **columnDataArray;
+    uint32 stripeIndex;
+    uint32 *stripeRowIndexArray;
 
 } StripeData;
 
 
+/*
+ * ColumnBlockBuffers holds the serialized "exists" and "value" streams of a
+ * column block while its rows are being written. Values are appended in their
+ * on-disk form as rows arrive, so a block only takes as much memory as its
+ * values actually need. For offset value streams, offsetBuffer collects the
+ * value offsets of the block's rows, and blobBuffer the block's out-of-line
+ * values.
+ */
+typedef struct ColumnBlockBuffers {
+    StringInfo existsBuffer;
+    StringInfo valueBuffer;
+    StringInfo offsetBuffer;
+    StringInfo blobBuffer;
+
+} ColumnBlockBuffers;
+
+
+/*
+ * ColumnBuffers holds the block buffers of a column in the stripe that is
+ * being written. Block buffers are created the first time a block is used.
+ */
+typedef struct ColumnBuffers {
+    ColumnBlockBuffers **blockBuffersArray;
+
+} ColumnBuffers;
+
+
+/*
+ * StripeBuffers holds the write buffers for a row stripe. The block slot
+ * arrays grow on demand up to blockCapacity, and the buffers themselves are
+ * reset and reused for the next stripe after a stripe is flushed.
+ */
+typedef struct StripeBuffers {
+    uint32 columnCount;
+    uint32 rowCount;
+    uint32 blockCapacity;
+    ColumnBuffers **columnBuffersArray;
+
+} StripeBuffers;
+
+
+/*
+ * StripeReadBuffers keeps the column data arrays and buffers of a read
+ * operation. Block arrays are sized for blockRowCount rows, block slots grow
+ * on demand up to blockCapacity, and all of these are reused for every stripe
+ * that the read operation loads. readBuffer is a scratch buffer for reading
+ * exists streams and compressed value streams.
+ */
+typedef struct StripeReadBuffers {
+    MemoryContext bufferContext;
+    uint32 columnCount;
+    uint32 blockRowCount;
+    uint32 blockCapacity;
+    ColumnData **columnDataArray;
+    StringInfo readBuffer;
+
+} StripeReadBuffers;
+
+
+/*
+ * ShreddedColumn represents a top-level key of a json or jsonb column whose
+ * values we also store as a separate text column. Such columns are stored
+ * after the table's columns, with the parent column's attribute number and the
+ * key as their id.
+ */
+typedef struct ShreddedColumn {
+    AttrNumber attributeNumber;
+    char *path;
+
+} ShreddedColumn;
+
+
 /*
  * StripeFooter represents a stripe's footer. In this footer, we keep three
- * arrays of sizes. The number of elements in each of the arrays is equal
- * to the number of columns.
+ * arrays of sizes, and the ids of the columns these sizes belong to. The number
+ * of elements in each of the arrays is equal to the number of columns stored in
+ * the stripe, which can differ from the table's column count after columns are
+ * added or dropped.
  */
 typedef struct StripeFooter {
     uint32 columnCount;
@@ -223,6 +451,12 @@ typedef struct StripeFooter {
     uint64 *existsSizeArray;
     uint64 *valueSizeArray;
 
+    /* attribute numbers of the stored columns; dropped columns aren't stored */
+    uint32 *columnIdArray;
+
+    /* json keys of shredded columns, and NULL for the table's own columns */
+    char **columnPathArray;
+
 } StripeFooter;
 
 
@@ -240,11 +474,41 @@ typedef struct TableReadState {
     List *projectedColumnList;
 
     List *whereClauseList;
+
+    /*
+     * Shredded columns that restriction clauses refer to. We read these after
+     * the table's columns in tupleDescriptor, but never return them.
+     */
+    List *shreddedColumnList;
+
+    /*
+     * Stripe metadata is allocated in stripeReadContext, which is reset before
+     * loading a new stripe. Column data of the loaded stripe lives in
+     * stripeReadBuffers, and is overwritten in place by the next stripe.
+     */
     MemoryContext stripeReadContext;
+    StripeReadBuffers *stripeReadBuffers;
     StripeData *stripeData;
     uint32 readStripeCount;
     uint64 stripeReadRowCount;
 
+    /*
+     * Metadata, footer and skip list of the stripe we read last. These also
+     * live in stripeReadContext, and let callers look at a stripe's skip list
+     * before deciding to load its data.
+     */
+    uint32 stripeIndex;
+    StripeMetadata *stripeMetadata;
+    StripeFooter *stripeFooter;
+    StripeSkipList *stripeSkipList;
+
+    /* deletion file is opened when we first load a stripe with deleted rows */
+    StringInfo deletionFilename;
+    FILE *deletionFile;
+
+    /* row id of the row read last */
+    uint64 currentRowId;
+
 } TableReadState;
 
 
@@ -254,19 +518,64 @@ typedef struct TableWriteState {
     TableFooter *tableFooter;
     StringInfo tableFooterFilename;
     CompressionType compressionType;
+    CompressionType *columnCompressionTypeArray;
     TupleDesc tupleDescriptor;
     FmgrInfo **comparisonFunctionArray;
     uint64 currentFileOffset;
 
+    /*
+     * Shredded columns follow the table's columns in tupleDescriptor. For each
+     * row, we extract their values into the row arrays below, using a memory
+     * context that is reset for every row.
+     */
+    List *shreddedColumnList;
+    uint32 tableColumnCount;
+    FmgrInfo *shreddingFunctionArray;
+    Datum *rowValueArray;
+    bool *rowNullArray;
+    MemoryContext shreddingContext;
 
+    /*
+     * Stripe buffers and skip list live in stripeBufferContext for the whole
+     * write operation and are reused across stripes. stripeWriteContext only
+     * holds temporary allocations for the stripe being written, and is reset
+     * after each stripe flush.
+     */
+    MemoryContext stripeBufferContext;
     MemoryContext stripeWriteContext;
-    StripeData *stripeData;
+    StripeBuffers *stripeBuffers;
     StripeSkipList *stripeSkipList;
     uint32 stripeMaxRowCount;
 
 } TableWriteState;
 
 
+/*
+ * TableDeleteState represents state of a cstore file delete operation. Rows
+ * deleted in the operation are collected in per-stripe bitmaps, and written to
+ * the deletion file when the operation ends.
+ */
+typedef struct TableDeleteState {
+    StringInfo tableFooterFilename;
+    StringInfo deletionFilename;
+    TableFooter *tableFooter;
+    StringInfo *deletionBitmapArray;
+    uint32 stripeCount;
+
+} TableDeleteState;
+
+
+/*
+ * CStoreModifyState keeps the state of a DELETE on a cstore table. Row ids of
+ * the rows to delete come from the "ctid" junk column of the scan.
+ */
+typedef struct CStoreModifyState {
+    TableDeleteState *deleteState;
+    AttrNumber rowIdAttributeNumber;
+
+} CStoreModifyState;
+
+
 /* Function declarations for extension loading and unloading */
 extern void _PG_init(void);
 
@@ -278,23 +587,39 @@ extern Datum cstore_ddl_event_end_trigger(PG_FUNCTION_ARGS);
 /* Function declarations for utility UDFs */
 extern Datum cstore_table_size(PG_FUNCTION_ARGS);
 
+extern Datum cstore_drop_stripes_before(PG_FUNCTION_ARGS);
+
 /* Function declarations for foreign data wrapper */
 extern Datum cstore_fdw_handler(PG_FUNCTION_ARGS);
 
 extern Datum cstore_fdw_validator(PG_FUNCTION_ARGS);
 
+extern bool CStoreTable(Oid relationId);
+
 /* Function declarations for writing to a cstore file */
 extern TableWriteState *CStoreBeginWrite(const char *filename,
                                          CompressionType compressionType,
+                                         CompressionType *columnCompressionTypeArray,
                                          uint64 stripeMaxRowCount,
                                          uint32 blockRowCount,
-                                         TupleDesc tupleDescriptor);
+                                         TupleDesc tupleDescriptor,
+                                         List *shreddedColumnList);
 
 extern void CStoreWriteRow(TableWriteState *state, Datum *columnValues,
                            bool *columnNulls);
 
 extern void CStoreEndWrite(TableWriteState *state);
 
+/* Function declarations for deleting rows from a cstore file */
+extern TableDeleteState *CStoreBeginDelete(const char *filename);
+
+extern void CStoreDeleteRow(TableDeleteState *state, uint64 rowId);
+
+extern void CStoreEndDelete(TableDeleteState *state);
+
+extern uint64 CStoreDropStripesBefore(const char *filename, TupleDesc tupleDescriptor,
+                                      uint32 columnIndex, Datum value);
+
 /* Function declarations for reading from a cstore file */
 extern TableReadState *CStoreBeginRead(const char *filename, TupleDesc tupleDescriptor,
                                        List *projectedColumnList, List *qualConditions);
@@ -306,11 +631,35 @@ extern bool CStoreReadFinished(TableReadState *state);
 extern bool CStoreReadNextRow(TableReadState *state, Datum *columnValues,
                               bool *columnNulls);
 
+extern StripeData *CStoreReadNextStripe(TableReadState *state);
+
+extern StripeSkipList *CStoreReadNextStripeSkipList(TableReadState *state);
+
+extern StripeData *CStoreReadCurrentStripe(TableReadState *state);
+
+extern uint64 CStoreCurrentRowId(TableReadState *state);
+
 extern void CStoreEndRead(TableReadState *state);
 
+extern bool StringFilterClause(Node *whereClause);
+
+/* Function declarations for type-specific value stream encodings */
+extern bool GorillaCompress(const char *source, uint32 sourceLength,
+                            StringInfo compressedBuffer);
+
+extern void GorillaDecompress(StringInfo buffer, StringInfo decompressedBuffer);
+
+extern bool DeltaCompress(const char *source, uint32 sourceLength, uint32 valueWidth,
+                          StringInfo compressedBuffer);
+
+extern void DeltaDecompress(StringInfo buffer, StringInfo decompressedBuffer);
+
 /* Function declarations for common functions */
 extern FmgrInfo *GetFunctionInfoOrNull(Oid typeId, Oid accessMethodId,
                                        int16 procedureId);
 
+extern TupleDesc ShreddedTupleDescriptor(TupleDesc tupleDescriptor,
+                                         List *shreddedColumnList);
+
 
 #endif   /* CSTORE_FDW_H */ 
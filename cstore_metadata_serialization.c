@@ -93,6 +93,18 @@ SerializeTableFooter(TableFooter *tableFooter) {
         protobufStripeMetadata->has_footerlength = true;
         protobufStripeMetadata->footerlength = stripeMetadata->footerLength;
 
+        /* only stripes with deleted rows reference a deletion bitmap */
+        if (stripeMetadata->deletedRowCount > 0) {
+            protobufStripeMetadata->has_deletedrowcount = true;
+            protobufStripeMetadata->deletedrowcount = stripeMetadata->deletedRowCount;
+            protobufStripeMetadata->has_deletionbitmapoffset = true;
+            protobufStripeMetadata->deletionbitmapoffset =
+                    stripeMetadata->deletionBitmapOffset;
+            protobufStripeMetadata->has_deletionbitmaplength = true;
+            protobufStripeMetadata->deletionbitmaplength =
+                    stripeMetadata->deletionBitmapLength;
+        }
+
         stripeMetadataArray[stripeIndex] = protobufStripeMetadata;
         stripeIndex++;
     }
@@ -125,6 +137,21 @@ SerializeStripeFooter(StripeFooter *stripeFooter) {
     Protobuf__StripeFooter protobufStripeFooter = PROTOBUF__STRIPE_FOOTER__INIT;
     uint8 *stripeFooterData = NULL;
     uint32 stripeFooterSize = 0;
+    char **columnPathArray = NULL;
+    bool columnPathExists = false;
+    uint32 columnIndex = 0;
+
+    /* only stripes with shredded columns keep their paths */
+    columnPathArray = palloc0(Max(stripeFooter->columnCount, 1) * sizeof(char *));
+    for (columnIndex = 0; columnIndex < stripeFooter->columnCount; columnIndex++) {
+        char *columnPath = stripeFooter->columnPathArray[columnIndex];
+        if (columnPath != NULL) {
+            columnPathArray[columnIndex] = columnPath;
+            columnPathExists = true;
+        } else {
+            columnPathArray[columnIndex] = "";
+        }
+    }
 
     protobufStripeFooter.n_skiplistsizearray = stripeFooter->columnCount;
     protobufStripeFooter.skiplistsizearray = (uint64_t *) stripeFooter->skipListSizeArray;
@@ -132,6 +159,12 @@ SerializeStripeFooter(StripeFooter *stripeFooter) {
     protobufStripeFooter.existssizearray = (uint64_t *) stripeFooter->existsSizeArray;
     protobufStripeFooter.n_valuesizearray = stripeFooter->columnCount;
     protobufStripeFooter.valuesizearray = (uint64_t *) stripeFooter->valueSizeArray;
+    protobufStripeFooter.n_columnidarray = stripeFooter->columnCount;
+    protobufStripeFooter.columnidarray = (uint32_t *) stripeFooter->columnIdArray;
+    if (columnPathExists) {
+        protobufStripeFooter.n_columnpatharray = stripeFooter->columnCount;
+        protobufStripeFooter.columnpatharray = columnPathArray;
+    }
 
     stripeFooterSize = protobuf__stripe_footer__get_packed_size(&protobufStripeFooter);
     stripeFooterData = palloc0(stripeFooterSize);
@@ -189,6 +222,8 @@ SerializeColumnSkipList(ColumnBlockSkipNode *blockSkipNodeArray, uint32 blockCou
         protobufBlockSkipNode->valueblockoffset = blockSkipNode.valueBlockOffset;
         protobufBlockSkipNode->has_valuelength = true;
         protobufBlockSkipNode->valuelength = blockSkipNode.valueLength;
+        protobufBlockSkipNode->has_bloblength = (blockSkipNode.blobLength > 0);
+        protobufBlockSkipNode->bloblength = blockSkipNode.blobLength;
         protobufBlockSkipNode->has_existsblockoffset = true;
         protobufBlockSkipNode->existsblockoffset = blockSkipNode.existsBlockOffset;
         protobufBlockSkipNode->has_existslength = true;
@@ -196,6 +231,17 @@ SerializeColumnSkipList(ColumnBlockSkipNode *blockSkipNodeArray, uint32 blockCou
         protobufBlockSkipNode->has_valuecompressiontype = true;
         protobufBlockSkipNode->valuecompressiontype =
                 (Protobuf__CompressionType) blockSkipNode.valueCompressionType;
+        protobufBlockSkipNode->has_valueformat = true;
+        protobufBlockSkipNode->valueformat =
+                (Protobuf__ValueFormat) blockSkipNode.valueFormat;
+        protobufBlockSkipNode->has_nonnullcount = blockSkipNode.hasNonNullCount;
+        protobufBlockSkipNode->nonnullcount = blockSkipNode.nonNullCount;
+        protobufBlockSkipNode->has_integersum = blockSkipNode.hasIntegerSum;
+        protobufBlockSkipNode->integersum = blockSkipNode.integerSum;
+        protobufBlockSkipNode->has_floatsum = blockSkipNode.hasFloatSum;
+        protobufBlockSkipNode->floatsum = blockSkipNode.floatSum;
+        protobufBlockSkipNode->has_sumofsquares = blockSkipNode.hasFloatSum;
+        protobufBlockSkipNode->sumofsquares = blockSkipNode.sumOfSquares;
 
         protobufBlockSkipNodeArray[blockIndex] = protobufBlockSkipNode;
     }
@@ -296,6 +342,11 @@ DeserializeTableFooter(StringInfo buffer) {
         stripeMetadata->skipListLength = protobufStripeMetadata->skiplistlength;
         stripeMetadata->dataLength = protobufStripeMetadata->datalength;
         stripeMetadata->footerLength = protobufStripeMetadata->footerlength;
+        stripeMetadata->deletedRowCount = protobufStripeMetadata->deletedrowcount;
+        stripeMetadata->deletionBitmapOffset =
+                protobufStripeMetadata->deletionbitmapoffset;
+        stripeMetadata->deletionBitmapLength =
+                protobufStripeMetadata->deletionbitmaplength;
 
         stripeMetadataList = lappend(stripeMetadataList, stripeMetadata);
     }
@@ -321,8 +372,11 @@ DeserializeStripeFooter(StringInfo buffer) {
     uint64 *skipListSizeArray = NULL;
     uint64 *existsSizeArray = NULL;
     uint64 *valueSizeArray = NULL;
+    uint32 *columnIdArray = NULL;
+    char **columnPathArray = NULL;
     uint64 sizeArrayLength = 0;
     uint32 columnCount = 0;
+    uint32 columnIndex = 0;
 
     protobufStripeFooter = protobuf__stripe_footer__unpack(NULL, buffer->len,
                                                            (uint8 *) buffer->data);
@@ -348,12 +402,42 @@ DeserializeStripeFooter(StringInfo buffer) {
     memcpy(existsSizeArray, protobufStripeFooter->existssizearray, sizeArrayLength);
     memcpy(valueSizeArray, protobufStripeFooter->valuesizearray, sizeArrayLength);
 
+    /* stripes without column ids store all columns in attribute number order */
+    columnIdArray = palloc0(Max(columnCount, 1) * sizeof(uint32));
+    if (protobufStripeFooter->n_columnidarray == 0) {
+        for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
+            columnIdArray[columnIndex] = columnIndex + 1;
+        }
+    } else if (protobufStripeFooter->n_columnidarray == columnCount) {
+        memcpy(columnIdArray, protobufStripeFooter->columnidarray,
+               columnCount * sizeof(uint32));
+    } else {
+        ereport(ERROR, (errmsg("could not unpack column store"),
+                errdetail("stripe column id count and column count don't match")));
+    }
+
+    /* empty paths mark the table's own columns */
+    columnPathArray = palloc0(Max(columnCount, 1) * sizeof(char *));
+    if (protobufStripeFooter->n_columnpatharray == columnCount) {
+        for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
+            char *columnPath = protobufStripeFooter->columnpatharray[columnIndex];
+            if (columnPath[0] != '\0') {
+                columnPathArray[columnIndex] = pstrdup(columnPath);
+            }
+        }
+    } else if (protobufStripeFooter->n_columnpatharray != 0) {
+        ereport(ERROR, (errmsg("could not unpack column store"),
+                errdetail("stripe column path count and column count don't match")));
+    }
+
     protobuf__stripe_footer__free_unpacked(protobufStripeFooter, NULL);
 
     stripeFooter = palloc0(sizeof(StripeFooter));
     stripeFooter->skipListSizeArray = skipListSizeArray;
     stripeFooter->existsSizeArray = existsSizeArray;
     stripeFooter->valueSizeArray = valueSizeArray;
+    stripeFooter->columnIdArray = columnIdArray;
+    stripeFooter->columnPathArray = columnPathArray;
     stripeFooter->columnCount = columnCount;
 
     return stripeFooter;
@@ -361,12 +445,15 @@ DeserializeStripeFooter(StringInfo buffer) {
 
 
 /*
- * DeserializeBlockCount deserializes the given column skip list buffer and
- * returns the number of blocks in column skip list.
+ * DeserializeBlockRowCountArray deserializes the given column skip list buffer,
+ * sets the number of blocks in the column skip list, and returns the row counts
+ * of these blocks. Since all columns of a stripe have the same block row counts,
+ * we use this to avoid decoding the skip lists of columns we don't read.
  */
-uint32
-DeserializeBlockCount(StringInfo buffer) {
-    uint32 blockCount = 0;
+uint64 *
+DeserializeBlockRowCountArray(StringInfo buffer, uint32 *blockCount) {
+    uint64 *blockRowCountArray = NULL;
+    uint32 blockIndex = 0;
     Protobuf__ColumnBlockSkipList *protobufBlockSkipList = NULL;
 
     protobufBlockSkipList =
@@ -377,11 +464,23 @@ DeserializeBlockCount(StringInfo buffer) {
                 errdetail("invalid skip list buffer")));
     }
 
-    blockCount = protobufBlockSkipList->n_blockskipnodearray;
+    (*blockCount) = protobufBlockSkipList->n_blockskipnodearray;
+
+    blockRowCountArray = palloc0(Max(*blockCount, 1) * sizeof(uint64));
+    for (blockIndex = 0; blockIndex < (*blockCount); blockIndex++) {
+        Protobuf__ColumnBlockSkipNode *protobufBlockSkipNode =
+                protobufBlockSkipList->blockskipnodearray[blockIndex];
+        if (!protobufBlockSkipNode->has_rowcount) {
+            ereport(ERROR, (errmsg("could not unpack column store"),
+                    errdetail("missing required block skip node metadata")));
+        }
+
+        blockRowCountArray[blockIndex] = protobufBlockSkipNode->rowcount;
+    }
 
     protobuf__column_block_skip_list__free_unpacked(protobufBlockSkipList, NULL);
 
-    return blockCount;
+    return blockRowCountArray;
 }
 
 
@@ -454,8 +553,27 @@ DeserializeColumnSkipList(StringInfo buffer, bool typeByValue, int typeLength,
         blockSkipNode->valueBlockOffset = protobufBlockSkipNode->valueblockoffset;
         blockSkipNode->existsLength = protobufBlockSkipNode->existslength;
         blockSkipNode->valueLength = protobufBlockSkipNode->valuelength;
+        blockSkipNode->blobLength = 0;
+        if (protobufBlockSkipNode->has_bloblength) {
+            blockSkipNode->blobLength = protobufBlockSkipNode->bloblength;
+        }
         blockSkipNode->valueCompressionType =
                 (CompressionType) protobufBlockSkipNode->valuecompressiontype;
+        blockSkipNode->valueFormat = VALUE_FORMAT_ALIGNED;
+        if (protobufBlockSkipNode->has_valueformat) {
+            blockSkipNode->valueFormat =
+                    (ValueFormat) protobufBlockSkipNode->valueformat;
+        }
+
+        /* precomputed aggregates are optional, and missing in older files */
+        blockSkipNode->hasNonNullCount = protobufBlockSkipNode->has_nonnullcount;
+        blockSkipNode->nonNullCount = protobufBlockSkipNode->nonnullcount;
+        blockSkipNode->hasIntegerSum = protobufBlockSkipNode->has_integersum;
+        blockSkipNode->integerSum = protobufBlockSkipNode->integersum;
+        blockSkipNode->hasFloatSum = (protobufBlockSkipNode->has_floatsum &&
+                                      protobufBlockSkipNode->has_sumofsquares);
+        blockSkipNode->floatSum = protobufBlockSkipNode->floatsum;
+        blockSkipNode->sumOfSquares = protobufBlockSkipNode->sumofsquares;
     }
 
     protobuf__column_block_skip_list__free_unpacked(protobufBlockSkipList, NULL);
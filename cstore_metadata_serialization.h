@@ -36,7 +36,7 @@ extern void DeserializePostScript(StringInfo buffer, uint64 *tableFooterLength);
 
 extern TableFooter *DeserializeTableFooter(StringInfo buffer);
 
-extern uint32 DeserializeBlockCount(StringInfo buffer);
+extern uint64 *DeserializeBlockRowCountArray(StringInfo buffer, uint32 *blockCount);
 
 extern StripeFooter *DeserializeStripeFooter(StringInfo buffer);
 
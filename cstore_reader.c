@@ -20,7 +20,12 @@
 
 #include "access/nbtree.h"
 #include "access/skey.h"
+#include "access/transam.h"
+#include "access/tupdesc.h"
+#include "catalog/pg_proc.h"
+#include "catalog/pg_type.h"
 #include "commands/defrem.h"
+#include "mb/pg_wchar.h"
 #include "nodes/makefuncs.h"
 #include "optimizer/clauses.h"
 #include "optimizer/predtest.h"
@@ -28,31 +33,157 @@
 #include "optimizer/var.h"
 #include "port.h"
 #include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
+#include "utils/pg_locale.h"
 #include "utils/pg_lzcompress.h"
 #include "utils/rel.h"
 
 
+/*
+ * StringFilterKind lists the text restrictions that scans evaluate by comparing
+ * bytes. LIKE patterns qualify when their only wildcards are leading or trailing
+ * percent signs, which makes them exact, prefix, suffix, or substring matches.
+ * Ordering comparisons qualify for the C and POSIX collations, which order
+ * text by its bytes. STRING_FILTER_LIKE is only used while parsing patterns.
+ */
+typedef enum {
+    STRING_FILTER_EQUAL = 0,
+    STRING_FILTER_PREFIX = 1,
+    STRING_FILTER_SUFFIX = 2,
+    STRING_FILTER_CONTAINS = 3,
+    STRING_FILTER_LIKE = 4,
+    STRING_FILTER_LESS = 5,
+    STRING_FILTER_LESS_EQUAL = 6,
+    STRING_FILTER_GREATER = 7,
+    STRING_FILTER_GREATER_EQUAL = 8
+
+} StringFilterKind;
+
+
+/*
+ * StringFilter holds the byte pattern a text restriction compares values with,
+ * and whether the restriction's result is negated, as it is for <> and NOT LIKE.
+ */
+typedef struct StringFilter {
+    StringFilterKind filterKind;
+    bool negated;
+    const char *pattern;
+    uint32 patternLength;
+
+} StringFilter;
+
+
+/*
+ * ColumnFilter is a restriction clause that compares a variable-length column
+ * with a constant, using an immutable and strict operator. For blocks with
+ * dictionary value streams, we evaluate such clauses once per distinct value
+ * instead of once per row. Clauses that have a string filter are evaluated on
+ * all blocks, and the planner leaves them to the scan. Clauses may also compare
+ * a key of a json or jsonb column, extracted with ->>, with a constant; these
+ * are evaluated on the key's shredded column.
+ */
+typedef struct ColumnFilter {
+    uint32 columnIndex;
+    char *columnPath;
+    bool columnIsLeftOperand;
+    Datum constantValue;
+    Oid collation;
+    Oid functionId;
+    FmgrInfo operatorFunction;
+    StringFilter *stringFilter;
+
+} ColumnFilter;
+
+
 /* static function declarations */
+static bool LoadNextStripe(TableReadState *readState);
+
+static bool LoadNextStripeSkipList(TableReadState *readState);
+
+static StripeData *LoadCurrentStripeData(TableReadState *readState);
+
 static StripeData *LoadFilteredStripeData(FILE *tableFile,
                                           StripeMetadata *stripeMetadata,
+                                          StripeFooter *stripeFooter,
+                                          StripeSkipList *stripeSkipList,
+                                          StringInfo deletionBitmap,
                                           TupleDesc tupleDescriptor,
                                           List *projectedColumnList,
-                                          List *whereClauseList);
+                                          List *whereClauseList,
+                                          List *shreddedColumnList,
+                                          StripeReadBuffers *stripeReadBuffers);
+
+static StringInfo LoadDeletionBitmap(TableReadState *readState);
+
+static uint32 *StripeRowIndexArray(StripeSkipList *stripeSkipList,
+                                   bool *selectedBlockMask, uint32 blockRowCount);
+
+static List *ColumnFilterList(List *whereClauseList, TupleDesc tupleDescriptor,
+                              bool *projectedColumnMask, List *shreddedColumnList,
+                              StripeFooter *stripeFooter);
+
+static ColumnFilter *BuildColumnFilter(Node *whereClause);
+
+static Var *FilterColumnOperand(Node *operand, char **columnPath);
+
+static List *ShreddedFilterColumnList(List *whereClauseList);
+
+static int32 ShreddedColumnPosition(List *shreddedColumnList,
+                                   AttrNumber attributeNumber, const char *path);
+
+static StringFilter *BuildStringFilter(Oid functionId, Const *constant,
+                                       bool columnIsLeftOperand, Oid collation);
+
+static bool *EvaluateColumnFilters(List *columnFilterList, ColumnData **columnDataArray,
+                                   StripeSkipList *selectedBlockSkipList,
+                                   uint32 blockRowCount, bool *selectedRowMask);
+
+static bool ColumnFilterMatches(ColumnFilter *columnFilter, Datum columnValue);
+
+static bool StringFilterMatches(StringFilter *stringFilter, const char *value,
+                                uint32 valueLength);
+
+static void RemoveUnselectedRows(StripeData *stripeData, bool *projectedColumnMask,
+                                 StringInfo deletionBitmap, bool *selectedRowMask,
+                                 uint32 blockRowCount);
+
+static bool RowDeleted(StringInfo deletionBitmap, uint32 stripeRowIndex);
 
 static void ReadStripeNextRow(StripeData *stripeData, List *projectedColumnList,
                               uint64 blockIndex, uint64 blockRowIndex,
                               Datum *columnValues, bool *columnNulls);
 
-static ColumnData *LoadColumnData(FILE *tableFile,
-                                  ColumnBlockSkipNode *blockSkipNodeArray,
-                                  uint32 blockCount, uint64 existsFileOffset,
-                                  uint64 valueFileOffset,
-                                  Form_pg_attribute attributeForm);
+static void LoadColumnData(FILE *tableFile, ColumnBlockSkipNode *blockSkipNodeArray,
+                           uint32 blockCount, uint64 existsFileOffset,
+                           uint64 valueFileOffset, Form_pg_attribute attributeForm,
+                           ColumnData *columnData, StringInfo readBuffer,
+                           bool *selectedRowMask, uint32 blockRowCount);
+
+static void LoadBlobValues(FILE *tableFile, uint64 blobFileOffset,
+                           ColumnBlockData *blockData, uint32 rowCount,
+                           bool *blockRowMask);
+
+static void LoadStripeColumn(FILE *tableFile, StripeFooter *stripeFooter,
+                             uint64 *columnFileOffsetArray,
+                             StripeSkipList *selectedBlockSkipList,
+                             Form_pg_attribute attributeForm, uint32 columnIndex,
+                             StripeReadBuffers *stripeReadBuffers,
+                             bool *selectedRowMask);
+
+static void LoadMissingColumnData(ColumnBlockSkipNode *blockSkipNodeArray,
+                                  uint32 blockCount, ColumnData *columnData);
+
+static StripeReadBuffers *CreateStripeReadBuffers(uint32 columnCount,
+                                                  uint32 blockRowCount);
+
+static ColumnData *ReserveColumnData(StripeReadBuffers *stripeReadBuffers,
+                                     uint32 columnIndex, uint32 blockCount);
 
 static StripeFooter *LoadStripeFooter(FILE *tableFile, StripeMetadata *stripeMetadata,
-                                      uint32 columnCount);
+                                      uint32 columnCount, List *shreddedColumnList);
 
 static StripeSkipList *LoadStripeSkipList(FILE *tableFile,
                                           StripeMetadata *stripeMetadata,
@@ -60,6 +191,11 @@ static StripeSkipList *LoadStripeSkipList(FILE *tableFile,
                                           uint32 columnCount,
                                           Form_pg_attribute *attributeFormArray);
 
+static int32 StripeColumnPosition(StripeFooter *stripeFooter, uint32 columnIndex);
+
+static ColumnBlockSkipNode *MissingColumnSkipList(uint64 *blockRowCountArray,
+                                                  uint32 blockCount);
+
 static bool *SelectedBlockMask(StripeSkipList *stripeSkipList,
                                List *projectedColumnList, List *whereClauseList);
 
@@ -80,22 +216,45 @@ static uint32 StripeSkipListRowCount(StripeSkipList *stripeSkipList);
 
 static bool *ProjectedColumnMask(uint32 columnCount, List *projectedColumnList);
 
-static bool *DeserializeBoolArray(StringInfo boolArrayBuffer, uint32 boolArrayLength);
+static void DeserializeBoolArray(StringInfo boolArrayBuffer, bool *boolArray,
+                                 uint32 boolArrayLength);
+
+static void DeserializeDatumArray(StringInfo datumBuffer, bool *existsArray,
+                                  uint32 datumCount, bool datumTypeByValue,
+                                  int datumTypeLength, char datumTypeAlign,
+                                  Datum *datumArray);
 
-static Datum *DeserializeDatumArray(StringInfo datumBuffer, bool *existsArray,
-                                    uint32 datumCount, bool datumTypeByValue,
-                                    int datumTypeLength, char datumTypeAlign);
+static void DeserializePackedDatumArray(StringInfo datumBuffer, bool *existsArray,
+                                        uint32 datumCount, bool datumTypeByValue,
+                                        int datumTypeLength, char datumTypeAlign,
+                                        Datum *datumArray,
+                                        StringInfo alignedDatumBuffer);
+
+static void DeserializeOffsetDatumArray(StringInfo datumBuffer, bool *existsArray,
+                                        uint32 datumCount, Datum *datumArray);
+
+static void DeserializeDictionaryDatumArray(StringInfo datumBuffer, uint32 datumCount,
+                                            ColumnBlockData *blockData);
 
 static int64 FileSize(FILE *file);
 
 static StringInfo ReadFromFile(FILE *file, uint64 offset, uint32 size);
 
-static StringInfo DecompressBuffer(StringInfo buffer, CompressionType compressionType);
+static void ReadFromFileIntoBuffer(FILE *file, uint64 offset, uint32 size,
+                                   StringInfo resultBuffer);
+
+static void ReadFromFileIntoPointer(FILE *file, uint64 offset, uint32 size,
+                                    char *resultPointer);
+
+static void DecompressBuffer(StringInfo buffer, CompressionType compressionType,
+                             StringInfo decompressedBuffer);
 
 
 /*
  * CStoreBeginRead initializes a cstore read operation. This function returns a
  * read handle that's used during reading rows and finishing the read operation.
+ * If restriction clauses compare json keys with constants, we also read these
+ * keys' shredded columns to filter rows.
  */
 TableReadState *
 CStoreBeginRead(const char *filename, TupleDesc tupleDescriptor,
@@ -104,6 +263,10 @@ CStoreBeginRead(const char *filename, TupleDesc tupleDescriptor,
     TableFooter *tableFooter = NULL;
     FILE *tableFile = NULL;
     MemoryContext stripeReadContext = NULL;
+    MemoryContext stripeBufferContext = NULL;
+    MemoryContext oldContext = NULL;
+    StripeReadBuffers *stripeReadBuffers = NULL;
+    List *shreddedColumnList = NIL;
 
     StringInfo tableFooterFilename = makeStringInfo();
     appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
@@ -120,8 +283,14 @@ CStoreBeginRead(const char *filename, TupleDesc tupleDescriptor,
                        filename)));
     }
 
+    /* shredded columns are read after the table's columns */
+    shreddedColumnList = ShreddedFilterColumnList(whereClauseList);
+    if (shreddedColumnList != NIL) {
+        tupleDescriptor = ShreddedTupleDescriptor(tupleDescriptor, shreddedColumnList);
+    }
+
     /*
-     * We allocate all stripe specific data in the stripeReadContext, and reset
+     * We allocate stripe specific metadata in the stripeReadContext, and reset
      * this memory context before loading a new stripe. This is to avoid memory
      * leaks.
      */
@@ -131,16 +300,43 @@ CStoreBeginRead(const char *filename, TupleDesc tupleDescriptor,
                                               ALLOCSET_DEFAULT_INITSIZE,
                                               ALLOCSET_DEFAULT_MAXSIZE);
 
+    /*
+     * Column data arrays and buffers live for the whole read operation, and
+     * are reused by every stripe. This way, steady state scanning doesn't
+     * allocate any column data.
+     */
+    stripeBufferContext = AllocSetContextCreate(CurrentMemoryContext,
+                                                "Stripe Buffer Memory Context",
+                                                ALLOCSET_DEFAULT_MINSIZE,
+                                                ALLOCSET_DEFAULT_INITSIZE,
+                                                ALLOCSET_DEFAULT_MAXSIZE);
+
+    oldContext = MemoryContextSwitchTo(stripeBufferContext);
+    stripeReadBuffers = CreateStripeReadBuffers(tupleDescriptor->natts,
+                                                tableFooter->blockRowCount);
+    MemoryContextSwitchTo(oldContext);
+
     readState = palloc0(sizeof(TableReadState));
     readState->tableFile = tableFile;
     readState->tableFooter = tableFooter;
     readState->projectedColumnList = projectedColumnList;
     readState->whereClauseList = whereClauseList;
+    readState->shreddedColumnList = shreddedColumnList;
     readState->stripeData = NULL;
     readState->readStripeCount = 0;
     readState->stripeReadRowCount = 0;
     readState->tupleDescriptor = tupleDescriptor;
     readState->stripeReadContext = stripeReadContext;
+    readState->stripeReadBuffers = stripeReadBuffers;
+    readState->stripeMetadata = NULL;
+    readState->stripeFooter = NULL;
+    readState->stripeSkipList = NULL;
+    readState->deletionFilename = makeStringInfo();
+    readState->deletionFile = NULL;
+    readState->currentRowId = 0;
+
+    appendStringInfo(readState->deletionFilename, "%s%s", filename,
+                     CSTORE_DELETION_FILE_SUFFIX);
 
     return readState;
 }
@@ -221,41 +417,12 @@ CStoreReadNextRow(TableReadState *readState, Datum *columnValues, bool *columnNu
     uint32 blockRowIndex = 0;
     TableFooter *tableFooter = readState->tableFooter;
 
-    /*
-     * If no stripes are loaded, load the next non-empty stripe. Note that when
-     * loading stripes, we skip over blocks whose contents can be filtered with
-     * the query's restriction qualifiers. So, even when a stripe is physically
-     * not empty, we may end up loading it as an empty stripe.
-     */
-    while (readState->stripeData == NULL) {
-        StripeData *stripeData = NULL;
-        StripeMetadata *stripeMetadata = NULL;
-        MemoryContext oldContext = NULL;
-        List *stripeMetadataList = tableFooter->stripeMetadataList;
-        uint32 stripeCount = list_length(stripeMetadataList);
-
-        /* if we have read all stripes, return false */
-        if (readState->readStripeCount == stripeCount) {
+    /* if no stripes are loaded, load the next non-empty stripe */
+    if (readState->stripeData == NULL) {
+        bool stripeLoaded = LoadNextStripe(readState);
+        if (!stripeLoaded) {
             return false;
         }
-
-        oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
-        MemoryContextReset(readState->stripeReadContext);
-
-        stripeMetadata = list_nth(stripeMetadataList, readState->readStripeCount);
-        stripeData = LoadFilteredStripeData(readState->tableFile, stripeMetadata,
-                                            readState->tupleDescriptor,
-                                            readState->projectedColumnList,
-                                            readState->whereClauseList);
-        readState->readStripeCount++;
-
-        MemoryContextSwitchTo(oldContext);
-
-        if (stripeData->rowCount != 0) {
-            readState->stripeData = stripeData;
-            readState->stripeReadRowCount = 0;
-            break;
-        }
     }
 
     blockIndex = readState->stripeReadRowCount / tableFooter->blockRowCount;
@@ -264,6 +431,11 @@ CStoreReadNextRow(TableReadState *readState, Datum *columnValues, bool *columnNu
     ReadStripeNextRow(readState->stripeData, readState->projectedColumnList,
                       blockIndex, blockRowIndex, columnValues, columnNulls);
 
+    readState->currentRowId =
+            CSTORE_ROW_ID(readState->stripeData->stripeIndex,
+                          readState->stripeData->stripeRowIndexArray[
+                                  readState->stripeReadRowCount]);
+
     /*
      * If we finished reading the current stripe, set stripe data to NULL. That
      * way, we will load a new stripe the next time this function gets called.
@@ -277,11 +449,158 @@ CStoreReadNextRow(TableReadState *readState, Datum *columnValues, bool *columnNu
 }
 
 
+/*
+ * CStoreReadNextStripe loads the next non-empty stripe from the cstore file, and
+ * returns it as a whole. Vectorized aggregates use this function to process a
+ * stripe at a time instead of a row at a time. The returned stripe is valid
+ * until the next read call. If there are no more stripes to read, the function
+ * returns NULL.
+ */
+StripeData *
+CStoreReadNextStripe(TableReadState *readState) {
+    StripeData *stripeData = NULL;
+
+    /* drop any partially read stripe, and start from the next one */
+    readState->stripeData = NULL;
+
+    if (!LoadNextStripe(readState)) {
+        return NULL;
+    }
+
+    /* row reads after this call should also start from the next stripe */
+    stripeData = readState->stripeData;
+    readState->stripeData = NULL;
+
+    return stripeData;
+}
+
+
+/*
+ * CStoreReadNextStripeSkipList moves to the next stripe in the cstore file, and
+ * returns its skip list without loading any column data. Callers can then
+ * compute what they need from the skip list, or load the stripe's data with
+ * CStoreReadCurrentStripe(). Note that the skip list covers all blocks of the
+ * stripe, and isn't filtered with the query's restriction qualifiers. If there
+ * are no more stripes to read, the function returns NULL.
+ */
+StripeSkipList *
+CStoreReadNextStripeSkipList(TableReadState *readState) {
+    /* drop any partially read stripe, and start from the next one */
+    readState->stripeData = NULL;
+
+    if (!LoadNextStripeSkipList(readState)) {
+        return NULL;
+    }
+
+    return readState->stripeSkipList;
+}
+
+
+/*
+ * CStoreReadCurrentStripe loads the data of the stripe whose skip list was read
+ * last by CStoreReadNextStripeSkipList(), and returns it as a whole. Unlike
+ * CStoreReadNextStripe(), the returned stripe may have no rows left after
+ * block filtering.
+ */
+StripeData *
+CStoreReadCurrentStripe(TableReadState *readState) {
+    Assert(readState->stripeSkipList != NULL);
+
+    return LoadCurrentStripeData(readState);
+}
+
+
+/*
+ * CStoreCurrentRowId returns the row id of the row read last with
+ * CStoreReadNextRow().
+ */
+uint64
+CStoreCurrentRowId(TableReadState *readState) {
+    return readState->currentRowId;
+}
+
+
+/*
+ * LoadNextStripe loads the next non-empty stripe into the read state, and
+ * returns true. If we have read all stripes, the function returns false. Note
+ * that when loading stripes, we skip over blocks whose contents can be filtered
+ * with the query's restriction qualifiers. So, even when a stripe is physically
+ * not empty, we may end up loading it as an empty stripe.
+ */
+static bool
+LoadNextStripe(TableReadState *readState) {
+    while (LoadNextStripeSkipList(readState)) {
+        StripeData *stripeData = LoadCurrentStripeData(readState);
+
+        if (stripeData->rowCount != 0) {
+            readState->stripeData = stripeData;
+            readState->stripeReadRowCount = 0;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ * LoadNextStripeSkipList moves to the next stripe in the table, and loads the
+ * stripe's footer and skip list into the read state. If we have read all
+ * stripes, the function returns false.
+ */
+static bool
+LoadNextStripeSkipList(TableReadState *readState) {
+    TableFooter *tableFooter = readState->tableFooter;
+    List *stripeMetadataList = tableFooter->stripeMetadataList;
+    uint32 stripeCount = list_length(stripeMetadataList);
+    uint32 columnCount = readState->tupleDescriptor->natts;
+    uint32 tableColumnCount = columnCount - list_length(readState->shreddedColumnList);
+    uint32 stripeIndex = readState->readStripeCount;
+    StripeMetadata *stripeMetadata = NULL;
+    MemoryContext oldContext = NULL;
+
+    MemoryContextReset(readState->stripeReadContext);
+    readState->stripeMetadata = NULL;
+    readState->stripeFooter = NULL;
+    readState->stripeSkipList = NULL;
+
+    if (stripeIndex >= stripeCount) {
+        return false;
+    }
+
+    readState->readStripeCount++;
+
+    oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
+
+    stripeMetadata = list_nth(stripeMetadataList, stripeIndex);
+    readState->stripeIndex = stripeIndex;
+    readState->stripeMetadata = stripeMetadata;
+    readState->stripeFooter = LoadStripeFooter(readState->tableFile, stripeMetadata,
+                                               tableColumnCount,
+                                               readState->shreddedColumnList);
+    readState->stripeSkipList = LoadStripeSkipList(readState->tableFile,
+                                                   stripeMetadata,
+                                                   readState->stripeFooter,
+                                                   columnCount,
+                                                   readState->tupleDescriptor->attrs);
+
+    MemoryContextSwitchTo(oldContext);
+
+    return true;
+}
+
+
 /* Finishes a cstore read operation. */
 void
 CStoreEndRead(TableReadState *readState) {
     MemoryContextDelete(readState->stripeReadContext);
+    MemoryContextDelete(readState->stripeReadBuffers->bufferContext);
     FreeFile(readState->tableFile);
+    if (readState->deletionFile != NULL) {
+        FreeFile(readState->deletionFile);
+    }
+    pfree(readState->deletionFilename->data);
+    pfree(readState->deletionFilename);
     list_free_deep(readState->tableFooter->stripeMetadataList);
     pfree(readState->tableFooter);
     pfree(readState);
@@ -289,165 +608,1271 @@ CStoreEndRead(TableReadState *readState) {
 
 
 /*
- * LoadFilteredStripeData reads and decompresses stripe data from the given file.
- * The function skips over blocks whose rows are refuted by restriction qualifiers,
- * and only loads columns that are projected in the query.
+ * LoadCurrentStripeData loads the data of the stripe whose skip list was read
+ * last into the stripe read buffers, and returns it. Deleted rows of the stripe
+ * are left out.
+ */
+static StripeData *
+LoadCurrentStripeData(TableReadState *readState) {
+    StripeData *stripeData = NULL;
+    StringInfo deletionBitmap = NULL;
+    MemoryContext oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
+
+    if (readState->stripeMetadata->deletedRowCount > 0) {
+        deletionBitmap = LoadDeletionBitmap(readState);
+    }
+
+    stripeData = LoadFilteredStripeData(readState->tableFile, readState->stripeMetadata,
+                                        readState->stripeFooter,
+                                        readState->stripeSkipList, deletionBitmap,
+                                        readState->tupleDescriptor,
+                                        readState->projectedColumnList,
+                                        readState->whereClauseList,
+                                        readState->shreddedColumnList,
+                                        readState->stripeReadBuffers);
+    stripeData->stripeIndex = readState->stripeIndex;
+
+    MemoryContextSwitchTo(oldContext);
+
+    return stripeData;
+}
+
+
+/*
+ * LoadDeletionBitmap reads the deleted row bitmap of the current stripe from
+ * the deletion file. We open the deletion file the first time we need it.
+ */
+static StringInfo
+LoadDeletionBitmap(TableReadState *readState) {
+    StripeMetadata *stripeMetadata = readState->stripeMetadata;
+
+    if (readState->deletionFile == NULL) {
+        readState->deletionFile = AllocateFile(readState->deletionFilename->data,
+                                               PG_BINARY_R);
+        if (readState->deletionFile == NULL) {
+            ereport(ERROR, (errcode_for_file_access(),
+                    errmsg("could not open file \"%s\" for reading: %m",
+                           readState->deletionFilename->data)));
+        }
+    }
+
+    return ReadFromFile(readState->deletionFile, stripeMetadata->deletionBitmapOffset,
+                        stripeMetadata->deletionBitmapLength);
+}
+
+
+/*
+ * LoadFilteredStripeData reads and decompresses stripe data from the given file,
+ * using the stripe's already loaded footer and skip list. The function skips
+ * over blocks whose rows are refuted by restriction qualifiers, and only loads
+ * columns that are projected in the query. Column data are loaded into the
+ * given stripe read buffers, overwriting the previous stripe's data.
+ *
+ * Restriction clauses that compare a column with a constant are also evaluated
+ * on the distinct values of dictionary-encoded blocks, and text equality and
+ * simple LIKE clauses on the values of all blocks. We load these clauses'
+ * columns first, skip the remaining columns of blocks that have no matching
+ * rows, and leave out the other non-matching rows along with deleted rows. The
+ * executor checks the remaining clauses on the rows we return. Shredded columns
+ * in the given list are only read for filtering, and aren't part of the
+ * returned stripe data's columns.
  */
 static StripeData *
 LoadFilteredStripeData(FILE *tableFile, StripeMetadata *stripeMetadata,
+                       StripeFooter *stripeFooter, StripeSkipList *stripeSkipList,
+                       StringInfo deletionBitmap,
                        TupleDesc tupleDescriptor, List *projectedColumnList,
-                       List *whereClauseList) {
+                       List *whereClauseList, List *shreddedColumnList,
+                       StripeReadBuffers *stripeReadBuffers) {
     StripeData *stripeData = NULL;
-    ColumnData **columnDataArray = NULL;
+    uint64 *columnFileOffsetArray = NULL;
     uint64 currentColumnFileOffset = 0;
     uint32 columnIndex = 0;
+    uint32 blockIndex = 0;
+    uint32 stripeColumnIndex = 0;
+    uint32 stripeColumnCount = stripeFooter->columnCount;
+    uint32 blockRowCount = stripeReadBuffers->blockRowCount;
     Form_pg_attribute *attributeFormArray = tupleDescriptor->attrs;
     uint32 columnCount = tupleDescriptor->natts;
+    List *columnFilterList = NIL;
+    ListCell *columnFilterCell = NULL;
+    bool *filterColumnMask = NULL;
+    bool *selectedRowMask = NULL;
+
+    bool *projectedColumnMask = ProjectedColumnMask(columnCount, projectedColumnList);
+    bool *selectedBlockMask = SelectedBlockMask(stripeSkipList, projectedColumnList,
+                                                whereClauseList);
+
+    StripeSkipList *selectedBlockSkipList = SelectedBlockSkipList(stripeSkipList,
+                                                                  selectedBlockMask);
+
+    /* block arrays in read buffers only have room for blockRowCount rows */
+    for (blockIndex = 0; blockIndex < selectedBlockSkipList->blockCount; blockIndex++) {
+        ColumnBlockSkipNode *blockSkipNode =
+                &selectedBlockSkipList->blockSkipNodeArray[0][blockIndex];
+        if (blockSkipNode->rowCount > blockRowCount) {
+            ereport(ERROR, (errmsg("block row count exceeds table's block row count")));
+        }
+    }
+
+    /* find where each stored column's data starts */
+    columnFileOffsetArray = palloc0(Max(stripeColumnCount, 1) * sizeof(uint64));
+    currentColumnFileOffset = stripeMetadata->fileOffset + stripeMetadata->skipListLength;
+
+    for (stripeColumnIndex = 0; stripeColumnIndex < stripeColumnCount; stripeColumnIndex++) {
+        columnFileOffsetArray[stripeColumnIndex] = currentColumnFileOffset;
+
+        currentColumnFileOffset += stripeFooter->existsSizeArray[stripeColumnIndex];
+        currentColumnFileOffset += stripeFooter->valueSizeArray[stripeColumnIndex];
+    }
+
+    /* load columns of column filters, and evaluate filters on their blocks */
+    filterColumnMask = palloc0(columnCount * sizeof(bool));
+    columnFilterList = ColumnFilterList(whereClauseList, tupleDescriptor,
+                                        projectedColumnMask, shreddedColumnList,
+                                        stripeFooter);
+
+    foreach(columnFilterCell, columnFilterList) {
+        ColumnFilter *columnFilter = lfirst(columnFilterCell);
+        columnIndex = columnFilter->columnIndex;
+
+        if (!filterColumnMask[columnIndex]) {
+            LoadStripeColumn(tableFile, stripeFooter, columnFileOffsetArray,
+                             selectedBlockSkipList, attributeFormArray[columnIndex],
+                             columnIndex, stripeReadBuffers, NULL);
+            filterColumnMask[columnIndex] = true;
+        }
+    }
+
+    if (columnFilterList != NIL && selectedBlockSkipList->blockCount > 0) {
+        ColumnData **columnDataArray = stripeReadBuffers->columnDataArray;
+        uint32 selectedBlockCount = selectedBlockSkipList->blockCount;
+        uint32 selectedBlockIndex = 0;
+        uint32 matchingBlockCount = 0;
+        bool *blockMatchArray = NULL;
+
+        selectedRowMask = palloc(selectedBlockCount * blockRowCount * sizeof(bool));
+        memset(selectedRowMask, true, selectedBlockCount * blockRowCount * sizeof(bool));
+
+        blockMatchArray = EvaluateColumnFilters(columnFilterList, columnDataArray,
+                                                selectedBlockSkipList, blockRowCount,
+                                                selectedRowMask);
+
+        /*
+         * Drop blocks without matching rows from the selection. Loaded blocks of
+         * filter columns and their row masks move down to stay in block order.
+         */
+        for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++) {
+            if (!selectedBlockMask[blockIndex]) {
+                continue;
+            }
+
+            if (!blockMatchArray[selectedBlockIndex]) {
+                selectedBlockMask[blockIndex] = false;
+                selectedBlockIndex++;
+                continue;
+            }
+
+            if (matchingBlockCount != selectedBlockIndex) {
+                for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
+                    ColumnBlockData **blockDataArray = NULL;
+                    ColumnBlockData *matchingBlockData = NULL;
+
+                    if (!filterColumnMask[columnIndex]) {
+                        continue;
+                    }
+
+                    blockDataArray = columnDataArray[columnIndex]->blockDataArray;
+                    matchingBlockData = blockDataArray[selectedBlockIndex];
+                    blockDataArray[selectedBlockIndex] = blockDataArray[matchingBlockCount];
+                    blockDataArray[matchingBlockCount] = matchingBlockData;
+                }
+
+                memcpy(selectedRowMask + matchingBlockCount * blockRowCount,
+                       selectedRowMask + selectedBlockIndex * blockRowCount,
+                       blockRowCount * sizeof(bool));
+            }
+
+            matchingBlockCount++;
+            selectedBlockIndex++;
+        }
+
+        if (matchingBlockCount != selectedBlockCount) {
+            selectedBlockSkipList = SelectedBlockSkipList(stripeSkipList,
+                                                          selectedBlockMask);
+        }
+    }
+
+    /*
+     * Load column data for the remaining projected columns. Out-of-line values
+     * of these columns are only read for rows that matched the column filters.
+     */
+    for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
+        if (!projectedColumnMask[columnIndex] || filterColumnMask[columnIndex]) {
+            continue;
+        }
+
+        LoadStripeColumn(tableFile, stripeFooter, columnFileOffsetArray,
+                         selectedBlockSkipList, attributeFormArray[columnIndex],
+                         columnIndex, stripeReadBuffers, selectedRowMask);
+    }
+
+    stripeData = palloc0(sizeof(StripeData));
+    stripeData->columnCount = columnCount - list_length(shreddedColumnList);
+    stripeData->rowCount = StripeSkipListRowCount(selectedBlockSkipList);
+    stripeData->columnDataArray = stripeReadBuffers->columnDataArray;
+    stripeData->stripeRowIndexArray = StripeRowIndexArray(stripeSkipList,
+                                                          selectedBlockMask,
+                                                          blockRowCount);
+
+    if (deletionBitmap != NULL || selectedRowMask != NULL) {
+        RemoveUnselectedRows(stripeData, projectedColumnMask, deletionBitmap,
+                             selectedRowMask, blockRowCount);
+    }
+
+    return stripeData;
+}
+
+
+/*
+ * StripeRowIndexArray returns the position within the stripe of each row in
+ * the selected blocks. All blocks but the last one of a stripe are full, so a
+ * block's rows start at the block index times the block row count.
+ */
+static uint32 *
+StripeRowIndexArray(StripeSkipList *stripeSkipList, bool *selectedBlockMask,
+                    uint32 blockRowCount) {
+    uint32 *stripeRowIndexArray = NULL;
+    uint32 selectedRowCount = 0;
+    uint32 rowIndex = 0;
+    uint32 blockIndex = 0;
+
+    for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++) {
+        if (selectedBlockMask[blockIndex]) {
+            selectedRowCount += stripeSkipList->blockSkipNodeArray[0][blockIndex].rowCount;
+        }
+    }
+
+    stripeRowIndexArray = palloc0(Max(selectedRowCount, 1) * sizeof(uint32));
+    for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++) {
+        uint32 blockRowIndex = 0;
+        uint32 rowCountInBlock = 0;
+
+        if (!selectedBlockMask[blockIndex]) {
+            continue;
+        }
+
+        rowCountInBlock = stripeSkipList->blockSkipNodeArray[0][blockIndex].rowCount;
+        for (blockRowIndex = 0; blockRowIndex < rowCountInBlock; blockRowIndex++) {
+            stripeRowIndexArray[rowIndex] = blockIndex * blockRowCount + blockRowIndex;
+            rowIndex++;
+        }
+    }
+
+    return stripeRowIndexArray;
+}
+
+
+/*
+ * ColumnFilterList walks over the given restriction clauses, and returns column
+ * filters for clauses that compare a projected variable-length column with a
+ * constant. Filters on json keys use the keys' shredded columns, and are left
+ * out for stripes written before the keys were shredded.
+ */
+static List *
+ColumnFilterList(List *whereClauseList, TupleDesc tupleDescriptor,
+                 bool *projectedColumnMask, List *shreddedColumnList,
+                 StripeFooter *stripeFooter) {
+    List *columnFilterList = NIL;
+    ListCell *whereClauseCell = NULL;
+    uint32 tableColumnCount = tupleDescriptor->natts - list_length(shreddedColumnList);
+
+    foreach(whereClauseCell, whereClauseList) {
+        Node *whereClause = lfirst(whereClauseCell);
+        ColumnFilter *columnFilter = BuildColumnFilter(whereClause);
+        uint32 columnIndex = 0;
+
+        if (columnFilter == NULL) {
+            continue;
+        }
+
+        columnIndex = columnFilter->columnIndex;
+        if (columnFilter->columnPath != NULL) {
+            int32 shreddedColumnIndex =
+                    ShreddedColumnPosition(shreddedColumnList, columnIndex + 1,
+                                           columnFilter->columnPath);
+            if (shreddedColumnIndex < 0) {
+                continue;
+            }
+
+            columnIndex = tableColumnCount + shreddedColumnIndex;
+            if (StripeColumnPosition(stripeFooter, columnIndex) < 0) {
+                continue;
+            }
+
+            columnFilter->columnIndex = columnIndex;
+        } else if (columnIndex >= tableColumnCount || !projectedColumnMask[columnIndex]) {
+            continue;
+        }
+
+        if (tupleDescriptor->attrs[columnIndex]->attlen >= 0) {
+            continue;
+        }
+
+        fmgr_info(columnFilter->functionId, &columnFilter->operatorFunction);
+        columnFilterList = lappend(columnFilterList, columnFilter);
+    }
+
+    return columnFilterList;
+}
+
+
+/*
+ * BuildColumnFilter returns a column filter for the given restriction clause if
+ * the clause compares a table column, or a json key extracted from one, with a
+ * non-null constant, and NULL otherwise. We only consider operators whose
+ * functions are immutable and strict, so that evaluating them once per distinct
+ * value is the same as evaluating them per row, and null rows never match.
+ */
+static ColumnFilter *
+BuildColumnFilter(Node *whereClause) {
+    OpExpr *operatorExpression = NULL;
+    Node *leftOperand = NULL;
+    Node *rightOperand = NULL;
+    Var *column = NULL;
+    Const *constant = NULL;
+    bool columnIsLeftOperand = false;
+    Oid functionId = InvalidOid;
+    char *columnPath = NULL;
+    ColumnFilter *columnFilter = NULL;
+
+    if (!IsA(whereClause, OpExpr)) {
+        return NULL;
+    }
+
+    operatorExpression = (OpExpr *) whereClause;
+    if (list_length(operatorExpression->args) != 2 ||
+        operatorExpression->opresulttype != BOOLOID) {
+        return NULL;
+    }
+
+    /* binary compatible casts, such as varchar to text, don't change values */
+    leftOperand = linitial(operatorExpression->args);
+    while (IsA(leftOperand, RelabelType)) {
+        leftOperand = (Node *) ((RelabelType *) leftOperand)->arg;
+    }
+
+    rightOperand = lsecond(operatorExpression->args);
+    while (IsA(rightOperand, RelabelType)) {
+        rightOperand = (Node *) ((RelabelType *) rightOperand)->arg;
+    }
+
+    if (IsA(rightOperand, Const)) {
+        column = FilterColumnOperand(leftOperand, &columnPath);
+        constant = (Const *) rightOperand;
+        columnIsLeftOperand = true;
+    } else if (IsA(leftOperand, Const)) {
+        column = FilterColumnOperand(rightOperand, &columnPath);
+        constant = (Const *) leftOperand;
+        columnIsLeftOperand = false;
+    }
+
+    if (column == NULL || constant->constisnull || column->varattno <= 0 ||
+        column->varlevelsup != 0) {
+        return NULL;
+    }
+
+    functionId = get_opcode(operatorExpression->opno);
+    if (!OidIsValid(functionId) || !func_strict(functionId) ||
+        func_volatile(functionId) != PROVOLATILE_IMMUTABLE) {
+        return NULL;
+    }
+
+    columnFilter = palloc0(sizeof(ColumnFilter));
+    columnFilter->columnIndex = column->varattno - 1;
+    columnFilter->columnPath = columnPath;
+    columnFilter->columnIsLeftOperand = columnIsLeftOperand;
+    columnFilter->constantValue = constant->constvalue;
+    columnFilter->collation = operatorExpression->inputcollid;
+    columnFilter->functionId = functionId;
+    columnFilter->stringFilter = BuildStringFilter(functionId, constant,
+                                                   columnIsLeftOperand,
+                                                   operatorExpression->inputcollid);
+
+    return columnFilter;
+}
+
+
+/*
+ * FilterColumnOperand returns the table column of the given operand if it is a
+ * column, or a top-level key extracted from a json or jsonb column with the ->>
+ * operator; and NULL otherwise. For keys, the function also sets the key.
+ */
+static Var *
+FilterColumnOperand(Node *operand, char **columnPath) {
+    OpExpr *operatorExpression = NULL;
+    Node *columnOperand = NULL;
+    Node *keyOperand = NULL;
+    Const *keyConstant = NULL;
+    Oid functionId = InvalidOid;
+
+    *columnPath = NULL;
+
+    if (IsA(operand, Var)) {
+        return (Var *) operand;
+    } else if (!IsA(operand, OpExpr)) {
+        return NULL;
+    }
+
+    operatorExpression = (OpExpr *) operand;
+    functionId = get_opcode(operatorExpression->opno);
+    if ((functionId != F_JSON_OBJECT_FIELD_TEXT &&
+         functionId != F_JSONB_OBJECT_FIELD_TEXT) ||
+        list_length(operatorExpression->args) != 2) {
+        return NULL;
+    }
+
+    columnOperand = linitial(operatorExpression->args);
+    keyOperand = lsecond(operatorExpression->args);
+    if (!IsA(columnOperand, Var) || !IsA(keyOperand, Const)) {
+        return NULL;
+    }
+
+    keyConstant = (Const *) keyOperand;
+    if (keyConstant->constisnull || keyConstant->consttype != TEXTOID) {
+        return NULL;
+    }
+
+    *columnPath = TextDatumGetCString(keyConstant->constvalue);
+
+    return (Var *) columnOperand;
+}
+
+
+/*
+ * ShreddedFilterColumnList returns the distinct json keys that the given
+ * restriction clauses compare with constants. Scans read these keys' shredded
+ * columns, if stripes have them.
+ */
+static List *
+ShreddedFilterColumnList(List *whereClauseList) {
+    List *shreddedColumnList = NIL;
+    ListCell *whereClauseCell = NULL;
+
+    foreach(whereClauseCell, whereClauseList) {
+        Node *whereClause = lfirst(whereClauseCell);
+        ColumnFilter *columnFilter = BuildColumnFilter(whereClause);
+        ShreddedColumn *shreddedColumn = NULL;
+        AttrNumber attributeNumber = 0;
+
+        if (columnFilter == NULL || columnFilter->columnPath == NULL) {
+            continue;
+        }
+
+        attributeNumber = (AttrNumber) (columnFilter->columnIndex + 1);
+        if (ShreddedColumnPosition(shreddedColumnList, attributeNumber,
+                                   columnFilter->columnPath) >= 0) {
+            continue;
+        }
+
+        shreddedColumn = palloc0(sizeof(ShreddedColumn));
+        shreddedColumn->attributeNumber = attributeNumber;
+        shreddedColumn->path = columnFilter->columnPath;
+
+        shreddedColumnList = lappend(shreddedColumnList, shreddedColumn);
+    }
+
+    return shreddedColumnList;
+}
+
+
+/*
+ * ShreddedColumnPosition returns the position of the given column's json key in
+ * the shredded column list, or -1 if the list doesn't have the key.
+ */
+static int32
+ShreddedColumnPosition(List *shreddedColumnList, AttrNumber attributeNumber,
+                       const char *path) {
+    ListCell *shreddedColumnCell = NULL;
+    int32 shreddedColumnIndex = 0;
+
+    foreach(shreddedColumnCell, shreddedColumnList) {
+        ShreddedColumn *shreddedColumn = lfirst(shreddedColumnCell);
+        if (shreddedColumn->attributeNumber == attributeNumber &&
+            strcmp(shreddedColumn->path, path) == 0) {
+            return shreddedColumnIndex;
+        }
+
+        shreddedColumnIndex++;
+    }
+
+    return -1;
+}
+
+
+/*
+ * BuildStringFilter returns a string filter for the given text function and
+ * constant, or NULL if we can't evaluate them by comparing bytes. Text equality
+ * is always bytewise. Ordering comparisons are bytewise only for the C and
+ * POSIX collations. LIKE patterns match characters bytewise only in single-byte
+ * encodings and in UTF8, where no character's encoding appears within
+ * another's; and we leave patterns with underscores, escapes, or percent signs
+ * between other characters to the operator.
+ */
+static StringFilter *
+BuildStringFilter(Oid functionId, Const *constant, bool columnIsLeftOperand,
+                  Oid collation) {
+    StringFilter *stringFilter = NULL;
+    StringFilterKind filterKind = STRING_FILTER_EQUAL;
+    bool negated = false;
+    text *constantText = NULL;
+    const char *pattern = NULL;
+    uint32 patternLength = 0;
+    uint32 patternStart = 0;
+    uint32 patternEnd = 0;
+    uint32 patternIndex = 0;
+
+    switch (functionId) {
+        case F_TEXTEQ:
+            filterKind = STRING_FILTER_EQUAL;
+            break;
+        case F_TEXTNE:
+            filterKind = STRING_FILTER_EQUAL;
+            negated = true;
+            break;
+        case F_TEXT_LT:
+            filterKind = STRING_FILTER_LESS;
+            break;
+        case F_TEXT_LE:
+            filterKind = STRING_FILTER_LESS_EQUAL;
+            break;
+        case F_TEXT_GT:
+            filterKind = STRING_FILTER_GREATER;
+            break;
+        case F_TEXT_GE:
+            filterKind = STRING_FILTER_GREATER_EQUAL;
+            break;
+        case F_TEXTLIKE:
+            filterKind = STRING_FILTER_LIKE;
+            break;
+        case F_TEXTNLIKE:
+            filterKind = STRING_FILTER_LIKE;
+            negated = true;
+            break;
+        default:
+            return NULL;
+    }
+
+    if (filterKind >= STRING_FILTER_LESS && filterKind <= STRING_FILTER_GREATER_EQUAL) {
+        if (!OidIsValid(collation) || !lc_collate_is_c(collation)) {
+            return NULL;
+        }
+
+        /* a constant on the left flips the comparison, as in 'm' < column */
+        if (!columnIsLeftOperand) {
+            switch (filterKind) {
+                case STRING_FILTER_LESS:
+                    filterKind = STRING_FILTER_GREATER;
+                    break;
+                case STRING_FILTER_LESS_EQUAL:
+                    filterKind = STRING_FILTER_GREATER_EQUAL;
+                    break;
+                case STRING_FILTER_GREATER:
+                    filterKind = STRING_FILTER_LESS;
+                    break;
+                default:
+                    filterKind = STRING_FILTER_LESS_EQUAL;
+                    break;
+            }
+        }
+    }
+
+    if (filterKind == STRING_FILTER_LIKE) {
+        if (pg_database_encoding_max_length() != 1 && GetDatabaseEncoding() != PG_UTF8) {
+            return NULL;
+        }
+
+        /* LIKE patterns are always the right operand */
+        if (!columnIsLeftOperand) {
+            return NULL;
+        }
+    }
+
+    constantText = DatumGetTextPP(constant->constvalue);
+    pattern = VARDATA_ANY(constantText);
+    patternLength = VARSIZE_ANY_EXHDR(constantText);
+
+    if (filterKind == STRING_FILTER_LIKE) {
+        patternEnd = patternLength;
+        while (patternStart < patternEnd && pattern[patternStart] == '%') {
+            patternStart++;
+        }
+
+        while (patternEnd > patternStart && pattern[patternEnd - 1] == '%') {
+            patternEnd--;
+        }
+
+        for (patternIndex = patternStart; patternIndex < patternEnd; patternIndex++) {
+            char patternChar = pattern[patternIndex];
+            if (patternChar == '%' || patternChar == '_' || patternChar == '\\') {
+                return NULL;
+            }
+        }
+
+        if (patternStart > 0 && patternEnd < patternLength) {
+            filterKind = STRING_FILTER_CONTAINS;
+        } else if (patternStart > 0) {
+            filterKind = STRING_FILTER_SUFFIX;
+        } else if (patternEnd < patternLength) {
+            filterKind = STRING_FILTER_PREFIX;
+        } else {
+            filterKind = STRING_FILTER_EQUAL;
+        }
+
+        pattern += patternStart;
+        patternLength = patternEnd - patternStart;
+    }
+
+    stringFilter = palloc0(sizeof(StringFilter));
+    stringFilter->filterKind = filterKind;
+    stringFilter->negated = negated;
+    stringFilter->pattern = pattern;
+    stringFilter->patternLength = patternLength;
+
+    return stringFilter;
+}
+
+
+/*
+ * StringFilterClause checks if scans evaluate the given restriction clause on
+ * every row they return, so that the executor doesn't need to check it again.
+ * Stripes written before a json key was shredded don't have the key's column,
+ * so the executor still checks clauses on json keys.
+ */
+bool
+StringFilterClause(Node *whereClause) {
+    ColumnFilter *columnFilter = BuildColumnFilter(whereClause);
+
+    return (columnFilter != NULL && columnFilter->stringFilter != NULL &&
+            columnFilter->columnPath == NULL);
+}
+
+
+/*
+ * EvaluateColumnFilters evaluates the given column filters on the loaded blocks
+ * of the selected block skip list, and clears rows that don't match in the
+ * selected row mask. For dictionary-encoded blocks, a filter is evaluated once
+ * per distinct value, and rows are then matched by their codes. String filters
+ * are also evaluated on the rows of other blocks, by comparing value bytes in
+ * place; other filters are left to the executor on these blocks. The function
+ * returns for each block whether any of its rows may still match.
+ */
+static bool *
+EvaluateColumnFilters(List *columnFilterList, ColumnData **columnDataArray,
+                      StripeSkipList *selectedBlockSkipList, uint32 blockRowCount,
+                      bool *selectedRowMask) {
+    uint32 blockCount = selectedBlockSkipList->blockCount;
+    bool *blockMatchArray = palloc0(blockCount * sizeof(bool));
+    bool *entryMatchArray = palloc0(blockRowCount * sizeof(bool));
+    uint32 blockIndex = 0;
+
+    for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        uint32 rowCount = selectedBlockSkipList->blockSkipNodeArray[0][blockIndex].rowCount;
+        bool *blockRowMask = selectedRowMask + blockIndex * blockRowCount;
+        bool blockMatches = true;
+        ListCell *columnFilterCell = NULL;
+        uint32 rowIndex = 0;
+
+        foreach(columnFilterCell, columnFilterList) {
+            ColumnFilter *columnFilter = lfirst(columnFilterCell);
+            uint32 columnIndex = columnFilter->columnIndex;
+            ColumnBlockData *blockData =
+                    columnDataArray[columnIndex]->blockDataArray[blockIndex];
+            ColumnBlockSkipNode *blockSkipNode =
+                    &selectedBlockSkipList->blockSkipNodeArray[columnIndex][blockIndex];
+            uint16 *codeArray = blockData->dictionaryCodeArray;
+            bool *existsArray = blockData->existsArray;
+            Datum *valueArray = blockData->valueArray;
+            bool entryMatches = false;
+            uint32 entryIndex = 0;
+
+            /* strict operators never match blocks with only nulls */
+            if (blockSkipNode->hasNonNullCount && blockSkipNode->nonNullCount == 0) {
+                blockMatches = false;
+                break;
+            }
+
+            if (codeArray == NULL) {
+                if (columnFilter->stringFilter == NULL) {
+                    continue;
+                }
+
+                for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+                    if (blockRowMask[rowIndex]) {
+                        blockRowMask[rowIndex] =
+                                existsArray[rowIndex] &&
+                                ColumnFilterMatches(columnFilter, valueArray[rowIndex]);
+                    }
+                }
+
+                continue;
+            }
+
+            for (entryIndex = 0; entryIndex < blockData->dictionaryEntryCount;
+                 entryIndex++) {
+                Datum entryValue = blockData->dictionaryEntryArray[entryIndex];
+
+                entryMatchArray[entryIndex] = ColumnFilterMatches(columnFilter,
+                                                                  entryValue);
+                entryMatches |= entryMatchArray[entryIndex];
+            }
+
+            if (!entryMatches) {
+                blockMatches = false;
+                break;
+            }
+
+            for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+                blockRowMask[rowIndex] &= existsArray[rowIndex] &
+                                          entryMatchArray[codeArray[rowIndex]];
+            }
+        }
+
+        if (blockMatches) {
+            blockMatches = false;
+            for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+                blockMatches |= blockRowMask[rowIndex];
+            }
+        }
+
+        blockMatchArray[blockIndex] = blockMatches;
+    }
+
+    return blockMatchArray;
+}
+
+
+/*
+ * ColumnFilterMatches evaluates the given column filter on a non-null column
+ * value. String filters compare the value's bytes directly, unless the value is
+ * compressed or stored out of line; other filters call the clause's operator.
+ */
+static bool
+ColumnFilterMatches(ColumnFilter *columnFilter, Datum columnValue) {
+    Pointer valuePointer = DatumGetPointer(columnValue);
+    Datum leftValue = columnValue;
+    Datum rightValue = columnFilter->constantValue;
+
+    if (columnFilter->stringFilter != NULL &&
+        (VARATT_IS_SHORT(valuePointer) || !VARATT_IS_EXTENDED(valuePointer))) {
+        StringFilter *stringFilter = columnFilter->stringFilter;
+        bool valueMatches = StringFilterMatches(stringFilter, VARDATA_ANY(valuePointer),
+                                                VARSIZE_ANY_EXHDR(valuePointer));
+
+        return (valueMatches != stringFilter->negated);
+    }
+
+    if (!columnFilter->columnIsLeftOperand) {
+        leftValue = columnFilter->constantValue;
+        rightValue = columnValue;
+    }
+
+    return DatumGetBool(FunctionCall2Coll(&columnFilter->operatorFunction,
+                                          columnFilter->collation,
+                                          leftValue, rightValue));
+}
+
+
+/*
+ * StringFilterMatches checks if the given value matches the string filter's
+ * pattern. Ordering comparisons compare bytes the way the C collation does,
+ * with shorter values sorting first when one value is a prefix of the other.
+ * Substring matches use memchr to find candidate positions of the pattern's
+ * first byte, and memcmp to check the rest of the pattern; both scan many
+ * bytes at a time in the C library.
+ */
+static bool
+StringFilterMatches(StringFilter *stringFilter, const char *value,
+                    uint32 valueLength) {
+    const char *pattern = stringFilter->pattern;
+    uint32 patternLength = stringFilter->patternLength;
+    const char *candidate = value;
+    const char *lastCandidate = NULL;
+    bool valueMatches = false;
+    int comparison = 0;
+
+    if (stringFilter->filterKind >= STRING_FILTER_LESS) {
+        comparison = memcmp(value, pattern, Min(valueLength, patternLength));
+        if (comparison == 0 && valueLength != patternLength) {
+            comparison = (valueLength < patternLength) ? -1 : 1;
+        }
+    } else if (valueLength < patternLength) {
+        return false;
+    }
+
+    switch (stringFilter->filterKind) {
+        case STRING_FILTER_EQUAL:
+            valueMatches = (valueLength == patternLength &&
+                            memcmp(value, pattern, patternLength) == 0);
+            break;
+        case STRING_FILTER_PREFIX:
+            valueMatches = (memcmp(value, pattern, patternLength) == 0);
+            break;
+        case STRING_FILTER_SUFFIX:
+            valueMatches = (memcmp(value + valueLength - patternLength, pattern,
+                                   patternLength) == 0);
+            break;
+        case STRING_FILTER_CONTAINS:
+            lastCandidate = value + valueLength - patternLength;
+            valueMatches = (patternLength == 0);
+            while (!valueMatches && candidate <= lastCandidate) {
+                candidate = memchr(candidate, pattern[0], lastCandidate - candidate + 1);
+                if (candidate == NULL) {
+                    break;
+                }
+
+                valueMatches = (memcmp(candidate + 1, pattern + 1,
+                                       patternLength - 1) == 0);
+                candidate++;
+            }
+            break;
+        case STRING_FILTER_LESS:
+            valueMatches = (comparison < 0);
+            break;
+        case STRING_FILTER_LESS_EQUAL:
+            valueMatches = (comparison <= 0);
+            break;
+        case STRING_FILTER_GREATER:
+            valueMatches = (comparison > 0);
+            break;
+        case STRING_FILTER_GREATER_EQUAL:
+            valueMatches = (comparison >= 0);
+            break;
+        case STRING_FILTER_LIKE:
+            break;
+    }
+
+    return valueMatches;
+}
+
+
+/*
+ * RemoveUnselectedRows applies the stripe's deletion bitmap and the given row
+ * mask to the loaded stripe; either of them may be NULL. The function moves
+ * rows that are not deleted and are selected towards the start of the stripe,
+ * so that readers and vectorized transition functions can keep going over the
+ * stripe's rows as before, and only see these rows.
+ */
+static void
+RemoveUnselectedRows(StripeData *stripeData, bool *projectedColumnMask,
+                     StringInfo deletionBitmap, bool *selectedRowMask,
+                     uint32 blockRowCount) {
+    uint32 rowIndex = 0;
+    uint32 liveRowCount = 0;
+    uint32 columnIndex = 0;
+
+    for (rowIndex = 0; rowIndex < stripeData->rowCount; rowIndex++) {
+        uint32 stripeRowIndex = stripeData->stripeRowIndexArray[rowIndex];
+
+        if (deletionBitmap != NULL && RowDeleted(deletionBitmap, stripeRowIndex)) {
+            continue;
+        }
+
+        if (selectedRowMask != NULL && !selectedRowMask[rowIndex]) {
+            continue;
+        }
+
+        if (liveRowCount != rowIndex) {
+            for (columnIndex = 0; columnIndex < stripeData->columnCount; columnIndex++) {
+                ColumnData *columnData = NULL;
+                ColumnBlockData *sourceBlockData = NULL;
+                ColumnBlockData *targetBlockData = NULL;
+                uint32 sourceRowIndex = rowIndex % blockRowCount;
+                uint32 targetRowIndex = liveRowCount % blockRowCount;
+
+                if (!projectedColumnMask[columnIndex]) {
+                    continue;
+                }
+
+                columnData = stripeData->columnDataArray[columnIndex];
+                sourceBlockData = columnData->blockDataArray[rowIndex / blockRowCount];
+                targetBlockData = columnData->blockDataArray[liveRowCount / blockRowCount];
+
+                targetBlockData->existsArray[targetRowIndex] =
+                        sourceBlockData->existsArray[sourceRowIndex];
+                targetBlockData->valueArray[targetRowIndex] =
+                        sourceBlockData->valueArray[sourceRowIndex];
+            }
+
+            stripeData->stripeRowIndexArray[liveRowCount] = stripeRowIndex;
+        }
+
+        liveRowCount++;
+    }
+
+    stripeData->rowCount = liveRowCount;
+}
+
+
+/* RowDeleted checks if the given stripe row is marked in the deletion bitmap. */
+static bool
+RowDeleted(StringInfo deletionBitmap, uint32 stripeRowIndex) {
+    uint32 byteIndex = stripeRowIndex / 8;
+    uint32 bitIndex = stripeRowIndex % 8;
+
+    if (byteIndex >= (uint32) deletionBitmap->len) {
+        return false;
+    }
+
+    return (deletionBitmap->data[byteIndex] & (1 << bitIndex)) != 0;
+}
+
+
+/*
+ * ReadStripeNextRow reads the next row from the given stripe, finds the projected
+ * column values within this row, and accordingly sets the column values and nulls.
+ * Note that this function sets the values for all non-projected columns to null.
+ */
+static void
+ReadStripeNextRow(StripeData *stripeData, List *projectedColumnList,
+                  uint64 blockIndex, uint64 blockRowIndex,
+                  Datum *columnValues, bool *columnNulls) {
+    ListCell *projectedColumnCell = NULL;
+
+    /* set all columns to null by default */
+    memset(columnNulls, 1, stripeData->columnCount * sizeof(bool));
+
+    foreach(projectedColumnCell, projectedColumnList) {
+        Var *projectedColumn = lfirst(projectedColumnCell);
+        uint32 projectedColumnIndex = projectedColumn->varattno - 1;
+        ColumnData *columnData = stripeData->columnDataArray[projectedColumnIndex];
+        ColumnBlockData *blockData = columnData->blockDataArray[blockIndex];
+
+        if (blockData->existsArray[blockRowIndex]) {
+            columnValues[projectedColumnIndex] = blockData->valueArray[blockRowIndex];
+            columnNulls[projectedColumnIndex] = false;
+        }
+    }
+}
+
+
+/*
+ * LoadStripeColumn loads the given column's data for blocks of the selected
+ * block skip list into the stripe read buffers. Columns added after the stripe
+ * was written are read as all nulls. If a selected row mask is given, we only
+ * read out-of-line values of the selected rows.
+ */
+static void
+LoadStripeColumn(FILE *tableFile, StripeFooter *stripeFooter,
+                 uint64 *columnFileOffsetArray, StripeSkipList *selectedBlockSkipList,
+                 Form_pg_attribute attributeForm, uint32 columnIndex,
+                 StripeReadBuffers *stripeReadBuffers, bool *selectedRowMask) {
+    ColumnBlockSkipNode *blockSkipNode =
+            selectedBlockSkipList->blockSkipNodeArray[columnIndex];
+    uint32 blockCount = selectedBlockSkipList->blockCount;
+    ColumnData *columnData = ReserveColumnData(stripeReadBuffers, columnIndex,
+                                               blockCount);
+    int32 stripeColumnPosition = StripeColumnPosition(stripeFooter, columnIndex);
+    uint64 existsFileOffset = 0;
+    uint64 valueFileOffset = 0;
+
+    if (stripeColumnPosition < 0) {
+        LoadMissingColumnData(blockSkipNode, blockCount, columnData);
+        return;
+    }
+
+    existsFileOffset = columnFileOffsetArray[stripeColumnPosition];
+    valueFileOffset = existsFileOffset +
+                      stripeFooter->existsSizeArray[stripeColumnPosition];
+
+    LoadColumnData(tableFile, blockSkipNode, blockCount, existsFileOffset,
+                   valueFileOffset, attributeForm, columnData,
+                   stripeReadBuffers->readBuffer, selectedRowMask,
+                   stripeReadBuffers->blockRowCount);
+}
+
+
+/*
+ * LoadColumnData reads and decompresses column data from the given file into
+ * the given column data's reusable blocks. These column data are laid out as
+ * sequential blocks in the file; and block positions and lengths are retrieved
+ * from the column block skip node array. The selected row mask, if any, has
+ * blockRowCount entries for each block.
+ */
+static void
+LoadColumnData(FILE *tableFile, ColumnBlockSkipNode *blockSkipNodeArray,
+               uint32 blockCount, uint64 existsFileOffset, uint64 valueFileOffset,
+               Form_pg_attribute attributeForm, ColumnData *columnData,
+               StringInfo readBuffer, bool *selectedRowMask, uint32 blockRowCount) {
+    uint32 blockIndex = 0;
+    const bool typeByValue = attributeForm->attbyval;
+    const int typeLength = attributeForm->attlen;
+    const char typeAlign = attributeForm->attalign;
+    ColumnBlockData **blockDataArray = columnData->blockDataArray;
+
+    /*
+     * We first read the "exists" blocks. We don't read "values" array here,
+     * because "exists" blocks are stored sequentially on disk, and we want to
+     * minimize disk seeks.
+     */
+    for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+        uint32 rowCount = blockSkipNode->rowCount;
+        uint64 existsOffset = existsFileOffset + blockSkipNode->existsBlockOffset;
+
+        /*
+         * Blocks without nulls or with only nulls don't have an "exists" block,
+         * and their non-null count tells which case they are.
+         */
+        if (blockSkipNode->existsLength == 0) {
+            bool valuesExist = (blockSkipNode->hasNonNullCount &&
+                                blockSkipNode->nonNullCount > 0);
+
+            memset(blockDataArray[blockIndex]->existsArray, valuesExist,
+                   rowCount * sizeof(bool));
+            continue;
+        }
+
+        ReadFromFileIntoBuffer(tableFile, existsOffset, blockSkipNode->existsLength,
+                               readBuffer);
+        DeserializeBoolArray(readBuffer, blockDataArray[blockIndex]->existsArray,
+                             rowCount);
+    }
+
+    /* then read "values" blocks, which are also stored sequentially on disk */
+    for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+        ColumnBlockData *blockData = blockDataArray[blockIndex];
+        uint32 rowCount = blockSkipNode->rowCount;
+        uint64 valueOffset = valueFileOffset + blockSkipNode->valueBlockOffset;
+        CompressionType compressionType = blockSkipNode->valueCompressionType;
 
-    StripeFooter *stripeFooter = LoadStripeFooter(tableFile, stripeMetadata,
-                                                  columnCount);
-    StripeSkipList *stripeSkipList = LoadStripeSkipList(tableFile, stripeMetadata,
-                                                        stripeFooter, columnCount,
-                                                        attributeFormArray);
+        blockData->dictionaryCodeArray = NULL;
+        blockData->dictionaryEntryCount = 0;
 
-    bool *projectedColumnMask = ProjectedColumnMask(columnCount, projectedColumnList);
-    bool *selectedBlockMask = SelectedBlockMask(stripeSkipList, projectedColumnList,
-                                                whereClauseList);
+        /* blocks with only nulls have no values to read */
+        if (blockSkipNode->hasNonNullCount && blockSkipNode->nonNullCount == 0) {
+            continue;
+        }
 
-    StripeSkipList *selectedBlockSkipList = SelectedBlockSkipList(stripeSkipList,
-                                                                  selectedBlockMask);
+        /* uncompressed streams are read directly into the block's value buffer */
+        if (compressionType == COMPRESSION_NONE) {
+            ReadFromFileIntoBuffer(tableFile, valueOffset, blockSkipNode->valueLength,
+                                   blockData->valueBuffer);
+        } else {
+            ReadFromFileIntoBuffer(tableFile, valueOffset, blockSkipNode->valueLength,
+                                   readBuffer);
+            DecompressBuffer(readBuffer, compressionType, blockData->valueBuffer);
+        }
 
-    /* load column data for projected columns */
-    columnDataArray = palloc0(columnCount * sizeof(ColumnData *));
-    currentColumnFileOffset = stripeMetadata->fileOffset + stripeMetadata->skipListLength;
+        if (blockSkipNode->valueFormat == VALUE_FORMAT_DICTIONARY) {
+            DeserializeDictionaryDatumArray(blockData->valueBuffer, rowCount, blockData);
+        } else if (blockSkipNode->valueFormat == VALUE_FORMAT_OFFSETS) {
+            DeserializeOffsetDatumArray(blockData->valueBuffer, blockData->existsArray,
+                                        rowCount, blockData->valueArray);
 
-    for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
-        uint64 existsSize = stripeFooter->existsSizeArray[columnIndex];
-        uint64 valueSize = stripeFooter->valueSizeArray[columnIndex];
-        uint64 existsFileOffset = currentColumnFileOffset;
-        uint64 valueFileOffset = currentColumnFileOffset + existsSize;
+            if (blockSkipNode->blobLength > 0) {
+                bool *blockRowMask = NULL;
+                if (selectedRowMask != NULL) {
+                    blockRowMask = selectedRowMask + blockIndex * blockRowCount;
+                }
 
-        if (projectedColumnMask[columnIndex]) {
-            ColumnBlockSkipNode *blockSkipNode =
-                    selectedBlockSkipList->blockSkipNodeArray[columnIndex];
-            Form_pg_attribute attributeForm = attributeFormArray[columnIndex];
-            uint32 blockCount = selectedBlockSkipList->blockCount;
+                LoadBlobValues(tableFile, valueOffset + blockSkipNode->valueLength,
+                               blockData, rowCount, blockRowMask);
+            }
+        } else if (blockSkipNode->valueFormat == VALUE_FORMAT_PACKED) {
+            DeserializePackedDatumArray(blockData->valueBuffer, blockData->existsArray,
+                                        rowCount, typeByValue, typeLength, typeAlign,
+                                        blockData->valueArray,
+                                        blockData->alignedValueBuffer);
+        } else {
+            DeserializeDatumArray(blockData->valueBuffer, blockData->existsArray,
+                                  rowCount, typeByValue, typeLength, typeAlign,
+                                  blockData->valueArray);
+        }
+    }
+}
 
-            ColumnData *columnData = LoadColumnData(tableFile, blockSkipNode, blockCount,
-                                                    existsFileOffset, valueFileOffset,
-                                                    attributeForm);
 
-            columnDataArray[columnIndex] = columnData;
+/*
+ * LoadBlobValues reads the out-of-line values of the given block's rows from
+ * the block's blob area, and points the rows' values to them instead of to
+ * their blob references. If a row mask is given, we skip rows that it doesn't
+ * select; the caller removes these rows later. Blobs are read into the block's
+ * blob buffer, at offsets aligned for varlena headers.
+ */
+static void
+LoadBlobValues(FILE *tableFile, uint64 blobFileOffset, ColumnBlockData *blockData,
+               uint32 rowCount, bool *blockRowMask) {
+    uint32 *offsetArray = (uint32 *) blockData->valueBuffer->data;
+    StringInfo blobBuffer = blockData->blobBuffer;
+    uint64 blobBufferLength = 0;
+    uint32 rowIndex = 0;
+
+    /* first find how much room the blobs need, so the buffer doesn't move */
+    for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+        BlobReference blobReference;
+
+        if (!blockData->existsArray[rowIndex] ||
+            (offsetArray[rowIndex] & VALUE_OFFSET_BLOB) == 0 ||
+            (blockRowMask != NULL && !blockRowMask[rowIndex])) {
+            continue;
         }
 
-        currentColumnFileOffset += existsSize;
-        currentColumnFileOffset += valueSize;
+        memcpy(&blobReference, DatumGetPointer(blockData->valueArray[rowIndex]),
+               sizeof(BlobReference));
+        blobBufferLength += MAXALIGN(blobReference.blobLength);
     }
 
-    stripeData = palloc0(sizeof(StripeData));
-    stripeData->columnCount = columnCount;
-    stripeData->rowCount = StripeSkipListRowCount(selectedBlockSkipList);
-    stripeData->columnDataArray = columnDataArray;
+    if (blobBufferLength >= MaxAllocSize) {
+        ereport(ERROR, (errmsg("out-of-line values of block are too large")));
+    }
 
-    return stripeData;
+    resetStringInfo(blobBuffer);
+    enlargeStringInfo(blobBuffer, (int) blobBufferLength);
+
+    for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+        BlobReference blobReference;
+        char *blobPointer = blobBuffer->data + blobBuffer->len;
+
+        if (!blockData->existsArray[rowIndex] ||
+            (offsetArray[rowIndex] & VALUE_OFFSET_BLOB) == 0 ||
+            (blockRowMask != NULL && !blockRowMask[rowIndex])) {
+            continue;
+        }
+
+        memcpy(&blobReference, DatumGetPointer(blockData->valueArray[rowIndex]),
+               sizeof(BlobReference));
+        ReadFromFileIntoPointer(tableFile, blobFileOffset + blobReference.blobOffset,
+                                blobReference.blobLength, blobPointer);
+
+        blockData->valueArray[rowIndex] = PointerGetDatum(blobPointer);
+        blobBuffer->len += MAXALIGN(blobReference.blobLength);
+    }
 }
 
 
 /*
- * ReadStripeNextRow reads the next row from the given stripe, finds the projected
- * column values within this row, and accordingly sets the column values and nulls.
- * Note that this function sets the values for all non-projected columns to null.
+ * LoadMissingColumnData fills the given column data's blocks with nulls, for a
+ * column that doesn't exist in the stripe. The function doesn't do any I/O.
  */
 static void
-ReadStripeNextRow(StripeData *stripeData, List *projectedColumnList,
-                  uint64 blockIndex, uint64 blockRowIndex,
-                  Datum *columnValues, bool *columnNulls) {
-    ListCell *projectedColumnCell = NULL;
-
-    /* set all columns to null by default */
-    memset(columnNulls, 1, stripeData->columnCount * sizeof(bool));
+LoadMissingColumnData(ColumnBlockSkipNode *blockSkipNodeArray, uint32 blockCount,
+                      ColumnData *columnData) {
+    uint32 blockIndex = 0;
 
-    foreach(projectedColumnCell, projectedColumnList) {
-        Var *projectedColumn = lfirst(projectedColumnCell);
-        uint32 projectedColumnIndex = projectedColumn->varattno - 1;
-        ColumnData *columnData = stripeData->columnDataArray[projectedColumnIndex];
+    for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
         ColumnBlockData *blockData = columnData->blockDataArray[blockIndex];
+        uint32 rowCount = blockSkipNodeArray[blockIndex].rowCount;
 
-        if (blockData->existsArray[blockRowIndex]) {
-            columnValues[projectedColumnIndex] = blockData->valueArray[blockRowIndex];
-            columnNulls[projectedColumnIndex] = false;
-        }
+        memset(blockData->existsArray, false, rowCount * sizeof(bool));
+        blockData->dictionaryCodeArray = NULL;
+        blockData->dictionaryEntryCount = 0;
     }
 }
 
 
 /*
- * LoadColumnData reads and decompresses column data from the given file. These
- * column data are laid out as sequential blocks in the file; and block positions
- * and lengths are retrieved from the column block skip node array.
+ * CreateStripeReadBuffers creates empty stripe read buffers for the given column
+ * count. Column data and their blocks are created on demand by ReserveColumnData.
+ * Callers should switch to the memory context that will own these buffers.
+ */
+static StripeReadBuffers *
+CreateStripeReadBuffers(uint32 columnCount, uint32 blockRowCount) {
+    StripeReadBuffers *stripeReadBuffers = palloc0(sizeof(StripeReadBuffers));
+    stripeReadBuffers->bufferContext = CurrentMemoryContext;
+    stripeReadBuffers->columnCount = columnCount;
+    stripeReadBuffers->blockRowCount = blockRowCount;
+    stripeReadBuffers->blockCapacity = 0;
+    stripeReadBuffers->columnDataArray = palloc0(columnCount * sizeof(ColumnData *));
+    stripeReadBuffers->readBuffer = makeStringInfo();
+
+    return stripeReadBuffers;
+}
+
+
+/*
+ * ReserveColumnData returns the reusable column data for the given column, and
+ * makes sure that it has blocks for at least the given block count. Slot arrays
+ * are grown by doubling, and each new block gets arrays for blockRowCount rows.
+ * Blocks that already exist are returned as-is, and are overwritten by the
+ * caller.
  */
 static ColumnData *
-LoadColumnData(FILE *tableFile, ColumnBlockSkipNode *blockSkipNodeArray,
-               uint32 blockCount, uint64 existsFileOffset, uint64 valueFileOffset,
-               Form_pg_attribute attributeForm) {
+ReserveColumnData(StripeReadBuffers *stripeReadBuffers, uint32 columnIndex,
+                  uint32 blockCount) {
     ColumnData *columnData = NULL;
     uint32 blockIndex = 0;
-    const bool typeByValue = attributeForm->attbyval;
-    const int typeLength = attributeForm->attlen;
-    const char typeAlign = attributeForm->attalign;
+    uint32 blockRowCount = stripeReadBuffers->blockRowCount;
+    MemoryContext oldContext = MemoryContextSwitchTo(stripeReadBuffers->bufferContext);
 
-    ColumnBlockData **blockDataArray = palloc0(blockCount * sizeof(ColumnBlockData *));
-    for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
-        blockDataArray[blockIndex] = palloc0(sizeof(ColumnBlockData));
+    if (blockCount > stripeReadBuffers->blockCapacity) {
+        uint32 oldBlockCapacity = stripeReadBuffers->blockCapacity;
+        uint32 newBlockCapacity = Max(oldBlockCapacity * 2, blockCount);
+        uint32 existingColumnIndex = 0;
+
+        for (existingColumnIndex = 0; existingColumnIndex < stripeReadBuffers->columnCount;
+             existingColumnIndex++) {
+            ColumnData *existingColumnData =
+                    stripeReadBuffers->columnDataArray[existingColumnIndex];
+            ColumnBlockData **blockDataArray = NULL;
+
+            if (existingColumnData == NULL) {
+                continue;
+            }
+
+            blockDataArray = repalloc(existingColumnData->blockDataArray,
+                                      newBlockCapacity * sizeof(ColumnBlockData *));
+            memset(blockDataArray + oldBlockCapacity, 0,
+                   (newBlockCapacity - oldBlockCapacity) * sizeof(ColumnBlockData *));
+
+            existingColumnData->blockDataArray = blockDataArray;
+        }
+
+        stripeReadBuffers->blockCapacity = newBlockCapacity;
     }
 
-    /*
-     * We first read the "exists" blocks. We don't read "values" array here,
-     * because "exists" blocks are stored sequentially on disk, and we want to
-     * minimize disk seeks.
-     */
-    for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
-        ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
-        uint32 rowCount = blockSkipNode->rowCount;
-        uint64 existsOffset = existsFileOffset + blockSkipNode->existsBlockOffset;
-        StringInfo rawExistsBuffer = ReadFromFile(tableFile, existsOffset,
-                                                  blockSkipNode->existsLength);
+    columnData = stripeReadBuffers->columnDataArray[columnIndex];
+    if (columnData == NULL) {
+        uint32 blockCapacity = Max(stripeReadBuffers->blockCapacity, 1);
+
+        columnData = palloc0(sizeof(ColumnData));
+        columnData->blockDataArray = palloc0(blockCapacity * sizeof(ColumnBlockData *));
 
-        bool *existsArray = DeserializeBoolArray(rawExistsBuffer, rowCount);
-        blockDataArray[blockIndex]->existsArray = existsArray;
+        stripeReadBuffers->columnDataArray[columnIndex] = columnData;
     }
 
-    /* then read "values" blocks, which are also stored sequentially on disk */
     for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
-        ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
-        uint32 rowCount = blockSkipNode->rowCount;
-        bool *existsArray = blockDataArray[blockIndex]->existsArray;
-        uint64 valueOffset = valueFileOffset + blockSkipNode->valueBlockOffset;
-        StringInfo rawValueBuffer = ReadFromFile(tableFile, valueOffset,
-                                                 blockSkipNode->valueLength);
-        StringInfo valueBuffer = DecompressBuffer(rawValueBuffer,
-                                                  blockSkipNode->valueCompressionType);
-
-        Datum *valueArray = DeserializeDatumArray(valueBuffer, existsArray,
-                                                  rowCount, typeByValue, typeLength,
-                                                  typeAlign);
-        blockDataArray[blockIndex]->valueArray = valueArray;
+        if (columnData->blockDataArray[blockIndex] == NULL) {
+            ColumnBlockData *blockData = palloc0(sizeof(ColumnBlockData));
+            blockData->existsArray = palloc0(blockRowCount * sizeof(bool));
+            blockData->valueArray = palloc0(blockRowCount * sizeof(Datum));
+            blockData->valueBuffer = makeStringInfo();
+            blockData->alignedValueBuffer = makeStringInfo();
+            blockData->blobBuffer = makeStringInfo();
+            blockData->dictionaryEntryArray = palloc0(blockRowCount * sizeof(Datum));
+
+            columnData->blockDataArray[blockIndex] = blockData;
+        }
     }
 
-    columnData = palloc0(sizeof(ColumnData));
-    columnData->blockDataArray = blockDataArray;
+    MemoryContextSwitchTo(oldContext);
 
     return columnData;
 }
 
 
-/* Reads and returns the given stripe's footer. */
+/*
+ * Reads and returns the given stripe's footer. Stripes may store fewer columns
+ * than the table has, but never columns the table doesn't have.
+ */
 static StripeFooter *
 LoadStripeFooter(FILE *tableFile, StripeMetadata *stripeMetadata,
-                 uint32 columnCount) {
+                 uint32 columnCount, List *shreddedColumnList) {
     StripeFooter *stripeFooter = NULL;
     StringInfo footerBuffer = NULL;
     uint64 footerOffset = 0;
+    uint32 stripeColumnIndex = 0;
 
     footerOffset += stripeMetadata->fileOffset;
     footerOffset += stripeMetadata->skipListLength;
@@ -455,16 +1880,44 @@ LoadStripeFooter(FILE *tableFile, StripeMetadata *stripeMetadata,
 
     footerBuffer = ReadFromFile(tableFile, footerOffset, stripeMetadata->footerLength);
     stripeFooter = DeserializeStripeFooter(footerBuffer);
-    if (stripeFooter->columnCount != columnCount) {
-        ereport(ERROR, (errmsg("stripe footer column count and table column count "
-                               "don't match")));
+    for (stripeColumnIndex = 0; stripeColumnIndex < stripeFooter->columnCount;
+         stripeColumnIndex++) {
+        uint32 columnId = stripeFooter->columnIdArray[stripeColumnIndex];
+        char *columnPath = stripeFooter->columnPathArray[stripeColumnIndex];
+        int32 shreddedColumnIndex = 0;
+
+        if (columnId == 0 || columnId > columnCount) {
+            ereport(ERROR, (errmsg("stripe footer column ids and table columns "
+                                   "don't match")));
+        }
+
+        if (columnPath == NULL) {
+            continue;
+        }
+
+        /*
+         * Shredded columns we read go after the table's columns. We give other
+         * shredded columns an id that no column has.
+         */
+        shreddedColumnIndex = ShreddedColumnPosition(shreddedColumnList, columnId,
+                                                     columnPath);
+        if (shreddedColumnIndex >= 0) {
+            stripeFooter->columnIdArray[stripeColumnIndex] =
+                    columnCount + shreddedColumnIndex + 1;
+        } else {
+            stripeFooter->columnIdArray[stripeColumnIndex] = 0;
+        }
     }
 
     return stripeFooter;
 }
 
 
-/* Reads the skip list for the given stripe. */
+/*
+ * Reads the skip list for the given stripe. We only decode the skip lists of
+ * columns the stripe stores and the table still has; other columns get skip
+ * lists synthesized from the stripe's block row counts.
+ */
 static StripeSkipList *
 LoadStripeSkipList(FILE *tableFile, StripeMetadata *stripeMetadata,
                    StripeFooter *stripeFooter, uint32 columnCount,
@@ -472,32 +1925,56 @@ LoadStripeSkipList(FILE *tableFile, StripeMetadata *stripeMetadata,
     StripeSkipList *stripeSkipList = NULL;
     ColumnBlockSkipNode **blockSkipNodeArray = NULL;
     StringInfo firstColumnSkipListBuffer = NULL;
+    uint64 *blockRowCountArray = NULL;
+    uint64 *skipListFileOffsetArray = NULL;
     uint64 currentColumnSkipListFileOffset = 0;
     uint32 columnIndex = 0;
+    uint32 stripeColumnIndex = 0;
+    uint32 stripeColumnCount = stripeFooter->columnCount;
     uint32 stripeBlockCount = 0;
 
-    /* deserialize block count */
+    /* deserialize block count and block row counts */
     firstColumnSkipListBuffer = ReadFromFile(tableFile, stripeMetadata->fileOffset,
                                              stripeFooter->skipListSizeArray[0]);
-    stripeBlockCount = DeserializeBlockCount(firstColumnSkipListBuffer);
+    blockRowCountArray = DeserializeBlockRowCountArray(firstColumnSkipListBuffer,
+                                                       &stripeBlockCount);
+
+    /* find where each stored column's skip list starts */
+    skipListFileOffsetArray = palloc0(Max(stripeColumnCount, 1) * sizeof(uint64));
+    currentColumnSkipListFileOffset = stripeMetadata->fileOffset;
+
+    for (stripeColumnIndex = 0; stripeColumnIndex < stripeColumnCount; stripeColumnIndex++) {
+        skipListFileOffsetArray[stripeColumnIndex] = currentColumnSkipListFileOffset;
+        currentColumnSkipListFileOffset += stripeFooter->skipListSizeArray[stripeColumnIndex];
+    }
 
     /* deserialize column skip lists */
     blockSkipNodeArray = palloc0(columnCount * sizeof(ColumnBlockSkipNode *));
-    currentColumnSkipListFileOffset = stripeMetadata->fileOffset;
 
     for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
-        uint64 columnSkipListSize = stripeFooter->skipListSizeArray[columnIndex];
         Form_pg_attribute attributeForm = attributeFormArray[columnIndex];
+        int32 stripeColumnPosition = StripeColumnPosition(stripeFooter, columnIndex);
+        StringInfo columnSkipListBuffer = NULL;
+        uint64 columnSkipListSize = 0;
+
+        /*
+         * Queries never read dropped columns, and columns added after the
+         * stripe was written are all nulls.
+         */
+        if (attributeForm->attisdropped || stripeColumnPosition < 0) {
+            blockSkipNodeArray[columnIndex] = MissingColumnSkipList(blockRowCountArray,
+                                                                    stripeBlockCount);
+            continue;
+        }
 
-        StringInfo columnSkipListBuffer =
-                ReadFromFile(tableFile, currentColumnSkipListFileOffset, columnSkipListSize);
+        columnSkipListSize = stripeFooter->skipListSizeArray[stripeColumnPosition];
+        columnSkipListBuffer = ReadFromFile(tableFile,
+                                            skipListFileOffsetArray[stripeColumnPosition],
+                                            columnSkipListSize);
 
-        ColumnBlockSkipNode *columnSkipList =
+        blockSkipNodeArray[columnIndex] =
                 DeserializeColumnSkipList(columnSkipListBuffer, attributeForm->attbyval,
                                           attributeForm->attlen, stripeBlockCount);
-        blockSkipNodeArray[columnIndex] = columnSkipList;
-
-        currentColumnSkipListFileOffset += columnSkipListSize;
     }
 
     stripeSkipList = palloc0(sizeof(StripeSkipList));
@@ -509,6 +1986,64 @@ LoadStripeSkipList(FILE *tableFile, StripeMetadata *stripeMetadata,
 }
 
 
+/*
+ * StripeColumnPosition returns the position of the given table column among the
+ * columns stored in the stripe. If the stripe doesn't store the column, the
+ * function returns -1. Columns are stored in attribute number order, so most of
+ * the time the column is at its own index.
+ */
+static int32
+StripeColumnPosition(StripeFooter *stripeFooter, uint32 columnIndex) {
+    uint32 columnId = columnIndex + 1;
+    uint32 stripeColumnIndex = 0;
+
+    if (columnIndex < stripeFooter->columnCount &&
+        stripeFooter->columnIdArray[columnIndex] == columnId) {
+        return (int32) columnIndex;
+    }
+
+    for (stripeColumnIndex = 0; stripeColumnIndex < stripeFooter->columnCount;
+         stripeColumnIndex++) {
+        if (stripeFooter->columnIdArray[stripeColumnIndex] == columnId) {
+            return (int32) stripeColumnIndex;
+        }
+    }
+
+    return -1;
+}
+
+
+/*
+ * MissingColumnSkipList creates skip nodes for a column whose data we don't
+ * read from the stripe. The column's blocks have the given row counts, and are
+ * read as all nulls. So, the blocks have no min/max values or data streams, and
+ * their precomputed aggregates are all zero.
+ */
+static ColumnBlockSkipNode *
+MissingColumnSkipList(uint64 *blockRowCountArray, uint32 blockCount) {
+    ColumnBlockSkipNode *blockSkipNodeArray =
+            palloc0(Max(blockCount, 1) * sizeof(ColumnBlockSkipNode));
+    uint32 blockIndex = 0;
+
+    for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+
+        blockSkipNode->rowCount = blockRowCountArray[blockIndex];
+        blockSkipNode->hasMinMax = false;
+        blockSkipNode->valueCompressionType = COMPRESSION_NONE;
+        blockSkipNode->hasNonNullCount = true;
+        blockSkipNode->nonNullCount = 0;
+        blockSkipNode->hasIntegerSum = true;
+        blockSkipNode->integerSum = 0;
+        blockSkipNode->hasFloatSum = true;
+        blockSkipNode->floatSum = 0.0;
+        blockSkipNode->sumOfSquares = 0.0;
+    }
+
+    return blockSkipNodeArray;
+}
+
+
 /*
  * SelectedBlockMask walks over each column's blocks and checks if a block can
  * be filtered without reading its data. The filtering happens when all rows in
@@ -531,6 +2066,15 @@ SelectedBlockMask(StripeSkipList *stripeSkipList, List *projectedColumnList,
         FmgrInfo *comparisonFunction = NULL;
         Node *baseConstraint = NULL;
 
+        /*
+         * Writers don't record min/max values of extension types, such as the
+         * encrypted ones, and their comparators can't order plaintext skip list
+         * values anyway, so we don't filter their blocks.
+         */
+        if (column->vartype >= FirstNormalObjectId) {
+            continue;
+        }
+
         /* if this column's data type doesn't have a comparator, skip it */
         comparisonFunction = GetFunctionInfoOrNull(column->vartype, BTREE_AM_OID,
                                                    BTORDER_PROC);
@@ -548,7 +2092,7 @@ SelectedBlockMask(StripeSkipList *stripeSkipList, List *projectedColumnList,
 
             /*
              * A column block with comparable data type can miss min/max values
-             * if all values in the block are NULL.
+             * if all values in the block are NULL, or if the column is encrypted.
              */
             if (!blockSkipNode->hasMinMax) {
                 continue;
@@ -605,6 +2149,38 @@ GetFunctionInfoOrNull(Oid typeId, Oid accessMethodId, int16 procedureId) {
 }
 
 
+/*
+ * ShreddedTupleDescriptor returns a copy of the given tuple descriptor, with a
+ * text attribute for each of the given shredded columns after the table's
+ * attributes. Shredded columns are named after their json keys.
+ */
+TupleDesc
+ShreddedTupleDescriptor(TupleDesc tupleDescriptor, List *shreddedColumnList) {
+    TupleDesc shreddedTupleDescriptor = NULL;
+    uint32 tableColumnCount = tupleDescriptor->natts;
+    uint32 columnCount = tableColumnCount + list_length(shreddedColumnList);
+    uint32 columnIndex = 0;
+    AttrNumber attributeNumber = (AttrNumber) tableColumnCount;
+    ListCell *shreddedColumnCell = NULL;
+
+    shreddedTupleDescriptor = CreateTemplateTupleDesc(columnCount, false);
+    for (columnIndex = 0; columnIndex < tableColumnCount; columnIndex++) {
+        memcpy(shreddedTupleDescriptor->attrs[columnIndex],
+               tupleDescriptor->attrs[columnIndex], ATTRIBUTE_FIXED_PART_SIZE);
+    }
+
+    foreach(shreddedColumnCell, shreddedColumnList) {
+        ShreddedColumn *shreddedColumn = lfirst(shreddedColumnCell);
+
+        attributeNumber++;
+        TupleDescInitEntry(shreddedTupleDescriptor, attributeNumber,
+                           shreddedColumn->path, TEXTOID, -1, 0);
+    }
+
+    return shreddedTupleDescriptor;
+}
+
+
 /*
  * BuildRestrictInfoList builds restrict info list using the selection criteria,
  * and then return this list. The function is copied from CitusDB's shard pruning
@@ -822,12 +2398,12 @@ ProjectedColumnMask(uint32 columnCount, List *projectedColumnList) {
 
 
 /*
- * DeserializeBoolArray reads an array of bits from the given buffer and returns
- * it as a boolean array.
+ * DeserializeBoolArray reads an array of bits from the given buffer into the
+ * given boolean array.
  */
-static bool *
-DeserializeBoolArray(StringInfo boolArrayBuffer, uint32 boolArrayLength) {
-    bool *boolArray = NULL;
+static void
+DeserializeBoolArray(StringInfo boolArrayBuffer, bool *boolArray,
+                     uint32 boolArrayLength) {
     uint32 boolArrayIndex = 0;
 
     uint32 maximumBoolCount = boolArrayBuffer->len * 8;
@@ -835,7 +2411,6 @@ DeserializeBoolArray(StringInfo boolArrayBuffer, uint32 boolArrayLength) {
         ereport(ERROR, (errmsg("insufficient data for reading boolean array")));
     }
 
-    boolArray = palloc0(boolArrayLength * sizeof(bool));
     for (boolArrayIndex = 0; boolArrayIndex < boolArrayLength; boolArrayIndex++) {
         uint32 byteIndex = boolArrayIndex / 8;
         uint32 bitIndex = boolArrayIndex % 8;
@@ -848,29 +2423,26 @@ DeserializeBoolArray(StringInfo boolArrayBuffer, uint32 boolArrayLength) {
             boolArray[boolArrayIndex] = true;
         }
     }
-
-    return boolArray;
 }
 
 
 /*
- * DeserializeDatumArray reads an array of datums from the given buffer and
- * returns the array. If a value is marked as false in the exists array, the
- * function assumes that the datum isn't in the buffer, and simply skips it.
+ * DeserializeDatumArray reads an array of datums from the given buffer into the
+ * given datum array. If a value is marked as false in the exists array, the
+ * function assumes that the datum isn't in the buffer, and sets it to zero.
  */
-static Datum *
+static void
 DeserializeDatumArray(StringInfo datumBuffer, bool *existsArray, uint32 datumCount,
                       bool datumTypeByValue, int datumTypeLength,
-                      char datumTypeAlign) {
-    Datum *datumArray = NULL;
+                      char datumTypeAlign, Datum *datumArray) {
     uint32 datumIndex = 0;
     uint32 currentDatumDataOffset = 0;
 
-    datumArray = palloc0(datumCount * sizeof(Datum));
     for (datumIndex = 0; datumIndex < datumCount; datumIndex++) {
         char *currentDatumDataPointer = NULL;
 
         if (!existsArray[datumIndex]) {
+            datumArray[datumIndex] = (Datum) 0;
             continue;
         }
 
@@ -888,8 +2460,185 @@ DeserializeDatumArray(StringInfo datumBuffer, bool *existsArray, uint32 datumCou
             ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
         }
     }
+}
+
+
+/*
+ * DeserializePackedDatumArray is the counterpart of DeserializeDatumArray for
+ * packed value streams. Pass-by-value datums are copied out of the buffer, and
+ * varlenas are used in place, since they are either short or aligned. The only
+ * values that may not be aligned for their type are fixed-length
+ * pass-by-reference ones, and we copy those into the given aligned buffer.
+ */
+static void
+DeserializePackedDatumArray(StringInfo datumBuffer, bool *existsArray,
+                            uint32 datumCount, bool datumTypeByValue,
+                            int datumTypeLength, char datumTypeAlign,
+                            Datum *datumArray, StringInfo alignedDatumBuffer) {
+    uint32 datumIndex = 0;
+    uint32 currentDatumDataOffset = 0;
+    bool realignDatums = (!datumTypeByValue && datumTypeLength > 0 &&
+                          datumTypeAlign != 'c');
+
+    /*
+     * Datums in the aligned buffer are pointed to from the datum array, so we
+     * allocate room for all of them upfront to keep the buffer from moving.
+     */
+    resetStringInfo(alignedDatumBuffer);
+    if (realignDatums) {
+        enlargeStringInfo(alignedDatumBuffer,
+                          datumCount * (datumTypeLength + MAXIMUM_ALIGNOF));
+    }
+
+    for (datumIndex = 0; datumIndex < datumCount; datumIndex++) {
+        char *currentDatumDataPointer = NULL;
+        uint32 nextDatumDataOffset = 0;
+
+        if (!existsArray[datumIndex]) {
+            datumArray[datumIndex] = (Datum) 0;
+            continue;
+        }
+
+        /* varlenas with 4-byte headers are aligned, and padded with zeros */
+        if (datumTypeLength == -1) {
+            if (currentDatumDataOffset >= datumBuffer->len) {
+                ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+            }
+
+            currentDatumDataOffset = att_align_pointer(currentDatumDataOffset,
+                                                       datumTypeAlign, datumTypeLength,
+                                                       datumBuffer->data +
+                                                       currentDatumDataOffset);
+        }
+
+        currentDatumDataPointer = datumBuffer->data + currentDatumDataOffset;
+        nextDatumDataOffset = att_addlength_pointer(currentDatumDataOffset,
+                                                    datumTypeLength,
+                                                    currentDatumDataPointer);
+        if (nextDatumDataOffset > datumBuffer->len) {
+            ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+        }
+
+        if (datumTypeByValue) {
+            Datum datumCopy = 0;
+
+            memcpy(&datumCopy, currentDatumDataPointer, datumTypeLength);
+            datumArray[datumIndex] = fetch_att(&datumCopy, datumTypeByValue,
+                                               datumTypeLength);
+        } else if (realignDatums &&
+                   att_align_nominal(currentDatumDataPointer, datumTypeAlign) !=
+                   (uintptr_t) currentDatumDataPointer) {
+            uint32 alignedOffset = att_align_nominal(alignedDatumBuffer->len,
+                                                     datumTypeAlign);
+            char *alignedPointer = alignedDatumBuffer->data + alignedOffset;
+
+            memcpy(alignedPointer, currentDatumDataPointer, datumTypeLength);
+            alignedDatumBuffer->len = alignedOffset + datumTypeLength;
+
+            datumArray[datumIndex] = PointerGetDatum(alignedPointer);
+        } else {
+            datumArray[datumIndex] = PointerGetDatum(currentDatumDataPointer);
+        }
+
+        currentDatumDataOffset = nextDatumDataOffset;
+    }
+}
+
+
+/*
+ * DeserializeOffsetDatumArray reads variable-length datums from the given
+ * offset value stream. Each datum is located through its row's offset, so
+ * datums don't depend on the lengths of the ones before them. A NULL exists
+ * array means that all datums exist.
+ */
+static void
+DeserializeOffsetDatumArray(StringInfo datumBuffer, bool *existsArray,
+                            uint32 datumCount, Datum *datumArray) {
+    uint32 datumIndex = 0;
+    uint32 offsetArrayLength = VALUE_OFFSET_ARRAY_LENGTH(datumCount);
+    uint32 *offsetArray = (uint32 *) datumBuffer->data;
+    char *valueData = datumBuffer->data + offsetArrayLength;
+    uint32 valueLength = 0;
+
+    if (offsetArrayLength > datumBuffer->len) {
+        ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+    }
+
+    valueLength = offsetArray[datumCount];
+    if (offsetArrayLength + valueLength > datumBuffer->len) {
+        ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+    }
+
+    for (datumIndex = 0; datumIndex < datumCount; datumIndex++) {
+        uint32 datumOffset = offsetArray[datumIndex] & ~VALUE_OFFSET_BLOB;
+
+        if (existsArray != NULL && !existsArray[datumIndex]) {
+            datumArray[datumIndex] = (Datum) 0;
+            continue;
+        }
+
+        if (datumOffset >= valueLength) {
+            ereport(ERROR, (errmsg("invalid value offset in datum buffer")));
+        }
+
+        datumArray[datumIndex] = PointerGetDatum(valueData + datumOffset);
+    }
+}
+
+
+/*
+ * DeserializeDictionaryDatumArray reads the given dictionary value stream into
+ * the given block. The block's distinct values are read once from the stream's
+ * offset value stream, and each row's datum then points to the value its code
+ * refers to. The block keeps the distinct values and codes for filtering.
+ */
+static void
+DeserializeDictionaryDatumArray(StringInfo datumBuffer, uint32 datumCount,
+                                ColumnBlockData *blockData) {
+    uint32 codeArrayLength = DICTIONARY_CODE_ARRAY_LENGTH(datumCount);
+    DictionaryHeader *dictionaryHeader = (DictionaryHeader *) datumBuffer->data;
+    uint16 *codeArray = (uint16 *) (datumBuffer->data + sizeof(DictionaryHeader));
+    bool *existsArray = blockData->existsArray;
+    Datum *entryArray = blockData->dictionaryEntryArray;
+    Datum *datumArray = blockData->valueArray;
+    StringInfoData entryBuffer;
+    uint32 entryCount = 0;
+    uint32 datumIndex = 0;
+
+    if (codeArrayLength > datumBuffer->len) {
+        ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+    }
+
+    entryCount = dictionaryHeader->entryCount;
+    if (dictionaryHeader->rowCount != datumCount || entryCount > datumCount) {
+        ereport(ERROR, (errmsg("invalid dictionary in datum buffer")));
+    }
+
+    /* distinct values form an offset value stream without nulls */
+    entryBuffer.data = datumBuffer->data + codeArrayLength;
+    entryBuffer.len = datumBuffer->len - codeArrayLength;
+    entryBuffer.maxlen = entryBuffer.len;
+    entryBuffer.cursor = 0;
+
+    DeserializeOffsetDatumArray(&entryBuffer, NULL, entryCount, entryArray);
+
+    for (datumIndex = 0; datumIndex < datumCount; datumIndex++) {
+        uint16 code = codeArray[datumIndex];
+
+        if (!existsArray[datumIndex]) {
+            datumArray[datumIndex] = (Datum) 0;
+            continue;
+        }
+
+        if (code >= entryCount) {
+            ereport(ERROR, (errmsg("invalid dictionary code in datum buffer")));
+        }
+
+        datumArray[datumIndex] = entryArray[code];
+    }
 
-    return datumArray;
+    blockData->dictionaryCodeArray = codeArray;
+    blockData->dictionaryEntryCount = entryCount;
 }
 
 
@@ -916,19 +2665,43 @@ FileSize(FILE *file) {
 }
 
 
-/* Reads the given segment from the given file. */
+/* Reads the given segment from the given file into a new buffer. */
 static StringInfo
 ReadFromFile(FILE *file, uint64 offset, uint32 size) {
-    int fseekResult = 0;
-    int freadResult = 0;
-    int fileError = 0;
-
     StringInfo resultBuffer = makeStringInfo();
+    ReadFromFileIntoBuffer(file, offset, size, resultBuffer);
+
+    return resultBuffer;
+}
+
+
+/*
+ * ReadFromFileIntoBuffer reads the given segment from the given file into the
+ * given buffer, replacing the buffer's previous contents. The buffer is only
+ * enlarged when it is too small, so callers can reuse it across reads.
+ */
+static void
+ReadFromFileIntoBuffer(FILE *file, uint64 offset, uint32 size, StringInfo resultBuffer) {
+    resetStringInfo(resultBuffer);
     enlargeStringInfo(resultBuffer, size);
     resultBuffer->len = size;
 
+    ReadFromFileIntoPointer(file, offset, size, resultBuffer->data);
+}
+
+
+/*
+ * ReadFromFileIntoPointer reads the given segment from the given file into the
+ * given memory, which must have room for the segment.
+ */
+static void
+ReadFromFileIntoPointer(FILE *file, uint64 offset, uint32 size, char *resultPointer) {
+    int fseekResult = 0;
+    int freadResult = 0;
+    int fileError = 0;
+
     if (size == 0) {
-        return resultBuffer;
+        return;
     }
 
     errno = 0;
@@ -938,7 +2711,7 @@ ReadFromFile(FILE *file, uint64 offset, uint32 size) {
                 errmsg("could not seek in file: %m")));
     }
 
-    freadResult = fread(resultBuffer->data, size, 1, file);
+    freadResult = fread(resultPointer, size, 1, file);
     if (freadResult != 1) {
         ereport(ERROR, (errmsg("could not read enough data from file")));
     }
@@ -948,29 +2721,26 @@ ReadFromFile(FILE *file, uint64 offset, uint32 size) {
         ereport(ERROR, (errcode_for_file_access(),
                 errmsg("could not read file: %m")));
     }
-
-    return resultBuffer;
 }
 
 
 /*
  * DecompressBuffer decompresses the given buffer with the given compression
- * type. This function returns the buffer as-is when no compression is applied.
+ * type into decompressedBuffer, replacing its previous contents. The function
+ * copies the buffer as-is when no compression is applied.
  */
-static StringInfo
-DecompressBuffer(StringInfo buffer, CompressionType compressionType) {
-    StringInfo decompressedBuffer = NULL;
-    Assert(compressionType == COMPRESSION_NONE || compressionType == COMPRESSION_PG_LZ ||
-           compressionType == COMPRESSION_LZ4);
+static void
+DecompressBuffer(StringInfo buffer, CompressionType compressionType,
+                 StringInfo decompressedBuffer) {
+    resetStringInfo(decompressedBuffer);
 
     if (compressionType == COMPRESSION_NONE) {
-        /* in case of no compression, return buffer */
-        decompressedBuffer = buffer;
+        /* in case of no compression, copy buffer */
+        appendBinaryStringInfo(decompressedBuffer, buffer->data, buffer->len);
     } else if (compressionType == COMPRESSION_PG_LZ) {
         PGLZ_Header *compressedData = (PGLZ_Header *) buffer->data;
         uint32 compressedDataSize = VARSIZE(compressedData);
         uint32 decompressedDataSize = PGLZ_RAW_SIZE(compressedData);
-        char *decompressedData = NULL;
 
         if (compressedDataSize != buffer->len) {
             ereport(ERROR, (errmsg("cannot decompress the buffer"),
@@ -978,25 +2748,21 @@ DecompressBuffer(StringInfo buffer, CompressionType compressionType) {
                               compressedDataSize, buffer->len)));
         }
 
-        decompressedData = palloc0(decompressedDataSize);
-        pglz_decompress(compressedData, decompressedData);
-
-        decompressedBuffer = palloc0(sizeof(StringInfoData));
-        decompressedBuffer->data = decompressedData;
+        enlargeStringInfo(decompressedBuffer, decompressedDataSize);
+        pglz_decompress(compressedData, decompressedBuffer->data);
         decompressedBuffer->len = decompressedDataSize;
-        decompressedBuffer->maxlen = decompressedDataSize;
     } else if (compressionType == COMPRESSION_LZ4) {
         size_t compressedDataSize = ((LZ4CompressHeader *) (buffer->data))->comp_len;
         int decompressedDataSize_expected = (int) CSTORE_COMPRESS_RAWSIZE_LZ4(buffer->data);
         int decompressedDataSize_real = 0;
-        char *decompressedData = NULL;
         if (compressedDataSize + CSTORE_COMPRESS_HDRSZ_LZ4 != buffer->len) {
             ereport(ERROR, (errmsg("cannot decompress the buffer"),
                     errdetail("Expected %u bytes, but received %u bytes",
                               buffer->len, compressedDataSize + CSTORE_COMPRESS_HDRSZ_LZ4)));
         }
-        decompressedData = palloc0(decompressedDataSize_expected);
-        decompressedDataSize_real = LZ4_decompress_safe(CSTORE_COMPRESS_RAWDATA_LZ4(buffer->data), decompressedData,
+        enlargeStringInfo(decompressedBuffer, decompressedDataSize_expected);
+        decompressedDataSize_real = LZ4_decompress_safe(CSTORE_COMPRESS_RAWDATA_LZ4(buffer->data),
+                                                        decompressedBuffer->data,
                                                         compressedDataSize,
                                                         decompressedDataSize_expected);
         if (decompressedDataSize_real < 0) {
@@ -1004,43 +2770,32 @@ DecompressBuffer(StringInfo buffer, CompressionType compressionType) {
                     errdetail("Expected %zu bytes, but received %u bytes",
                               compressedDataSize, buffer->len)));
         }
-        decompressedBuffer = palloc0(sizeof(StringInfoData));
-        decompressedBuffer->data = decompressedData;
         decompressedBuffer->len = decompressedDataSize_real;
-        decompressedBuffer->maxlen = decompressedDataSize_real;
+    } else if (compressionType == COMPRESSION_GORILLA) {
+        GorillaDecompress(buffer, decompressedBuffer);
+    } else if (compressionType == COMPRESSION_DELTA) {
+        DeltaDecompress(buffer, decompressedBuffer);
     } else if (compressionType == COMPRESSION_ENC_LZ4) {
-        char *decompressedData = palloc0(buffer->maxlen);
         int resp, dec_len;
-        resp = enc_text_decrypt_n_decompress(buffer->data, buffer->len, decompressedData);
+        enlargeStringInfo(decompressedBuffer, buffer->maxlen);
+        resp = enc_text_decrypt_n_decompress(buffer->data, buffer->len,
+                                             decompressedBuffer->data);
         dec_len = (resp >> 4);
         resp -= (dec_len << 4);
         sgxErrorHandler(resp);
         if (dec_len > 0) {
-            buffer->len = dec_len;
-            decompressedBuffer = palloc0(sizeof(StringInfoData));
-            decompressedBuffer->data = palloc0(sizeof(char) * dec_len);
-            memcpy(decompressedBuffer->data, decompressedData, dec_len);
             decompressedBuffer->len = dec_len;
-            decompressedBuffer->maxlen = dec_len;
-            pfree(decompressedData);
         }
     } else if (compressionType == COMPRESSION_ENC_NONE) {
-        char *decompressedData = palloc0(buffer->maxlen);
         int resp, dec_len;
-        resp = enc_text_decrypt(buffer->data, buffer->len, decompressedData, buffer->maxlen);
+        enlargeStringInfo(decompressedBuffer, buffer->maxlen);
+        resp = enc_text_decrypt(buffer->data, buffer->len, decompressedBuffer->data,
+                                buffer->maxlen);
         dec_len = (resp >> 4);
         resp -= (dec_len << 4);
         sgxErrorHandler(resp);
         if (dec_len > 0) {
-            buffer->len = dec_len;
-            decompressedBuffer = palloc0(sizeof(StringInfoData));
-            decompressedBuffer->data = palloc0(sizeof(char) * dec_len);
-            memcpy(decompressedBuffer->data, decompressedData, dec_len);
             decompressedBuffer->len = dec_len;
-            decompressedBuffer->maxlen = dec_len;
-            pfree(decompressedData);
         }
     }
-
-    return decompressedBuffer;
 }
@@ -19,53 +19,119 @@
 #include "cstore_metadata_serialization.h"
 
 #include <sys/stat.h>
+#include <fcntl.h>
+#include "access/hash.h"
 #include "access/nbtree.h"
+#include "access/transam.h"
+#include "access/tuptoaster.h"
 #include "catalog/pg_collation.h"
+#include "catalog/pg_type.h"
 #include "commands/defrem.h"
+#include "mb/pg_wchar.h"
+#include "nodes/makefuncs.h"
 #include "optimizer/var.h"
 #include "port.h"
 #include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
+#include "utils/pg_locale.h"
 #include "utils/pg_lzcompress.h"
 #include "utils/rel.h"
+#include "utils/selfuncs.h"
 
+/* varlena packing macros, which PostgreSQL keeps private to heaptuple.c */
+#ifndef VARATT_CAN_MAKE_SHORT
+#define VARATT_CAN_MAKE_SHORT(PTR) \
+    (VARATT_IS_4B_U(PTR) && \
+     (VARSIZE(PTR) - VARHDRSZ + VARHDRSZ_SHORT) <= VARATT_SHORT_MAXSIZE)
+#define VARATT_CONVERTED_SHORT_SIZE(PTR) \
+    (VARSIZE(PTR) - VARHDRSZ + VARHDRSZ_SHORT)
+#endif
 
 static void CStoreWriteFooter(StringInfo footerFileName, TableFooter *tableFooter);
 
-static StripeData *CreateEmptyStripeData(uint32 stripeMaxRowCount, uint32 blockRowCount,
-                                         uint32 columnCount);
+static void ReplaceTableFooter(StringInfo tableFooterFilename, TableFooter *tableFooter);
 
-static StripeSkipList *CreateEmptyStripeSkipList(uint32 stripeMaxRowCount,
-                                                 uint32 blockRowCount,
-                                                 uint32 columnCount);
+static bool StripeValuesBefore(StripeSkipList *stripeSkipList, uint32 columnIndex,
+                               Datum value, Oid columnCollation,
+                               FmgrInfo *comparisonFunction);
+
+static int CompareColumnValues(Datum leftValue, Datum rightValue, Oid columnCollation,
+                               FmgrInfo *comparisonFunction);
+
+static void PunchStripeHoles(const char *filename, List *stripeMetadataList);
+
+static StringInfo ReadDeletionBitmap(FILE *deletionFile,
+                                     StripeMetadata *stripeMetadata);
+
+static uint64 DeletionBitmapRowCount(StringInfo deletionBitmap);
+
+static StripeBuffers *CreateEmptyStripeBuffers(uint32 columnCount);
+
+static StripeSkipList *CreateEmptyStripeSkipList(uint32 columnCount);
+
+static void ShredColumnValues(TableWriteState *writeState, Datum *columnValues,
+                              bool *columnNulls);
+
+static void AddStripeBlock(StripeBuffers *stripeBuffers, StripeSkipList *stripeSkipList,
+                           uint32 blockIndex);
 
 static StripeMetadata FlushStripe(TableWriteState *writeState);
 
-static StringInfo **CreateExistsBufferArray(ColumnData **columnDataArray,
-                                            StripeSkipList *stripeSkipList);
+static bool *StoredColumnMask(TupleDesc tupleDescriptor);
 
-static StringInfo **CreateValueBufferArray(ColumnData **columnDataArray,
-                                           StripeSkipList *stripeSkipList,
-                                           TupleDesc tupleDescriptor);
+static bool BlockExistsImplied(ColumnBlockSkipNode *blockSkipNode);
 
 static StringInfo *CreateSkipListBufferArray(StripeSkipList *stripeSkipList,
-                                             TupleDesc tupleDescriptor);
+                                             TupleDesc tupleDescriptor,
+                                             bool *storedColumnMask);
 
 static StripeFooter *CreateStripeFooter(StripeSkipList *stripeSkipList,
-                                        StringInfo *skipListBufferArray);
+                                        StringInfo *skipListBufferArray,
+                                        bool *storedColumnMask,
+                                        uint32 tableColumnCount,
+                                        List *shreddedColumnList);
 
-static StringInfo SerializeBoolArray(bool *boolArray, uint32 boolArrayLength);
+static void SerializeSingleBool(StringInfo boolArrayBuffer, uint32 boolArrayIndex,
+                                bool boolValue);
 
-static StringInfo SerializeDatumArray(Datum *datumArray, bool *existsArray,
-                                      uint32 datumCount, bool datumTypeByValue,
-                                      int datumTypeLength, char datumTypeAlign);
+static uint32 SerializeSingleDatum(StringInfo datumBuffer, Datum datum,
+                                   bool datumTypeByValue, int datumTypeLength,
+                                   char datumTypeAlign, char datumTypeStorage,
+                                   ValueFormat valueFormat);
+
+static uint32 SerializePackedDatum(StringInfo datumBuffer, Datum datum,
+                                   bool datumTypeByValue, int datumTypeLength,
+                                   char datumTypeAlign, char datumTypeStorage);
+
+static void SerializeSingleOffset(StringInfo offsetBuffer, uint32 offset);
+
+static uint32 SerializeBlobValue(ColumnBlockBuffers *blockBuffers, Datum value,
+                                 CompressionType compressionType);
+
+static ValueFormat ColumnValueFormat(TableWriteState *writeState, uint32 columnIndex);
+
+static StringInfo CreateOffsetValueBuffer(StringInfo offsetBuffer, StringInfo valueBuffer);
+
+static StringInfo CreateDictionaryValueBuffer(ColumnBlockBuffers *blockBuffers,
+                                              Form_pg_attribute attributeForm);
 
 static void UpdateBlockSkipNodeMinMax(ColumnBlockSkipNode *blockSkipNode,
                                       Datum columnValue, bool columnTypeByValue,
                                       int columnTypeLength, Oid columnCollation,
                                       FmgrInfo *comparisonFunction);
 
+static void TruncateBlockSkipNodeMinMax(ColumnBlockSkipNode *blockSkipNode,
+                                        Form_pg_attribute attributeForm,
+                                        FmgrInfo *comparisonFunction);
+
+static void UpdateBlockSkipNodeAggregates(ColumnBlockSkipNode *blockSkipNode,
+                                          Datum columnValue, bool columnNull,
+                                          Oid columnTypeId,
+                                          CompressionType compressionType);
+
 static Datum DatumCopy(Datum datum, bool datumTypeByValue, int datumTypeLength);
 
 static void AppendStripeMetadata(TableFooter *tableFooter,
@@ -81,21 +147,34 @@ static void SyncAndCloseFile(FILE *file);
  * handle. This handle should be used for adding the row values and finishing the
  * data load operation. If the cstore footer file already exists, we read the
  * footer and then seek to right after the last stripe  where the new stripes
- * will be added.
+ * will be added. Columns are compressed with the compression types in the
+ * given column array, or with the table's compression type if it is NULL.
+ * Shredded columns in the given list are stored after the table's columns, and
+ * use the table's compression type.
  */
 TableWriteState *
 CStoreBeginWrite(const char *filename, CompressionType compressionType,
+                 CompressionType *columnCompressionTypeArray,
                  uint64 stripeMaxRowCount, uint32 blockRowCount,
-                 TupleDesc tupleDescriptor) {
+                 TupleDesc tupleDescriptor, List *shreddedColumnList) {
     TableWriteState *writeState = NULL;
     FILE *tableFile = NULL;
     StringInfo tableFooterFilename = NULL;
     TableFooter *tableFooter = NULL;
     FmgrInfo **comparisonFunctionArray = NULL;
+    FmgrInfo *shreddingFunctionArray = NULL;
+    CompressionType *compressionTypeArray = NULL;
+    MemoryContext stripeBufferContext = NULL;
+    MemoryContext shreddingContext = NULL;
     MemoryContext stripeWriteContext = NULL;
+    MemoryContext oldContext = NULL;
+    StripeBuffers *stripeBuffers = NULL;
+    StripeSkipList *stripeSkipList = NULL;
     uint64 currentFileOffset = 0;
     uint32 columnCount = 0;
+    uint32 tableColumnCount = tupleDescriptor->natts;
     uint32 columnIndex = 0;
+    ListCell *shreddedColumnCell = NULL;
     struct stat statBuffer;
     int statResult = 0;
 
@@ -149,20 +228,55 @@ CStoreBeginWrite(const char *filename, CompressionType compressionType,
         }
     }
 
-    /* get comparison function pointers for each of the columns */
-    columnCount = tupleDescriptor->natts;
-    comparisonFunctionArray = palloc0(columnCount * sizeof(FmgrInfo *));
-    for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
-        Oid typeId = tupleDescriptor->attrs[columnIndex]->atttypid;
-        FmgrInfo *comparisonFunction = GetFunctionInfoOrNull(typeId, BTREE_AM_OID,
-                                                             BTORDER_PROC);
-        comparisonFunctionArray[columnIndex] = comparisonFunction;
+    /*
+     * Shredded columns are written as text columns after the table's columns.
+     * Their values are extracted with the functions behind the ->> operator.
+     */
+    if (shreddedColumnList != NIL) {
+        uint32 shreddedColumnIndex = 0;
+
+        shreddingFunctionArray = palloc0(list_length(shreddedColumnList) *
+                                         sizeof(FmgrInfo));
+        foreach(shreddedColumnCell, shreddedColumnList) {
+            ShreddedColumn *shreddedColumn = lfirst(shreddedColumnCell);
+            Form_pg_attribute attributeForm =
+                    tupleDescriptor->attrs[shreddedColumn->attributeNumber - 1];
+            Oid functionId = F_JSON_OBJECT_FIELD_TEXT;
+
+            if (attributeForm->atttypid == JSONBOID) {
+                functionId = F_JSONB_OBJECT_FIELD_TEXT;
+            }
+
+            fmgr_info(functionId, &shreddingFunctionArray[shreddedColumnIndex]);
+            shreddedColumnIndex++;
+        }
+
+        tupleDescriptor = ShreddedTupleDescriptor(tupleDescriptor, shreddedColumnList);
+
+        shreddingContext = AllocSetContextCreate(CurrentMemoryContext,
+                                                 "Column Shredding Memory Context",
+                                                 ALLOCSET_DEFAULT_MINSIZE,
+                                                 ALLOCSET_DEFAULT_INITSIZE,
+                                                 ALLOCSET_DEFAULT_MAXSIZE);
     }
 
+    columnCount = tupleDescriptor->natts;
+
     /*
-     * We allocate all stripe specific data in the stripeWriteContext, and
-     * reset this memory context once we have flushed the stripe to the file.
-     * This is to avoid memory leaks.
+     * Stripe buffers are kept in stripeBufferContext, and are reused across
+     * stripes. They grow block by block as rows are written, so we don't need
+     * to reserve memory for stripeMaxRowCount rows up front.
+     */
+    stripeBufferContext = AllocSetContextCreate(CurrentMemoryContext,
+                                                "Stripe Buffer Memory Context",
+                                                ALLOCSET_DEFAULT_MINSIZE,
+                                                ALLOCSET_DEFAULT_INITSIZE,
+                                                ALLOCSET_DEFAULT_MAXSIZE);
+
+    /*
+     * We allocate temporary stripe specific data in the stripeWriteContext,
+     * and reset this memory context once we have flushed the stripe to the
+     * file. This is to avoid memory leaks.
      */
     stripeWriteContext = AllocSetContextCreate(CurrentMemoryContext,
                                                "Stripe Write Memory Context",
@@ -170,64 +284,120 @@ CStoreBeginWrite(const char *filename, CompressionType compressionType,
                                                ALLOCSET_DEFAULT_INITSIZE,
                                                ALLOCSET_DEFAULT_MAXSIZE);
 
+    oldContext = MemoryContextSwitchTo(stripeBufferContext);
+    stripeBuffers = CreateEmptyStripeBuffers(columnCount);
+    stripeSkipList = CreateEmptyStripeSkipList(columnCount);
+    MemoryContextSwitchTo(oldContext);
+
+    /* columns without their own compression type use the table's */
+    compressionTypeArray = palloc0(columnCount * sizeof(CompressionType));
+    for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
+        compressionTypeArray[columnIndex] = compressionType;
+        if (columnCompressionTypeArray != NULL && columnIndex < tableColumnCount) {
+            compressionTypeArray[columnIndex] = columnCompressionTypeArray[columnIndex];
+        }
+    }
+
+    /*
+     * Get comparison function pointers for each of the columns. We keep min/max
+     * values only for unencrypted columns of built-in types, since min/max values
+     * are stored in plaintext, and the comparison functions of encrypted types
+     * can't order values read back from skip lists.
+     */
+    comparisonFunctionArray = palloc0(columnCount * sizeof(FmgrInfo *));
+    for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
+        Oid typeId = tupleDescriptor->attrs[columnIndex]->atttypid;
+        CompressionType columnCompressionType = compressionTypeArray[columnIndex];
+        FmgrInfo *comparisonFunction = NULL;
+
+        if (columnCompressionType != COMPRESSION_ENC_LZ4 &&
+            columnCompressionType != COMPRESSION_ENC_NONE &&
+            typeId < FirstNormalObjectId) {
+            comparisonFunction = GetFunctionInfoOrNull(typeId, BTREE_AM_OID,
+                                                       BTORDER_PROC);
+        }
+
+        comparisonFunctionArray[columnIndex] = comparisonFunction;
+    }
+
     writeState = palloc0(sizeof(TableWriteState));
     writeState->tableFile = tableFile;
     writeState->tableFooterFilename = tableFooterFilename;
     writeState->tableFooter = tableFooter;
     writeState->compressionType = compressionType;
+    writeState->columnCompressionTypeArray = compressionTypeArray;
     writeState->stripeMaxRowCount = stripeMaxRowCount;
     writeState->tupleDescriptor = tupleDescriptor;
     writeState->currentFileOffset = currentFileOffset;
     writeState->comparisonFunctionArray = comparisonFunctionArray;
-    writeState->stripeData = NULL;
-    writeState->stripeSkipList = NULL;
+    writeState->stripeBuffers = stripeBuffers;
+    writeState->stripeSkipList = stripeSkipList;
+    writeState->stripeBufferContext = stripeBufferContext;
     writeState->stripeWriteContext = stripeWriteContext;
+    writeState->shreddedColumnList = shreddedColumnList;
+    writeState->tableColumnCount = tableColumnCount;
+    writeState->shreddingFunctionArray = shreddingFunctionArray;
+    writeState->rowValueArray = palloc0(columnCount * sizeof(Datum));
+    writeState->rowNullArray = palloc0(columnCount * sizeof(bool));
+    writeState->shreddingContext = shreddingContext;
 
     return writeState;
 }
 
 
 /*
- * CStoreWriteRow adds a row to the cstore file. If the stripe is not initialized,
- * we create structures to hold stripe data and skip list. Then, we add data for
- * each of the columns and update corresponding skip nodes. Then, if row count
- * exceeds stripeMaxRowCount, we flush the stripe, and add its metadata to the
- * table footer.
+ * CStoreWriteRow adds a row to the cstore file. If the row starts a new block,
+ * we first make room for the block in stripe buffers and skip list. Then, we
+ * serialize data for each of the columns into the block's buffers and update
+ * corresponding skip nodes. Values of shredded columns are extracted from the
+ * row before that. Then, if row count exceeds stripeMaxRowCount, we
+ * flush the stripe, and add its metadata to the table footer.
  */
 void
 CStoreWriteRow(TableWriteState *writeState, Datum *columnValues, bool *columnNulls) {
     uint32 columnIndex = 0;
     uint32 blockIndex = 0;
     uint32 blockRowIndex = 0;
-    StripeData *stripeData = writeState->stripeData;
+    StripeBuffers *stripeBuffers = writeState->stripeBuffers;
     StripeSkipList *stripeSkipList = writeState->stripeSkipList;
     uint32 columnCount = writeState->tupleDescriptor->natts;
     TableFooter *tableFooter = writeState->tableFooter;
     const uint32 blockRowCount = tableFooter->blockRowCount;
 
-    MemoryContext oldContext = MemoryContextSwitchTo(writeState->stripeWriteContext);
+    MemoryContext oldContext = NULL;
 
-    if (stripeData == NULL) {
-        stripeData = CreateEmptyStripeData(writeState->stripeMaxRowCount,
-                                           blockRowCount, columnCount);
-        stripeSkipList = CreateEmptyStripeSkipList(writeState->stripeMaxRowCount,
-                                                   blockRowCount, columnCount);
-        writeState->stripeData = stripeData;
-        writeState->stripeSkipList = stripeSkipList;
+    if (writeState->shreddedColumnList != NIL) {
+        ShredColumnValues(writeState, columnValues, columnNulls);
+        columnValues = writeState->rowValueArray;
+        columnNulls = writeState->rowNullArray;
     }
 
-    blockIndex = stripeData->rowCount / blockRowCount;
-    blockRowIndex = stripeData->rowCount % blockRowCount;
+    oldContext = MemoryContextSwitchTo(writeState->stripeBufferContext);
+
+    blockIndex = stripeBuffers->rowCount / blockRowCount;
+    blockRowIndex = stripeBuffers->rowCount % blockRowCount;
+
+    if (blockRowIndex == 0) {
+        AddStripeBlock(stripeBuffers, stripeSkipList, blockIndex);
+    }
+
+    MemoryContextSwitchTo(writeState->stripeWriteContext);
 
     for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
-        ColumnData *columnData = stripeData->columnDataArray[columnIndex];
-        ColumnBlockData *blockData = columnData->blockDataArray[blockIndex];
+        ColumnBuffers *columnBuffers = stripeBuffers->columnBuffersArray[columnIndex];
+        ColumnBlockBuffers *blockBuffers = columnBuffers->blockBuffersArray[blockIndex];
         ColumnBlockSkipNode **blockSkipNodeArray = stripeSkipList->blockSkipNodeArray;
         ColumnBlockSkipNode *blockSkipNode =
                 &blockSkipNodeArray[columnIndex][blockIndex];
 
+        Oid columnTypeId = writeState->tupleDescriptor->attrs[columnIndex]->atttypid;
+        CompressionType compressionType =
+                writeState->columnCompressionTypeArray[columnIndex];
+        ValueFormat valueFormat = ColumnValueFormat(writeState, columnIndex);
+        uint32 valueOffset = blockBuffers->valueBuffer->len;
+
         if (columnNulls[columnIndex]) {
-            blockData->existsArray[blockRowIndex] = false;
+            SerializeSingleBool(blockBuffers->existsBuffer, blockRowIndex, false);
         } else {
             FmgrInfo *comparisonFunction =
                     writeState->comparisonFunctionArray[columnIndex];
@@ -235,31 +405,48 @@ CStoreWriteRow(TableWriteState *writeState, Datum *columnValues, bool *columnNul
                     writeState->tupleDescriptor->attrs[columnIndex];
             bool columnTypeByValue = attributeForm->attbyval;
             int columnTypeLength = attributeForm->attlen;
+            char columnTypeAlign = attributeForm->attalign;
+            char columnTypeStorage = attributeForm->attstorage;
             Oid columnCollation = attributeForm->attcollation;
 
-            blockData->existsArray[blockRowIndex] = true;
-            blockData->valueArray[blockRowIndex] = DatumCopy(columnValues[columnIndex],
-                                                             columnTypeByValue,
-                                                             columnTypeLength);
+            SerializeSingleBool(blockBuffers->existsBuffer, blockRowIndex, true);
+
+            if (valueFormat == VALUE_FORMAT_OFFSETS && columnTypeLength == -1 &&
+                VARSIZE_ANY(DatumGetPointer(columnValues[columnIndex])) >
+                BLOB_VALUE_LENGTH_MINIMUM) {
+                valueOffset = SerializeBlobValue(blockBuffers, columnValues[columnIndex],
+                                                 compressionType);
+            } else {
+                valueOffset = SerializeSingleDatum(blockBuffers->valueBuffer,
+                                                   columnValues[columnIndex],
+                                                   columnTypeByValue, columnTypeLength,
+                                                   columnTypeAlign, columnTypeStorage,
+                                                   valueFormat);
+            }
 
-            // commented this line to avoid compare enc_int4 type with plain int type during reading from plain data file
-//            UpdateBlockSkipNodeMinMax(blockSkipNode, columnValues[columnIndex],
-//            columnTypeByValue, columnTypeLength,
-//                    columnCollation, comparisonFunction);
+            UpdateBlockSkipNodeMinMax(blockSkipNode, columnValues[columnIndex],
+                                      columnTypeByValue, columnTypeLength,
+                                      columnCollation, comparisonFunction);
         }
 
+        if (valueFormat == VALUE_FORMAT_OFFSETS) {
+            SerializeSingleOffset(blockBuffers->offsetBuffer, valueOffset);
+        }
+
+        UpdateBlockSkipNodeAggregates(blockSkipNode, columnValues[columnIndex],
+                                      columnNulls[columnIndex], columnTypeId,
+                                      compressionType);
         blockSkipNode->rowCount++;
     }
 
-    stripeSkipList->blockCount = blockIndex + 1;
-    stripeData->rowCount++;
-    if (stripeData->rowCount >= writeState->stripeMaxRowCount) {
+    stripeBuffers->rowCount++;
+    if (stripeBuffers->rowCount >= writeState->stripeMaxRowCount) {
         StripeMetadata stripeMetadata = FlushStripe(writeState);
         MemoryContextReset(writeState->stripeWriteContext);
 
-        /* set stripe data and skip list to NULL so they are recreated next time */
-        writeState->stripeData = NULL;
-        writeState->stripeSkipList = NULL;
+        /* keep the buffers around, and start filling them from the first block */
+        stripeBuffers->rowCount = 0;
+        stripeSkipList->blockCount = 0;
 
         /*
          * Append stripeMetadata in old context so next MemoryContextReset
@@ -281,12 +468,8 @@ CStoreWriteRow(TableWriteState *writeState, Datum *columnValues, bool *columnNul
  */
 void
 CStoreEndWrite(TableWriteState *writeState) {
-    StringInfo tableFooterFilename = NULL;
-    StringInfo tempTableFooterFileName = NULL;
-    int renameResult = 0;
-
-    StripeData *stripeData = writeState->stripeData;
-    if (stripeData != NULL) {
+    StripeBuffers *stripeBuffers = writeState->stripeBuffers;
+    if (stripeBuffers->rowCount > 0) {
         MemoryContext oldContext = MemoryContextSwitchTo(writeState->stripeWriteContext);
 
         StripeMetadata stripeMetadata = FlushStripe(writeState);
@@ -298,12 +481,357 @@ CStoreEndWrite(TableWriteState *writeState) {
 
     SyncAndCloseFile(writeState->tableFile);
 
-    tableFooterFilename = writeState->tableFooterFilename;
+    ReplaceTableFooter(writeState->tableFooterFilename, writeState->tableFooter);
+
+    MemoryContextDelete(writeState->stripeWriteContext);
+    MemoryContextDelete(writeState->stripeBufferContext);
+    if (writeState->shreddingContext != NULL) {
+        MemoryContextDelete(writeState->shreddingContext);
+    }
+    list_free_deep(writeState->tableFooter->stripeMetadataList);
+    pfree(writeState->tableFooter);
+    pfree(writeState->tableFooterFilename->data);
+    pfree(writeState->tableFooterFilename);
+    pfree(writeState->comparisonFunctionArray);
+    pfree(writeState->columnCompressionTypeArray);
+    pfree(writeState->rowValueArray);
+    pfree(writeState->rowNullArray);
+    pfree(writeState);
+}
+
+
+/*
+ * CStoreBeginDelete initializes a cstore delete operation and returns a delete
+ * handle. Rows to delete are then passed to CStoreDeleteRow(), and the deletions
+ * are written to disk by CStoreEndDelete().
+ */
+TableDeleteState *
+CStoreBeginDelete(const char *filename) {
+    TableDeleteState *deleteState = NULL;
+    StringInfo tableFooterFilename = makeStringInfo();
+    StringInfo deletionFilename = makeStringInfo();
+    TableFooter *tableFooter = NULL;
+    uint32 stripeCount = 0;
+
+    appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
+    appendStringInfo(deletionFilename, "%s%s", filename, CSTORE_DELETION_FILE_SUFFIX);
+
+    tableFooter = CStoreReadFooter(tableFooterFilename);
+    stripeCount = list_length(tableFooter->stripeMetadataList);
+
+    deleteState = palloc0(sizeof(TableDeleteState));
+    deleteState->tableFooterFilename = tableFooterFilename;
+    deleteState->deletionFilename = deletionFilename;
+    deleteState->tableFooter = tableFooter;
+    deleteState->stripeCount = stripeCount;
+    deleteState->deletionBitmapArray = palloc0(Max(stripeCount, 1) * sizeof(StringInfo));
+
+    return deleteState;
+}
+
+
+/*
+ * CStoreDeleteRow marks the row with the given row id as deleted. Deletions are
+ * kept in memory until the delete operation ends.
+ */
+void
+CStoreDeleteRow(TableDeleteState *deleteState, uint64 rowId) {
+    uint32 stripeIndex = CSTORE_ROW_ID_STRIPE_INDEX(rowId);
+    uint32 stripeRowIndex = CSTORE_ROW_ID_ROW_INDEX(rowId);
+    uint32 byteIndex = stripeRowIndex / 8;
+    uint32 bitIndex = stripeRowIndex % 8;
+    StringInfo deletionBitmap = NULL;
+
+    if (stripeIndex >= deleteState->stripeCount) {
+        ereport(ERROR, (errmsg("invalid row id " UINT64_FORMAT, rowId)));
+    }
+
+    deletionBitmap = deleteState->deletionBitmapArray[stripeIndex];
+    if (deletionBitmap == NULL) {
+        deletionBitmap = makeStringInfo();
+        deleteState->deletionBitmapArray[stripeIndex] = deletionBitmap;
+    }
+
+    /* grow the bitmap with zero bytes until it covers the row */
+    while ((uint32) deletionBitmap->len <= byteIndex) {
+        appendStringInfoCharMacro(deletionBitmap, 0);
+    }
+
+    deletionBitmap->data[byteIndex] |= (1 << bitIndex);
+}
+
+
+/*
+ * CStoreEndDelete finishes a cstore delete operation. For each stripe with
+ * deleted rows, we merge the rows deleted now into the stripe's previous
+ * deletion bitmap, and append the merged bitmap to the deletion file. Previous
+ * bitmaps are left in place; only the footer references the new ones. Last, we
+ * sync the deletion file, and atomically replace the footer file.
+ */
+void
+CStoreEndDelete(TableDeleteState *deleteState) {
+    FILE *deletionFile = NULL;
+    uint32 stripeIndex = 0;
+    bool rowsDeleted = false;
+
+    for (stripeIndex = 0; stripeIndex < deleteState->stripeCount; stripeIndex++) {
+        if (deleteState->deletionBitmapArray[stripeIndex] != NULL) {
+            rowsDeleted = true;
+            break;
+        }
+    }
+
+    if (rowsDeleted) {
+        deletionFile = AllocateFile(deleteState->deletionFilename->data, "a+b");
+        if (deletionFile == NULL) {
+            ereport(ERROR, (errcode_for_file_access(),
+                    errmsg("could not open file \"%s\" for writing: %m",
+                           deleteState->deletionFilename->data)));
+        }
+
+        for (stripeIndex = 0; stripeIndex < deleteState->stripeCount; stripeIndex++) {
+            StringInfo deletionBitmap = deleteState->deletionBitmapArray[stripeIndex];
+            StripeMetadata *stripeMetadata = NULL;
+            int fseekResult = 0;
+            off_t deletionBitmapOffset = 0;
+
+            if (deletionBitmap == NULL) {
+                continue;
+            }
+
+            stripeMetadata = list_nth(deleteState->tableFooter->stripeMetadataList,
+                                      stripeIndex);
+            if (stripeMetadata->deletedRowCount > 0) {
+                StringInfo previousBitmap = ReadDeletionBitmap(deletionFile,
+                                                               stripeMetadata);
+                int byteIndex = 0;
+
+                while (deletionBitmap->len < previousBitmap->len) {
+                    appendStringInfoCharMacro(deletionBitmap, 0);
+                }
+
+                for (byteIndex = 0; byteIndex < previousBitmap->len; byteIndex++) {
+                    deletionBitmap->data[byteIndex] |= previousBitmap->data[byteIndex];
+                }
+            }
+
+            /* switching from reading to writing requires a seek */
+            errno = 0;
+            fseekResult = fseeko(deletionFile, 0, SEEK_END);
+            if (fseekResult != 0) {
+                ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not seek in file \"%s\": %m",
+                               deleteState->deletionFilename->data)));
+            }
+
+            deletionBitmapOffset = ftello(deletionFile);
+            WriteToFile(deletionFile, deletionBitmap->data, deletionBitmap->len);
+
+            stripeMetadata->deletedRowCount = DeletionBitmapRowCount(deletionBitmap);
+            stripeMetadata->deletionBitmapOffset = deletionBitmapOffset;
+            stripeMetadata->deletionBitmapLength = deletionBitmap->len;
+        }
+
+        SyncAndCloseFile(deletionFile);
+
+        ReplaceTableFooter(deleteState->tableFooterFilename, deleteState->tableFooter);
+    }
+
+    list_free_deep(deleteState->tableFooter->stripeMetadataList);
+    pfree(deleteState->tableFooter);
+    pfree(deleteState->tableFooterFilename->data);
+    pfree(deleteState->tableFooterFilename);
+    pfree(deleteState->deletionFilename->data);
+    pfree(deleteState->deletionFilename);
+    pfree(deleteState);
+}
+
+
+/*
+ * CStoreDropStripesBefore drops the stripes in which all values of the given
+ * column are less than the given value, and returns the number of dropped
+ * stripes. We find these stripes using the column's min/max values in stripe
+ * skip lists, and drop them by removing them from the table footer. Stripes
+ * are not moved, so the remaining stripes' offsets stay valid. Last, we free
+ * the disk space of dropped stripes where the file system lets us.
+ *
+ * The caller should hold a lock that blocks both readers and writers, since
+ * concurrent scans could still read the dropped stripes.
+ */
+uint64
+CStoreDropStripesBefore(const char *filename, TupleDesc tupleDescriptor,
+                        uint32 columnIndex, Datum value) {
+    TableReadState *readState = NULL;
+    StripeSkipList *stripeSkipList = NULL;
+    StringInfo tableFooterFilename = NULL;
+    List *keptStripeList = NIL;
+    List *droppedStripeList = NIL;
+    uint64 droppedStripeCount = 0;
+    Form_pg_attribute attributeForm = tupleDescriptor->attrs[columnIndex];
+    FmgrInfo *comparisonFunction = GetFunctionInfoOrNull(attributeForm->atttypid,
+                                                         BTREE_AM_OID, BTORDER_PROC);
+    if (comparisonFunction == NULL) {
+        ereport(ERROR, (errcode(ERRCODE_UNDEFINED_FUNCTION),
+                errmsg("could not identify a comparison function for type %s",
+                       format_type_be(attributeForm->atttypid))));
+    }
+
+    readState = CStoreBeginRead(filename, tupleDescriptor, NIL, NIL);
+
+    while ((stripeSkipList = CStoreReadNextStripeSkipList(readState)) != NULL) {
+        StripeMetadata *stripeMetadata = readState->stripeMetadata;
+        bool stripeValuesBefore = StripeValuesBefore(stripeSkipList, columnIndex, value,
+                                                     attributeForm->attcollation,
+                                                     comparisonFunction);
+        if (stripeValuesBefore) {
+            droppedStripeList = lappend(droppedStripeList, stripeMetadata);
+        } else {
+            keptStripeList = lappend(keptStripeList, stripeMetadata);
+        }
+    }
+
+    droppedStripeCount = list_length(droppedStripeList);
+    if (droppedStripeCount > 0) {
+        tableFooterFilename = makeStringInfo();
+        appendStringInfo(tableFooterFilename, "%s%s", filename,
+                         CSTORE_FOOTER_FILE_SUFFIX);
+
+        readState->tableFooter->stripeMetadataList = keptStripeList;
+        ReplaceTableFooter(tableFooterFilename, readState->tableFooter);
+
+        /* the footer no longer references dropped stripes, so free their space */
+        PunchStripeHoles(filename, droppedStripeList);
+    }
+
+    CStoreEndRead(readState);
+
+    return droppedStripeCount;
+}
+
+
+/*
+ * StripeValuesBefore checks if all of the stripe's values in the given column
+ * are less than the given value. Null values are never before the value, so we
+ * only consider blocks that we know to have no nulls.
+ */
+static bool
+StripeValuesBefore(StripeSkipList *stripeSkipList, uint32 columnIndex, Datum value,
+                   Oid columnCollation, FmgrInfo *comparisonFunction) {
+    ColumnBlockSkipNode *blockSkipNodeArray =
+            stripeSkipList->blockSkipNodeArray[columnIndex];
+    uint32 blockIndex = 0;
+
+    if (stripeSkipList->blockCount == 0) {
+        return false;
+    }
+
+    for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++) {
+        ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+        int comparison = 0;
+
+        if (!blockSkipNode->hasMinMax || !blockSkipNode->hasNonNullCount ||
+            blockSkipNode->nonNullCount != blockSkipNode->rowCount) {
+            return false;
+        }
+
+        comparison = CompareColumnValues(blockSkipNode->maximumValue, value,
+                                         columnCollation, comparisonFunction);
+        if (comparison >= 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*
+ * CompareColumnValues compares the given values with the column's btree
+ * comparison function. Text in the C or POSIX collation sorts by its bytes, so
+ * we compare these values in place with memcmp, and skip both the function
+ * call and detoasting. Compressed or external values still go through the
+ * comparison function.
+ */
+static int
+CompareColumnValues(Datum leftValue, Datum rightValue, Oid columnCollation,
+                    FmgrInfo *comparisonFunction) {
+    struct varlena *leftText = (struct varlena *) DatumGetPointer(leftValue);
+    struct varlena *rightText = (struct varlena *) DatumGetPointer(rightValue);
+    Datum comparisonDatum = 0;
+
+    if (comparisonFunction->fn_oid == F_BTTEXTCMP &&
+        !VARATT_IS_COMPRESSED(leftText) && !VARATT_IS_EXTERNAL(leftText) &&
+        !VARATT_IS_COMPRESSED(rightText) && !VARATT_IS_EXTERNAL(rightText) &&
+        OidIsValid(columnCollation) && lc_collate_is_c(columnCollation)) {
+        uint32 leftLength = VARSIZE_ANY_EXHDR(leftText);
+        uint32 rightLength = VARSIZE_ANY_EXHDR(rightText);
+        int comparison = memcmp(VARDATA_ANY(leftText), VARDATA_ANY(rightText),
+                                Min(leftLength, rightLength));
+        if (comparison == 0 && leftLength != rightLength) {
+            comparison = (leftLength < rightLength) ? -1 : 1;
+        }
+
+        return comparison;
+    }
+
+    comparisonDatum = FunctionCall2Coll(comparisonFunction, columnCollation,
+                                        leftValue, rightValue);
+
+    return DatumGetInt32(comparisonDatum);
+}
+
+
+/*
+ * PunchStripeHoles deallocates the file ranges of the given stripes, keeping
+ * the file size the same. If the platform or file system doesn't support
+ * punching holes, the space is reused only when the table is reloaded.
+ */
+static void
+PunchStripeHoles(const char *filename, List *stripeMetadataList) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+    ListCell *stripeMetadataCell = NULL;
+    int fileDescriptor = OpenTransientFile((char *) filename, O_RDWR | PG_BINARY, 0);
+    if (fileDescriptor < 0) {
+        ereport(ERROR, (errcode_for_file_access(),
+                errmsg("could not open file \"%s\": %m", filename)));
+    }
+
+    foreach(stripeMetadataCell, stripeMetadataList) {
+        StripeMetadata *stripeMetadata = lfirst(stripeMetadataCell);
+        uint64 stripeSize = stripeMetadata->skipListLength +
+                            stripeMetadata->dataLength +
+                            stripeMetadata->footerLength;
+        int fallocateResult = fallocate(fileDescriptor,
+                                        FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                        stripeMetadata->fileOffset, stripeSize);
+        if (fallocateResult != 0 && errno == EOPNOTSUPP) {
+            break;
+        } else if (fallocateResult != 0) {
+            ereport(WARNING, (errcode_for_file_access(),
+                    errmsg("could not free space in file \"%s\": %m", filename)));
+            break;
+        }
+    }
+
+    CloseTransientFile(fileDescriptor);
+#endif
+}
+
+
+/*
+ * ReplaceTableFooter flushes the footer to a temporary file, and atomically
+ * renames this temporary file to the given footer file.
+ */
+static void
+ReplaceTableFooter(StringInfo tableFooterFilename, TableFooter *tableFooter) {
+    StringInfo tempTableFooterFileName = NULL;
+    int renameResult = 0;
+
     tempTableFooterFileName = makeStringInfo();
     appendStringInfo(tempTableFooterFileName, "%s%s", tableFooterFilename->data,
                      CSTORE_TEMP_FILE_SUFFIX);
 
-    CStoreWriteFooter(tempTableFooterFileName, writeState->tableFooter);
+    CStoreWriteFooter(tempTableFooterFileName, tableFooter);
 
     renameResult = rename(tempTableFooterFileName->data, tableFooterFilename->data);
     if (renameResult != 0) {
@@ -315,14 +843,55 @@ CStoreEndWrite(TableWriteState *writeState) {
 
     pfree(tempTableFooterFileName->data);
     pfree(tempTableFooterFileName);
+}
 
-    MemoryContextDelete(writeState->stripeWriteContext);
-    list_free_deep(writeState->tableFooter->stripeMetadataList);
-    pfree(writeState->tableFooter);
-    pfree(writeState->tableFooterFilename->data);
-    pfree(writeState->tableFooterFilename);
-    pfree(writeState->comparisonFunctionArray);
-    pfree(writeState);
+
+/* ReadDeletionBitmap reads the stripe's current deletion bitmap. */
+static StringInfo
+ReadDeletionBitmap(FILE *deletionFile, StripeMetadata *stripeMetadata) {
+    StringInfo deletionBitmap = makeStringInfo();
+    uint32 deletionBitmapLength = stripeMetadata->deletionBitmapLength;
+    int fseekResult = 0;
+    int freadResult = 0;
+
+    enlargeStringInfo(deletionBitmap, deletionBitmapLength);
+    deletionBitmap->len = deletionBitmapLength;
+
+    if (deletionBitmapLength == 0) {
+        return deletionBitmap;
+    }
+
+    errno = 0;
+    fseekResult = fseeko(deletionFile, stripeMetadata->deletionBitmapOffset, SEEK_SET);
+    if (fseekResult != 0) {
+        ereport(ERROR, (errcode_for_file_access(),
+                errmsg("could not seek in file: %m")));
+    }
+
+    freadResult = fread(deletionBitmap->data, deletionBitmapLength, 1, deletionFile);
+    if (freadResult != 1) {
+        ereport(ERROR, (errmsg("could not read enough data from file")));
+    }
+
+    return deletionBitmap;
+}
+
+
+/* DeletionBitmapRowCount counts the rows marked in the given deletion bitmap. */
+static uint64
+DeletionBitmapRowCount(StringInfo deletionBitmap) {
+    uint64 deletedRowCount = 0;
+    int byteIndex = 0;
+
+    for (byteIndex = 0; byteIndex < deletionBitmap->len; byteIndex++) {
+        uint8 bitmapByte = (uint8) deletionBitmap->data[byteIndex];
+        while (bitmapByte != 0) {
+            deletedRowCount += (bitmapByte & 1);
+            bitmapByte >>= 1;
+        }
+    }
+
+    return deletedRowCount;
 }
 
 
@@ -369,61 +938,51 @@ CStoreWriteFooter(StringInfo tableFooterFilename, TableFooter *tableFooter) {
 
 
 /*
- * CreateEmptyStripeData allocates an empty StripeData structure with the given
- * column count. This structure has enough capacity to hold stripeMaxRowCount rows.
+ * CreateEmptyStripeBuffers allocates an empty StripeBuffers structure with the
+ * given column count. Buffers for individual blocks are added on demand by
+ * AddStripeBlock as rows are written.
  */
-static StripeData *
-CreateEmptyStripeData(uint32 stripeMaxRowCount, uint32 blockRowCount,
-                      uint32 columnCount) {
-    StripeData *stripeData = NULL;
+static StripeBuffers *
+CreateEmptyStripeBuffers(uint32 columnCount) {
+    StripeBuffers *stripeBuffers = NULL;
     uint32 columnIndex = 0;
-    uint32 maxBlockCount = (stripeMaxRowCount / blockRowCount) + 1;
+    uint32 blockCapacity = 1;
 
-    ColumnData **columnDataArray = palloc0(columnCount * sizeof(ColumnData *));
+    ColumnBuffers **columnBuffersArray = palloc0(columnCount * sizeof(ColumnBuffers *));
     for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
-        uint32 blockIndex = 0;
-        ColumnBlockData **blockDataArray = NULL;
+        ColumnBlockBuffers **blockBuffersArray =
+                palloc0(blockCapacity * sizeof(ColumnBlockBuffers *));
 
-        blockDataArray = palloc0(maxBlockCount * sizeof(ColumnBlockData *));
-        for (blockIndex = 0; blockIndex < maxBlockCount; blockIndex++) {
-            bool *existsArray = palloc0(blockRowCount * sizeof(bool));
-            Datum *valueArray = palloc0(blockRowCount * sizeof(Datum));
-
-            blockDataArray[blockIndex] = palloc0(sizeof(ColumnBlockData));
-            blockDataArray[blockIndex]->existsArray = existsArray;
-            blockDataArray[blockIndex]->valueArray = valueArray;
-        }
-
-        columnDataArray[columnIndex] = palloc0(sizeof(ColumnData));
-        columnDataArray[columnIndex]->blockDataArray = blockDataArray;
+        columnBuffersArray[columnIndex] = palloc0(sizeof(ColumnBuffers));
+        columnBuffersArray[columnIndex]->blockBuffersArray = blockBuffersArray;
     }
 
-    stripeData = palloc0(sizeof(StripeData));
-    stripeData->columnDataArray = columnDataArray;
-    stripeData->columnCount = columnCount;
-    stripeData->rowCount = 0;
+    stripeBuffers = palloc0(sizeof(StripeBuffers));
+    stripeBuffers->columnBuffersArray = columnBuffersArray;
+    stripeBuffers->columnCount = columnCount;
+    stripeBuffers->blockCapacity = blockCapacity;
+    stripeBuffers->rowCount = 0;
 
-    return stripeData;
+    return stripeBuffers;
 }
 
 
 /*
  * CreateEmptyStripeSkipList allocates an empty StripeSkipList structure with
- * the given column count. This structure has enough blocks to hold statistics
- * for stripeMaxRowCount rows.
+ * the given column count. Like stripe buffers, the skip node arrays start with
+ * room for a single block and grow in AddStripeBlock.
  */
 static StripeSkipList *
-CreateEmptyStripeSkipList(uint32 stripeMaxRowCount, uint32 blockRowCount,
-                          uint32 columnCount) {
+CreateEmptyStripeSkipList(uint32 columnCount) {
     StripeSkipList *stripeSkipList = NULL;
     uint32 columnIndex = 0;
-    uint32 maxBlockCount = (stripeMaxRowCount / blockRowCount) + 1;
+    uint32 blockCapacity = 1;
 
     ColumnBlockSkipNode **blockSkipNodeArray =
             palloc0(columnCount * sizeof(ColumnBlockSkipNode *));
     for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
         blockSkipNodeArray[columnIndex] =
-                palloc0(maxBlockCount * sizeof(ColumnBlockSkipNode));
+                palloc0(blockCapacity * sizeof(ColumnBlockSkipNode));
     }
 
     stripeSkipList = palloc0(sizeof(StripeSkipList));
@@ -435,6 +994,126 @@ CreateEmptyStripeSkipList(uint32 stripeMaxRowCount, uint32 blockRowCount,
 }
 
 
+/*
+ * ShredColumnValues copies the given row's values into the write state's row
+ * arrays, and extracts the values of shredded columns after them. We call the
+ * same functions as the ->> operator, so keys that are missing, or whose parent
+ * value isn't an object, are stored as nulls.
+ */
+static void
+ShredColumnValues(TableWriteState *writeState, Datum *columnValues, bool *columnNulls) {
+    uint32 tableColumnCount = writeState->tableColumnCount;
+    uint32 columnIndex = tableColumnCount;
+    ListCell *shreddedColumnCell = NULL;
+    MemoryContext oldContext = NULL;
+
+    memcpy(writeState->rowValueArray, columnValues, tableColumnCount * sizeof(Datum));
+    memcpy(writeState->rowNullArray, columnNulls, tableColumnCount * sizeof(bool));
+
+    /* values of the previous row have already been serialized */
+    MemoryContextReset(writeState->shreddingContext);
+    oldContext = MemoryContextSwitchTo(writeState->shreddingContext);
+
+    foreach(shreddedColumnCell, writeState->shreddedColumnList) {
+        ShreddedColumn *shreddedColumn = lfirst(shreddedColumnCell);
+        uint32 parentIndex = shreddedColumn->attributeNumber - 1;
+        FmgrInfo *shreddingFunction =
+                &writeState->shreddingFunctionArray[columnIndex - tableColumnCount];
+        FunctionCallInfoData functionCallInfo;
+        Datum columnValue = 0;
+
+        writeState->rowValueArray[columnIndex] = (Datum) 0;
+        writeState->rowNullArray[columnIndex] = true;
+
+        if (!columnNulls[parentIndex]) {
+            InitFunctionCallInfoData(functionCallInfo, shreddingFunction, 2,
+                                     InvalidOid, NULL, NULL);
+            functionCallInfo.arg[0] = columnValues[parentIndex];
+            functionCallInfo.arg[1] = CStringGetTextDatum(shreddedColumn->path);
+            functionCallInfo.argnull[0] = false;
+            functionCallInfo.argnull[1] = false;
+
+            columnValue = FunctionCallInvoke(&functionCallInfo);
+            if (!functionCallInfo.isnull) {
+                writeState->rowValueArray[columnIndex] = columnValue;
+                writeState->rowNullArray[columnIndex] = false;
+            }
+        }
+
+        columnIndex++;
+    }
+
+    MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * AddStripeBlock prepares the stripe buffers and skip list for writing the
+ * block with the given index. If the block slot arrays are full, the function
+ * doubles their capacity. The function then creates buffers for the block, or
+ * resets the buffers left over from a previously flushed stripe so that their
+ * memory gets reused. Callers should switch to the stripe buffer context.
+ */
+static void
+AddStripeBlock(StripeBuffers *stripeBuffers, StripeSkipList *stripeSkipList,
+               uint32 blockIndex) {
+    uint32 columnIndex = 0;
+    uint32 columnCount = stripeBuffers->columnCount;
+
+    if (blockIndex >= stripeBuffers->blockCapacity) {
+        uint32 oldBlockCapacity = stripeBuffers->blockCapacity;
+        uint32 newBlockCapacity = Max(oldBlockCapacity * 2, blockIndex + 1);
+        uint32 addedBlockCount = newBlockCapacity - oldBlockCapacity;
+
+        for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
+            ColumnBuffers *columnBuffers = stripeBuffers->columnBuffersArray[columnIndex];
+            ColumnBlockBuffers **blockBuffersArray = columnBuffers->blockBuffersArray;
+            ColumnBlockSkipNode *blockSkipNodeArray =
+                    stripeSkipList->blockSkipNodeArray[columnIndex];
+
+            blockBuffersArray = repalloc(blockBuffersArray, newBlockCapacity *
+                                                            sizeof(ColumnBlockBuffers *));
+            memset(blockBuffersArray + oldBlockCapacity, 0,
+                   addedBlockCount * sizeof(ColumnBlockBuffers *));
+
+            blockSkipNodeArray = repalloc(blockSkipNodeArray, newBlockCapacity *
+                                                              sizeof(ColumnBlockSkipNode));
+
+            columnBuffers->blockBuffersArray = blockBuffersArray;
+            stripeSkipList->blockSkipNodeArray[columnIndex] = blockSkipNodeArray;
+        }
+
+        stripeBuffers->blockCapacity = newBlockCapacity;
+    }
+
+    for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
+        ColumnBuffers *columnBuffers = stripeBuffers->columnBuffersArray[columnIndex];
+        ColumnBlockBuffers *blockBuffers = columnBuffers->blockBuffersArray[blockIndex];
+        ColumnBlockSkipNode *blockSkipNode =
+                &stripeSkipList->blockSkipNodeArray[columnIndex][blockIndex];
+
+        if (blockBuffers == NULL) {
+            blockBuffers = palloc0(sizeof(ColumnBlockBuffers));
+            blockBuffers->existsBuffer = makeStringInfo();
+            blockBuffers->valueBuffer = makeStringInfo();
+            blockBuffers->offsetBuffer = makeStringInfo();
+            blockBuffers->blobBuffer = makeStringInfo();
+
+            columnBuffers->blockBuffersArray[blockIndex] = blockBuffers;
+        } else {
+            resetStringInfo(blockBuffers->existsBuffer);
+            resetStringInfo(blockBuffers->valueBuffer);
+            resetStringInfo(blockBuffers->offsetBuffer);
+            resetStringInfo(blockBuffers->blobBuffer);
+        }
+
+        memset(blockSkipNode, 0, sizeof(ColumnBlockSkipNode));
+    }
+
+    stripeSkipList->blockCount = blockIndex + 1;
+}
+
+
 /*
  * FlushStripe compresses the data in the current stripe, flushes the compressed
  * data into the file, and returns the stripe metadata. To do this, the function
@@ -445,7 +1124,7 @@ CreateEmptyStripeSkipList(uint32 stripeMaxRowCount, uint32 blockRowCount,
  */
 static StripeMetadata
 FlushStripe(TableWriteState *writeState) {
-    StripeMetadata stripeMetadata = {0, 0, 0, 0};
+    StripeMetadata stripeMetadata = {0, 0, 0, 0, 0, 0, 0};
     uint64 skipListLength = 0;
     uint64 dataLength = 0;
     StringInfo **existsBufferArray = NULL;
@@ -454,29 +1133,83 @@ FlushStripe(TableWriteState *writeState) {
     StringInfo *skipListBufferArray = NULL;
     StripeFooter *stripeFooter = NULL;
     StringInfo stripeFooterBuffer = NULL;
+    StringInfo emptyExistsBuffer = NULL;
+    bool *storedColumnMask = NULL;
     uint32 columnIndex = 0;
     uint32 blockIndex = 0;
 
     FILE *tableFile = writeState->tableFile;
-    StripeData *stripeData = writeState->stripeData;
+    StripeBuffers *stripeBuffers = writeState->stripeBuffers;
     StripeSkipList *stripeSkipList = writeState->stripeSkipList;
-    CompressionType compressionType = writeState->compressionType;
     TupleDesc tupleDescriptor = writeState->tupleDescriptor;
     uint32 columnCount = tupleDescriptor->natts;
     uint32 blockCount = stripeSkipList->blockCount;
 
-    /* create "exists" and "value" buffers */
-    existsBufferArray = CreateExistsBufferArray(stripeData->columnDataArray,
-                                                stripeSkipList);
-    valueBufferArray = CreateValueBufferArray(stripeData->columnDataArray,
-                                              stripeSkipList, tupleDescriptor);
+    /* we don't store dropped columns in new stripes */
+    storedColumnMask = StoredColumnMask(tupleDescriptor);
+
+    /*
+     * Collect "exists" and "value" buffers. These are already serialized, so we
+     * only gather pointers to them here. Compressed value buffers below replace
+     * entries of valueBufferArray, leaving the reusable block buffers intact.
+     * Blocks without nulls or with only nulls don't need an "exists" buffer, as
+     * their skip nodes' non-null counts tell which values exist. Offset and
+     * dictionary value streams are the only ones we assemble here, from their
+     * offsets and values; blocks with few distinct values get dictionaries.
+     */
+    emptyExistsBuffer = makeStringInfo();
+    existsBufferArray = palloc0(columnCount * sizeof(StringInfo *));
+    valueBufferArray = palloc0(columnCount * sizeof(StringInfo *));
+    for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
+        ColumnBuffers *columnBuffers = stripeBuffers->columnBuffersArray[columnIndex];
+        ColumnBlockSkipNode *blockSkipNodeArray =
+                stripeSkipList->blockSkipNodeArray[columnIndex];
+
+        existsBufferArray[columnIndex] = palloc0(blockCount * sizeof(StringInfo));
+        valueBufferArray[columnIndex] = palloc0(blockCount * sizeof(StringInfo));
+        for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+            ColumnBlockBuffers *blockBuffers = columnBuffers->blockBuffersArray[blockIndex];
+            ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+
+            if (BlockExistsImplied(blockSkipNode)) {
+                existsBufferArray[columnIndex][blockIndex] = emptyExistsBuffer;
+            } else {
+                existsBufferArray[columnIndex][blockIndex] = blockBuffers->existsBuffer;
+            }
+
+            blockSkipNode->valueFormat = ColumnValueFormat(writeState, columnIndex);
+            valueBufferArray[columnIndex][blockIndex] = blockBuffers->valueBuffer;
+
+            if (storedColumnMask[columnIndex] &&
+                blockSkipNode->valueFormat == VALUE_FORMAT_OFFSETS) {
+                StringInfo dictionaryValueBuffer =
+                        CreateDictionaryValueBuffer(blockBuffers,
+                                                    tupleDescriptor->attrs[columnIndex]);
+
+                if (dictionaryValueBuffer != NULL) {
+                    valueBufferArray[columnIndex][blockIndex] = dictionaryValueBuffer;
+                    blockSkipNode->valueFormat = VALUE_FORMAT_DICTIONARY;
+                } else {
+                    valueBufferArray[columnIndex][blockIndex] =
+                            CreateOffsetValueBuffer(blockBuffers->offsetBuffer,
+                                                    blockBuffers->valueBuffer);
+                }
+            }
+        }
+    }
 
     valueCompressionTypeArray = palloc0(columnCount * sizeof(CompressionType *));
     for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
         CompressionType *blockCompressionTypeArray =
                 palloc0(blockCount * sizeof(CompressionType));
+        CompressionType compressionType =
+                writeState->columnCompressionTypeArray[columnIndex];
         valueCompressionTypeArray[columnIndex] = blockCompressionTypeArray;
 
+        if (!storedColumnMask[columnIndex]) {
+            continue;
+        }
+
         for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
             StringInfo valueBuffer = NULL;
             uint64 maximumLength = 0;
@@ -488,23 +1221,45 @@ FlushStripe(TableWriteState *writeState) {
                 continue;
             }
 
-            /* the only other supported compression type is pg_lz for now */
             Assert((compressionType == COMPRESSION_PG_LZ) || (compressionType == COMPRESSION_LZ4) ||
-                   compressionType == COMPRESSION_ENC_LZ4);
+                   compressionType == COMPRESSION_ENC_LZ4 ||
+                   compressionType == COMPRESSION_GORILLA ||
+                   compressionType == COMPRESSION_DELTA);
             valueBuffer = valueBufferArray[columnIndex][blockIndex];
-            if (compressionType == COMPRESSION_PG_LZ) {
+            if (compressionType == COMPRESSION_GORILLA ||
+                compressionType == COMPRESSION_DELTA) {
+                StringInfo compressedBuffer = makeStringInfo();
+                int16 valueWidth = tupleDescriptor->attrs[columnIndex]->attlen;
+
+                if (compressionType == COMPRESSION_GORILLA) {
+                    compressable = GorillaCompress(valueBuffer->data, valueBuffer->len,
+                                                   compressedBuffer);
+                } else {
+                    compressable = DeltaCompress(valueBuffer->data, valueBuffer->len,
+                                                 valueWidth, compressedBuffer);
+                }
+
+                if (compressable) {
+                    valueBufferArray[columnIndex][blockIndex] = compressedBuffer;
+                    blockCompressionTypeArray[blockIndex] = compressionType;
+                } else {
+                    pfree(compressedBuffer->data);
+                    pfree(compressedBuffer);
+                    blockCompressionTypeArray[blockIndex] = COMPRESSION_NONE;
+                }
+            } else if (compressionType == COMPRESSION_PG_LZ) {
                 maximumLength = PGLZ_MAX_OUTPUT(valueBuffer->len);
                 compressedData = palloc0(maximumLength);
                 compressable = pglz_compress((const char *) valueBuffer->data,
                                              valueBuffer->len, compressedData,
                                              PGLZ_strategy_always);
                 if (compressable) {
-                    pfree(valueBuffer->data);
-
+                    valueBuffer = palloc0(sizeof(StringInfoData));
                     valueBuffer->data = (char *) compressedData;
                     valueBuffer->len = VARSIZE(compressedData);
                     valueBuffer->maxlen = maximumLength;
 
+                    valueBufferArray[columnIndex][blockIndex] = valueBuffer;
                     blockCompressionTypeArray[blockIndex] = COMPRESSION_PG_LZ;
                 } else {
                     pfree(compressedData);
@@ -522,10 +1277,11 @@ FlushStripe(TableWriteState *writeState) {
                 if (compressed_bytes > 0) {
                     CSTORE_COMPRESS_SET_RAWSIZE_LZ4(compressedData, valueBuffer->len);
                     ((LZ4CompressHeader *) compressedData)->comp_len = compressed_bytes;
-                    pfree(valueBuffer->data);
+                    valueBuffer = palloc0(sizeof(StringInfoData));
                     valueBuffer->data = (char *) compressedData;
                     valueBuffer->len = compressed_bytes + CSTORE_COMPRESS_HDRSZ_LZ4;
                     valueBuffer->maxlen = maximumLength;
+                    valueBufferArray[columnIndex][blockIndex] = valueBuffer;
                     blockCompressionTypeArray[blockIndex] = COMPRESSION_LZ4;
                 } else {
                     pfree(compressedData);
@@ -551,9 +1307,13 @@ FlushStripe(TableWriteState *writeState) {
                 }
                 sgxErrorHandler(resp);
                 if (enc_len > 0) {
-                    pfree(valueBuffer->data);
+                    int maximumLength = valueBuffer->maxlen;
+
+                    valueBuffer = palloc0(sizeof(StringInfoData));
                     valueBuffer->data = (char *) compressedData;
                     valueBuffer->len = enc_len;
+                    valueBuffer->maxlen = maximumLength;
+                    valueBufferArray[columnIndex][blockIndex] = valueBuffer;
                     blockCompressionTypeArray[blockIndex] = actualCompressionType;
                 } else {
                     pfree(compressedData);
@@ -563,8 +1323,12 @@ FlushStripe(TableWriteState *writeState) {
         }
     }
 
-    /* update buffer sizes and positions in stripe skip list */
+    /*
+     * Update buffer sizes and positions in stripe skip list, and bound the size
+     * of the min/max values we store there.
+     */
     for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
+        ColumnBuffers *columnBuffers = stripeBuffers->columnBuffersArray[columnIndex];
         ColumnBlockSkipNode **columnSkipNodeArray = stripeSkipList->blockSkipNodeArray;
         ColumnBlockSkipNode *blockSkipNodeArray = columnSkipNodeArray[columnIndex];
         uint32 blockCount = stripeSkipList->blockCount;
@@ -575,24 +1339,33 @@ FlushStripe(TableWriteState *writeState) {
         for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
             uint64 existsBufferSize = existsBufferArray[columnIndex][blockIndex]->len;
             uint64 valueBufferSize = valueBufferArray[columnIndex][blockIndex]->len;
+            uint64 blobBufferSize =
+                    columnBuffers->blockBuffersArray[blockIndex]->blobBuffer->len;
             CompressionType valueCompressionType =
                     valueCompressionTypeArray[columnIndex][blockIndex];
             ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
 
+            TruncateBlockSkipNodeMinMax(blockSkipNode, tupleDescriptor->attrs[columnIndex],
+                                        writeState->comparisonFunctionArray[columnIndex]);
+
             blockSkipNode->existsBlockOffset = currentExistsBlockOffset;
             blockSkipNode->existsLength = existsBufferSize;
             blockSkipNode->valueBlockOffset = currentValueBlockOffset;
             blockSkipNode->valueLength = valueBufferSize;
+            blockSkipNode->blobLength = blobBufferSize;
             blockSkipNode->valueCompressionType = valueCompressionType;
 
             currentExistsBlockOffset += existsBufferSize;
-            currentValueBlockOffset += valueBufferSize;
+            currentValueBlockOffset += valueBufferSize + blobBufferSize;
         }
     }
 
     /* create skip list and footer buffers */
-    skipListBufferArray = CreateSkipListBufferArray(stripeSkipList, tupleDescriptor);
-    stripeFooter = CreateStripeFooter(stripeSkipList, skipListBufferArray);
+    skipListBufferArray = CreateSkipListBufferArray(stripeSkipList, tupleDescriptor,
+                                                    storedColumnMask);
+    stripeFooter = CreateStripeFooter(stripeSkipList, skipListBufferArray,
+                                      storedColumnMask, writeState->tableColumnCount,
+                                      writeState->shreddedColumnList);
     stripeFooterBuffer = SerializeStripeFooter(stripeFooter);
 
     /*
@@ -606,26 +1379,37 @@ FlushStripe(TableWriteState *writeState) {
      * present values. For each column, we first store all "exists" buffers,
      * and then all "value" buffers.
      * (3) Stripe footer, which contains the skip list buffer size, exists buffer
-     * size, and value buffer size for each of the columns.
+     * size, and value buffer size for each of the stored columns, and the ids
+     * of these columns.
      *
      * We start by flushing the skip list buffers.
      */
     for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
         StringInfo skipListBuffer = skipListBufferArray[columnIndex];
-        WriteToFile(tableFile, skipListBuffer->data, skipListBuffer->len);
+        if (storedColumnMask[columnIndex]) {
+            WriteToFile(tableFile, skipListBuffer->data, skipListBuffer->len);
+        }
     }
 
     /* then, we flush the data buffers */
     for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
         uint32 blockIndex = 0;
+        if (!storedColumnMask[columnIndex]) {
+            continue;
+        }
+
         for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++) {
             StringInfo existsBuffer = existsBufferArray[columnIndex][blockIndex];
             WriteToFile(tableFile, existsBuffer->data, existsBuffer->len);
         }
 
         for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++) {
+            ColumnBuffers *columnBuffers = stripeBuffers->columnBuffersArray[columnIndex];
             StringInfo valueBuffer = valueBufferArray[columnIndex][blockIndex];
+            StringInfo blobBuffer = columnBuffers->blockBuffersArray[blockIndex]->blobBuffer;
+
             WriteToFile(tableFile, valueBuffer->data, valueBuffer->len);
+            WriteToFile(tableFile, blobBuffer->data, blobBuffer->len);
         }
     }
 
@@ -633,7 +1417,7 @@ FlushStripe(TableWriteState *writeState) {
     WriteToFile(tableFile, stripeFooterBuffer->data, stripeFooterBuffer->len);
 
     /* set stripe metadata */
-    for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
+    for (columnIndex = 0; columnIndex < stripeFooter->columnCount; columnIndex++) {
         skipListLength += stripeFooter->skipListSizeArray[columnIndex];
         dataLength += stripeFooter->existsSizeArray[columnIndex];
         dataLength += stripeFooter->valueSizeArray[columnIndex];
@@ -654,89 +1438,57 @@ FlushStripe(TableWriteState *writeState) {
 
 
 /*
- * CreateExistsBufferArray serializes  the "exists" arrays of stripe data for
- * each columnIndex and blockIndex combination and returns the result as a two
- * dimensional array.
+ * StoredColumnMask returns which of the table's columns we store in stripes.
+ * Dropped columns are only null, and are never read, so we leave them out. We
+ * need the block row counts of at least one column though, so if all columns
+ * are dropped, we keep the first one.
  */
-static StringInfo **
-CreateExistsBufferArray(ColumnData **columnDataArray,
-                        StripeSkipList *stripeSkipList) {
-    StringInfo **existsBufferArray = NULL;
+static bool *
+StoredColumnMask(TupleDesc tupleDescriptor) {
+    uint32 columnCount = tupleDescriptor->natts;
+    bool *storedColumnMask = palloc0(columnCount * sizeof(bool));
+    bool columnStored = false;
     uint32 columnIndex = 0;
-    uint32 columnCount = stripeSkipList->columnCount;
-    uint32 blockCount = stripeSkipList->blockCount;
-    ColumnBlockSkipNode **blockSkipNodeArray = stripeSkipList->blockSkipNodeArray;
 
-    existsBufferArray = palloc0(columnCount * sizeof(StringInfo *));
     for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
-        uint32 blockIndex = 0;
-
-        existsBufferArray[columnIndex] = palloc0(blockCount * sizeof(StringInfo));
-        for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
-            ColumnData *columnData = columnDataArray[columnIndex];
-            ColumnBlockData *blockData = columnData->blockDataArray[blockIndex];
-            ColumnBlockSkipNode *blockSkipNode =
-                    &blockSkipNodeArray[columnIndex][blockIndex];
-
-            StringInfo existsBuffer = SerializeBoolArray(blockData->existsArray,
-                                                         blockSkipNode->rowCount);
-
-            existsBufferArray[columnIndex][blockIndex] = existsBuffer;
+        Form_pg_attribute attributeForm = tupleDescriptor->attrs[columnIndex];
+        if (!attributeForm->attisdropped) {
+            storedColumnMask[columnIndex] = true;
+            columnStored = true;
         }
     }
 
-    return existsBufferArray;
+    if (!columnStored && columnCount > 0) {
+        storedColumnMask[0] = true;
+    }
+
+    return storedColumnMask;
 }
 
 
 /*
- * CreateValueBufferArray serializes the "values" arrays of stripe data for
- * each columnIndex and blockIndex combination and returns the result as a
- * two dimensional array.
+ * BlockExistsImplied checks if the block's non-null count alone tells which of
+ * its values exist. That is the case when the block has no nulls, or only has
+ * nulls.
  */
-static StringInfo **
-CreateValueBufferArray(ColumnData **columnDataArray,
-                       StripeSkipList *stripeSkipList,
-                       TupleDesc tupleDescriptor) {
-    StringInfo **valueBufferArray = NULL;
-    uint32 columnIndex = 0;
-    uint32 columnCount = stripeSkipList->columnCount;
-    uint32 blockCount = stripeSkipList->blockCount;
-    ColumnBlockSkipNode **blockSkipNodeArray = stripeSkipList->blockSkipNodeArray;
-
-    valueBufferArray = palloc0(columnCount * sizeof(StringInfo *));
-    for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
-        Form_pg_attribute attributeForm = tupleDescriptor->attrs[columnIndex];
-        uint32 blockIndex = 0;
-
-        valueBufferArray[columnIndex] = palloc0(blockCount * sizeof(StringInfo));
-        for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
-            ColumnData *columnData = columnDataArray[columnIndex];
-            ColumnBlockData *blockData = columnData->blockDataArray[blockIndex];
-            ColumnBlockSkipNode *blockSkipNode =
-                    &blockSkipNodeArray[columnIndex][blockIndex];
-
-            StringInfo valueBuffer = SerializeDatumArray(blockData->valueArray,
-                                                         blockData->existsArray,
-                                                         blockSkipNode->rowCount,
-                                                         attributeForm->attbyval,
-                                                         attributeForm->attlen,
-                                                         attributeForm->attalign);
-
-            valueBufferArray[columnIndex][blockIndex] = valueBuffer;
-        }
+static bool
+BlockExistsImplied(ColumnBlockSkipNode *blockSkipNode) {
+    if (!blockSkipNode->hasNonNullCount) {
+        return false;
     }
 
-    return valueBufferArray;
+    return (blockSkipNode->nonNullCount == 0 ||
+            blockSkipNode->nonNullCount == blockSkipNode->rowCount);
 }
 
 
 /*
- * CreateSkipListBufferArray serializes the skip list for each column of the
- * given stripe and returns the result as an array.
+ * CreateSkipListBufferArray serializes the skip list for each stored column of
+ * the given stripe and returns the result as an array.
  */
 static StringInfo *
-CreateSkipListBufferArray(StripeSkipList *stripeSkipList, TupleDesc tupleDescriptor) {
+CreateSkipListBufferArray(StripeSkipList *stripeSkipList, TupleDesc tupleDescriptor,
+                          bool *storedColumnMask) {
     StringInfo *skipListBufferArray = NULL;
     uint32 columnIndex = 0;
     uint32 columnCount = stripeSkipList->columnCount;
@@ -748,6 +1500,10 @@ CreateSkipListBufferArray(StripeSkipList *stripeSkipList, TupleDesc tupleDescrip
                 stripeSkipList->blockSkipNodeArray[columnIndex];
         Form_pg_attribute attributeForm = tupleDescriptor->attrs[columnIndex];
 
+        if (!storedColumnMask[columnIndex]) {
+            continue;
+        }
+
         skipListBuffer = SerializeColumnSkipList(blockSkipNodeArray,
                                                  stripeSkipList->blockCount,
                                                  attributeForm->attbyval,
@@ -760,108 +1516,412 @@ CreateSkipListBufferArray(StripeSkipList *stripeSkipList, TupleDesc tupleDescrip
 }
 
 
-/* Creates and returns the footer for given stripe. */
+/*
+ * Creates and returns the footer for given stripe. Shredded columns follow the
+ * table's columns, and are identified by their parent column and key.
+ */
 static StripeFooter *
-CreateStripeFooter(StripeSkipList *stripeSkipList, StringInfo *skipListBufferArray) {
+CreateStripeFooter(StripeSkipList *stripeSkipList, StringInfo *skipListBufferArray,
+                   bool *storedColumnMask, uint32 tableColumnCount,
+                   List *shreddedColumnList) {
     StripeFooter *stripeFooter = NULL;
     uint32 columnIndex = 0;
     uint32 columnCount = stripeSkipList->columnCount;
+    uint32 stripeColumnCount = 0;
     uint64 *skipListSizeArray = palloc0(columnCount * sizeof(uint64));
     uint64 *existsSizeArray = palloc0(columnCount * sizeof(uint64));
     uint64 *valueSizeArray = palloc0(columnCount * sizeof(uint64));
+    uint32 *columnIdArray = palloc0(columnCount * sizeof(uint32));
+    char **columnPathArray = palloc0(columnCount * sizeof(char *));
 
     for (columnIndex = 0; columnIndex < columnCount; columnIndex++) {
         ColumnBlockSkipNode *blockSkipNodeArray =
                 stripeSkipList->blockSkipNodeArray[columnIndex];
         uint32 blockIndex = 0;
 
+        if (!storedColumnMask[columnIndex]) {
+            continue;
+        }
+
         for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++) {
-            existsSizeArray[columnIndex] += blockSkipNodeArray[blockIndex].existsLength;
-            valueSizeArray[columnIndex] += blockSkipNodeArray[blockIndex].valueLength;
+            existsSizeArray[stripeColumnCount] += blockSkipNodeArray[blockIndex].existsLength;
+            valueSizeArray[stripeColumnCount] += blockSkipNodeArray[blockIndex].valueLength;
+            valueSizeArray[stripeColumnCount] += blockSkipNodeArray[blockIndex].blobLength;
         }
-        skipListSizeArray[columnIndex] = skipListBufferArray[columnIndex]->len;
+        skipListSizeArray[stripeColumnCount] = skipListBufferArray[columnIndex]->len;
+        columnIdArray[stripeColumnCount] = columnIndex + 1;
+
+        if (columnIndex >= tableColumnCount) {
+            ShreddedColumn *shreddedColumn =
+                    list_nth(shreddedColumnList, columnIndex - tableColumnCount);
+            columnIdArray[stripeColumnCount] = shreddedColumn->attributeNumber;
+            columnPathArray[stripeColumnCount] = shreddedColumn->path;
+        }
+
+        stripeColumnCount++;
     }
 
     stripeFooter = palloc0(sizeof(StripeFooter));
-    stripeFooter->columnCount = columnCount;
+    stripeFooter->columnCount = stripeColumnCount;
     stripeFooter->skipListSizeArray = skipListSizeArray;
     stripeFooter->existsSizeArray = existsSizeArray;
     stripeFooter->valueSizeArray = valueSizeArray;
+    stripeFooter->columnIdArray = columnIdArray;
+    stripeFooter->columnPathArray = columnPathArray;
 
     return stripeFooter;
 }
 
 
 /*
- * SerializeBoolArray serializes the given boolean array and returns the result
- * as a StringInfo. This function packs every 8 boolean values into one byte.
+ * SerializeSingleBool sets the bit at the given index of a packed boolean array
+ * buffer. The function appends a zeroed byte whenever the index starts a new
+ * byte, so callers must set bits in increasing index order.
  */
-static StringInfo
-SerializeBoolArray(bool *boolArray, uint32 boolArrayLength) {
-    StringInfo boolArrayBuffer = NULL;
-    uint32 boolArrayIndex = 0;
-    uint32 byteCount = (boolArrayLength + 7) / 8;
+static void
+SerializeSingleBool(StringInfo boolArrayBuffer, uint32 boolArrayIndex, bool boolValue) {
+    uint32 byteIndex = boolArrayIndex / 8;
+    uint32 bitIndex = boolArrayIndex % 8;
+
+    if (bitIndex == 0) {
+        appendStringInfoCharMacro(boolArrayBuffer, 0);
+    }
+
+    if (boolValue) {
+        boolArrayBuffer->data[byteIndex] |= (1 << bitIndex);
+    }
+}
+
+
+/*
+ * SerializeSingleDatum serializes the given datum value and appends it to the
+ * provided string info buffer, using the given value stream format. The
+ * function returns the offset in the buffer where the value starts.
+ */
+static uint32
+SerializeSingleDatum(StringInfo datumBuffer, Datum datum, bool datumTypeByValue,
+                     int datumTypeLength, char datumTypeAlign, char datumTypeStorage,
+                     ValueFormat valueFormat) {
+    uint32 datumOffset = datumBuffer->len;
+    uint32 datumLength = 0;
+    uint32 datumLengthAligned = 0;
+    char *currentDatumDataPointer = NULL;
+
+    if (valueFormat != VALUE_FORMAT_ALIGNED) {
+        return SerializePackedDatum(datumBuffer, datum, datumTypeByValue,
+                                    datumTypeLength, datumTypeAlign, datumTypeStorage);
+    }
+
+    datumLength = att_addlength_datum(0, datumTypeLength, datum);
+    datumLengthAligned = att_align_nominal(datumLength, datumTypeAlign);
+
+    enlargeStringInfo(datumBuffer, datumLengthAligned);
+    currentDatumDataPointer = datumBuffer->data + datumBuffer->len;
+    memset(currentDatumDataPointer, 0, datumLengthAligned);
+
+    if (datumTypeLength > 0) {
+        if (datumTypeByValue) {
+            store_att_byval(currentDatumDataPointer, datum, datumTypeLength);
+        } else {
+            memcpy(currentDatumDataPointer, DatumGetPointer(datum), datumTypeLength);
+        }
+    } else {
+        Assert(!datumTypeByValue);
+        memcpy(currentDatumDataPointer, DatumGetPointer(datum), datumLength);
+    }
+
+    datumBuffer->len += datumLengthAligned;
 
-    boolArrayBuffer = makeStringInfo();
-    enlargeStringInfo(boolArrayBuffer, byteCount);
-    boolArrayBuffer->len = byteCount;
-    memset(boolArrayBuffer->data, 0, byteCount);
+    return datumOffset;
+}
+
+
+/*
+ * SerializePackedDatum appends the given datum value to the provided buffer
+ * without alignment padding. Varlenas are converted to short headers when they
+ * fit, the same way PostgreSQL packs them into heap tuples. As in heap tuples,
+ * types with plain storage keep their 4-byte headers, since their functions
+ * may not accept short headers. Varlenas that still need 4-byte headers are
+ * aligned with zero padding, so readers can tell their headers from padding and
+ * use them in place. The function returns the offset in the buffer where the
+ * value starts.
+ */
+static uint32
+SerializePackedDatum(StringInfo datumBuffer, Datum datum, bool datumTypeByValue,
+                     int datumTypeLength, char datumTypeAlign, char datumTypeStorage) {
+    uint32 datumOffset = datumBuffer->len;
+    char *currentDatumDataPointer = NULL;
+
+    if (datumTypeByValue) {
+        Datum datumCopy = 0;
+
+        store_att_byval(&datumCopy, datum, datumTypeLength);
+        appendBinaryStringInfo(datumBuffer, (char *) &datumCopy, datumTypeLength);
+    } else if (datumTypeLength > 0) {
+        appendBinaryStringInfo(datumBuffer, DatumGetPointer(datum), datumTypeLength);
+    } else if (datumTypeLength == -1) {
+        Pointer datumPointer = DatumGetPointer(datum);
+
+        if (VARATT_IS_SHORT(datumPointer)) {
+            appendBinaryStringInfo(datumBuffer, datumPointer, VARSIZE_SHORT(datumPointer));
+        } else if (datumTypeStorage != 'p' && VARATT_CAN_MAKE_SHORT(datumPointer)) {
+            uint32 shortLength = VARATT_CONVERTED_SHORT_SIZE(datumPointer);
+
+            enlargeStringInfo(datumBuffer, shortLength);
+            currentDatumDataPointer = datumBuffer->data + datumBuffer->len;
+            SET_VARSIZE_SHORT(currentDatumDataPointer, shortLength);
+            memcpy(currentDatumDataPointer + VARHDRSZ_SHORT, VARDATA(datumPointer),
+                   shortLength - VARHDRSZ_SHORT);
+
+            datumBuffer->len += shortLength;
+            datumBuffer->data[datumBuffer->len] = '\0';
+        } else {
+            uint32 datumLength = VARSIZE_ANY(datumPointer);
+            uint32 paddingLength = 0;
 
-    for (boolArrayIndex = 0; boolArrayIndex < boolArrayLength; boolArrayIndex++) {
-        if (boolArray[boolArrayIndex]) {
-            uint32 byteIndex = boolArrayIndex / 8;
-            uint32 bitIndex = boolArrayIndex % 8;
-            boolArrayBuffer->data[byteIndex] |= (1 << bitIndex);
+            datumOffset = att_align_nominal(datumBuffer->len, datumTypeAlign);
+            paddingLength = datumOffset - datumBuffer->len;
+
+            enlargeStringInfo(datumBuffer, paddingLength + datumLength);
+            currentDatumDataPointer = datumBuffer->data + datumBuffer->len;
+            memset(currentDatumDataPointer, 0, paddingLength);
+            memcpy(currentDatumDataPointer + paddingLength, datumPointer, datumLength);
+
+            datumBuffer->len += paddingLength + datumLength;
+            datumBuffer->data[datumBuffer->len] = '\0';
         }
+    } else {
+        Assert(datumTypeLength == -2);
+        appendBinaryStringInfo(datumBuffer, DatumGetPointer(datum),
+                               strlen(DatumGetCString(datum)) + 1);
     }
 
-    return boolArrayBuffer;
+    return datumOffset;
+}
+
+
+/* SerializeSingleOffset appends the given value offset to the offset buffer. */
+static void
+SerializeSingleOffset(StringInfo offsetBuffer, uint32 offset) {
+    appendBinaryStringInfo(offsetBuffer, (char *) &offset, sizeof(uint32));
 }
 
 
 /*
- * SerializeDatumArray serializes the non-null elements of the given datum array
- * into a string info buffer, and then returns this buffer.
+ * SerializeBlobValue appends the given varlena value to the block's blob area,
+ * and a reference to it to the block's value stream. Blob areas aren't part of
+ * the compressed value stream, so blobs of compressed columns are compressed
+ * on their own, the way TOAST compresses large values. The function returns
+ * the reference's offset in the value stream, flagged as a blob.
+ */
+static uint32
+SerializeBlobValue(ColumnBlockBuffers *blockBuffers, Datum value,
+                   CompressionType compressionType) {
+    StringInfo blobBuffer = blockBuffers->blobBuffer;
+    uint32 referenceOffset = blockBuffers->valueBuffer->len;
+    Datum blobValue = value;
+    BlobReference blobReference;
+
+    if (compressionType != COMPRESSION_NONE &&
+        !VARATT_IS_COMPRESSED(DatumGetPointer(value))) {
+        Datum compressedValue = toast_compress_datum(value);
+        if (DatumGetPointer(compressedValue) != NULL) {
+            blobValue = compressedValue;
+        }
+    }
+
+    blobReference.blobOffset = blobBuffer->len;
+    blobReference.blobLength = VARSIZE_ANY(DatumGetPointer(blobValue));
+
+    appendBinaryStringInfo(blobBuffer, DatumGetPointer(blobValue),
+                           blobReference.blobLength);
+    appendBinaryStringInfo(blockBuffers->valueBuffer, (char *) &blobReference,
+                           sizeof(BlobReference));
+
+    if (blobValue != value) {
+        pfree(DatumGetPointer(blobValue));
+    }
+
+    return referenceOffset | VALUE_OFFSET_BLOB;
+}
+
+
+/*
+ * ColumnValueFormat returns the value stream format for the given column's
+ * blocks. Encrypted compression inspects the start of value streams to detect
+ * values that are already encrypted, so we keep these streams aligned. Other
+ * streams are packed, and variable-length values get an offset array so that
+ * readers can find each value without walking the stream.
+ */
+static ValueFormat
+ColumnValueFormat(TableWriteState *writeState, uint32 columnIndex) {
+    Form_pg_attribute attributeForm = writeState->tupleDescriptor->attrs[columnIndex];
+    CompressionType compressionType = writeState->columnCompressionTypeArray[columnIndex];
+    ValueFormat valueFormat = VALUE_FORMAT_PACKED;
+
+    if (compressionType == COMPRESSION_ENC_LZ4) {
+        valueFormat = VALUE_FORMAT_ALIGNED;
+    } else if (attributeForm->attlen < 0) {
+        valueFormat = VALUE_FORMAT_OFFSETS;
+    }
+
+    return valueFormat;
+}
+
+
+/*
+ * CreateOffsetValueBuffer assembles an offset value stream from the given value
+ * offsets and packed values. The stream starts with the offsets and the total
+ * value length, padded to MAXALIGN so that aligned values stay aligned, and
+ * ends with the packed values.
+ */
+static StringInfo
+CreateOffsetValueBuffer(StringInfo offsetBuffer, StringInfo valueBuffer) {
+    uint32 rowCount = offsetBuffer->len / sizeof(uint32);
+    uint32 offsetArrayLength = VALUE_OFFSET_ARRAY_LENGTH(rowCount);
+    uint32 valueLength = valueBuffer->len;
+    StringInfo offsetValueBuffer = makeStringInfo();
+
+    enlargeStringInfo(offsetValueBuffer, offsetArrayLength + valueLength);
+    memset(offsetValueBuffer->data, 0, offsetArrayLength);
+    memcpy(offsetValueBuffer->data, offsetBuffer->data, offsetBuffer->len);
+    memcpy(offsetValueBuffer->data + offsetBuffer->len, &valueLength, sizeof(uint32));
+    memcpy(offsetValueBuffer->data + offsetArrayLength, valueBuffer->data, valueLength);
+
+    offsetValueBuffer->len = offsetArrayLength + valueLength;
+    offsetValueBuffer->data[offsetValueBuffer->len] = '\0';
+
+    return offsetValueBuffer;
+}
+
+
+/*
+ * CreateDictionaryValueBuffer tries to assemble a dictionary value stream for
+ * the given block of variable-length values. Distinct values are found by
+ * hashing their serialized bytes into an open addressing table. The function
+ * returns NULL if the block has too many distinct values, if the dictionary
+ * stream wouldn't be smaller than the block's offset value stream, or if the
+ * block has out-of-line values.
  */
 static StringInfo
-SerializeDatumArray(Datum *datumArray, bool *existsArray, uint32 datumCount,
-                    bool datumTypeByValue, int datumTypeLength, char datumTypeAlign) {
-    StringInfo datumBuffer = makeStringInfo();
-    uint32 datumIndex = 0;
-
-    for (datumIndex = 0; datumIndex < datumCount; datumIndex++) {
-        Datum datum = datumArray[datumIndex];
-        uint32 datumLength = 0;
-        uint32 datumLengthAligned = 0;
-        char *currentDatumDataPointer = NULL;
-
-        if (!existsArray[datumIndex]) {
+CreateDictionaryValueBuffer(ColumnBlockBuffers *blockBuffers,
+                            Form_pg_attribute attributeForm) {
+    StringInfo existsBuffer = blockBuffers->existsBuffer;
+    StringInfo valueBuffer = blockBuffers->valueBuffer;
+    uint32 *offsetArray = (uint32 *) blockBuffers->offsetBuffer->data;
+    uint32 rowCount = blockBuffers->offsetBuffer->len / sizeof(uint32);
+    uint32 maximumEntryCount = Min(rowCount / 2, DICTIONARY_ENTRY_COUNT_MAXIMUM);
+    uint32 slotCount = 2;
+    uint32 *slotArray = NULL;
+    uint32 *entryOffsetArray = NULL;
+    uint32 *entryLengthArray = NULL;
+    uint16 *codeArray = NULL;
+    uint32 entryCount = 0;
+    uint32 rowIndex = 0;
+    uint32 entryIndex = 0;
+    uint32 codeArrayLength = DICTIONARY_CODE_ARRAY_LENGTH(rowCount);
+    uint32 offsetValueLength = VALUE_OFFSET_ARRAY_LENGTH(rowCount) + valueBuffer->len;
+    DictionaryHeader dictionaryHeader;
+    StringInfo entryOffsetBuffer = NULL;
+    StringInfo entryValueBuffer = NULL;
+    StringInfo entryStreamBuffer = NULL;
+    StringInfo dictionaryBuffer = NULL;
+
+    if (blockBuffers->blobBuffer->len > 0) {
+        return NULL;
+    }
+
+    /* keep the hash table at most half full */
+    while (slotCount < maximumEntryCount * 2) {
+        slotCount *= 2;
+    }
+
+    slotArray = palloc0(slotCount * sizeof(uint32));
+    entryOffsetArray = palloc0(Max(maximumEntryCount, 1) * sizeof(uint32));
+    entryLengthArray = palloc0(Max(maximumEntryCount, 1) * sizeof(uint32));
+    codeArray = palloc0(Max(rowCount, 1) * sizeof(uint16));
+
+    for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+        bool valueExists = (existsBuffer->data[rowIndex / 8] & (1 << (rowIndex % 8))) != 0;
+        char *valuePointer = NULL;
+        uint32 valueLength = 0;
+        uint32 slotIndex = 0;
+
+        if (!valueExists) {
             continue;
         }
 
-        datumLength = att_addlength_datum(0, datumTypeLength, datum);
-        datumLengthAligned = att_align_nominal(datumLength, datumTypeAlign);
+        valuePointer = valueBuffer->data + offsetArray[rowIndex];
+        if (attributeForm->attlen == -1) {
+            valueLength = VARSIZE_ANY(valuePointer);
+        } else {
+            valueLength = strlen(valuePointer) + 1;
+        }
 
-        enlargeStringInfo(datumBuffer, datumBuffer->len + datumLengthAligned);
-        currentDatumDataPointer = datumBuffer->data + datumBuffer->len;
-        memset(currentDatumDataPointer, 0, datumLengthAligned);
+        slotIndex = DatumGetUInt32(hash_any((unsigned char *) valuePointer,
+                                            valueLength)) & (slotCount - 1);
 
-        if (datumTypeLength > 0) {
-            if (datumTypeByValue) {
-                store_att_byval(currentDatumDataPointer, datum, datumTypeLength);
-            } else {
-                memcpy(currentDatumDataPointer, DatumGetPointer(datum),
-                       datumTypeLength);
+        /* slots hold entry indexes plus one, so that zero means empty */
+        while (slotArray[slotIndex] != 0) {
+            entryIndex = slotArray[slotIndex] - 1;
+            if (entryLengthArray[entryIndex] == valueLength &&
+                memcmp(valueBuffer->data + entryOffsetArray[entryIndex], valuePointer,
+                       valueLength) == 0) {
+                break;
             }
-        } else {
-            Assert(!datumTypeByValue);
-            memcpy(currentDatumDataPointer, DatumGetPointer(datum), datumLength);
+
+            slotIndex = (slotIndex + 1) & (slotCount - 1);
         }
 
-        datumBuffer->len += datumLengthAligned;
+        if (slotArray[slotIndex] == 0) {
+            if (entryCount == maximumEntryCount) {
+                return NULL;
+            }
+
+            entryIndex = entryCount;
+            entryOffsetArray[entryIndex] = offsetArray[rowIndex];
+            entryLengthArray[entryIndex] = valueLength;
+            slotArray[slotIndex] = entryIndex + 1;
+            entryCount++;
+        }
+
+        codeArray[rowIndex] = (uint16) entryIndex;
+    }
+
+    /* distinct values are packed the same way as the block's values */
+    entryOffsetBuffer = makeStringInfo();
+    entryValueBuffer = makeStringInfo();
+    for (entryIndex = 0; entryIndex < entryCount; entryIndex++) {
+        Datum entryDatum = PointerGetDatum(valueBuffer->data +
+                                           entryOffsetArray[entryIndex]);
+        uint32 entryOffset = SerializePackedDatum(entryValueBuffer, entryDatum, false,
+                                                  attributeForm->attlen,
+                                                  attributeForm->attalign,
+                                                  attributeForm->attstorage);
+
+        SerializeSingleOffset(entryOffsetBuffer, entryOffset);
+    }
+
+    entryStreamBuffer = CreateOffsetValueBuffer(entryOffsetBuffer, entryValueBuffer);
+    if (codeArrayLength + entryStreamBuffer->len >= offsetValueLength) {
+        return NULL;
     }
 
-    return datumBuffer;
+    dictionaryHeader.entryCount = entryCount;
+    dictionaryHeader.rowCount = rowCount;
+
+    dictionaryBuffer = makeStringInfo();
+    enlargeStringInfo(dictionaryBuffer, codeArrayLength + entryStreamBuffer->len);
+    memset(dictionaryBuffer->data, 0, codeArrayLength);
+    memcpy(dictionaryBuffer->data, &dictionaryHeader, sizeof(DictionaryHeader));
+    memcpy(dictionaryBuffer->data + sizeof(DictionaryHeader), codeArray,
+           rowCount * sizeof(uint16));
+    dictionaryBuffer->len = codeArrayLength;
+
+    appendBinaryStringInfo(dictionaryBuffer, entryStreamBuffer->data,
+                           entryStreamBuffer->len);
+
+    return dictionaryBuffer;
 }
 
 
@@ -890,14 +1950,10 @@ UpdateBlockSkipNodeMinMax(ColumnBlockSkipNode *blockSkipNode, Datum columnValue,
         currentMinimum = DatumCopy(columnValue, columnTypeByValue, columnTypeLength);
         currentMaximum = DatumCopy(columnValue, columnTypeByValue, columnTypeLength);
     } else {
-        Datum minimumComparisonDatum = FunctionCall2Coll(comparisonFunction,
-                                                         columnCollation, columnValue,
-                                                         previousMinimum);
-        Datum maximumComparisonDatum = FunctionCall2Coll(comparisonFunction,
-                                                         columnCollation, columnValue,
-                                                         previousMaximum);
-        int minimumComparison = DatumGetInt32(minimumComparisonDatum);
-        int maximumComparison = DatumGetInt32(maximumComparisonDatum);
+        int minimumComparison = CompareColumnValues(columnValue, previousMinimum,
+                                                    columnCollation, comparisonFunction);
+        int maximumComparison = CompareColumnValues(columnValue, previousMaximum,
+                                                    columnCollation, comparisonFunction);
 
         if (minimumComparison < 0) {
             currentMinimum = DatumCopy(columnValue, columnTypeByValue, columnTypeLength);
@@ -918,6 +1974,130 @@ UpdateBlockSkipNodeMinMax(ColumnBlockSkipNode *blockSkipNode, Datum columnValue,
 }
 
 
+/*
+ * TruncateBlockSkipNodeMinMax bounds the size of the block's variable-length
+ * min/max values, so that skip lists stay small for wide columns. When the
+ * column's type orders by bytes, that is for bytea and for text in the C or
+ * POSIX collation, we keep a prefix of the minimum, and round a prefix of the
+ * maximum up to the next greater string. Both still bound every value in the
+ * block. We can't bound values of other types or collations this way, so we
+ * drop their min/max values instead, and scans then always read the block.
+ */
+static void
+TruncateBlockSkipNodeMinMax(ColumnBlockSkipNode *blockSkipNode,
+                            Form_pg_attribute attributeForm,
+                            FmgrInfo *comparisonFunction) {
+    struct varlena *minimumValue = NULL;
+    struct varlena *maximumValue = NULL;
+    Oid lessThanFunctionId = InvalidOid;
+    Const *prefixConstant = NULL;
+    Const *greaterConstant = NULL;
+    FmgrInfo lessThanFunction;
+    int prefixLength = 0;
+
+    if (!blockSkipNode->hasMinMax || attributeForm->attlen != -1) {
+        return;
+    }
+
+    minimumValue = PG_DETOAST_DATUM_PACKED(blockSkipNode->minimumValue);
+    maximumValue = PG_DETOAST_DATUM_PACKED(blockSkipNode->maximumValue);
+    if (VARSIZE_ANY_EXHDR(minimumValue) <= SKIP_NODE_VALUE_LENGTH_MAXIMUM &&
+        VARSIZE_ANY_EXHDR(maximumValue) <= SKIP_NODE_VALUE_LENGTH_MAXIMUM) {
+        return;
+    }
+
+    if (comparisonFunction == NULL) {
+        blockSkipNode->hasMinMax = false;
+        return;
+    } else if (comparisonFunction->fn_oid == F_BYTEACMP) {
+        lessThanFunctionId = F_BYTEALT;
+    } else if (comparisonFunction->fn_oid == F_BTTEXTCMP &&
+               OidIsValid(attributeForm->attcollation) &&
+               lc_collate_is_c(attributeForm->attcollation)) {
+        lessThanFunctionId = F_TEXT_LT;
+    } else {
+        blockSkipNode->hasMinMax = false;
+        return;
+    }
+
+    if (VARSIZE_ANY_EXHDR(minimumValue) > SKIP_NODE_VALUE_LENGTH_MAXIMUM) {
+        prefixLength = SKIP_NODE_VALUE_LENGTH_MAXIMUM;
+        if (lessThanFunctionId == F_TEXT_LT) {
+            prefixLength = pg_mbcliplen(VARDATA_ANY(minimumValue),
+                                        VARSIZE_ANY_EXHDR(minimumValue), prefixLength);
+        }
+
+        blockSkipNode->minimumValue =
+                PointerGetDatum(cstring_to_text_with_len(VARDATA_ANY(minimumValue),
+                                                         prefixLength));
+    }
+
+    if (VARSIZE_ANY_EXHDR(maximumValue) > SKIP_NODE_VALUE_LENGTH_MAXIMUM) {
+        prefixLength = SKIP_NODE_VALUE_LENGTH_MAXIMUM;
+        if (lessThanFunctionId == F_TEXT_LT) {
+            prefixLength = pg_mbcliplen(VARDATA_ANY(maximumValue),
+                                        VARSIZE_ANY_EXHDR(maximumValue), prefixLength);
+        }
+
+        prefixConstant = makeConst(attributeForm->atttypid, -1,
+                                   attributeForm->attcollation, -1,
+                                   PointerGetDatum(cstring_to_text_with_len(
+                                           VARDATA_ANY(maximumValue), prefixLength)),
+                                   false, false);
+
+        fmgr_info(lessThanFunctionId, &lessThanFunction);
+        greaterConstant = make_greater_string(prefixConstant, &lessThanFunction,
+                                              attributeForm->attcollation);
+
+        /* no character of the prefix could be incremented, so there is no bound */
+        if (greaterConstant == NULL) {
+            blockSkipNode->hasMinMax = false;
+            return;
+        }
+
+        blockSkipNode->maximumValue = greaterConstant->constvalue;
+    }
+}
+
+
+/*
+ * UpdateBlockSkipNodeAggregates adds the given column value to the aggregates
+ * we precompute for the column block. Blocks have at most
+ * BLOCK_ROW_COUNT_MAXIMUM rows, so integer sums of int4 values can't overflow.
+ * Vectorized aggregates only read sums of int4, float4 and float8 columns, so
+ * we don't keep sums of other types. Skip lists are stored in plaintext, so we
+ * don't keep sums of encrypted columns.
+ */
+static void
+UpdateBlockSkipNodeAggregates(ColumnBlockSkipNode *blockSkipNode, Datum columnValue,
+                              bool columnNull, Oid columnTypeId,
+                              CompressionType compressionType) {
+    blockSkipNode->hasNonNullCount = true;
+    if (!columnNull) {
+        blockSkipNode->nonNullCount++;
+    }
+
+    if (compressionType == COMPRESSION_ENC_LZ4 ||
+        compressionType == COMPRESSION_ENC_NONE) {
+        return;
+    } else if (columnTypeId == INT4OID) {
+        blockSkipNode->hasIntegerSum = true;
+        if (!columnNull) {
+            blockSkipNode->integerSum += (int64) DatumGetInt32(columnValue);
+        }
+    } else if (columnTypeId == FLOAT4OID || columnTypeId == FLOAT8OID) {
+        blockSkipNode->hasFloatSum = true;
+        if (!columnNull) {
+            float8 floatValue = (columnTypeId == FLOAT4OID) ?
+                                (float8) DatumGetFloat4(columnValue) :
+                                DatumGetFloat8(columnValue);
+            blockSkipNode->floatSum += floatValue;
+            blockSkipNode->sumOfSquares += floatValue * floatValue;
+        }
+    }
+}
+
+
 /* Creates a copy of the given datum. */
 static Datum
 DatumCopy(Datum datum, bool datumTypeByValue, int datumTypeLength) {
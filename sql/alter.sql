@@ -0,0 +1,60 @@
+--
+-- Test ALTER FOREIGN TABLE commands on cstore_fdw tables.
+--
+
+CREATE FOREIGN TABLE test_alter_table (a int, b int, c int) SERVER cstore_server;
+
+COPY test_alter_table FROM STDIN;
+1	2	3
+4	5	6
+7	8	9
+\.
+
+-- Verify that stripes written before a column was added read the column as nulls
+ALTER FOREIGN TABLE test_alter_table ADD COLUMN d int;
+SELECT * FROM test_alter_table;
+
+COPY test_alter_table FROM STDIN;
+10	11	12	13
+\.
+
+SELECT * FROM test_alter_table;
+SELECT count(*), count(d), sum(d), avg(d) FROM test_alter_table;
+SET cstore_fdw.enable_vectorization TO off;
+SELECT count(*), count(d), sum(d), avg(d) FROM test_alter_table;
+RESET cstore_fdw.enable_vectorization;
+
+-- Verify that dropped columns are skipped in old stripes, and not stored in new ones
+ALTER FOREIGN TABLE test_alter_table DROP COLUMN b;
+SELECT * FROM test_alter_table;
+
+COPY test_alter_table FROM STDIN;
+14	15	16
+\.
+
+SELECT * FROM test_alter_table;
+SELECT count(*), count(c), sum(c), count(d), sum(d) FROM test_alter_table;
+
+DROP FOREIGN TABLE test_alter_table;
+
+-- Verify per-column compression options
+CREATE FOREIGN TABLE test_compression_table (a int, b float8 OPTIONS (compression 'gorilla'),
+	c bigint OPTIONS (compression 'delta')) SERVER cstore_server;
+
+COPY test_compression_table FROM STDIN;
+1	1.5	1000
+2	1.5	1010
+3	1.75	1020
+4	2.25	1031
+5	\N	\N
+\.
+
+SELECT * FROM test_compression_table;
+SELECT count(b), sum(b), min(b), max(b) FROM test_compression_table;
+SELECT count(c), sum(c), min(c), max(c) FROM test_compression_table;
+
+ALTER FOREIGN TABLE test_compression_table ALTER COLUMN a OPTIONS (compression 'zstd');
+CREATE FOREIGN TABLE test_gorilla_table (a int OPTIONS (compression 'gorilla')) SERVER cstore_server;
+CREATE FOREIGN TABLE test_gorilla_table (a float8) SERVER cstore_server OPTIONS (compression 'gorilla');
+
+DROP FOREIGN TABLE test_compression_table;
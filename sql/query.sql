@@ -32,3 +32,78 @@ ORDER BY country;
 SELECT *
 FROM contestant_compressed
 ORDER BY handle;
+
+-- plan_nodes returns the plan nodes of the given query, without their details
+CREATE FUNCTION plan_nodes(query text) RETURNS SETOF text AS
+$$
+    DECLARE
+        rec text;
+    BEGIN
+        FOR rec IN EXECUTE 'EXPLAIN (COSTS OFF) ' || query LOOP
+            IF rec !~ '^\s+[A-Z][A-Za-z ]*:' THEN
+                RETURN NEXT rec;
+            END IF;
+        END LOOP;
+    END;
+$$ LANGUAGE PLPGSQL;
+
+-- Aggregates over cstore scans are vectorized, unless the executor filters rows
+SELECT plan_nodes('SELECT count(*) FROM contestant');
+SELECT plan_nodes('SELECT count(*) FROM contestant WHERE rating > 2200');
+
+-- Compare vectorized aggregates with regular ones
+SELECT count(*), sum(rating)
+FROM contestant;
+SET cstore_fdw.enable_vectorization TO off;
+SELECT count(*), sum(rating)
+FROM contestant;
+RESET cstore_fdw.enable_vectorization;
+
+-- Aggregates precomputed in skip lists should match regular aggregates
+SELECT count(rating), avg(rating), sum(percentile)
+FROM contestant;
+SET cstore_fdw.enable_vectorization TO off;
+SELECT count(rating), avg(rating), sum(percentile)
+FROM contestant;
+RESET cstore_fdw.enable_vectorization;
+SELECT plan_nodes('SELECT count(rating), avg(rating), sum(percentile) FROM contestant');
+
+-- Combine partial aggregates computed over both tables
+SELECT cstore_partial_avg(rating)
+FROM contestant;
+SELECT cstore_combine_avg(partial_avg), cstore_combine_count(row_count)
+FROM (SELECT cstore_partial_avg(rating) AS partial_avg, count(*) AS row_count
+      FROM contestant
+      UNION ALL
+      SELECT cstore_partial_avg(rating), count(*)
+      FROM contestant_compressed) AS partials;
+
+-- Conditional aggregates should match regular aggregates
+SELECT sum(rating) FILTER (WHERE country = 'XD') AS xd_sum,
+       sum(rating) FILTER (WHERE country = 'XZ') AS xz_sum,
+       sum(CASE WHEN country = 'XA' THEN rating END) AS xa_sum,
+       count(*) FILTER (WHERE rating > 2200 AND percentile < 99) AS rated_count,
+       count(CASE WHEN rating > 2200 THEN 1 END) AS case_count
+FROM contestant;
+SET cstore_fdw.enable_vectorization TO off;
+SELECT sum(rating) FILTER (WHERE country = 'XD') AS xd_sum,
+       sum(rating) FILTER (WHERE country = 'XZ') AS xz_sum,
+       sum(CASE WHEN country = 'XA' THEN rating END) AS xa_sum,
+       count(*) FILTER (WHERE rating > 2200 AND percentile < 99) AS rated_count,
+       count(CASE WHEN rating > 2200 THEN 1 END) AS case_count
+FROM contestant;
+RESET cstore_fdw.enable_vectorization;
+SELECT plan_nodes('SELECT sum(rating) FILTER (WHERE country = ''XD''), count(CASE WHEN rating > 2200 THEN 1 END) FROM contestant');
+SELECT plan_nodes('SELECT sum(rating) FILTER (WHERE rating + 1 > 2200) FROM contestant');
+
+-- Distinct keys, and group bys without aggregates
+SELECT DISTINCT country
+FROM contestant
+ORDER BY country;
+SELECT country
+FROM contestant_compressed
+GROUP BY country
+ORDER BY country;
+SET enable_sort TO off;
+SELECT plan_nodes('SELECT DISTINCT country FROM contestant');
+RESET enable_sort;
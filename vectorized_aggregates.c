@@ -2,6 +2,7 @@
 #include "cstore_fdw.h"
 #include "vectorized_aggregates.h"
 
+#include "access/hash.h"
 #include "access/htup_details.h"
 #include "access/sysattr.h"
 #include "access/transam.h"
@@ -11,6 +12,7 @@
 #include "catalog/pg_aggregate.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
+#include "commands/explain.h"
 #include "commands/trigger.h"
 #include "executor/execdebug.h"
 #include "executor/executor.h"
@@ -18,22 +20,29 @@
 #include "foreign/fdwapi.h"
 #include "mb/pg_wchar.h"
 #include "miscadmin.h"
+#include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
 #include "optimizer/clauses.h"
 #include "optimizer/tlist.h"
 #include "parser/parse_agg.h"
 #include "parser/parse_coerce.h"
 #include "parser/parsetree.h"
+#include "parser/scansup.h"
 #include "storage/bufmgr.h"
 #include "storage/lmgr.h"
 #include "tcop/utility.h"
 #include "utils/acl.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/fmgroids.h"
 #include "utils/hsearch.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
 #include "utils/tqual.h"
 #include "utils/tuplesort.h"
 #include "utils/datum.h"
@@ -59,6 +68,12 @@ typedef struct AggStatePerAggData {
     /* number of inputs including ORDER BY expressions */
     int numInputs;
 
+    /* number of aggregated input columns to pass to the transfn */
+    int numTransInputs;
+
+    /* number of arguments to pass to the finalfn */
+    int numFinalArgs;
+
     /* Oids of transfer functions */
     Oid transfn_oid;
     Oid finalfn_oid;    /* may be InvalidOid */
@@ -143,6 +158,13 @@ typedef struct AggStatePerAggData {
      */
 
     Tuplesortstate *sortstate;    /* sort object, if DISTINCT or ORDER BY */
+
+    /*
+     * This field is a pre-initialized FunctionCallInfo struct used for
+     * calling this aggregate's transfn.  We save a few cycles per row by not
+     * re-initializing the unchanging fields.
+     */
+    FunctionCallInfoData transfn_fcinfo;
 } AggStatePerAggData;
 
 
@@ -193,77 +215,214 @@ typedef struct AggHashEntryData {
 } AggHashEntryData;    /* VARIABLE LENGTH STRUCT */
 
 
-typedef struct AggregationHashEntry {
-    Datum key;
-    Datum value;
-} AggregationHashEntry;
-
-
-typedef enum VectorizedAggType {
-    VAT_GROUP_BY_COUNT,
-    VAT_GROUP_BY_SUM
-} VectorizedAggType;
-
-
 static void initialize_aggregates(AggState *aggstate,
                                   AggStatePerAgg peragg,
                                   AggStatePerGroup pergroup);
 
-static void process_ordered_aggregate_single(AggState *aggstate,
-                                             AggStatePerAgg peraggstate,
-                                             AggStatePerGroup pergroupstate);
-
-static void process_ordered_aggregate_multi(AggState *aggstate,
-                                            AggStatePerAgg peraggstate,
-                                            AggStatePerGroup pergroupstate);
-
-static void advance_transition_function(AggState *aggstate,
-                                        AggStatePerAgg peraggstate,
-                                        AggStatePerGroup pergroupstate,
-                                        FunctionCallInfoData *fcinfo);
-
 static void finalize_aggregate(AggState *aggstate,
                                AggStatePerAgg peraggstate,
                                AggStatePerGroup pergroupstate,
                                Datum *resultVal,
                                bool *resultIsNull);
 
-static void ExecutePlanVectorized(EState *estate,
-                                  PlanState *planstate,
-                                  CmdType operation,
-                                  bool sendTuples,
-                                  long numberTuples,
-                                  ScanDirection direction,
-                                  DestReceiver *dest);
+static Plan *VectorizePlanTree(Plan *plan, PlannedStmt *plannedStmt);
+
+static bool VectorizableAggregate(Agg *aggPlan, List *rangeTableList);
+
+static bool VectorizablePlainAggregate(Agg *aggPlan, Plan *scanPlan);
+
+static bool VectorizableGroupByAggregate(Agg *aggPlan, Plan *scanPlan);
+
+static bool VectorizableAggref(Aggref *aggref);
+
+static Expr *AggregateArgument(Aggref *aggref, List **conditionList);
+
+static AggregateFilterClause *BuildAggregateFilterClause(Plan *scanPlan, Expr *clause);
+
+static bool AggrefListWalker(Node *node, List **aggrefList);
+
+static Expr *ScanTargetExpression(Plan *scanPlan, Expr *expression);
+
+static Var *ScanColumnVar(Plan *scanPlan, Expr *expression);
+
+static Var *TimestampBucketColumn(Expr *keyExpression, TimestampBucket *bucket);
+
+static bool GroupByAggregateType(Oid aggregateId, VectorizedAggType *aggType);
+
+static Oid AggregateTransitionFunction(Oid aggregateId);
+
+static Oid VectorizedTransitionFunction(Oid transitionFunctionId,
+                                        int32 argumentCount);
+
+static CustomScan *CreateVectorizedAggScan(Agg *aggPlan);
+
+static List *VectorizedAggTargetList(List *aggTargetList);
+
+static Node *CreateVectorizedAggScanState(CustomScan *customScan);
+
+static CustomScan *CopyVectorizedAggScan(const CustomScan *from);
+
+static void BeginVectorizedAggScan(CustomScanState *customScanState,
+                                   EState *executorState, int executorFlags);
+
+static void InitPlainAggregates(VectorizedAggState *vectorizedAggState,
+                                AggState *aggstate, Plan *scanPlan);
+
+static int32 AggregateFilterIndex(VectorizedAggState *vectorizedAggState,
+                                  List *conditionList, Plan *scanPlan);
 
-static void advance_aggregates_vectorized(AggState *aggstate,
-                                          AggStatePerGroup pergroup);
+static void InitGroupByAggregate(VectorizedAggState *vectorizedAggState,
+                                 Agg *aggPlan, Plan *scanPlan);
+
+static TupleTableSlot *ExecVectorizedAggScan(CustomScanState *customScanState);
+
+static void EndVectorizedAggScan(CustomScanState *customScanState);
+
+static void ReScanVectorizedAggScan(CustomScanState *customScanState);
+
+static void ExplainVectorizedAggScan(CustomScanState *customScanState,
+                                     List *ancestors, ExplainState *explainState);
+
+static TupleTableSlot *ExecAggVectorized(VectorizedAggState *vectorizedAggState,
+                                         AggState *aggstate);
+
+static TupleTableSlot *agg_retrieve_hash_vectorized(VectorizedAggState *vectorizedAggState,
+                                                    AggState *aggstate);
+
+static void FillAggregationHash(VectorizedAggState *vectorizedAggState,
+                                AggState *aggstate);
+
+static AggregationHashEntry *LookupGroupByHashEntry(VectorizedAggState *vectorizedAggState,
+                                                    TypeCacheEntry *keyTypeCacheEntry,
+                                                    Datum key);
+
+static void AdvanceGroupByRow(VectorizedAggState *vectorizedAggState,
+                              AggregationHashEntry *hashEntry,
+                              ColumnBlockData *valueBlockData, uint32 blockRowIndex);
+
+static void AggregateColumnKeys(VectorizedAggState *vectorizedAggState,
+                                TypeCacheEntry *keyTypeCacheEntry,
+                                StripeData *stripeData, uint64 blockRowCount);
+
+static void AggregateDistinctKeys(VectorizedAggState *vectorizedAggState,
+                                  TypeCacheEntry *keyTypeCacheEntry,
+                                  StripeData *stripeData, uint64 blockRowCount,
+                                  StripeSkipList *stripeSkipList);
+
+static void AggregateTimestampBuckets(VectorizedAggState *vectorizedAggState,
+                                      TypeCacheEntry *keyTypeCacheEntry,
+                                      StripeData *stripeData, uint64 blockRowCount);
+
+static void TimestampBucketIds(TimestampBucket *bucket, ColumnBlockData *blockData,
+                               uint32 rowCount, int64 *bucketIdArray,
+                               bool *bucketFoundArray);
+
+static void AggregateDenseBuckets(VectorizedAggState *vectorizedAggState,
+                                  ColumnBlockData *valueBlockData, uint32 rowCount,
+                                  int64 minimumBucketId);
+
+static void MergeDenseBuckets(VectorizedAggState *vectorizedAggState,
+                              TypeCacheEntry *keyTypeCacheEntry,
+                              int64 minimumBucketId, int64 bucketCount);
+
+static Datum TimestampBucketKey(TimestampBucket *bucket, int64 bucketId);
+
+static Datum TimestampFunctionKey(TimestampBucket *bucket, Datum timestamp);
+
+static int64 FloorDivide(int64 dividend, int64 divisor);
+
+static void MergeGroupByAggregate(VectorizedAggState *vectorizedAggState,
+                                  AggregationHashEntry *hashEntry, int64 partialValue);
+
+static void AdvanceGroupByAggregate(VectorizedAggState *vectorizedAggState,
+                                    AggregationHashEntry *hashEntry, Datum value);
+
+static void DestroyAggregationHash(VectorizedAggState *vectorizedAggState);
+
+static TupleTableSlot *agg_retrieve_direct_vectorized(VectorizedAggState *vectorizedAggState,
+                                                      AggState *aggstate);
+
+static void advance_aggregates_vectorized(VectorizedAggState *vectorizedAggState,
+                                          AggState *aggstate,
+                                          AggStatePerGroup pergroup,
+                                          StripeData *stripeData,
+                                          uint64 blockRowCount);
+
+static void EvaluateAggregateFilters(VectorizedAggState *vectorizedAggState,
+                                     StripeData *stripeData, uint64 blockRowCount);
+
+static bool AggregateFilterClauseMatches(AggregateFilterClause *filterClause,
+                                         ColumnBlockData *blockData,
+                                         uint32 blockRowIndex);
+
+static ColumnData *MaskedColumnData(ColumnData *columnData, bool *selectedRowMask,
+                                    uint32 rowCount, uint64 blockRowCount);
+
+static SkipListAggType SkipListAggregateType(Oid transitionFunctionId,
+                                             Oid columnTypeId);
+
+static void AdvanceAggregatesFromSkipLists(VectorizedAggState *vectorizedAggState,
+                                           AggState *aggstate,
+                                           AggStatePerGroup pergroup,
+                                           TableReadState *readState);
+
+static bool SkipListHasAggregates(VectorizedAggState *vectorizedAggState,
+                                  AggState *aggstate, StripeSkipList *stripeSkipList);
+
+static void AdvanceAggregateFromSkipList(AggState *aggstate,
+                                         AggStatePerAgg peraggstate,
+                                         AggStatePerGroup pergroupstate,
+                                         SkipListAggType skipListAggType,
+                                         ColumnBlockSkipNode *blockSkipNodeArray,
+                                         uint32 blockCount);
 
 static void advance_transition_function_vectorized(AggState *aggstate,
                                                    AggStatePerAgg peraggstate,
                                                    AggStatePerGroup pergroupstate,
                                                    FunctionCallInfoData *fcinfo);
 
-static TupleTableSlot *agg_retrieve_hash_vectorized(AggState *aggstate);
+static struct varlena *InlineTextKey(Datum key);
 
-static TupleTableSlot *agg_retrieve_direct_vectorized(AggState *aggstate);
+static uint32 VectorizedHashTableHash(const void *key, Size keysize);
 
-int CompareHashKeyStrings(const void *key1, const void *key2, Size keysize);
+static int VectorizedHashTableMatch(const void *key1, const void *key2, Size keySize);
 
 
-/* is it a group by query */
-static Var *CurrentKeyVar = NULL;
-static Var *CurrentValueVar = NULL;
-static HTAB *CurrentAggregationHash = NULL;
-static HASH_SEQ_STATUS CurrentHashSeqStatus;
-static VectorizedAggType CurrentVectorizedAggType = VAT_GROUP_BY_COUNT;
+/* GUC to enable vectorized aggregates */
+bool EnableVectorization = true;
 
+/*
+ * Hash and equality functions for the group by key. These are set right before
+ * we fill an aggregation hash, since dynahash callbacks don't take arguments.
+ */
 static FmgrInfo *CurrentHashFunction = NULL;
 static FmgrInfo *CurrentEqualityFunction = NULL;
 
-static uint32 VectorizedHashTableHash(const void *key, Size keysize);
-
-static int VectorizedHashTableMatch(const void *key1, const void *key2, Size keySize);
+/*
+ * Text keys hash and compare by their bytes whatever their collation, so we
+ * hash and compare them in place instead of calling hashtext() and texteq().
+ */
+static bool CurrentKeyIsText = false;
+
+/* plan and execution methods for vectorized aggregate custom scans */
+static CustomScanMethods VectorizedAggScanMethods = {
+    VECTORIZED_AGGREGATE_SCAN_NAME,
+    CreateVectorizedAggScanState,
+    NULL,
+    CopyVectorizedAggScan
+};
+
+static CustomExecMethods VectorizedAggExecMethods = {
+    VECTORIZED_AGGREGATE_SCAN_NAME,
+    BeginVectorizedAggScan,
+    ExecVectorizedAggScan,
+    EndVectorizedAggScan,
+    ReScanVectorizedAggScan,
+    NULL,
+    NULL,
+    ExplainVectorizedAggScan,
+    NULL
+};
 
 
 /*
@@ -344,273 +503,6 @@ initialize_aggregates(AggState *aggstate,
 }
 
 
-/*
- * Run the transition function for a DISTINCT or ORDER BY aggregate
- * with only one input.  This is called after we have completed
- * entering all the input values into the sort object.  We complete the
- * sort, read out the values in sorted order, and run the transition
- * function on each value (applying DISTINCT if appropriate).
- *
- * Note that the strictness of the transition function was checked when
- * entering the values into the sort, so we don't check it again here;
- * we just apply standard SQL DISTINCT logic.
- *
- * The one-input case is handled separately from the multi-input case
- * for performance reasons: for single by-value inputs, such as the
- * common case of count(distinct id), the tuplesort_getdatum code path
- * is around 300% faster.  (The speedup for by-reference types is less
- * but still noticeable.)
- *
- * When called, CurrentMemoryContext should be the per-query context.
- */
-static void
-process_ordered_aggregate_single(AggState *aggstate,
-                                 AggStatePerAgg peraggstate,
-                                 AggStatePerGroup pergroupstate) {
-    Datum oldVal = (Datum) 0;
-    bool oldIsNull = true;
-    bool haveOldVal = false;
-    MemoryContext workcontext = aggstate->tmpcontext->ecxt_per_tuple_memory;
-    MemoryContext oldContext;
-    bool isDistinct = (peraggstate->numDistinctCols > 0);
-    Datum *newVal;
-    bool *isNull;
-    FunctionCallInfoData fcinfo;
-
-    Assert(peraggstate->numDistinctCols < 2);
-
-    tuplesort_performsort(peraggstate->sortstate);
-
-    /* Load the column into argument 1 (arg 0 will be transition value) */
-    newVal = fcinfo.arg + 1;
-    isNull = fcinfo.argnull + 1;
-
-    /*
-     * Note: if input type is pass-by-ref, the datums returned by the sort are
-     * freshly palloc'd in the per-query context, so we must be careful to
-     * pfree them when they are no longer needed.
-     */
-
-    while (tuplesort_getdatum(peraggstate->sortstate, true,
-                              newVal, isNull)) {
-        /*
-         * Clear and select the working context for evaluation of the equality
-         * function and transition function.
-         */
-        MemoryContextReset(workcontext);
-        oldContext = MemoryContextSwitchTo(workcontext);
-
-        /*
-         * If DISTINCT mode, and not distinct from prior, skip it.
-         *
-         * Note: we assume equality functions don't care about collation.
-         */
-        if (isDistinct &&
-            haveOldVal &&
-            ((oldIsNull && *isNull) ||
-             (!oldIsNull && !*isNull &&
-              DatumGetBool(FunctionCall2(&peraggstate->equalfns[0],
-                                         oldVal, *newVal))))) {
-            /* equal to prior, so forget this one */
-            if (!peraggstate->inputtypeByVal && !*isNull)
-                pfree(DatumGetPointer(*newVal));
-        } else {
-            advance_transition_function(aggstate, peraggstate, pergroupstate,
-                                        &fcinfo);
-            /* forget the old value, if any */
-            if (!oldIsNull && !peraggstate->inputtypeByVal)
-                pfree(DatumGetPointer(oldVal));
-            /* and remember the new one for subsequent equality checks */
-            oldVal = *newVal;
-            oldIsNull = *isNull;
-            haveOldVal = true;
-        }
-
-        MemoryContextSwitchTo(oldContext);
-    }
-
-    if (!oldIsNull && !peraggstate->inputtypeByVal)
-        pfree(DatumGetPointer(oldVal));
-
-    tuplesort_end(peraggstate->sortstate);
-    peraggstate->sortstate = NULL;
-}
-
-
-/*
- * Run the transition function for a DISTINCT or ORDER BY aggregate
- * with more than one input.  This is called after we have completed
- * entering all the input values into the sort object.  We complete the
- * sort, read out the values in sorted order, and run the transition
- * function on each value (applying DISTINCT if appropriate).
- *
- * When called, CurrentMemoryContext should be the per-query context.
- */
-static void
-process_ordered_aggregate_multi(AggState *aggstate,
-                                AggStatePerAgg peraggstate,
-                                AggStatePerGroup pergroupstate) {
-    MemoryContext workcontext = aggstate->tmpcontext->ecxt_per_tuple_memory;
-    FunctionCallInfoData fcinfo;
-    TupleTableSlot *slot1 = peraggstate->evalslot;
-    TupleTableSlot *slot2 = peraggstate->uniqslot;
-    int numArguments = peraggstate->numArguments;
-    int numDistinctCols = peraggstate->numDistinctCols;
-    bool haveOldValue = false;
-    int i;
-
-    tuplesort_performsort(peraggstate->sortstate);
-
-    ExecClearTuple(slot1);
-    if (slot2)
-        ExecClearTuple(slot2);
-
-    while (tuplesort_gettupleslot(peraggstate->sortstate, true, slot1)) {
-        /*
-         * Extract the first numArguments as datums to pass to the transfn.
-         * (This will help execTuplesMatch too, so do it immediately.)
-         */
-        slot_getsomeattrs(slot1, numArguments);
-
-        if (numDistinctCols == 0 ||
-            !haveOldValue ||
-            !execTuplesMatch(slot1, slot2,
-                             numDistinctCols,
-                             peraggstate->sortColIdx,
-                             peraggstate->equalfns,
-                             workcontext)) {
-            /* Load values into fcinfo */
-            /* Start from 1, since the 0th arg will be the transition value */
-            for (i = 0; i < numArguments; i++) {
-                fcinfo.arg[i + 1] = slot1->tts_values[i];
-                fcinfo.argnull[i + 1] = slot1->tts_isnull[i];
-            }
-
-            advance_transition_function(aggstate, peraggstate, pergroupstate,
-                                        &fcinfo);
-
-            if (numDistinctCols > 0) {
-                /* swap the slot pointers to retain the current tuple */
-                TupleTableSlot *tmpslot = slot2;
-
-                slot2 = slot1;
-                slot1 = tmpslot;
-                haveOldValue = true;
-            }
-        }
-
-        /* Reset context each time, unless execTuplesMatch did it for us */
-        if (numDistinctCols == 0)
-            MemoryContextReset(workcontext);
-
-        ExecClearTuple(slot1);
-    }
-
-    if (slot2)
-        ExecClearTuple(slot2);
-
-    tuplesort_end(peraggstate->sortstate);
-    peraggstate->sortstate = NULL;
-}
-
-
-/*
- * Given new input value(s), advance the transition function of an aggregate.
- *
- * The new values (and null flags) have been preloaded into argument positions
- * 1 and up in fcinfo, so that we needn't copy them again to pass to the
- * transition function.  No other fields of fcinfo are assumed valid.
- *
- * It doesn't matter which memory context this is called in.
- */
-static void
-advance_transition_function(AggState *aggstate,
-                            AggStatePerAgg peraggstate,
-                            AggStatePerGroup pergroupstate,
-                            FunctionCallInfoData *fcinfo) {
-    int numArguments = peraggstate->numArguments;
-    MemoryContext oldContext;
-    Datum newVal;
-    int i;
-
-    if (peraggstate->transfn.fn_strict) {
-        /*
-         * For a strict transfn, nothing happens when there's a NULL input; we
-         * just keep the prior transValue.
-         */
-        for (i = 1; i <= numArguments; i++) {
-            if (fcinfo->argnull[i])
-                return;
-        }
-        if (pergroupstate->noTransValue) {
-            /*
-             * transValue has not been initialized. This is the first non-NULL
-             * input value. We use it as the initial value for transValue. (We
-             * already checked that the agg's input type is binary-compatible
-             * with its transtype, so straight copy here is OK.)
-             *
-             * We must copy the datum into aggcontext if it is pass-by-ref. We
-             * do not need to pfree the old transValue, since it's NULL.
-             */
-            oldContext = MemoryContextSwitchTo(aggstate->aggcontext);
-            pergroupstate->transValue = datumCopy(fcinfo->arg[1],
-                                                  peraggstate->transtypeByVal,
-                                                  peraggstate->transtypeLen);
-            pergroupstate->transValueIsNull = false;
-            pergroupstate->noTransValue = false;
-            MemoryContextSwitchTo(oldContext);
-            return;
-        }
-        if (pergroupstate->transValueIsNull) {
-            /*
-             * Don't call a strict function with NULL inputs.  Note it is
-             * possible to get here despite the above tests, if the transfn is
-             * strict *and* returned a NULL on a prior cycle. If that happens
-             * we will propagate the NULL all the way to the end.
-             */
-            return;
-        }
-    }
-
-    /* We run the transition functions in per-input-tuple memory context */
-    oldContext = MemoryContextSwitchTo(aggstate->tmpcontext->ecxt_per_tuple_memory);
-
-    /*
-     * OK to call the transition function
-     */
-    InitFunctionCallInfoData(*fcinfo, &(peraggstate->transfn),
-                             numArguments + 1,
-                             peraggstate->aggCollation,
-                             (void *) aggstate, NULL);
-    fcinfo->arg[0] = pergroupstate->transValue;
-    fcinfo->argnull[0] = pergroupstate->transValueIsNull;
-
-    newVal = FunctionCallInvoke(fcinfo);
-
-    /*
-     * If pass-by-ref datatype, must copy the new value into aggcontext and
-     * pfree the prior transValue.  But if transfn returned a pointer to its
-     * first input, we don't need to do anything.
-     */
-    if (!peraggstate->transtypeByVal &&
-        DatumGetPointer(newVal) != DatumGetPointer(pergroupstate->transValue)) {
-        if (!fcinfo->isnull) {
-            MemoryContextSwitchTo(aggstate->aggcontext);
-            newVal = datumCopy(newVal,
-                               peraggstate->transtypeByVal,
-                               peraggstate->transtypeLen);
-        }
-        if (!pergroupstate->transValueIsNull)
-            pfree(DatumGetPointer(pergroupstate->transValue));
-    }
-
-    pergroupstate->transValue = newVal;
-    pergroupstate->transValueIsNull = fcinfo->isnull;
-
-    MemoryContextSwitchTo(oldContext);
-}
-
-
 /*
  * Compute the final value of one aggregate.
  *
@@ -665,279 +557,1076 @@ finalize_aggregate(AggState *aggstate,
 
 
 /*
- * If the query is a supported one, use the vectorized execution,
- * if not use the standard one.
+ * VectorizeAggregatePlans walks over the planned statement, and replaces each
+ * aggregate over a cstore table scan that we know how to vectorize with a
+ * vectorized aggregate custom scan. The original aggregate node becomes the
+ * custom scan's child, so that the executor sets up its state as usual and we
+ * only take over the transition and projection steps.
  */
-void
-vectorized_ExecutorRun(QueryDesc *queryDesc,
-                       ScanDirection direction,
-                       long count) {
-    PlannedStmt *plannedstmt = queryDesc->plannedstmt;
-    struct Plan *planTree = plannedstmt->planTree;
-    bool groupByAggregate = false;
-    bool vectorizedExecution = false;
-
-    if ((planTree != NULL) && (planTree->type == T_Agg) &&
-        (planTree->lefttree != NULL) && (planTree->lefttree->type == T_ForeignScan)) {
-        vectorizedExecution = true;
-    }
-
-    if (vectorizedExecution && (((Agg *) planTree)->aggstrategy == AGG_HASHED)) {
-        groupByAggregate = true;
-    }
-
-    if (groupByAggregate) {
-        TargetEntry *targetEntry1 = (TargetEntry *) linitial(planTree->targetlist);
-        TargetEntry *targetEntry2 = (TargetEntry *) lsecond(planTree->targetlist);
-        Expr *expr1 = targetEntry1->expr;
-        Expr *expr2 = targetEntry2->expr;
-        if (expr1->type == T_Var && expr2->type == T_Aggref) {
-            Aggref *aggref = (Aggref *) expr2;
-            Oid aggregateFunctionId = aggref->aggfnoid;
-            List *aggregateArgumentList = aggref->args;
-            int32 aggregateArgumentCount = list_length(aggregateArgumentList);
-            TargetEntry *targetEntry = NULL;
-
-            /* look up the function name */
-            char *aggregateFunctionName = get_func_name(aggregateFunctionId);
-            if (aggregateFunctionName == NULL) {
-                ereport(ERROR, (errmsg("cache lookup failed for function %u",
-                                       aggregateFunctionId)));
-            }
+PlannedStmt *
+VectorizeAggregatePlans(PlannedStmt *plannedStmt) {
+    ListCell *subplanCell = NULL;
 
-            if (strncmp(aggregateFunctionName, "count", NAMEDATALEN) == 0) {
-                CurrentVectorizedAggType = VAT_GROUP_BY_COUNT;
-            } else if (strncmp(aggregateFunctionName, "sum", NAMEDATALEN) == 0) {
-                CurrentVectorizedAggType = VAT_GROUP_BY_SUM;
-            } else {
-                ereport(ERROR, (errmsg("vectorization unsupported for \"%s\" "
-                                       "group by", aggregateFunctionName)));
-            }
+    plannedStmt->planTree = VectorizePlanTree(plannedStmt->planTree, plannedStmt);
 
-            /*
-             * We also check for the argument count here. count(column) works,
-             * but count(*) returns 0 arguments. To make 0 arguments work, we
-             * need to rework the if / else nestings in vectorized group bys.
-             * For now, we only support count(column) group bys, and error out
-             * on count(*) group bys.
-             */
-            if (aggregateArgumentCount != 1) {
-                ereport(ERROR, (errmsg("vectorized group by aggregate received "
-                                       "%d arguments, but supports only 1",
-                                       aggregateArgumentCount)));
-            }
+    foreach(subplanCell, plannedStmt->subplans) {
+        Plan *subplan = (Plan *) lfirst(subplanCell);
+        lfirst(subplanCell) = VectorizePlanTree(subplan, plannedStmt);
+    }
+
+    return plannedStmt;
+}
+
+
+/*
+ * VectorizePlanTree recursively vectorizes aggregates in the given plan tree,
+ * and returns the new plan tree. Plans are vectorized after the standard planner
+ * has picked them, so we replace every aggregate we can vectorize; the custom
+ * scan's cost only matters for how EXPLAIN shows it.
+ */
+static Plan *
+VectorizePlanTree(Plan *plan, PlannedStmt *plannedStmt) {
+    ListCell *planCell = NULL;
 
-            /* set global key and value columns */
-            CurrentKeyVar = (Var *) expr1;
+    if (plan == NULL) {
+        return NULL;
+    }
 
-            targetEntry = (TargetEntry *) linitial(aggregateArgumentList);
-            CurrentValueVar = (Var *) targetEntry->expr;
+    plan->lefttree = VectorizePlanTree(plan->lefttree, plannedStmt);
+    plan->righttree = VectorizePlanTree(plan->righttree, plannedStmt);
+
+    if (IsA(plan, Append)) {
+        foreach(planCell, ((Append *) plan)->appendplans) {
+            lfirst(planCell) = VectorizePlanTree((Plan *) lfirst(planCell), plannedStmt);
+        }
+    } else if (IsA(plan, MergeAppend)) {
+        foreach(planCell, ((MergeAppend *) plan)->mergeplans) {
+            lfirst(planCell) = VectorizePlanTree((Plan *) lfirst(planCell), plannedStmt);
         }
+    } else if (IsA(plan, ModifyTable)) {
+        foreach(planCell, ((ModifyTable *) plan)->plans) {
+            lfirst(planCell) = VectorizePlanTree((Plan *) lfirst(planCell), plannedStmt);
+        }
+    } else if (IsA(plan, SubqueryScan)) {
+        SubqueryScan *subqueryScan = (SubqueryScan *) plan;
+        subqueryScan->subplan = VectorizePlanTree(subqueryScan->subplan, plannedStmt);
     }
 
-    if (vectorizedExecution) {
-        EState *estate = NULL;
-        CmdType operation = CMD_UNKNOWN;
-        DestReceiver *dest = NULL;
-        bool sendTuples = false;
-        MemoryContext oldcontext = NULL;
+    if (IsA(plan, Agg) && VectorizableAggregate((Agg *) plan, plannedStmt->rtable)) {
+        plan = (Plan *) CreateVectorizedAggScan((Agg *) plan);
+    }
 
-        /* sanity checks */
-        Assert(queryDesc != NULL);
+    return plan;
+}
 
-        estate = queryDesc->estate;
 
-        Assert(estate != NULL);
-        Assert(!(estate->es_top_eflags & EXEC_FLAG_EXPLAIN_ONLY));
+/*
+ * VectorizableAggregate checks if the given aggregate reads directly from a
+ * cstore table scan, and if we can compute all of its aggregates stripe by
+ * stripe. Vectorized aggregates skip the scan's tuple processing, so we don't
+ * vectorize scans whose rows the executor filters. Clauses that the scan
+ * evaluates itself remove rows from the stripes it returns, and are fine.
+ */
+static bool
+VectorizableAggregate(Agg *aggPlan, List *rangeTableList) {
+    Plan *scanPlan = aggPlan->plan.lefttree;
+    Index scanRangeTableIndex = 0;
+    RangeTblEntry *rangeTableEntry = NULL;
+
+    if (scanPlan == NULL || !IsA(scanPlan, ForeignScan) ||
+        aggPlan->plan.righttree != NULL) {
+        return false;
+    }
 
-        /*
-         * Switch into per-query memory context
-         */
-        oldcontext = MemoryContextSwitchTo(estate->es_query_cxt);
+    if (scanPlan->qual != NIL) {
+        return false;
+    }
 
-        /* Allow instrumentation of Executor overall runtime */
-        if (queryDesc->totaltime) {
-            InstrStartNode(queryDesc->totaltime);
-        }
+    scanRangeTableIndex = ((Scan *) scanPlan)->scanrelid;
+    if (scanRangeTableIndex == 0) {
+        return false;
+    }
 
-        /*
-         * extract information from the query descriptor and the query feature.
-         */
-        operation = queryDesc->operation;
-        dest = queryDesc->dest;
+    rangeTableEntry = rt_fetch(scanRangeTableIndex, rangeTableList);
+    if (rangeTableEntry->rtekind != RTE_RELATION ||
+        !CStoreTable(rangeTableEntry->relid)) {
+        return false;
+    }
 
-        /*
-         * startup tuple receiver, if we will be emitting tuples
-         */
-        estate->es_processed = 0;
-        estate->es_lastoid = InvalidOid;
+    if (aggPlan->aggstrategy == AGG_PLAIN) {
+        return VectorizablePlainAggregate(aggPlan, scanPlan);
+    } else if (aggPlan->aggstrategy == AGG_HASHED) {
+        return VectorizableGroupByAggregate(aggPlan, scanPlan);
+    }
+
+    return false;
+}
 
-        if ((operation == CMD_SELECT) || queryDesc->plannedstmt->hasReturning) {
-            sendTuples = true;
-        }
 
-        if (sendTuples) {
-            (*dest->rStartup)(dest, operation, queryDesc->tupDesc);
+/*
+ * VectorizablePlainAggregate checks that every aggregate in the target list and
+ * the having clause takes at most one table column as its argument, and has a
+ * vectorized transition function. Aggregates may also have a condition made of
+ * clauses we can evaluate on stripes, and count() may count a constant for rows
+ * that meet its condition.
+ */
+static bool
+VectorizablePlainAggregate(Agg *aggPlan, Plan *scanPlan) {
+    List *aggrefList = NIL;
+    ListCell *aggrefCell = NULL;
+
+    AggrefListWalker((Node *) aggPlan->plan.targetlist, &aggrefList);
+    AggrefListWalker((Node *) aggPlan->plan.qual, &aggrefList);
+
+    foreach(aggrefCell, aggrefList) {
+        Aggref *aggref = (Aggref *) lfirst(aggrefCell);
+        int32 argumentCount = list_length(aggref->args);
+        Expr *argument = NULL;
+        bool constantArgument = false;
+        List *conditionList = NIL;
+        ListCell *conditionCell = NULL;
+        Oid transitionFunctionId = InvalidOid;
+        Oid vectorTransitionFunctionId = InvalidOid;
+
+        if (!VectorizableAggref(aggref) || argumentCount > 1) {
+            return false;
         }
 
-        /*
-         * run plan
-         */
-        if (!ScanDirectionIsNoMovement(direction)) {
-            ExecutePlanVectorized(estate, queryDesc->planstate, operation,
-                                  sendTuples, count, direction, dest);
+        argument = AggregateArgument(aggref, &conditionList);
+        if (argument != NULL) {
+            constantArgument = (IsA(argument, Const) && !((Const *) argument)->constisnull);
+            if (!constantArgument && ScanColumnVar(scanPlan, argument) == NULL) {
+                return false;
+            }
         }
 
-        /*
-         * shutdown tuple receiver, if we started it
-         */
-        if (sendTuples) {
-            (*dest->rShutdown)(dest);
+        foreach(conditionCell, conditionList) {
+            Expr *clause = (Expr *) lfirst(conditionCell);
+            if (BuildAggregateFilterClause(scanPlan, clause) == NULL) {
+                return false;
+            }
         }
 
-        if (queryDesc->totaltime) {
-            InstrStopNode(queryDesc->totaltime, estate->es_processed);
+        transitionFunctionId = AggregateTransitionFunction(aggref->aggfnoid);
+        if (constantArgument &&
+            (conditionList == NIL || transitionFunctionId != F_INT8INC_ANY)) {
+            return false;
         }
 
-        MemoryContextSwitchTo(oldcontext);
-    } else {
-        standard_ExecutorRun(queryDesc, direction, count);
+        vectorTransitionFunctionId = VectorizedTransitionFunction(transitionFunctionId,
+                                                                  argumentCount);
+        if (!OidIsValid(vectorTransitionFunctionId)) {
+            return false;
+        }
     }
 
+    return true;
 }
 
 
 /*
- * Same as ExecutePlan. Instead of ExecProcNode we call ExecProcNodeVectorized.
+ * VectorizableGroupByAggregate checks if the given hash aggregate groups by a
+ * single table column or a timestamp bucket over one, and either computes a
+ * single count() or sum() over another table column, or only outputs the
+ * distinct keys. These are the group by aggregates we know how to vectorize.
  */
-static void
-ExecutePlanVectorized(EState *estate, PlanState *planstate, CmdType operation,
-                      bool sendTuples, long numberTuples, ScanDirection direction,
-                      DestReceiver *dest) {
-    TupleTableSlot *slot = NULL;
-    long current_tuple_count = 0;
+static bool
+VectorizableGroupByAggregate(Agg *aggPlan, Plan *scanPlan) {
+    List *targetList = aggPlan->plan.targetlist;
+    TargetEntry *keyTargetEntry = NULL;
+    TargetEntry *aggTargetEntry = NULL;
+    Aggref *aggref = NULL;
+    Expr *keyExpression = NULL;
+    Var *keyVar = NULL;
+    Var *valueVar = NULL;
+    VectorizedAggType aggType = VAT_GROUP_BY_COUNT;
+    TypeCacheEntry *keyTypeCacheEntry = NULL;
+    TimestampBucket keyBucket;
+
+    if (aggPlan->numCols != 1 || aggPlan->plan.qual != NIL ||
+        list_length(targetList) < 1 || list_length(targetList) > 2) {
+        return false;
+    }
 
-    /*
-     * initialize local variables
-     */
-    current_tuple_count = 0;
+    keyTargetEntry = (TargetEntry *) linitial(targetList);
+    if (!IsA(keyTargetEntry->expr, Var)) {
+        return false;
+    }
 
-    /*
-     * Set the direction.
-     */
-    estate->es_direction = direction;
+    /* the key must be the grouping column */
+    if (((Var *) keyTargetEntry->expr)->varattno != aggPlan->grpColIdx[0]) {
+        return false;
+    }
 
-    /*
-     * Loop until we've processed the proper number of tuples from the plan.
-     */
-    for (;;) {
-        /* Reset the per-output-tuple exprcontext */
-        ResetPerTupleExprContext(estate);
+    /* the key is either a table column, or computed from a timestamp column */
+    keyExpression = ScanTargetExpression(scanPlan, keyTargetEntry->expr);
+    keyVar = ScanColumnVar(scanPlan, keyTargetEntry->expr);
+    if (keyVar == NULL) {
+        keyVar = TimestampBucketColumn(keyExpression, &keyBucket);
+    }
 
-        /*
-         * Execute the plan and obtain a tuple
-         */
-        slot = ExecProcNodeVectorized(planstate);
+    if (keyVar == NULL) {
+        return false;
+    }
 
-        /*
-         * if the tuple is null, then we assume there is nothing more to
-         * process so we just end the loop...
-         */
-        if (TupIsNull(slot))
-            break;
+    /* SELECT DISTINCT, and group bys without aggregates, only output the key */
+    if (list_length(targetList) == 2) {
+        aggTargetEntry = (TargetEntry *) lsecond(targetList);
+        if (!IsA(aggTargetEntry->expr, Aggref)) {
+            return false;
+        }
 
-        /*
-         * If we have a junk filter, then project a new tuple with the junk
-         * removed.
-         *
-         * Store this new "clean" tuple in the junkfilter's resultSlot.
-         * (Formerly, we stored it back over the "dirty" tuple, which is WRONG
-         * because that tuple slot has the wrong descriptor.)
-         */
-        if (estate->es_junkFilter != NULL)
-            slot = ExecFilterJunk(estate->es_junkFilter, slot);
+        aggref = (Aggref *) aggTargetEntry->expr;
+        if (!VectorizableAggref(aggref) || aggref->aggfilter != NULL ||
+            list_length(aggref->args) > 1) {
+            return false;
+        }
 
-        /*
-         * If we are supposed to send the tuple somewhere, do so. (In
-         * practice, this is probably always the case at this point.)
-         */
-        if (sendTuples)
-            (*dest->receiveSlot)(slot, dest);
+        if (!GroupByAggregateType(aggref->aggfnoid, &aggType)) {
+            return false;
+        }
 
-        /*
-         * Count tuples processed, if this is a SELECT.  (For other operation
-         * types, the ModifyTable plan node must count the appropriate
-         * events.)
-         */
-        if (operation == CMD_SELECT)
-            (estate->es_processed)++;
+        if (aggref->args != NIL) {
+            TargetEntry *argument = (TargetEntry *) linitial(aggref->args);
+            valueVar = ScanColumnVar(scanPlan, argument->expr);
+            if (valueVar == NULL) {
+                return false;
+            }
+        }
 
-        /*
-         * check our tuple count.. if we've processed the proper number then
-         * quit, else loop again and process more tuples.  Zero numberTuples
-         * means no limit.
-         */
-        current_tuple_count++;
-        if (numberTuples && numberTuples == current_tuple_count)
-            break;
+        /* count(*) doesn't need a value column, but sum() does */
+        if (aggType == VAT_GROUP_BY_SUM &&
+            (valueVar == NULL ||
+             (valueVar->vartype != INT4OID && valueVar->vartype != FLOAT8OID))) {
+            return false;
+        }
     }
+
+    keyTypeCacheEntry = lookup_type_cache(exprType((Node *) keyExpression),
+                                          TYPECACHE_HASH_PROC | TYPECACHE_EQ_OPR);
+    if (!OidIsValid(keyTypeCacheEntry->hash_proc) ||
+        !OidIsValid(keyTypeCacheEntry->eq_opr)) {
+        return false;
+    }
+
+    return true;
 }
 
 
 /*
- * Similar to ExecProcNode, but supports only T_AggState. Instead of ExecAgg
- * we call ExecAggVectorized.
+ * VectorizableAggref checks that the aggregate is a regular aggregate without
+ * DISTINCT or ORDER BY clauses. We feed whole stripes to transition functions,
+ * and can't apply these clauses on the way. FILTER clauses are checked by the
+ * callers, since only plain aggregates evaluate them.
  */
-TupleTableSlot *
-ExecProcNodeVectorized(PlanState *node) {
-    TupleTableSlot *result = NULL;
+static bool
+VectorizableAggref(Aggref *aggref) {
+    if (aggref->aggkind != AGGKIND_NORMAL || aggref->aggdirectargs != NIL ||
+        aggref->aggdistinct != NIL || aggref->aggorder != NIL) {
+        return false;
+    }
 
-    CHECK_FOR_INTERRUPTS();
+    return true;
+}
 
-    if (node->chgParam != NULL) /* something changed */
-        ExecReScan(node);        /* let ReScan handle this */
 
-    if (node->instrument)
-        InstrStartNode(node->instrument);
+/*
+ * AggregateArgument returns the expression the given aggregate reads, or NULL
+ * for count(*), and sets the condition rows need to meet to be aggregated. The
+ * condition comes from the aggregate's FILTER clause, and from an argument of
+ * the form CASE WHEN condition THEN expression END. Such a CASE is null for
+ * rows that don't meet its condition, and aggregates skip null arguments, so
+ * we aggregate the THEN expression over rows that meet the condition instead.
+ * The condition is returned as a list of implicitly ANDed clauses.
+ */
+static Expr *
+AggregateArgument(Aggref *aggref, List **conditionList) {
+    Expr *argument = NULL;
 
-    switch (nodeTag(node)) {
-        case T_AggState:
-            result = ExecAggVectorized((AggState *) node);
-            break;
+    (*conditionList) = list_copy(make_ands_implicit((Expr *) aggref->aggfilter));
 
-        default:
-            elog(ERROR, "unrecognized node type: %d", (int) nodeTag(node));
-            result = NULL;
-            break;
+    if (aggref->args == NIL) {
+        return NULL;
+    }
+
+    argument = ((TargetEntry *) linitial(aggref->args))->expr;
+    if (IsA(argument, CaseExpr)) {
+        CaseExpr *caseExpression = (CaseExpr *) argument;
+        Expr *defaultResult = caseExpression->defresult;
+
+        if (caseExpression->arg == NULL && list_length(caseExpression->args) == 1 &&
+            (defaultResult == NULL ||
+             (IsA(defaultResult, Const) && ((Const *) defaultResult)->constisnull))) {
+            CaseWhen *caseWhen = (CaseWhen *) linitial(caseExpression->args);
+            List *caseConditionList = make_ands_implicit(caseWhen->expr);
+
+            (*conditionList) = list_concat(*conditionList, list_copy(caseConditionList));
+            argument = caseWhen->result;
+        }
+    }
+
+    return argument;
+}
+
+
+/*
+ * BuildAggregateFilterClause returns a filter clause for the given clause of an
+ * aggregate's condition if the clause compares a table column with a non-null
+ * constant, or checks whether a table column is null; and NULL otherwise. Like
+ * scan filters, we only consider immutable and strict operators, so that null
+ * rows never meet the clause. The operator's function is looked up later.
+ */
+static AggregateFilterClause *
+BuildAggregateFilterClause(Plan *scanPlan, Expr *clause) {
+    AggregateFilterClause *filterClause = NULL;
+    OpExpr *operatorExpression = NULL;
+    Expr *leftOperand = NULL;
+    Expr *rightOperand = NULL;
+    Var *column = NULL;
+    Const *constant = NULL;
+    bool columnIsLeftOperand = false;
+    Oid functionId = InvalidOid;
+
+    if (IsA(clause, NullTest)) {
+        NullTest *nullTest = (NullTest *) clause;
+
+        column = ScanColumnVar(scanPlan, nullTest->arg);
+        if (column == NULL || nullTest->argisrow) {
+            return NULL;
+        }
+
+        filterClause = palloc0(sizeof(AggregateFilterClause));
+        filterClause->columnIndex = column->varattno - 1;
+        filterClause->isNullTest = true;
+        filterClause->nullTestType = nullTest->nulltesttype;
+
+        return filterClause;
+    }
+
+    if (!IsA(clause, OpExpr)) {
+        return NULL;
+    }
+
+    operatorExpression = (OpExpr *) clause;
+    if (list_length(operatorExpression->args) != 2 ||
+        operatorExpression->opresulttype != BOOLOID) {
+        return NULL;
+    }
+
+    /* binary compatible casts, such as varchar to text, don't change values */
+    leftOperand = (Expr *) linitial(operatorExpression->args);
+    while (IsA(leftOperand, RelabelType)) {
+        leftOperand = ((RelabelType *) leftOperand)->arg;
+    }
+
+    rightOperand = (Expr *) lsecond(operatorExpression->args);
+    while (IsA(rightOperand, RelabelType)) {
+        rightOperand = ((RelabelType *) rightOperand)->arg;
+    }
+
+    if (IsA(rightOperand, Const)) {
+        column = ScanColumnVar(scanPlan, leftOperand);
+        constant = (Const *) rightOperand;
+        columnIsLeftOperand = true;
+    } else if (IsA(leftOperand, Const)) {
+        column = ScanColumnVar(scanPlan, rightOperand);
+        constant = (Const *) leftOperand;
+        columnIsLeftOperand = false;
+    }
+
+    if (column == NULL || constant->constisnull) {
+        return NULL;
+    }
+
+    functionId = get_opcode(operatorExpression->opno);
+    if (!OidIsValid(functionId) || !func_strict(functionId) ||
+        func_volatile(functionId) != PROVOLATILE_IMMUTABLE) {
+        return NULL;
+    }
+
+    filterClause = palloc0(sizeof(AggregateFilterClause));
+    filterClause->columnIndex = column->varattno - 1;
+    filterClause->columnIsLeftOperand = columnIsLeftOperand;
+    filterClause->constantValue = constant->constvalue;
+    filterClause->collation = operatorExpression->inputcollid;
+    filterClause->functionId = functionId;
+
+    return filterClause;
+}
+
+
+/* AggrefListWalker collects all aggregate references in the given expression. */
+static bool
+AggrefListWalker(Node *node, List **aggrefList) {
+    if (node == NULL) {
+        return false;
+    }
+
+    if (IsA(node, Aggref)) {
+        (*aggrefList) = lappend(*aggrefList, node);
+        return false;
+    }
+
+    return expression_tree_walker(node, AggrefListWalker, (void *) aggrefList);
+}
+
+
+/*
+ * ScanTargetExpression resolves an expression in the aggregate node to the
+ * expression the scan outputs for it. Aggregate expressions refer to the scan's
+ * target list through OUTER_VAR, so we follow that reference. If the expression
+ * isn't such a reference, the function returns NULL.
+ */
+static Expr *
+ScanTargetExpression(Plan *scanPlan, Expr *expression) {
+    Var *outerVar = NULL;
+    TargetEntry *scanTargetEntry = NULL;
+
+    if (expression == NULL || !IsA(expression, Var)) {
+        return NULL;
+    }
+
+    outerVar = (Var *) expression;
+    if (outerVar->varno != OUTER_VAR || outerVar->varattno <= 0 ||
+        outerVar->varattno > list_length(scanPlan->targetlist)) {
+        return NULL;
+    }
+
+    scanTargetEntry = (TargetEntry *) list_nth(scanPlan->targetlist,
+                                               outerVar->varattno - 1);
+
+    return scanTargetEntry->expr;
+}
+
+
+/*
+ * ScanColumnVar resolves an expression in the aggregate node to a table column.
+ * If the scan doesn't output a simple column reference for the expression, the
+ * function returns NULL.
+ */
+static Var *
+ScanColumnVar(Plan *scanPlan, Expr *expression) {
+    Expr *scanExpression = ScanTargetExpression(scanPlan, expression);
+    Var *scanVar = NULL;
+
+    if (scanExpression == NULL || !IsA(scanExpression, Var)) {
+        return NULL;
+    }
+
+    scanVar = (Var *) scanExpression;
+    if (scanVar->varattno <= 0) {
+        return NULL;
+    }
+
+    return scanVar;
+}
+
+
+/*
+ * TimestampBucketColumn checks if the given group by key is date_trunc(),
+ * date_part(), or a cast to date over a timestamp column, with a unit whose
+ * buckets have a fixed width. If so, the function fills in how we compute the
+ * key from the column's values, and returns the column. Otherwise, it returns
+ * NULL. Months and years vary in length, and timestamps with time zones depend
+ * on the session's time zone, so we leave them to the regular aggregate.
+ */
+static Var *
+TimestampBucketColumn(Expr *keyExpression, TimestampBucket *bucket) {
+#ifdef HAVE_INT64_TIMESTAMP
+    FuncExpr *funcExpression = NULL;
+    Node *timestampArgument = NULL;
+    Var *timestampVar = NULL;
+
+    if (keyExpression == NULL || !IsA(keyExpression, FuncExpr)) {
+        return NULL;
+    }
+
+    funcExpression = (FuncExpr *) keyExpression;
+    if (funcExpression->args == NIL) {
+        return NULL;
+    }
+
+    timestampArgument = (Node *) llast(funcExpression->args);
+    if (!IsA(timestampArgument, Var) || exprType(timestampArgument) != TIMESTAMPOID) {
+        return NULL;
+    }
+
+    timestampVar = (Var *) timestampArgument;
+    if (timestampVar->varattno <= 0) {
+        return NULL;
+    }
+
+    memset(bucket, 0, sizeof(TimestampBucket));
+    bucket->keyFunctionId = funcExpression->funcid;
+
+    if (funcExpression->funcid == F_TIMESTAMP_DATE) {
+        bucket->bucketType = TBT_DATE;
+        bucket->bucketWidth = USECS_PER_DAY;
+    } else if (funcExpression->funcid == F_TIMESTAMP_TRUNC ||
+               funcExpression->funcid == F_TIMESTAMP_PART) {
+        Node *unitArgument = (Node *) linitial(funcExpression->args);
+        text *unitText = NULL;
+        char *lowerUnit = NULL;
+        int unitType = 0;
+        int unitValue = 0;
+
+        if (!IsA(unitArgument, Const) || ((Const *) unitArgument)->constisnull) {
+            return NULL;
+        }
+
+        /* parse the unit the same way timestamp_trunc() and timestamp_part() do */
+        bucket->unitArgument = ((Const *) unitArgument)->constvalue;
+        unitText = DatumGetTextPP(bucket->unitArgument);
+        lowerUnit = downcase_truncate_identifier(VARDATA_ANY(unitText),
+                                                 VARSIZE_ANY_EXHDR(unitText), false);
+        unitType = DecodeUnits(0, lowerUnit, &unitValue);
+        if (unitType == UNKNOWN_FIELD) {
+            unitType = DecodeSpecial(0, lowerUnit, &unitValue);
+        }
+
+        if (funcExpression->funcid == F_TIMESTAMP_TRUNC) {
+            bucket->bucketType = TBT_TRUNC;
+
+            if (unitType != UNITS) {
+                return NULL;
+            }
+
+            switch (unitValue) {
+                case DTK_SECOND:
+                    bucket->bucketWidth = USECS_PER_SEC;
+                    break;
+                case DTK_MINUTE:
+                    bucket->bucketWidth = USECS_PER_MINUTE;
+                    break;
+                case DTK_HOUR:
+                    bucket->bucketWidth = USECS_PER_HOUR;
+                    break;
+                case DTK_DAY:
+                    bucket->bucketWidth = USECS_PER_DAY;
+                    break;
+                case DTK_WEEK:
+                    /* weeks start on Mondays, and 2000-01-03 is a Monday */
+                    bucket->bucketWidth = 7 * USECS_PER_DAY;
+                    bucket->bucketOffset = 2 * USECS_PER_DAY;
+                    break;
+                default:
+                    return NULL;
+            }
+        } else {
+            bucket->bucketType = TBT_PART;
+
+            if (unitType != UNITS && unitType != RESERV) {
+                return NULL;
+            }
+
+            if (unitValue == DTK_HOUR) {
+                bucket->bucketWidth = USECS_PER_HOUR;
+                bucket->partModulus = HOURS_PER_DAY;
+            } else if (unitValue == DTK_MINUTE) {
+                bucket->bucketWidth = USECS_PER_MINUTE;
+                bucket->partModulus = MINS_PER_HOUR;
+            } else if (unitValue == DTK_DOW) {
+                /* 2000-01-01 is a Saturday, and Sundays are day zero */
+                bucket->bucketWidth = USECS_PER_DAY;
+                bucket->partOffset = 6;
+                bucket->partModulus = 7;
+            } else {
+                return NULL;
+            }
+        }
+    } else {
+        return NULL;
     }
 
-    if (node->instrument)
-        InstrStopNode(node->instrument, TupIsNull(result) ? 0.0 : 1.0);
+    return timestampVar;
+#else
+    return NULL;
+#endif
+}
+
 
-    return result;
+/*
+ * GroupByAggregateType finds the vectorized group by aggregate type for the
+ * given aggregate function. If we can't vectorize the aggregate in group bys,
+ * the function returns false.
+ */
+static bool
+GroupByAggregateType(Oid aggregateId, VectorizedAggType *aggType) {
+    char *aggregateFunctionName = get_func_name(aggregateId);
+    if (aggregateFunctionName == NULL) {
+        ereport(ERROR, (errmsg("cache lookup failed for function %u", aggregateId)));
+    }
+
+    if (strncmp(aggregateFunctionName, "count", NAMEDATALEN) == 0) {
+        (*aggType) = VAT_GROUP_BY_COUNT;
+    } else if (strncmp(aggregateFunctionName, "sum", NAMEDATALEN) == 0) {
+        (*aggType) = VAT_GROUP_BY_SUM;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+
+/* AggregateTransitionFunction returns the transition function of an aggregate. */
+static Oid
+AggregateTransitionFunction(Oid aggregateId) {
+    HeapTuple aggregateTuple = NULL;
+    Form_pg_aggregate aggregateForm = NULL;
+    Oid transitionFunctionId = InvalidOid;
+
+    aggregateTuple = SearchSysCache1(AGGFNOID, ObjectIdGetDatum(aggregateId));
+    if (!HeapTupleIsValid(aggregateTuple)) {
+        ereport(ERROR, (errmsg("cache lookup failed for aggregate %u", aggregateId)));
+    }
+
+    aggregateForm = (Form_pg_aggregate) GETSTRUCT(aggregateTuple);
+    transitionFunctionId = aggregateForm->aggtransfn;
+
+    ReleaseSysCache(aggregateTuple);
+
+    return transitionFunctionId;
+}
+
+
+/*
+ * VectorizedTransitionFunction finds the vectorized version of the given
+ * transition function. We rely on a naming convention here, where vectorized
+ * function names are regular function names with _vec appended to them. That
+ * way, users type sum(), count(), or avg() instead of the vectorized aggregate
+ * names. If there is no vectorized version, the function returns InvalidOid.
+ */
+static Oid
+VectorizedTransitionFunction(Oid transitionFunctionId, int32 argumentCount) {
+    char *transitionFuncName = NULL;
+    char vectorTransitionFuncName[NAMEDATALEN];
+    List *qualVectorTransitionFuncName = NIL;
+    FuncCandidateList vectorTransitionFuncList = NULL;
+
+    transitionFuncName = get_func_name(transitionFunctionId);
+    if (transitionFuncName == NULL) {
+        ereport(ERROR, (errmsg("cache lookup failed for function %u",
+                               transitionFunctionId)));
+    }
+
+    snprintf(vectorTransitionFuncName, NAMEDATALEN, "%s_vec", transitionFuncName);
+
+    /* vectorized transition functions also take the transition value */
+    qualVectorTransitionFuncName = stringToQualifiedNameList(vectorTransitionFuncName);
+    vectorTransitionFuncList = FuncnameGetCandidates(qualVectorTransitionFuncName,
+                                                     argumentCount + 1, NIL,
+                                                     false, false, true);
+    if (vectorTransitionFuncList == NULL) {
+        return InvalidOid;
+    }
+
+    return vectorTransitionFuncList->oid;
+}
+
+
+/*
+ * CreateVectorizedAggScan creates a vectorized aggregate custom scan over the
+ * given aggregate. The custom scan projects the aggregate's output as is, and
+ * its cost is the aggregate's cost with a cheaper per-row aggregation step.
+ */
+static CustomScan *
+CreateVectorizedAggScan(Agg *aggPlan) {
+    CustomScan *customScan = makeNode(CustomScan);
+    Plan *plan = &customScan->scan.plan;
+    Plan *scanPlan = aggPlan->plan.lefttree;
+    Cost inputCost = scanPlan->total_cost;
+    Cost aggregateCost = aggPlan->plan.startup_cost - inputCost;
+    Cost outputCost = aggPlan->plan.total_cost - aggPlan->plan.startup_cost;
+
+    if (aggregateCost < 0) {
+        aggregateCost = 0;
+    }
+
+    plan->startup_cost = inputCost + aggregateCost * VECTORIZED_AGGREGATE_COST_FRACTION;
+    plan->total_cost = plan->startup_cost + outputCost;
+    plan->plan_rows = aggPlan->plan.plan_rows;
+    plan->plan_width = aggPlan->plan.plan_width;
+    plan->targetlist = VectorizedAggTargetList(aggPlan->plan.targetlist);
+    plan->qual = NIL;
+    plan->lefttree = (Plan *) aggPlan;
+    plan->righttree = NULL;
+    plan->extParam = bms_copy(aggPlan->plan.extParam);
+    plan->allParam = bms_copy(aggPlan->plan.allParam);
+
+    customScan->scan.scanrelid = ((Scan *) scanPlan)->scanrelid;
+    customScan->flags = 0;
+    customScan->custom_exprs = NIL;
+    customScan->custom_private = NIL;
+    customScan->methods = &VectorizedAggScanMethods;
+
+    return customScan;
 }
 
 
 /*
- * Similar to ExecAgg, but supports only plain aggregates. Instead of
- * agg_retrieve_direct, we call agg_retrieve_direct_vectorized.
+ * VectorizedAggTargetList builds the custom scan's target list, where each
+ * entry refers to the same entry in the aggregate's target list.
  */
-TupleTableSlot *
-ExecAggVectorized(AggState *node) {
+static List *
+VectorizedAggTargetList(List *aggTargetList) {
+    List *targetList = NIL;
+    ListCell *targetCell = NULL;
+
+    foreach(targetCell, aggTargetList) {
+        TargetEntry *aggTargetEntry = (TargetEntry *) lfirst(targetCell);
+        TargetEntry *targetEntry = flatCopyTargetEntry(aggTargetEntry);
+        Node *expression = (Node *) aggTargetEntry->expr;
+
+        targetEntry->expr = (Expr *) makeVar(OUTER_VAR, aggTargetEntry->resno,
+                                             exprType(expression),
+                                             exprTypmod(expression),
+                                             exprCollation(expression), 0);
+        targetList = lappend(targetList, targetEntry);
+    }
+
+    return targetList;
+}
+
+
+/* CreateVectorizedAggScanState creates the execution state for the custom scan. */
+static Node *
+CreateVectorizedAggScanState(CustomScan *customScan) {
+    VectorizedAggState *vectorizedAggState = palloc0(sizeof(VectorizedAggState));
+
+    NodeSetTag(vectorizedAggState, T_CustomScanState);
+    vectorizedAggState->customScanState.methods = &VectorizedAggExecMethods;
+    vectorizedAggState->keyColumnIndex = -1;
+    vectorizedAggState->valueColumnIndex = -1;
+
+    return (Node *) vectorizedAggState;
+}
+
+
+/*
+ * CopyVectorizedAggScan copies a vectorized aggregate custom scan. Custom scans
+ * need to copy all plan fields themselves.
+ */
+static CustomScan *
+CopyVectorizedAggScan(const CustomScan *from) {
+    CustomScan *newNode = makeNode(CustomScan);
+    const Plan *fromPlan = &from->scan.plan;
+    Plan *newPlan = &newNode->scan.plan;
+
+    newPlan->startup_cost = fromPlan->startup_cost;
+    newPlan->total_cost = fromPlan->total_cost;
+    newPlan->plan_rows = fromPlan->plan_rows;
+    newPlan->plan_width = fromPlan->plan_width;
+    newPlan->targetlist = copyObject(fromPlan->targetlist);
+    newPlan->qual = copyObject(fromPlan->qual);
+    newPlan->lefttree = copyObject(fromPlan->lefttree);
+    newPlan->righttree = copyObject(fromPlan->righttree);
+    newPlan->initPlan = copyObject(fromPlan->initPlan);
+    newPlan->extParam = bms_copy(fromPlan->extParam);
+    newPlan->allParam = bms_copy(fromPlan->allParam);
+
+    newNode->scan.scanrelid = from->scan.scanrelid;
+    newNode->flags = from->flags;
+    newNode->custom_exprs = copyObject(from->custom_exprs);
+    newNode->custom_private = copyObject(from->custom_private);
+    newNode->methods = from->methods;
+
+    return newNode;
+}
+
+
+/*
+ * BeginVectorizedAggScan initializes the aggregate node under the custom scan.
+ * We then resolve the table columns aggregates read from, and switch plain
+ * aggregates to their vectorized transition functions once for the scan.
+ */
+static void
+BeginVectorizedAggScan(CustomScanState *customScanState, EState *executorState,
+                       int executorFlags) {
+    VectorizedAggState *vectorizedAggState = (VectorizedAggState *) customScanState;
+    Plan *plan = customScanState->ss.ps.plan;
+    Agg *aggPlan = (Agg *) outerPlan(plan);
+    Plan *scanPlan = outerPlan(aggPlan);
+    AggState *aggstate = NULL;
+
+    aggstate = (AggState *) ExecInitNode((Plan *) aggPlan, executorState, executorFlags);
+    outerPlanState(customScanState) = (PlanState *) aggstate;
+
+    /* if Explain with no Analyze, do nothing */
+    if (executorFlags & EXEC_FLAG_EXPLAIN_ONLY) {
+        return;
+    }
+
+    if (aggPlan->aggstrategy == AGG_HASHED) {
+        InitGroupByAggregate(vectorizedAggState, aggPlan, scanPlan);
+    } else {
+        InitPlainAggregates(vectorizedAggState, aggstate, scanPlan);
+    }
+}
+
+
+/*
+ * InitPlainAggregates records the table column each plain aggregate reads from,
+ * and replaces the aggregates' transition functions with vectorized ones.
+ */
+static void
+InitPlainAggregates(VectorizedAggState *vectorizedAggState, AggState *aggstate,
+                    Plan *scanPlan) {
+    int aggno = 0;
+    ForeignScan *foreignScan = (ForeignScan *) scanPlan;
+    List *scanFilterList = foreignScan->fdw_exprs;
+
+    vectorizedAggState->aggColumnIndexArray = palloc0(Max(aggstate->numaggs, 1) *
+                                                      sizeof(int32));
+    vectorizedAggState->skipListAggTypeArray = palloc0(Max(aggstate->numaggs, 1) *
+                                                       sizeof(SkipListAggType));
+    vectorizedAggState->aggFilterIndexArray = palloc0(Max(aggstate->numaggs, 1) *
+                                                      sizeof(int32));
+    vectorizedAggState->aggFilterList = NIL;
+
+    /* block aggregates cover all rows, so scans that filter rows can't use them */
+    vectorizedAggState->skipListAggregates = (aggstate->numaggs > 0 &&
+                                              scanFilterList == NIL);
+
+    for (aggno = 0; aggno < aggstate->numaggs; aggno++) {
+        AggStatePerAgg peraggstate = &aggstate->peragg[aggno];
+        Aggref *aggref = peraggstate->aggref;
+        int32 argumentCount = list_length(aggref->args);
+        int32 columnIndex = -1;
+        int32 filterIndex = -1;
+        Oid columnTypeId = InvalidOid;
+        Oid vectorTransitionFunctionId = InvalidOid;
+        SkipListAggType skipListAggType = SLAT_NONE;
+        List *conditionList = NIL;
+        Expr *argument = AggregateArgument(aggref, &conditionList);
+        Var *scanVar = NULL;
+
+        /* count(*), and count() of a constant, don't read any columns */
+        scanVar = ScanColumnVar(scanPlan, argument);
+        if (scanVar != NULL) {
+            columnIndex = scanVar->varattno - 1;
+            columnTypeId = scanVar->vartype;
+        }
+
+        if (conditionList != NIL) {
+            filterIndex = AggregateFilterIndex(vectorizedAggState, conditionList,
+                                               scanPlan);
+        }
+
+        skipListAggType = SkipListAggregateType(peraggstate->transfn_oid, columnTypeId);
+        if (skipListAggType == SLAT_NONE || filterIndex >= 0) {
+            vectorizedAggState->skipListAggregates = false;
+        }
+
+        vectorizedAggState->skipListAggTypeArray[aggno] = skipListAggType;
+
+        vectorTransitionFunctionId =
+                VectorizedTransitionFunction(peraggstate->transfn_oid, argumentCount);
+        if (!OidIsValid(vectorTransitionFunctionId)) {
+            ereport(ERROR, (errmsg("could not find vectorized transition function "
+                                   "for aggregate %u", aggref->aggfnoid)));
+        }
+
+        fmgr_info(vectorTransitionFunctionId, &peraggstate->transfn);
+        vectorizedAggState->aggColumnIndexArray[aggno] = columnIndex;
+        vectorizedAggState->aggFilterIndexArray[aggno] = filterIndex;
+    }
+}
+
+
+/*
+ * AggregateFilterIndex returns the position of the given condition in the list
+ * of plain aggregates' conditions. If no other aggregate has the same condition,
+ * the function builds the condition's filter clauses, and appends it to the list.
+ */
+static int32
+AggregateFilterIndex(VectorizedAggState *vectorizedAggState, List *conditionList,
+                     Plan *scanPlan) {
+    AggregateFilter *aggFilter = NULL;
+    ListCell *aggFilterCell = NULL;
+    ListCell *conditionCell = NULL;
+    int32 filterIndex = 0;
+
+    foreach(aggFilterCell, vectorizedAggState->aggFilterList) {
+        aggFilter = (AggregateFilter *) lfirst(aggFilterCell);
+        if (equal(aggFilter->conditionList, conditionList)) {
+            return filterIndex;
+        }
+
+        filterIndex++;
+    }
+
+    aggFilter = palloc0(sizeof(AggregateFilter));
+    aggFilter->conditionList = conditionList;
+
+    foreach(conditionCell, conditionList) {
+        Expr *clause = (Expr *) lfirst(conditionCell);
+        AggregateFilterClause *filterClause = BuildAggregateFilterClause(scanPlan, clause);
+
+        Assert(filterClause != NULL);
+        if (!filterClause->isNullTest) {
+            fmgr_info(filterClause->functionId, &filterClause->operatorFunction);
+        }
+
+        aggFilter->clauseList = lappend(aggFilter->clauseList, filterClause);
+    }
+
+    vectorizedAggState->aggFilterList = lappend(vectorizedAggState->aggFilterList,
+                                                aggFilter);
+
+    return filterIndex;
+}
+
+
+/*
+ * InitGroupByAggregate records the table columns and types a group by aggregate
+ * reads from, and how to compute timestamp bucket keys. The aggregation hash
+ * itself is created on the first execution.
+ */
+static void
+InitGroupByAggregate(VectorizedAggState *vectorizedAggState, Agg *aggPlan,
+                     Plan *scanPlan) {
+    TargetEntry *keyTargetEntry = (TargetEntry *) linitial(aggPlan->plan.targetlist);
+    TargetEntry *aggTargetEntry = NULL;
+    Aggref *aggref = NULL;
+    Expr *keyExpression = ScanTargetExpression(scanPlan, keyTargetEntry->expr);
+    Var *keyVar = ScanColumnVar(scanPlan, keyTargetEntry->expr);
+    bool aggTypeFound = false;
+
+    if (keyVar == NULL) {
+        TimestampBucket *keyBucket = palloc0(sizeof(TimestampBucket));
+
+        keyVar = TimestampBucketColumn(keyExpression, keyBucket);
+        Assert(keyVar != NULL);
+
+        fmgr_info(keyBucket->keyFunctionId, &keyBucket->keyFunction);
+        vectorizedAggState->keyBucket = keyBucket;
+    }
+
+    vectorizedAggState->keyColumnIndex = keyVar->varattno - 1;
+    vectorizedAggState->keyTypeId = exprType((Node *) keyExpression);
+
+    if (list_length(aggPlan->plan.targetlist) == 1) {
+        vectorizedAggState->aggType = VAT_DISTINCT;
+        return;
+    }
+
+    aggTargetEntry = (TargetEntry *) lsecond(aggPlan->plan.targetlist);
+    aggref = (Aggref *) aggTargetEntry->expr;
+
+    if (aggref->args != NIL) {
+        TargetEntry *argument = (TargetEntry *) linitial(aggref->args);
+        Var *valueVar = ScanColumnVar(scanPlan, argument->expr);
+
+        Assert(valueVar != NULL);
+        vectorizedAggState->valueColumnIndex = valueVar->varattno - 1;
+        vectorizedAggState->valueTypeId = valueVar->vartype;
+    }
+
+    aggTypeFound = GroupByAggregateType(aggref->aggfnoid, &vectorizedAggState->aggType);
+    if (!aggTypeFound) {
+        ereport(ERROR, (errmsg("vectorization unsupported for aggregate %u group by",
+                               aggref->aggfnoid)));
+    }
+}
+
+
+/*
+ * ExecVectorizedAggScan returns the next aggregate tuple. We bypass the
+ * aggregate node's own execution, so we also do its instrumentation here.
+ */
+static TupleTableSlot *
+ExecVectorizedAggScan(CustomScanState *customScanState) {
+    VectorizedAggState *vectorizedAggState = (VectorizedAggState *) customScanState;
+    AggState *aggstate = (AggState *) outerPlanState(customScanState);
+    PlanState *aggPlanState = (PlanState *) aggstate;
+    TupleTableSlot *resultSlot = NULL;
+
+    if (aggPlanState->instrument) {
+        InstrStartNode(aggPlanState->instrument);
+    }
+
+    resultSlot = ExecAggVectorized(vectorizedAggState, aggstate);
+
+    if (aggPlanState->instrument) {
+        InstrStopNode(aggPlanState->instrument, TupIsNull(resultSlot) ? 0.0 : 1.0);
+    }
+
+    return resultSlot;
+}
+
+
+/* EndVectorizedAggScan releases the aggregation hash and ends the child node. */
+static void
+EndVectorizedAggScan(CustomScanState *customScanState) {
+    VectorizedAggState *vectorizedAggState = (VectorizedAggState *) customScanState;
+
+    DestroyAggregationHash(vectorizedAggState);
+    ExecEndNode(outerPlanState(customScanState));
+}
+
+
+/*
+ * ReScanVectorizedAggScan restarts the aggregation. We read stripes from the
+ * foreign scan directly instead of through ExecProcNode, so we also need to
+ * restart the foreign scan ourselves whenever the aggregate node wouldn't.
+ */
+static void
+ReScanVectorizedAggScan(CustomScanState *customScanState) {
+    VectorizedAggState *vectorizedAggState = (VectorizedAggState *) customScanState;
+    AggState *aggstate = (AggState *) outerPlanState(customScanState);
+    PlanState *scanState = outerPlanState(aggstate);
+    Agg *aggPlan = (Agg *) aggstate->ss.ps.plan;
+
+    DestroyAggregationHash(vectorizedAggState);
+
+    ExecReScan((PlanState *) aggstate);
+    aggstate->table_filled = false;
+    aggstate->agg_done = false;
+
+    if (aggPlan->aggstrategy == AGG_HASHED || scanState->chgParam != NULL) {
+        ExecReScan(scanState);
+    }
+}
+
+
+/* ExplainVectorizedAggScan shows the strategy of the vectorized aggregate. */
+static void
+ExplainVectorizedAggScan(CustomScanState *customScanState, List *ancestors,
+                         ExplainState *explainState) {
+    AggState *aggstate = (AggState *) outerPlanState(customScanState);
+    Agg *aggPlan = (Agg *) aggstate->ss.ps.plan;
+    const char *strategyName = "Plain";
+
+    if (aggPlan->aggstrategy == AGG_HASHED) {
+        strategyName = "Hashed";
+    }
+
+    ExplainPropertyText("Vectorized Strategy", strategyName, explainState);
+}
+
+
+/*
+ * Similar to ExecAgg, but supports only plain and hashed aggregates. Instead of
+ * agg_retrieve_direct and agg_retrieve_hash_table, we call their vectorized
+ * versions.
+ */
+static TupleTableSlot *
+ExecAggVectorized(VectorizedAggState *vectorizedAggState, AggState *aggstate) {
     /*
      * Check to see if we're still projecting out tuples from a previous agg
      * tuple (because there is a function-returning-set in the projection
      * expressions).  If so, try to project another one.
      */
-    if (node->ss.ps.ps_TupFromTlist) {
+    if (aggstate->ss.ps.ps_TupFromTlist) {
         TupleTableSlot *result;
         ExprDoneCond isDone;
 
-        result = ExecProject(node->ss.ps.ps_ProjInfo, &isDone);
+        result = ExecProject(aggstate->ss.ps.ps_ProjInfo, &isDone);
         if (isDone == ExprMultipleResult)
             return result;
         /* Done with that source tuple... */
-        node->ss.ps.ps_TupFromTlist = false;
+        aggstate->ss.ps.ps_TupFromTlist = false;
     }
 
     /*
@@ -945,14 +1634,14 @@ ExecAggVectorized(AggState *node) {
      * first, because in some cases agg_done gets set before we emit the final
      * aggregate tuple, and we have to finish running SRFs for it.)
      */
-    if (node->agg_done)
+    if (aggstate->agg_done)
         return NULL;
 
     /* Dispatch based on strategy */
-    if (((Agg *) node->ss.ps.plan)->aggstrategy == AGG_HASHED) {
-        return agg_retrieve_hash_vectorized(node);
+    if (((Agg *) aggstate->ss.ps.plan)->aggstrategy == AGG_HASHED) {
+        return agg_retrieve_hash_vectorized(vectorizedAggState, aggstate);
     } else {
-        return agg_retrieve_direct_vectorized(node);
+        return agg_retrieve_direct_vectorized(vectorizedAggState, aggstate);
     }
 }
 
@@ -965,189 +1654,671 @@ ExecAggVectorized(AggState *node) {
  * agg_fill_hash_table() and agg_retrieve_hash_table() into a single function.
  */
 static TupleTableSlot *
-agg_retrieve_hash_vectorized(AggState *aggstate) {
+agg_retrieve_hash_vectorized(VectorizedAggState *vectorizedAggState,
+                             AggState *aggstate) {
     TupleTableSlot *resultSlot = aggstate->ss.ps.ps_ProjInfo->pi_slot;
     AggregationHashEntry *nextHashEntry = NULL;
+    bool nullKey = false;
 
     if (!(aggstate->table_filled)) {
-        ExprContext *tmpcontext = NULL;
-        TupleTableSlot *outerslot = NULL;
+        FillAggregationHash(vectorizedAggState, aggstate);
+        aggstate->table_filled = true;
+    }
+
+    ExecClearTuple(resultSlot);
+
+    /* return the null key group first, since it isn't in the hash table */
+    if (vectorizedAggState->nullKeyFound) {
+        nextHashEntry = &vectorizedAggState->nullKeyEntry;
+        nullKey = true;
+        vectorizedAggState->nullKeyFound = false;
+    } else if (vectorizedAggState->hashSeqActive) {
+        nextHashEntry =
+                (AggregationHashEntry *) hash_seq_search(&vectorizedAggState->hashSeqStatus);
+        if (nextHashEntry == NULL) {
+            vectorizedAggState->hashSeqActive = false;
+        }
+    }
+
+    if (nextHashEntry != NULL) {
+        TupleDesc tupleDescriptor = resultSlot->tts_tupleDescriptor;
+        uint32 columnCount = tupleDescriptor->natts;
+        Datum *columnValues = resultSlot->tts_values;
+        bool *columnNulls = resultSlot->tts_isnull;
+
+        memset(columnValues, 0, columnCount * sizeof(Datum));
+        memset(columnNulls, true, columnCount * sizeof(bool));
+
+        columnValues[0] = nextHashEntry->key;
+        columnNulls[0] = nullKey;
+
+        /* distinct keys don't have an aggregate value */
+        if (columnCount > 1) {
+            columnValues[1] = nextHashEntry->value;
+            columnNulls[1] = nextHashEntry->valueIsNull;
+        }
+
+        ExecStoreVirtualTuple(resultSlot);
+    } else {
+        DestroyAggregationHash(vectorizedAggState);
+        aggstate->agg_done = true;
+    }
+
+    return resultSlot;
+}
+
+
+/*
+ * FillAggregationHash reads all stripes from the foreign scan, and aggregates
+ * their rows into the aggregation hash. Keys and pass-by-reference values are
+ * copied into the aggregate's memory context.
+ */
+static void
+FillAggregationHash(VectorizedAggState *vectorizedAggState, AggState *aggstate) {
+    ForeignScanState *foreignNode = (ForeignScanState *) outerPlanState(aggstate);
+    TableReadState *readState = (TableReadState *) foreignNode->fdw_state;
+    uint64 blockRowCount = readState->tableFooter->blockRowCount;
+    AggregationHashEntry *nullKeyEntry = &vectorizedAggState->nullKeyEntry;
+    TimestampBucket *keyBucket = vectorizedAggState->keyBucket;
+    TypeCacheEntry *keyTypeCacheEntry = NULL;
+    StripeData *stripeData = NULL;
+    MemoryContext oldContext = NULL;
+    HASHCTL info;
+    int hashFlags = 0;
+
+    keyTypeCacheEntry = lookup_type_cache(vectorizedAggState->keyTypeId,
+                                          (TYPECACHE_HASH_PROC_FINFO |
+                                           TYPECACHE_EQ_OPR_FINFO));
+
+    CurrentHashFunction = &(keyTypeCacheEntry->hash_proc_finfo);
+    CurrentEqualityFunction = &(keyTypeCacheEntry->eq_opr_finfo);
+    CurrentKeyIsText = (keyTypeCacheEntry->hash_proc == F_HASHTEXT &&
+                        keyTypeCacheEntry->eq_opr_finfo.fn_oid == F_TEXTEQ);
+
+    memset(&info, 0, sizeof(info));
+    info.keysize = sizeof(Datum);
+    info.entrysize = sizeof(AggregationHashEntry);
+    info.hash = VectorizedHashTableHash;
+    info.match = VectorizedHashTableMatch;
+    info.hcxt = aggstate->aggcontext;
+
+    hashFlags = HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT;
+
+    vectorizedAggState->aggregationHash = hash_create("Aggregation Hash", 1024,
+                                                      &info, hashFlags);
+
+    /* count starts from zero, and sum from null */
+    memset(nullKeyEntry, 0, sizeof(AggregationHashEntry));
+    nullKeyEntry->value = Int64GetDatum(0);
+    nullKeyEntry->valueIsNull = (vectorizedAggState->aggType == VAT_GROUP_BY_SUM);
+    vectorizedAggState->nullKeyFound = false;
+
+    oldContext = MemoryContextSwitchTo(aggstate->aggcontext);
+
+    if (keyBucket != NULL) {
+        vectorizedAggState->bucketIdArray = palloc0(blockRowCount * sizeof(int64));
+        vectorizedAggState->bucketFoundArray = palloc0(blockRowCount * sizeof(bool));
+        vectorizedAggState->denseValueArray =
+                palloc0(DENSE_BUCKET_COUNT_MAXIMUM * sizeof(int64));
+        vectorizedAggState->denseRowFoundArray =
+                palloc0(DENSE_BUCKET_COUNT_MAXIMUM * sizeof(bool));
+        vectorizedAggState->denseValueFoundArray =
+                palloc0(DENSE_BUCKET_COUNT_MAXIMUM * sizeof(bool));
+    }
+
+    stripeData = CStoreReadNextStripe(readState);
+    while (stripeData != NULL) {
+        if (keyBucket != NULL) {
+            AggregateTimestampBuckets(vectorizedAggState, keyTypeCacheEntry,
+                                      stripeData, blockRowCount);
+        } else if (vectorizedAggState->aggType == VAT_DISTINCT) {
+            AggregateDistinctKeys(vectorizedAggState, keyTypeCacheEntry, stripeData,
+                                  blockRowCount, readState->stripeSkipList);
+        } else {
+            AggregateColumnKeys(vectorizedAggState, keyTypeCacheEntry,
+                                stripeData, blockRowCount);
+        }
+
+        stripeData = CStoreReadNextStripe(readState);
+    }
+
+    MemoryContextSwitchTo(oldContext);
+
+    hash_seq_init(&vectorizedAggState->hashSeqStatus,
+                  vectorizedAggState->aggregationHash);
+    vectorizedAggState->hashSeqActive = true;
+}
+
+
+/*
+ * AggregateColumnKeys aggregates a stripe's rows whose group by key is a table
+ * column, looking up each row's group in the aggregation hash.
+ */
+static void
+AggregateColumnKeys(VectorizedAggState *vectorizedAggState,
+                    TypeCacheEntry *keyTypeCacheEntry, StripeData *stripeData,
+                    uint64 blockRowCount) {
+    int32 valueColumnIndex = vectorizedAggState->valueColumnIndex;
+    ColumnData *keyColumnData =
+            stripeData->columnDataArray[vectorizedAggState->keyColumnIndex];
+    ColumnData *valueColumnData = NULL;
+    uint32 rowIndex = 0;
+
+    if (valueColumnIndex >= 0) {
+        valueColumnData = stripeData->columnDataArray[valueColumnIndex];
+    }
+
+    for (rowIndex = 0; rowIndex < stripeData->rowCount; rowIndex++) {
+        uint32 blockIndex = rowIndex / blockRowCount;
+        uint32 blockRowIndex = rowIndex % blockRowCount;
+        ColumnBlockData *keyBlockData = keyColumnData->blockDataArray[blockIndex];
+        ColumnBlockData *valueBlockData = NULL;
+        AggregationHashEntry *aggregationHashEntry = NULL;
+
+        if (keyBlockData->existsArray[blockRowIndex]) {
+            Datum key = keyBlockData->valueArray[blockRowIndex];
+            aggregationHashEntry = LookupGroupByHashEntry(vectorizedAggState,
+                                                          keyTypeCacheEntry, key);
+        } else {
+            aggregationHashEntry = &vectorizedAggState->nullKeyEntry;
+            vectorizedAggState->nullKeyFound = true;
+        }
+
+        if (valueColumnData != NULL) {
+            valueBlockData = valueColumnData->blockDataArray[blockIndex];
+        }
+
+        AdvanceGroupByRow(vectorizedAggState, aggregationHashEntry,
+                          valueBlockData, blockRowIndex);
+    }
+}
+
+
+/*
+ * LookupGroupByHashEntry finds the aggregation hash entry for the given non-null
+ * key. If the key isn't in the hash yet, the function copies the key into the
+ * current memory context, and starts the group's aggregate.
+ */
+static AggregationHashEntry *
+LookupGroupByHashEntry(VectorizedAggState *vectorizedAggState,
+                       TypeCacheEntry *keyTypeCacheEntry, Datum key) {
+    AggregationHashEntry *nullKeyEntry = &vectorizedAggState->nullKeyEntry;
+    AggregationHashEntry *hashEntry = NULL;
+    bool handleFound = false;
+
+    hashEntry = (AggregationHashEntry *) hash_search(vectorizedAggState->aggregationHash,
+                                                     &key, HASH_ENTER, &handleFound);
+    if (!handleFound) {
+        hashEntry->key = datumCopy(key, keyTypeCacheEntry->typbyval,
+                                   keyTypeCacheEntry->typlen);
+        hashEntry->value = nullKeyEntry->value;
+        hashEntry->valueIsNull = nullKeyEntry->valueIsNull;
+    }
+
+    return hashEntry;
+}
+
+
+/*
+ * AdvanceGroupByRow adds one row to the group's aggregate. count(*) passes a
+ * null value block, and counts every row. Other aggregates skip null values.
+ */
+static void
+AdvanceGroupByRow(VectorizedAggState *vectorizedAggState,
+                  AggregationHashEntry *hashEntry, ColumnBlockData *valueBlockData,
+                  uint32 blockRowIndex) {
+    if (valueBlockData == NULL) {
+        AdvanceGroupByAggregate(vectorizedAggState, hashEntry, (Datum) 0);
+    } else if (valueBlockData->existsArray[blockRowIndex]) {
+        Datum value = valueBlockData->valueArray[blockRowIndex];
+        AdvanceGroupByAggregate(vectorizedAggState, hashEntry, value);
+    }
+}
+
+
+/*
+ * AggregateDistinctKeys adds the distinct keys of a stripe's rows to the
+ * aggregation hash. Dictionary-encoded blocks already list their distinct
+ * values, so we add these values instead of hashing each row's key, as long as
+ * the scan didn't leave out any of the stripe's rows; the dictionaries then
+ * cover exactly the rows we have. For other blocks, we skip the hash lookup for
+ * rows whose key datum is the same as the previous row's, which is common in
+ * sorted and low-cardinality columns.
+ */
+static void
+AggregateDistinctKeys(VectorizedAggState *vectorizedAggState,
+                      TypeCacheEntry *keyTypeCacheEntry, StripeData *stripeData,
+                      uint64 blockRowCount, StripeSkipList *stripeSkipList) {
+    ColumnData *keyColumnData =
+            stripeData->columnDataArray[vectorizedAggState->keyColumnIndex];
+    uint32 blockCount = (stripeData->rowCount + blockRowCount - 1) / blockRowCount;
+    uint64 stripeRowCount = 0;
+    bool stripeRowsComplete = false;
+    uint32 blockIndex = 0;
+
+    for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++) {
+        stripeRowCount += stripeSkipList->blockSkipNodeArray[0][blockIndex].rowCount;
+    }
+
+    stripeRowsComplete = (stripeData->rowCount == stripeRowCount);
+
+    for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        ColumnBlockData *keyBlockData = keyColumnData->blockDataArray[blockIndex];
+        uint32 rowCount = Min(blockRowCount, stripeData->rowCount -
+                                             blockIndex * blockRowCount);
+        bool previousKeyFound = false;
+        Datum previousKey = 0;
+        uint32 rowIndex = 0;
+
+        if (stripeRowsComplete && keyBlockData->dictionaryCodeArray != NULL) {
+            uint32 entryIndex = 0;
+
+            for (entryIndex = 0; entryIndex < keyBlockData->dictionaryEntryCount;
+                 entryIndex++) {
+                Datum key = keyBlockData->dictionaryEntryArray[entryIndex];
+                LookupGroupByHashEntry(vectorizedAggState, keyTypeCacheEntry, key);
+            }
+
+            /* dictionaries don't have nulls, so we still check for them */
+            for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+                if (!keyBlockData->existsArray[rowIndex]) {
+                    vectorizedAggState->nullKeyFound = true;
+                    break;
+                }
+            }
+
+            continue;
+        }
+
+        for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+            Datum key = keyBlockData->valueArray[rowIndex];
+
+            if (!keyBlockData->existsArray[rowIndex]) {
+                vectorizedAggState->nullKeyFound = true;
+                continue;
+            }
+
+            if (previousKeyFound && key == previousKey) {
+                continue;
+            }
+
+            LookupGroupByHashEntry(vectorizedAggState, keyTypeCacheEntry, key);
+            previousKey = key;
+            previousKeyFound = true;
+        }
+    }
+}
+
+
+/*
+ * AggregateTimestampBuckets aggregates a stripe's rows whose group by key is
+ * computed from a timestamp column. For each block, we first compute the rows'
+ * bucket ids in a single pass. If these ids fall into a small range, and the
+ * aggregate is a count, an integer sum, or absent as for distinct keys, we then
+ * aggregate the rows into dense arrays indexed by bucket, and only look up one
+ * hash entry per bucket. Float sums depend on the order we add values in, so we
+ * aggregate them and blocks with sparse buckets row by row. Null and infinite
+ * timestamps don't fall into buckets, and always go row by row.
+ */
+static void
+AggregateTimestampBuckets(VectorizedAggState *vectorizedAggState,
+                          TypeCacheEntry *keyTypeCacheEntry, StripeData *stripeData,
+                          uint64 blockRowCount) {
+    TimestampBucket *keyBucket = vectorizedAggState->keyBucket;
+    int64 *bucketIdArray = vectorizedAggState->bucketIdArray;
+    bool *bucketFoundArray = vectorizedAggState->bucketFoundArray;
+    int32 valueColumnIndex = vectorizedAggState->valueColumnIndex;
+    ColumnData *keyColumnData =
+            stripeData->columnDataArray[vectorizedAggState->keyColumnIndex];
+    ColumnData *valueColumnData = NULL;
+    bool denseAggregate = (vectorizedAggState->aggType == VAT_GROUP_BY_COUNT ||
+                           vectorizedAggState->aggType == VAT_DISTINCT ||
+                           vectorizedAggState->valueTypeId == INT4OID);
+    uint32 blockCount = (stripeData->rowCount + blockRowCount - 1) / blockRowCount;
+    uint32 blockIndex = 0;
+
+    if (valueColumnIndex >= 0) {
+        valueColumnData = stripeData->columnDataArray[valueColumnIndex];
+    }
+
+    for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        ColumnBlockData *keyBlockData = keyColumnData->blockDataArray[blockIndex];
+        ColumnBlockData *valueBlockData = NULL;
+        uint32 rowCount = Min(blockRowCount, stripeData->rowCount -
+                                             blockIndex * blockRowCount);
+        int64 minimumBucketId = 0;
+        int64 maximumBucketId = 0;
+        bool bucketFound = false;
+        bool denseBlock = false;
+        uint32 rowIndex = 0;
+
+        if (valueColumnData != NULL) {
+            valueBlockData = valueColumnData->blockDataArray[blockIndex];
+        }
+
+        TimestampBucketIds(keyBucket, keyBlockData, rowCount, bucketIdArray,
+                           bucketFoundArray);
+
+        for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+            int64 bucketId = bucketIdArray[rowIndex];
+            if (!bucketFoundArray[rowIndex]) {
+                continue;
+            }
+
+            if (!bucketFound || bucketId < minimumBucketId) {
+                minimumBucketId = bucketId;
+            }
+            if (!bucketFound || bucketId > maximumBucketId) {
+                maximumBucketId = bucketId;
+            }
+
+            bucketFound = true;
+        }
+
+        if (denseAggregate && bucketFound &&
+            maximumBucketId - minimumBucketId < DENSE_BUCKET_COUNT_MAXIMUM) {
+            AggregateDenseBuckets(vectorizedAggState, valueBlockData, rowCount,
+                                  minimumBucketId);
+            MergeDenseBuckets(vectorizedAggState, keyTypeCacheEntry, minimumBucketId,
+                              maximumBucketId - minimumBucketId + 1);
+            denseBlock = true;
+        }
+
+        for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+            AggregationHashEntry *aggregationHashEntry = NULL;
+
+            if (bucketFoundArray[rowIndex]) {
+                Datum key = 0;
+                if (denseBlock) {
+                    continue;
+                }
+
+                key = TimestampBucketKey(keyBucket, bucketIdArray[rowIndex]);
+                aggregationHashEntry = LookupGroupByHashEntry(vectorizedAggState,
+                                                              keyTypeCacheEntry, key);
+            } else if (keyBlockData->existsArray[rowIndex]) {
+                Datum timestamp = keyBlockData->valueArray[rowIndex];
+                Datum key = TimestampFunctionKey(keyBucket, timestamp);
+
+                aggregationHashEntry = LookupGroupByHashEntry(vectorizedAggState,
+                                                              keyTypeCacheEntry, key);
+            } else {
+                aggregationHashEntry = &vectorizedAggState->nullKeyEntry;
+                vectorizedAggState->nullKeyFound = true;
+            }
+
+            AdvanceGroupByRow(vectorizedAggState, aggregationHashEntry,
+                              valueBlockData, rowIndex);
+        }
+    }
+}
+
+
+/*
+ * TimestampBucketIds computes the bucket ids of a block's timestamps. Rows with
+ * null or infinite timestamps don't fall into any bucket, and are marked as not
+ * found.
+ */
+static void
+TimestampBucketIds(TimestampBucket *bucket, ColumnBlockData *blockData,
+                   uint32 rowCount, int64 *bucketIdArray, bool *bucketFoundArray) {
+    int64 bucketWidth = bucket->bucketWidth;
+    int64 bucketOffset = bucket->bucketOffset;
+    uint32 rowIndex = 0;
+
+    for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+        Timestamp timestamp = DatumGetTimestamp(blockData->valueArray[rowIndex]);
+        bool bucketFound = (blockData->existsArray[rowIndex] &&
+                            !TIMESTAMP_NOT_FINITE(timestamp));
+
+        bucketFoundArray[rowIndex] = bucketFound;
+        bucketIdArray[rowIndex] = 0;
+        if (bucketFound) {
+            bucketIdArray[rowIndex] = FloorDivide(timestamp - bucketOffset, bucketWidth);
+        }
+    }
+}
+
+
+/*
+ * AggregateDenseBuckets aggregates a block's rows that fall into buckets into
+ * the dense arrays, where each bucket's position is its distance from the
+ * smallest bucket id in the block.
+ */
+static void
+AggregateDenseBuckets(VectorizedAggState *vectorizedAggState,
+                      ColumnBlockData *valueBlockData, uint32 rowCount,
+                      int64 minimumBucketId) {
+    int64 *bucketIdArray = vectorizedAggState->bucketIdArray;
+    bool *bucketFoundArray = vectorizedAggState->bucketFoundArray;
+    int64 *denseValueArray = vectorizedAggState->denseValueArray;
+    bool *denseRowFoundArray = vectorizedAggState->denseRowFoundArray;
+    bool *denseValueFoundArray = vectorizedAggState->denseValueFoundArray;
+    bool countValues = (vectorizedAggState->aggType == VAT_GROUP_BY_COUNT);
+    uint32 rowIndex = 0;
+
+    for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+        uint32 bucketIndex = 0;
+        if (!bucketFoundArray[rowIndex]) {
+            continue;
+        }
+
+        bucketIndex = (uint32) (bucketIdArray[rowIndex] - minimumBucketId);
+        denseRowFoundArray[bucketIndex] = true;
+
+        if (valueBlockData == NULL) {
+            denseValueArray[bucketIndex] += 1;
+            denseValueFoundArray[bucketIndex] = true;
+        } else if (valueBlockData->existsArray[rowIndex]) {
+            Datum value = valueBlockData->valueArray[rowIndex];
+
+            denseValueArray[bucketIndex] += countValues ? 1 : DatumGetInt32(value);
+            denseValueFoundArray[bucketIndex] = true;
+        }
+    }
+}
+
+
+/*
+ * MergeDenseBuckets merges the dense arrays' buckets into their groups' hash
+ * entries, and clears the arrays for the next block. Buckets with rows but no
+ * values still create their groups.
+ */
+static void
+MergeDenseBuckets(VectorizedAggState *vectorizedAggState,
+                  TypeCacheEntry *keyTypeCacheEntry, int64 minimumBucketId,
+                  int64 bucketCount) {
+    int64 *denseValueArray = vectorizedAggState->denseValueArray;
+    bool *denseRowFoundArray = vectorizedAggState->denseRowFoundArray;
+    bool *denseValueFoundArray = vectorizedAggState->denseValueFoundArray;
+    int64 bucketIndex = 0;
+
+    for (bucketIndex = 0; bucketIndex < bucketCount; bucketIndex++) {
+        AggregationHashEntry *hashEntry = NULL;
+        Datum key = 0;
+
+        if (!denseRowFoundArray[bucketIndex]) {
+            continue;
+        }
 
-        PlanState *outerPlan = outerPlanState(aggstate);
-        ForeignScanState *foreignNode = (ForeignScanState *) outerPlan;
-        TableReadState *readState = (TableReadState *) foreignNode->fdw_state;
+        key = TimestampBucketKey(vectorizedAggState->keyBucket,
+                                 minimumBucketId + bucketIndex);
+        hashEntry = LookupGroupByHashEntry(vectorizedAggState, keyTypeCacheEntry, key);
 
-        AttrNumber keyVarIndex = CurrentKeyVar->varattno - 1;
-        AttrNumber valueVarIndex = CurrentValueVar->varattno - 1;
+        if (denseValueFoundArray[bucketIndex]) {
+            MergeGroupByAggregate(vectorizedAggState, hashEntry,
+                                  denseValueArray[bucketIndex]);
+        }
+    }
 
-        HASHCTL info;
-        int hashFlags = 0;
-        TypeCacheEntry *keyTypeCacheEntry = NULL;
-        TypeCacheEntry *valueTypeCacheEntry = NULL;
+    memset(denseValueArray, 0, bucketCount * sizeof(int64));
+    memset(denseRowFoundArray, 0, bucketCount * sizeof(bool));
+    memset(denseValueFoundArray, 0, bucketCount * sizeof(bool));
+}
 
-        keyTypeCacheEntry = lookup_type_cache(CurrentKeyVar->vartype,
-                                              (TYPECACHE_HASH_PROC_FINFO |
-                                               TYPECACHE_EQ_OPR_FINFO));
 
-        valueTypeCacheEntry = lookup_type_cache(CurrentValueVar->vartype, 0);
+/*
+ * TimestampBucketKey returns the group by key of the timestamps in the given
+ * bucket. The key has the same value the key's function returns for them.
+ */
+static Datum
+TimestampBucketKey(TimestampBucket *bucket, int64 bucketId) {
+    Datum key = 0;
+
+    switch (bucket->bucketType) {
+        case TBT_TRUNC: {
+            Timestamp bucketStart = bucketId * bucket->bucketWidth + bucket->bucketOffset;
+            key = TimestampGetDatum(bucketStart);
+            break;
+        }
+        case TBT_DATE: {
+            key = DateADTGetDatum((DateADT) bucketId);
+            break;
+        }
+        case TBT_PART: {
+            int64 part = bucketId + bucket->partOffset;
+            int64 partModulus = bucket->partModulus;
 
-        CurrentHashFunction = &(keyTypeCacheEntry->hash_proc_finfo);
-        CurrentEqualityFunction = &(keyTypeCacheEntry->eq_opr_finfo);
+            part = part - FloorDivide(part, partModulus) * partModulus;
+            key = Float8GetDatum((float8) part);
+            break;
+        }
+        default: {
+            ereport(ERROR, (errmsg("unrecognized timestamp bucket type: %d",
+                                   bucket->bucketType)));
+        }
+    }
 
-        info.keysize = sizeof(Datum);
-        info.entrysize = sizeof(AggregationHashEntry);
-        info.hash = VectorizedHashTableHash;
-        info.match = VectorizedHashTableMatch;
+    return key;
+}
 
-        hashFlags = HASH_ELEM | HASH_FUNCTION | HASH_COMPARE;
 
-        CurrentAggregationHash = hash_create("Aggregation Hash", 1024,
-                                             &info, hashFlags);
+/*
+ * TimestampFunctionKey calls the key's function for a timestamp that doesn't
+ * fall into a bucket, such as an infinite timestamp.
+ */
+static Datum
+TimestampFunctionKey(TimestampBucket *bucket, Datum timestamp) {
+    Datum key = 0;
 
-        /* tmpcontext is the per-input-tuple expression context */
-        tmpcontext = aggstate->tmpcontext;
+    if (bucket->bucketType == TBT_DATE) {
+        key = FunctionCall1(&bucket->keyFunction, timestamp);
+    } else {
+        key = FunctionCall2(&bucket->keyFunction, bucket->unitArgument, timestamp);
+    }
 
-        /*
-         * Process each outer-plan tuple, and then fetch the next one, until we
-         * exhaust the outer plan.
-         */
-        for (;;) {
-            uint32 i = 0;
-            uint32 rowCount = 0;
-            uint64 blockRowCount = 0;
-            StripeData *stripeData = NULL;
+    return key;
+}
 
-            ColumnData *keyColumnData = NULL;
-            ColumnData *valueColumnData = NULL;
 
-            readState->stripeData = NULL;
-            outerslot = foreignNode->fdwroutine->IterateForeignScan(foreignNode);
+/* FloorDivide divides by a positive divisor, rounding towards negative infinity. */
+static int64
+FloorDivide(int64 dividend, int64 divisor) {
+    int64 quotient = dividend / divisor;
 
-            if (TupIsNull(outerslot))
-                break;
+    if (dividend % divisor != 0 && dividend < 0) {
+        quotient -= 1;
+    }
 
-            /* set up for advance_aggregates call */
-            tmpcontext->ecxt_outertuple = outerslot;
+    return quotient;
+}
 
-            stripeData = readState->stripeData;
-            rowCount = stripeData->rowCount;
-            blockRowCount = readState->tableFooter->blockRowCount;
-            keyColumnData = stripeData->columnDataArray[keyVarIndex];
-            valueColumnData = stripeData->columnDataArray[valueVarIndex];
 
-            for (i = 0; i < rowCount; i++) {
-                AggregationHashEntry *aggregationHashEntry = NULL;
-                bool handleFound = false;
+/*
+ * MergeGroupByAggregate adds a partial count or integer sum, which we computed
+ * over several rows at once, to the group's aggregate. Distinct keys don't have
+ * an aggregate to merge into.
+ */
+static void
+MergeGroupByAggregate(VectorizedAggState *vectorizedAggState,
+                      AggregationHashEntry *hashEntry, int64 partialValue) {
+    int64 value = 0;
 
-                int blockIndex = i / blockRowCount;
-                int rowIndex = i % blockRowCount;
+    if (vectorizedAggState->aggType == VAT_DISTINCT) {
+        return;
+    }
 
-                ColumnBlockData *keyBlockData = keyColumnData->blockDataArray[blockIndex];
-                ColumnBlockData *valueBlockData =
-                        valueColumnData->blockDataArray[blockIndex];
+    Assert(vectorizedAggState->aggType == VAT_GROUP_BY_COUNT ||
+           vectorizedAggState->valueTypeId == INT4OID);
 
-                Datum key = keyBlockData->valueArray[rowIndex];
-                Datum value = valueBlockData->valueArray[rowIndex];
+    if (!hashEntry->valueIsNull) {
+        value = DatumGetInt64(hashEntry->value);
+    }
 
-                bool exists = valueBlockData->existsArray[rowIndex];
-                if (!exists) {
-                    /* Reset per-input-tuple context after each tuple */
-                    ResetExprContext(tmpcontext);
-                    continue;
-                }
+    hashEntry->value = Int64GetDatum(value + partialValue);
+    hashEntry->valueIsNull = false;
+}
 
-                aggregationHashEntry =
-                        (AggregationHashEntry *) hash_search(CurrentAggregationHash, &key,
-                                                             HASH_ENTER, &handleFound);
-
-                if (CurrentVectorizedAggType == VAT_GROUP_BY_SUM) {
-                    if (handleFound) {
-                        Oid aggregateColumnType = CurrentValueVar->vartype;
-                        if (aggregateColumnType == FLOAT8OID) {
-                            aggregationHashEntry->value =
-                                    DirectFunctionCall2(float8pl,
-                                                        aggregationHashEntry->value,
-                                                        value);
-                        } else if (aggregateColumnType == INT4OID) {
-                            aggregationHashEntry->value =
-                                    aggregationHashEntry->value + value;
-                        } else {
-                            ereport(ERROR, (errmsg("unsupported column type: %d "
-                                                   "for vectorized sum() group by",
-                                                   aggregateColumnType)));
-                        }
-                    } else {
-                        aggregationHashEntry->key =
-                                datumCopy(key, keyTypeCacheEntry->typbyval,
-                                          keyTypeCacheEntry->typlen);
-
-                        aggregationHashEntry->value =
-                                datumCopy(value, valueTypeCacheEntry->typbyval,
-                                          valueTypeCacheEntry->typlen);
-                    }
-                } else if (CurrentVectorizedAggType == VAT_GROUP_BY_COUNT) {
-                    if (handleFound) {
-                        aggregationHashEntry->value = aggregationHashEntry->value + 1;
-                    } else {
-                        aggregationHashEntry->key =
-                                datumCopy(key, keyTypeCacheEntry->typbyval,
-                                          keyTypeCacheEntry->typlen);
-
-                        aggregationHashEntry->value =
-                                datumCopy(Int64GetDatum(1), valueTypeCacheEntry->typbyval,
-                                          valueTypeCacheEntry->typlen);
-                    }
-                }
 
-                /* Reset per-input-tuple context after each tuple */
-                ResetExprContext(tmpcontext);
+/*
+ * AdvanceGroupByAggregate adds a non-null value to the group's aggregate. For
+ * count, the value is ignored. Sum of int4 values produces an int8, and sum of
+ * float8 values a float8. Distinct keys don't have an aggregate.
+ */
+static void
+AdvanceGroupByAggregate(VectorizedAggState *vectorizedAggState,
+                        AggregationHashEntry *hashEntry, Datum value) {
+    if (vectorizedAggState->aggType == VAT_GROUP_BY_COUNT) {
+        int64 count = DatumGetInt64(hashEntry->value);
+        hashEntry->value = Int64GetDatum(count + 1);
+    } else if (vectorizedAggState->aggType == VAT_GROUP_BY_SUM) {
+        Oid aggregateColumnType = vectorizedAggState->valueTypeId;
+        if (aggregateColumnType == FLOAT8OID) {
+            if (hashEntry->valueIsNull) {
+                hashEntry->value = Float8GetDatum(DatumGetFloat8(value));
+            } else {
+                hashEntry->value = DirectFunctionCall2(float8pl, hashEntry->value,
+                                                       value);
             }
+        } else if (aggregateColumnType == INT4OID) {
+            int64 sum = 0;
+            if (!hashEntry->valueIsNull) {
+                sum = DatumGetInt64(hashEntry->value);
+            }
+
+            hashEntry->value = Int64GetDatum(sum + DatumGetInt32(value));
+        } else {
+            ereport(ERROR, (errmsg("unsupported column type: %d "
+                                   "for vectorized sum() group by",
+                                   aggregateColumnType)));
         }
 
-        aggstate->table_filled = true;
-        hash_seq_init(&CurrentHashSeqStatus, CurrentAggregationHash);
+        hashEntry->valueIsNull = false;
     }
+}
 
-    ExecClearTuple(resultSlot);
-
-    nextHashEntry =
-            (AggregationHashEntry *) hash_seq_search(&CurrentHashSeqStatus);
-
-    if (nextHashEntry != NULL) {
-        TupleDesc tupleDescriptor = resultSlot->tts_tupleDescriptor;
-        uint32 columnCount = tupleDescriptor->natts;
-        Datum *columnValues = resultSlot->tts_values;
-        bool *columnNulls = resultSlot->tts_isnull;
-
-        memset(columnValues, 0, columnCount * sizeof(Datum));
-        memset(columnNulls, true, columnCount * sizeof(bool));
 
-        if ((CurrentVectorizedAggType == VAT_GROUP_BY_SUM) ||
-            (CurrentVectorizedAggType == VAT_GROUP_BY_COUNT)) {
-            columnValues[0] = nextHashEntry->key;
-            columnValues[1] = nextHashEntry->value;
-            columnNulls[0] = false;
-            columnNulls[1] = false;
-        }
+/*
+ * DestroyAggregationHash ends any open scan over the aggregation hash, and
+ * destroys the hash. We call this function before the aggregate's memory
+ * context is reset, since the hash lives in that context.
+ */
+static void
+DestroyAggregationHash(VectorizedAggState *vectorizedAggState) {
+    if (vectorizedAggState->aggregationHash == NULL) {
+        return;
+    }
 
-        ExecStoreVirtualTuple(resultSlot);
-    } else {
-        hash_destroy(CurrentAggregationHash);
-        CurrentAggregationHash = NULL;
+    if (vectorizedAggState->hashSeqActive) {
+        hash_seq_term(&vectorizedAggState->hashSeqStatus);
+        vectorizedAggState->hashSeqActive = false;
     }
 
-    return resultSlot;
+    hash_destroy(vectorizedAggState->aggregationHash);
+    vectorizedAggState->aggregationHash = NULL;
+    vectorizedAggState->nullKeyFound = false;
 }
 
 
-/* 
+/*
  * Similar to agg_retrieve_direct. But takes data stripe by stripe instead of
- * row by row. We force cstore to return a new stripe in each iteration by
- * setting previous stripe to NULL. Instead of advance_aggregates, we call
+ * row by row, and reads stripes from cstore directly instead of through the
+ * foreign scan node. Instead of advance_aggregates, we call
  * advance_aggregates_vectorized.
  */
 static TupleTableSlot *
-agg_retrieve_direct_vectorized(AggState *aggstate) {
+agg_retrieve_direct_vectorized(VectorizedAggState *vectorizedAggState,
+                               AggState *aggstate) {
     PlanState *outerPlan;
     ExprContext *econtext;
     ExprContext *tmpcontext;
@@ -1155,13 +2326,12 @@ agg_retrieve_direct_vectorized(AggState *aggstate) {
     bool *aggnulls;
     AggStatePerAgg peragg;
     AggStatePerGroup pergroup;
-    TupleTableSlot *outerslot;
     TupleTableSlot *firstSlot;
     int aggno;
     ForeignScanState *foreignNode;
     TableReadState *readState;
-    TupleTableSlot *result;
-    ExprDoneCond isDone;
+    StripeData *stripeData;
+    uint64 blockRowCount;
 
     /*
      * get state info from node
@@ -1181,18 +2351,7 @@ agg_retrieve_direct_vectorized(AggState *aggstate) {
 
     foreignNode = (ForeignScanState *) outerPlan;
     readState = (TableReadState *) foreignNode->fdw_state;
-    readState->stripeData = NULL;
-
-    outerslot = foreignNode->fdwroutine->IterateForeignScan(foreignNode);
-    if (!TupIsNull(outerslot)) {
-        /*
-         * Make a copy of the first input tuple; we will use this for
-         * comparisons (in group mode) and for projection.
-         */
-        aggstate->grp_firstTuple = ExecCopySlotTuple(outerslot);
-    } else {
-        aggstate->agg_done = true;
-    }
+    blockRowCount = readState->tableFooter->blockRowCount;
 
     /*
      * Clear the per-output-tuple context for each group, as well as
@@ -1209,41 +2368,28 @@ agg_retrieve_direct_vectorized(AggState *aggstate) {
      */
     initialize_aggregates(aggstate, peragg, pergroup);
 
-    if (aggstate->grp_firstTuple != NULL) {
-        /*
-         * Store the copied first input tuple in the tuple table slot
-         * reserved for it.  The tuple will be deleted when it is cleared
-         * from the slot.
-         */
-        ExecStoreTuple(aggstate->grp_firstTuple, firstSlot, InvalidBuffer, true);
-        aggstate->grp_firstTuple = NULL;    /* don't keep two pointers */
-
-        /* set up for first advance_aggregates call */
-        tmpcontext->ecxt_outertuple = firstSlot;
-
-        /*
-         * Process each outer-plan tuple, and then fetch the next one,
-         * until we exhaust the outer plan or cross a group boundary.
-         */
-        for (;;) {
-            advance_aggregates_vectorized(aggstate, pergroup);
+    /*
+     * Process each stripe, and then fetch the next one, until we exhaust the
+     * table. Plain aggregates have a single group, so we are done afterwards.
+     */
+    if (vectorizedAggState->skipListAggregates) {
+        AdvanceAggregatesFromSkipLists(vectorizedAggState, aggstate, pergroup,
+                                       readState);
+    } else {
+        stripeData = CStoreReadNextStripe(readState);
+        while (stripeData != NULL) {
+            advance_aggregates_vectorized(vectorizedAggState, aggstate, pergroup,
+                                          stripeData, blockRowCount);
 
-            /* Reset per-input-tuple context after each tuple */
+            /* Reset per-input-tuple context after each stripe */
             ResetExprContext(tmpcontext);
 
-            readState->stripeData = NULL;
-            outerslot = foreignNode->fdwroutine->IterateForeignScan(foreignNode);
-            if (TupIsNull(outerslot)) {
-                /* no more outer-plan tuples available */
-                aggstate->agg_done = true;
-                break;
-            }
-
-            /* set up for next advance_aggregates call */
-            tmpcontext->ecxt_outertuple = outerslot;
+            stripeData = CStoreReadNextStripe(readState);
         }
     }
 
+    aggstate->agg_done = true;
+
     /*
      * Done scanning input tuple group. Finalize each aggregate
      * calculation, and stash results in the per-output-tuple context.
@@ -1252,40 +2398,45 @@ agg_retrieve_direct_vectorized(AggState *aggstate) {
         AggStatePerAgg peraggstate = &peragg[aggno];
         AggStatePerGroup pergroupstate = &pergroup[aggno];
 
-        if (peraggstate->numSortCols > 0) {
-            if (peraggstate->numInputs == 1) {
-                process_ordered_aggregate_single(aggstate, peraggstate, pergroupstate);
-            } else {
-                process_ordered_aggregate_multi(aggstate, peraggstate, pergroupstate);
-            }
-        }
-
         finalize_aggregate(aggstate, peraggstate, pergroupstate,
                            &aggvalues[aggno], &aggnulls[aggno]);
     }
 
     /*
-     * Use the representative input tuple for any references to
-     * non-aggregated input columns in the qual and tlist.	(If we are not
-     * grouping, and there are no input rows at all, we will come here
-     * with an empty firstSlot ... but if not grouping, there can't be any
-     * references to non-aggregated input columns, so no problem.)
+     * We don't keep a representative input tuple, but plain aggregates can't
+     * have references to non-aggregated input columns, so an empty slot works
+     * for the qual and tlist.
      */
+    ExecClearTuple(firstSlot);
     econtext->ecxt_outertuple = firstSlot;
 
     /*
-     * Form and return a projection tuple using the aggregate results
-     * and the representative input tuple.
+     * Check the qual (HAVING clause); if the group does not match, there is
+     * no output row for plain aggregates.
      */
+    if (ExecQual(aggstate->ss.ps.qual, econtext, false)) {
+        TupleTableSlot *result;
+        ExprDoneCond isDone;
+
+        /*
+         * Form and return a projection tuple using the aggregate results
+         * and the representative input tuple.
+         */
+        result = ExecProject(aggstate->ss.ps.ps_ProjInfo, &isDone);
 
-    result = ExecProject(aggstate->ss.ps.ps_ProjInfo, &isDone);
+        aggstate->ss.ps.ps_TupFromTlist = false;
+        if (isDone == ExprMultipleResult) {
+            aggstate->ss.ps.ps_TupFromTlist = true;
+        }
 
-    aggstate->ss.ps.ps_TupFromTlist = false;
-    if (isDone == ExprMultipleResult) {
-        aggstate->ss.ps.ps_TupFromTlist = true;
+        if (isDone != ExprEndResult) {
+            return result;
+        }
+    } else {
+        InstrCountFiltered1(aggstate, 1);
     }
 
-    return result;
+    return NULL;
 }
 
 
@@ -1293,55 +2444,52 @@ agg_retrieve_direct_vectorized(AggState *aggstate) {
  * Similar to advance_aggregates. Instead of passing a cell, we pass a stripe to
  * transfunction. (With some meta information: row count, block count in a row)
  * Instead of advance_transition_function, we call
- * advance_transition_function_vectorized.
+ * advance_transition_function_vectorized. Conditional aggregates get a copy of
+ * their column where rows that don't meet their condition are null, and skip
+ * stripes without such rows, so that they stay null if no row is aggregated.
  */
 static void
-advance_aggregates_vectorized(AggState *aggstate, AggStatePerGroup pergroup) {
-    PlanState *outerPlan = outerPlanState(aggstate);
-    ForeignScanState *foreignNode = (ForeignScanState *) outerPlan;
-    TableReadState *readState = (TableReadState *) foreignNode->fdw_state;
-    StripeData *stripeData = readState->stripeData;
+advance_aggregates_vectorized(VectorizedAggState *vectorizedAggState,
+                              AggState *aggstate, AggStatePerGroup pergroup,
+                              StripeData *stripeData, uint64 blockRowCount) {
     uint32 rowCount = stripeData->rowCount;
-    uint64 blockRowCount = readState->tableFooter->blockRowCount;
-
     int aggno = 0;
+    MemoryContext oldContext = NULL;
+
+    /* selection masks and masked columns only live until the next stripe */
+    oldContext = MemoryContextSwitchTo(aggstate->tmpcontext->ecxt_per_tuple_memory);
+
+    if (vectorizedAggState->aggFilterList != NIL) {
+        EvaluateAggregateFilters(vectorizedAggState, stripeData, blockRowCount);
+    }
+
+    MemoryContextSwitchTo(oldContext);
+
     for (aggno = 0; aggno < aggstate->numaggs; aggno++) {
         AggStatePerAgg peraggstate = &aggstate->peragg[aggno];
         AggStatePerGroup pergroupstate = &pergroup[aggno];
-        int32 argumentCount = peraggstate->numArguments + 1;
+        int32 columnIndex = vectorizedAggState->aggColumnIndexArray[aggno];
+        int32 filterIndex = vectorizedAggState->aggFilterIndexArray[aggno];
         ColumnData *columnData = NULL;
-        char *transitionFuncName = NULL;
-        char vectorTransitionFuncName[NAMEDATALEN];
-        List *qualVectorTransitionFuncName = NIL;
-        FuncCandidateList vectorTransitionFuncList = NULL;
         FunctionCallInfoData fcinfo;
 
-        /* simple check to handle count(*) */
-        int simpleColumnCount = peraggstate->evalproj->pi_numSimpleVars;
-        if (simpleColumnCount >= 1) {
-            int columnIndex = peraggstate->evalproj->pi_varNumbers[0] - 1;
+        /* count(*) doesn't read a column */
+        if (columnIndex >= 0) {
             columnData = stripeData->columnDataArray[columnIndex];
         }
 
-        /*
-         * If the user typed sum(), count(), or avg() instead of the vectorized
-         * aggregate names, manually map to the vectorized version here. This is
-         * merely syntactic sugar. Note that we rely on a naming convention here,
-         * where vectorized function names are regular function names with _vec
-         * appended to them.
-         */
-        transitionFuncName = get_func_name(peraggstate->transfn_oid);
-        snprintf(vectorTransitionFuncName, NAMEDATALEN, "%s_vec", transitionFuncName);
-
-        qualVectorTransitionFuncName =
-                stringToQualifiedNameList(vectorTransitionFuncName);
-        vectorTransitionFuncList = FuncnameGetCandidates(qualVectorTransitionFuncName,
-                                                         argumentCount, NIL,
-                                                         false, false);
+        if (filterIndex >= 0) {
+            AggregateFilter *aggFilter =
+                    (AggregateFilter *) list_nth(vectorizedAggState->aggFilterList,
+                                                 filterIndex);
+            if (!aggFilter->rowSelected) {
+                continue;
+            }
 
-        if (vectorTransitionFuncList != NULL) {
-            Oid functionOid = vectorTransitionFuncList->oid;
-            fmgr_info(functionOid, &peraggstate->transfn);
+            oldContext = MemoryContextSwitchTo(aggstate->tmpcontext->ecxt_per_tuple_memory);
+            columnData = MaskedColumnData(columnData, aggFilter->selectedRowMask,
+                                          rowCount, blockRowCount);
+            MemoryContextSwitchTo(oldContext);
         }
 
         fcinfo.arg[1] = PointerGetDatum(columnData);
@@ -1355,6 +2503,371 @@ advance_aggregates_vectorized(AggState *aggstate, AggStatePerGroup pergroup) {
 }
 
 
+/*
+ * EvaluateAggregateFilters evaluates plain aggregates' conditions on the given
+ * stripe, and sets each condition's selection mask to the rows that meet it.
+ * Clauses are evaluated one column at a time, and only on rows that met the
+ * condition's previous clauses.
+ */
+static void
+EvaluateAggregateFilters(VectorizedAggState *vectorizedAggState,
+                         StripeData *stripeData, uint64 blockRowCount) {
+    uint32 rowCount = stripeData->rowCount;
+    ListCell *aggFilterCell = NULL;
+
+    foreach(aggFilterCell, vectorizedAggState->aggFilterList) {
+        AggregateFilter *aggFilter = (AggregateFilter *) lfirst(aggFilterCell);
+        bool *selectedRowMask = palloc(Max(rowCount, 1) * sizeof(bool));
+        bool rowSelected = false;
+        ListCell *clauseCell = NULL;
+        uint32 rowIndex = 0;
+
+        memset(selectedRowMask, true, rowCount * sizeof(bool));
+
+        foreach(clauseCell, aggFilter->clauseList) {
+            AggregateFilterClause *filterClause =
+                    (AggregateFilterClause *) lfirst(clauseCell);
+            ColumnData *columnData = stripeData->columnDataArray[filterClause->columnIndex];
+
+            for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+                ColumnBlockData *blockData = NULL;
+                if (!selectedRowMask[rowIndex]) {
+                    continue;
+                }
+
+                blockData = columnData->blockDataArray[rowIndex / blockRowCount];
+                selectedRowMask[rowIndex] =
+                        AggregateFilterClauseMatches(filterClause, blockData,
+                                                     rowIndex % blockRowCount);
+            }
+        }
+
+        for (rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+            rowSelected |= selectedRowMask[rowIndex];
+        }
+
+        aggFilter->selectedRowMask = selectedRowMask;
+        aggFilter->rowSelected = rowSelected;
+    }
+}
+
+
+/* AggregateFilterClauseMatches evaluates the given filter clause on a row. */
+static bool
+AggregateFilterClauseMatches(AggregateFilterClause *filterClause,
+                             ColumnBlockData *blockData, uint32 blockRowIndex) {
+    bool valueExists = blockData->existsArray[blockRowIndex];
+    Datum leftValue = 0;
+    Datum rightValue = 0;
+
+    if (filterClause->isNullTest) {
+        if (filterClause->nullTestType == IS_NULL) {
+            return !valueExists;
+        }
+
+        return valueExists;
+    }
+
+    /* strict operators never match null values */
+    if (!valueExists) {
+        return false;
+    }
+
+    leftValue = blockData->valueArray[blockRowIndex];
+    rightValue = filterClause->constantValue;
+    if (!filterClause->columnIsLeftOperand) {
+        leftValue = filterClause->constantValue;
+        rightValue = blockData->valueArray[blockRowIndex];
+    }
+
+    return DatumGetBool(FunctionCall2Coll(&filterClause->operatorFunction,
+                                          filterClause->collation,
+                                          leftValue, rightValue));
+}
+
+
+/*
+ * MaskedColumnData returns a copy of the given column, where rows that aren't
+ * in the selection mask are null. Value arrays are shared with the column. For
+ * aggregates that don't read a column, the copy has no values, and its exists
+ * arrays are the selection mask; count() then counts the selected rows.
+ */
+static ColumnData *
+MaskedColumnData(ColumnData *columnData, bool *selectedRowMask, uint32 rowCount,
+                 uint64 blockRowCount) {
+    uint32 blockCount = (rowCount + blockRowCount - 1) / blockRowCount;
+    ColumnData *maskedColumnData = palloc0(sizeof(ColumnData));
+    uint32 blockIndex = 0;
+
+    maskedColumnData->blockDataArray = palloc0(Max(blockCount, 1) *
+                                               sizeof(ColumnBlockData *));
+
+    for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        ColumnBlockData *maskedBlockData = palloc0(sizeof(ColumnBlockData));
+        bool *blockRowMask = selectedRowMask + blockIndex * blockRowCount;
+        uint32 blockRowTotal = Min(blockRowCount, rowCount - blockIndex * blockRowCount);
+        uint32 blockRowIndex = 0;
+
+        maskedBlockData->existsArray = palloc0(blockRowCount * sizeof(bool));
+
+        if (columnData != NULL) {
+            ColumnBlockData *blockData = columnData->blockDataArray[blockIndex];
+
+            maskedBlockData->valueArray = blockData->valueArray;
+            for (blockRowIndex = 0; blockRowIndex < blockRowTotal; blockRowIndex++) {
+                maskedBlockData->existsArray[blockRowIndex] =
+                        blockData->existsArray[blockRowIndex] & blockRowMask[blockRowIndex];
+            }
+        } else {
+            memcpy(maskedBlockData->existsArray, blockRowMask,
+                   blockRowTotal * sizeof(bool));
+        }
+
+        maskedColumnData->blockDataArray[blockIndex] = maskedBlockData;
+    }
+
+    return maskedColumnData;
+}
+
+
+/*
+ * SkipListAggregateType finds how we can compute an aggregate with the given
+ * transition function from aggregates precomputed in skip lists. Skip lists
+ * only keep sums for some column types, so we also check the column type. If
+ * the aggregate needs the column data, the function returns SLAT_NONE.
+ */
+static SkipListAggType
+SkipListAggregateType(Oid transitionFunctionId, Oid columnTypeId) {
+    SkipListAggType skipListAggType = SLAT_NONE;
+
+    switch (transitionFunctionId) {
+        case F_INT8INC:
+            skipListAggType = SLAT_COUNT_ROWS;
+            break;
+        case F_INT8INC_ANY:
+            skipListAggType = SLAT_COUNT;
+            break;
+        case F_INT4_SUM:
+            if (columnTypeId == INT4OID) {
+                skipListAggType = SLAT_INTEGER_SUM;
+            }
+            break;
+        case F_INT4_AVG_ACCUM:
+            if (columnTypeId == INT4OID) {
+                skipListAggType = SLAT_INTEGER_AVG;
+            }
+            break;
+        case F_FLOAT8PL:
+            if (columnTypeId == FLOAT8OID) {
+                skipListAggType = SLAT_FLOAT_SUM;
+            }
+            break;
+        case F_FLOAT4_ACCUM:
+            if (columnTypeId == FLOAT4OID) {
+                skipListAggType = SLAT_FLOAT_ACCUM;
+            }
+            break;
+        case F_FLOAT8_ACCUM:
+            if (columnTypeId == FLOAT8OID) {
+                skipListAggType = SLAT_FLOAT_ACCUM;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return skipListAggType;
+}
+
+
+/*
+ * AdvanceAggregatesFromSkipLists goes over the table's stripes, and advances
+ * plain aggregates with the block aggregates in each stripe's skip list. Stripes
+ * written before skip lists had these aggregates, and stripes with deleted rows,
+ * are read and aggregated as usual. Vectorized scans don't filter rows, so every
+ * block of a stripe contributes to the aggregates.
+ */
+static void
+AdvanceAggregatesFromSkipLists(VectorizedAggState *vectorizedAggState,
+                               AggState *aggstate, AggStatePerGroup pergroup,
+                               TableReadState *readState) {
+    uint64 blockRowCount = readState->tableFooter->blockRowCount;
+    StripeSkipList *stripeSkipList = CStoreReadNextStripeSkipList(readState);
+
+    while (stripeSkipList != NULL) {
+        /* block aggregates don't know about deleted rows */
+        bool stripeHasDeletedRows = (readState->stripeMetadata->deletedRowCount > 0);
+
+        if (!stripeHasDeletedRows &&
+            SkipListHasAggregates(vectorizedAggState, aggstate, stripeSkipList)) {
+            int aggno = 0;
+
+            for (aggno = 0; aggno < aggstate->numaggs; aggno++) {
+                int32 columnIndex = vectorizedAggState->aggColumnIndexArray[aggno];
+                SkipListAggType skipListAggType =
+                        vectorizedAggState->skipListAggTypeArray[aggno];
+
+                /* count(*) only needs row counts, which every column has */
+                ColumnBlockSkipNode *blockSkipNodeArray =
+                        stripeSkipList->blockSkipNodeArray[Max(columnIndex, 0)];
+
+                AdvanceAggregateFromSkipList(aggstate, &aggstate->peragg[aggno],
+                                             &pergroup[aggno], skipListAggType,
+                                             blockSkipNodeArray,
+                                             stripeSkipList->blockCount);
+            }
+        } else {
+            StripeData *stripeData = CStoreReadCurrentStripe(readState);
+            if (stripeData->rowCount > 0) {
+                advance_aggregates_vectorized(vectorizedAggState, aggstate, pergroup,
+                                              stripeData, blockRowCount);
+            }
+        }
+
+        /* Reset per-input-tuple context after each stripe */
+        ResetExprContext(aggstate->tmpcontext);
+
+        stripeSkipList = CStoreReadNextStripeSkipList(readState);
+    }
+}
+
+
+/*
+ * SkipListHasAggregates checks if the given stripe skip list has all the block
+ * aggregates the plain aggregates need.
+ */
+static bool
+SkipListHasAggregates(VectorizedAggState *vectorizedAggState, AggState *aggstate,
+                      StripeSkipList *stripeSkipList) {
+    int aggno = 0;
+
+    for (aggno = 0; aggno < aggstate->numaggs; aggno++) {
+        int32 columnIndex = vectorizedAggState->aggColumnIndexArray[aggno];
+        SkipListAggType skipListAggType = vectorizedAggState->skipListAggTypeArray[aggno];
+        ColumnBlockSkipNode *blockSkipNodeArray = NULL;
+        uint32 blockIndex = 0;
+
+        if (skipListAggType == SLAT_COUNT_ROWS) {
+            continue;
+        }
+
+        blockSkipNodeArray = stripeSkipList->blockSkipNodeArray[columnIndex];
+        for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++) {
+            ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+
+            if (!blockSkipNode->hasNonNullCount) {
+                return false;
+            }
+
+            if ((skipListAggType == SLAT_INTEGER_SUM ||
+                 skipListAggType == SLAT_INTEGER_AVG) && !blockSkipNode->hasIntegerSum) {
+                return false;
+            }
+
+            if ((skipListAggType == SLAT_FLOAT_SUM ||
+                 skipListAggType == SLAT_FLOAT_ACCUM) && !blockSkipNode->hasFloatSum) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/*
+ * AdvanceAggregateFromSkipList adds up the given column's block aggregates, and
+ * advances the aggregate's transition value with them. The transition values
+ * are the ones of the regular transition functions, so the aggregates' final
+ * functions work as is. Sum aggregates stay null until they see a value.
+ */
+static void
+AdvanceAggregateFromSkipList(AggState *aggstate, AggStatePerAgg peraggstate,
+                             AggStatePerGroup pergroupstate,
+                             SkipListAggType skipListAggType,
+                             ColumnBlockSkipNode *blockSkipNodeArray, uint32 blockCount) {
+    uint64 rowCount = 0;
+    uint64 nonNullCount = 0;
+    int64 integerSum = 0;
+    float8 floatSum = 0.0;
+    float8 sumOfSquares = 0.0;
+    uint32 blockIndex = 0;
+    Datum newVal = pergroupstate->transValue;
+    bool newValIsNull = pergroupstate->transValueIsNull;
+    MemoryContext oldContext = NULL;
+
+    for (blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+
+        rowCount += blockSkipNode->rowCount;
+        nonNullCount += blockSkipNode->nonNullCount;
+        integerSum += blockSkipNode->integerSum;
+        floatSum += blockSkipNode->floatSum;
+        sumOfSquares += blockSkipNode->sumOfSquares;
+    }
+
+    /* pass-by-ref transition values are allocated in the aggregate context */
+    oldContext = MemoryContextSwitchTo(aggstate->aggcontext);
+
+    switch (skipListAggType) {
+        case SLAT_COUNT_ROWS:
+            newVal = Int64GetDatum(DatumGetInt64(newVal) + (int64) rowCount);
+            break;
+        case SLAT_COUNT:
+            newVal = Int64GetDatum(DatumGetInt64(newVal) + (int64) nonNullCount);
+            break;
+        case SLAT_INTEGER_SUM:
+            if (nonNullCount > 0) {
+                int64 previousSum = newValIsNull ? 0 : DatumGetInt64(newVal);
+                newVal = Int64GetDatum(previousSum + integerSum);
+                newValIsNull = false;
+            }
+            break;
+        case SLAT_FLOAT_SUM:
+            if (nonNullCount > 0) {
+                float8 previousSum = newValIsNull ? 0.0 : DatumGetFloat8(newVal);
+                newVal = Float8GetDatum(previousSum + floatSum);
+                newValIsNull = false;
+            }
+            break;
+        case SLAT_INTEGER_AVG: {
+            /* avg(int4) keeps a two element int8 array of count and sum */
+            ArrayType *transarray = DatumGetArrayTypeP(newVal);
+            int64 *transdata = (int64 *) ARR_DATA_PTR(transarray);
+
+            transdata[0] += (int64) nonNullCount;
+            transdata[1] += integerSum;
+            newVal = PointerGetDatum(transarray);
+            break;
+        }
+        case SLAT_FLOAT_ACCUM: {
+            /* float accumulators keep a three element float8 array of N, sumX, sumX2 */
+            ArrayType *transarray = DatumGetArrayTypeP(newVal);
+            float8 *transvalues = (float8 *) ARR_DATA_PTR(transarray);
+
+            transvalues[0] += (float8) nonNullCount;
+            transvalues[1] += floatSum;
+            transvalues[2] += sumOfSquares;
+            newVal = PointerGetDatum(transarray);
+            break;
+        }
+        default:
+            ereport(ERROR, (errmsg("unrecognized skip list aggregate type: %d",
+                                   (int) skipListAggType)));
+    }
+
+    if (!peraggstate->transtypeByVal && !pergroupstate->transValueIsNull &&
+        DatumGetPointer(newVal) != DatumGetPointer(pergroupstate->transValue)) {
+        pfree(DatumGetPointer(pergroupstate->transValue));
+    }
+
+    pergroupstate->transValue = newVal;
+    pergroupstate->transValueIsNull = newValIsNull;
+
+    MemoryContextSwitchTo(oldContext);
+}
+
+
 /*
  * Similar to advance_transition_function, but in vectorized version we don't
  * check for nulls. A stripe should be never null. So handling null values is
@@ -1402,10 +2915,37 @@ advance_transition_function_vectorized(AggState *aggstate, AggStatePerAgg peragg
 }
 
 
+/*
+ * InlineTextKey returns the given text key if we can read its bytes in place,
+ * and NULL if the key is compressed or stored out of line.
+ */
+static struct varlena *
+InlineTextKey(Datum key) {
+    struct varlena *keyText = (struct varlena *) DatumGetPointer(key);
+
+    if (VARATT_IS_COMPRESSED(keyText) || VARATT_IS_EXTERNAL(keyText)) {
+        return NULL;
+    }
+
+    return keyText;
+}
+
+
 static uint32
 VectorizedHashTableHash(const void *key, Size keySize) {
-    uint32 hashKey = DatumGetUInt32(FunctionCall1(CurrentHashFunction,
-                                                  (*(Datum *) key)));
+    uint32 hashKey = 0;
+
+    if (CurrentKeyIsText) {
+        struct varlena *keyText = InlineTextKey(*(Datum *) key);
+        if (keyText != NULL) {
+            /* same as hashtext(), which hashes the text's bytes */
+            hashKey = DatumGetUInt32(hash_any((unsigned char *) VARDATA_ANY(keyText),
+                                              VARSIZE_ANY_EXHDR(keyText)));
+            return hashKey;
+        }
+    }
+
+    hashKey = DatumGetUInt32(FunctionCall1(CurrentHashFunction, (*(Datum *) key)));
     return hashKey;
 }
 
@@ -1413,9 +2953,25 @@ VectorizedHashTableHash(const void *key, Size keySize) {
 static int
 VectorizedHashTableMatch(const void *key1, const void *key2,
                          Size keySize) {
-    bool keysEqual = DatumGetBool(FunctionCall2(CurrentEqualityFunction,
-                                                (*(Datum *) key1),
-                                                (*(Datum *) key2)));
+    bool keysEqual = false;
+
+    if (CurrentKeyIsText) {
+        struct varlena *keyText1 = InlineTextKey(*(Datum *) key1);
+        struct varlena *keyText2 = InlineTextKey(*(Datum *) key2);
+        if (keyText1 != NULL && keyText2 != NULL) {
+            uint32 keyLength1 = VARSIZE_ANY_EXHDR(keyText1);
+            uint32 keyLength2 = VARSIZE_ANY_EXHDR(keyText2);
+
+            keysEqual = (keyLength1 == keyLength2 &&
+                         memcmp(VARDATA_ANY(keyText1), VARDATA_ANY(keyText2),
+                                keyLength1) == 0);
+            return keysEqual ? 0 : 1;
+        }
+    }
+
+    keysEqual = DatumGetBool(FunctionCall2(CurrentEqualityFunction,
+                                           (*(Datum *) key1),
+                                           (*(Datum *) key2)));
     if (keysEqual) {
         return 0;
     }
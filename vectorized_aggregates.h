@@ -1,15 +1,186 @@
 #ifndef VECTORIZED_AGGREGATES_H
 #define VECTORIZED_AGGREGATES_H
 
-#include "executor/execdesc.h"
-#include "nodes/parsenodes.h"
+#include "nodes/execnodes.h"
+#include "nodes/plannodes.h"
+#include "utils/hsearch.h"
 
 
-extern void vectorized_ExecutorRun(QueryDesc *queryDesc,
-                                   ScanDirection direction, long count);
+/* Name of the vectorized aggregate custom scan, as shown in EXPLAIN */
+#define VECTORIZED_AGGREGATE_SCAN_NAME "VectorizedAggregate"
 
-extern TupleTableSlot *ExecProcNodeVectorized(PlanState *node);
+/*
+ * Fraction of the regular aggregate's per-row cost that we charge for the
+ * vectorized aggregate. Transition functions run once per stripe instead of
+ * once per row, and we skip forming tuples for the aggregate's input. The cost
+ * is only shown by EXPLAIN, and doesn't decide whether we vectorize.
+ */
+#define VECTORIZED_AGGREGATE_COST_FRACTION 0.25
 
-extern TupleTableSlot *ExecAggVectorized(AggState *node);
+/*
+ * Largest range of timestamp buckets in a block that we aggregate into dense
+ * arrays indexed by bucket, instead of looking up each row's hash entry.
+ */
+#define DENSE_BUCKET_COUNT_MAXIMUM 4096
+
+
+/*
+ * Types of group by aggregates we can vectorize. Distinct groups by without
+ * aggregate functions, which is how SELECT DISTINCT is planned too.
+ */
+typedef enum VectorizedAggType {
+    VAT_GROUP_BY_COUNT,
+    VAT_GROUP_BY_SUM,
+    VAT_DISTINCT
+} VectorizedAggType;
+
+
+/*
+ * Plain aggregates we can compute from aggregates precomputed in stripe skip
+ * lists, without reading column data.
+ */
+typedef enum SkipListAggType {
+    SLAT_NONE,
+    SLAT_COUNT_ROWS,
+    SLAT_COUNT,
+    SLAT_INTEGER_SUM,
+    SLAT_INTEGER_AVG,
+    SLAT_FLOAT_SUM,
+    SLAT_FLOAT_ACCUM
+} SkipListAggType;
+
+
+/* Group by keys we compute from timestamp columns */
+typedef enum TimestampBucketType {
+    TBT_TRUNC,
+    TBT_DATE,
+    TBT_PART
+} TimestampBucketType;
+
+
+/*
+ * TimestampBucket describes a group by key that is computed from a timestamp
+ * column, such as date_trunc('hour', ts), ts::date, or date_part('hour', ts).
+ * A finite timestamp falls into bucket floor((ts - bucketOffset) / bucketWidth),
+ * and its key is computed from the bucket id. Truncation returns the bucket's
+ * start, casts to date the bucket id itself, and date_part the bucket id plus
+ * partOffset modulo partModulus. Infinite timestamps are passed to the key's
+ * function instead.
+ */
+typedef struct TimestampBucket {
+    TimestampBucketType bucketType;
+    int64 bucketWidth;
+    int64 bucketOffset;
+    int64 partOffset;
+    int64 partModulus;
+    Oid keyFunctionId;
+    FmgrInfo keyFunction;
+    Datum unitArgument;
+} TimestampBucket;
+
+
+/*
+ * AggregateFilterClause is a clause in the condition of a conditional aggregate.
+ * The clause either compares a table column with a constant using a strict
+ * operator, or checks whether the column is null.
+ */
+typedef struct AggregateFilterClause {
+    int32 columnIndex;
+    bool isNullTest;
+    NullTestType nullTestType;
+    bool columnIsLeftOperand;
+    Datum constantValue;
+    Oid collation;
+    Oid functionId;
+    FmgrInfo operatorFunction;
+
+} AggregateFilterClause;
+
+
+/*
+ * AggregateFilter is a condition that one or more plain aggregates only
+ * aggregate rows for, given in a FILTER clause or a CASE WHEN argument. We
+ * evaluate each condition once per stripe into a selection mask, and conditional
+ * aggregates with the same condition share the mask.
+ */
+typedef struct AggregateFilter {
+    List *conditionList;
+    List *clauseList;
+    bool *selectedRowMask;
+    bool rowSelected;
+
+} AggregateFilter;
+
+
+/* Hash table entry for group by aggregates */
+typedef struct AggregationHashEntry {
+    Datum key;
+    Datum value;
+    bool valueIsNull;
+} AggregationHashEntry;
+
+
+/*
+ * VectorizedAggState is the execution state of a vectorized aggregate custom
+ * scan. The aggregate plan node is kept as the scan's outer plan, and the
+ * aggregate's own outer plan is the cstore foreign scan the stripes come from.
+ * Group by aggregates keep their hash table here, so that several vectorized
+ * aggregates can run in the same query.
+ */
+typedef struct VectorizedAggState {
+    CustomScanState customScanState;
+
+    /* table column indexes of plain aggregates' arguments, -1 for count(*) */
+    int32 *aggColumnIndexArray;
+
+    /*
+     * Conditions of plain aggregates, and for each aggregate the position of
+     * its condition in the list, or -1 for aggregates that read all rows.
+     */
+    List *aggFilterList;
+    int32 *aggFilterIndexArray;
+
+    /*
+     * If all plain aggregates can be computed from skip lists, we only read a
+     * stripe's data when its skip list misses some precomputed aggregates.
+     */
+    SkipListAggType *skipListAggTypeArray;
+    bool skipListAggregates;
+
+    /*
+     * State for group by aggregates. The value column index is -1 for count(*),
+     * and rows with a null key are aggregated outside the hash table.
+     */
+    VectorizedAggType aggType;
+    int32 keyColumnIndex;
+    int32 valueColumnIndex;
+    Oid keyTypeId;
+    Oid valueTypeId;
+    HTAB *aggregationHash;
+    HASH_SEQ_STATUS hashSeqStatus;
+    bool hashSeqActive;
+    AggregationHashEntry nullKeyEntry;
+    bool nullKeyFound;
+
+    /*
+     * For keys computed from a timestamp column, keyColumnIndex is the
+     * timestamp column, and keyBucket describes how we compute the key. We
+     * compute the bucket ids of a block's rows into the arrays below, and may
+     * aggregate them into the dense arrays before looking up hash entries.
+     */
+    TimestampBucket *keyBucket;
+    int64 *bucketIdArray;
+    bool *bucketFoundArray;
+    int64 *denseValueArray;
+    bool *denseRowFoundArray;
+    bool *denseValueFoundArray;
+
+} VectorizedAggState;
+
+
+/* GUC to enable vectorized aggregates */
+extern bool EnableVectorization;
+
+extern PlannedStmt *VectorizeAggregatePlans(PlannedStmt *plannedStmt);
 
 #endif
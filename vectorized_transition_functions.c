@@ -36,6 +36,10 @@ Datum float4_accum_vec(PG_FUNCTION_ARGS);
 
 Datum float8_accum_vec(PG_FUNCTION_ARGS);
 
+Datum cstore_int4_avg_combine(PG_FUNCTION_ARGS);
+
+Datum cstore_float8_accum_combine(PG_FUNCTION_ARGS);
+
 PG_FUNCTION_INFO_V1(int4_sum_vec);
 
 PG_FUNCTION_INFO_V1(int8_sum_vec);
@@ -56,6 +60,10 @@ PG_FUNCTION_INFO_V1(float4_accum_vec);
 
 PG_FUNCTION_INFO_V1(float8_accum_vec);
 
+PG_FUNCTION_INFO_V1(cstore_int4_avg_combine);
+
+PG_FUNCTION_INFO_V1(cstore_float8_accum_combine);
+
 
 /*
  * Routines for avg(int2) and avg(int4).  The transition datatype
@@ -250,9 +258,24 @@ int8_avg_accum_vec(PG_FUNCTION_ARGS) {
 Datum
 int8inc_vec(PG_FUNCTION_ARGS) {
     int64 arg = PG_GETARG_INT64(0);
+    ColumnData *columnData = (ColumnData *) PG_GETARG_POINTER(1);
     uint32 rowCount = *((uint32 *) PG_GETARG_POINTER(2));
+    uint64 blockRowCount = *((uint64 *) PG_GETARG_POINTER(3));
     int64 result = arg + (int64) rowCount;
 
+    /* count(*) with a FILTER clause gets its selected rows as column data */
+    if (columnData != NULL) {
+        uint32 i = 0;
+
+        result = arg;
+        for (i = 0; i < rowCount; i++) {
+            ColumnBlockData *blockData = columnData->blockDataArray[i / blockRowCount];
+            if (blockData->existsArray[i % blockRowCount]) {
+                result++;
+            }
+        }
+    }
+
     /* Overflow check */
     if (result < arg) {
         ereport(ERROR,
@@ -367,10 +390,12 @@ float8_accum_vec(PG_FUNCTION_ARGS) {
     float8 *transvalues = NULL;
     float8 N = 0.0;
     float8 sumX = 0.0;
+    float8 sumX2 = 0.0;
 
     transvalues = check_float8_array(transarray, "float8_accum_vec", 3);
     N = transvalues[0];
     sumX = transvalues[1];
+    sumX2 = transvalues[2];
 
     for (i = 0; i < rowCount; i++) {
         uint32 blockIndex = i / blockRowCount;
@@ -381,12 +406,15 @@ float8_accum_vec(PG_FUNCTION_ARGS) {
         bool exists = blockData->existsArray[rowIndex];
 
         if (exists) {
-            sumX = sumX + DatumGetFloat8(value);
+            float8 newValue = DatumGetFloat8(value);
+            sumX = sumX + newValue;
+            sumX2 = sumX2 + newValue * newValue;
             N++;
         }
     }
     transvalues[0] = N;
     transvalues[1] = sumX;
+    transvalues[2] = sumX2;
 
     PG_RETURN_ARRAYTYPE_P(transarray);
 }
@@ -403,10 +431,12 @@ float4_accum_vec(PG_FUNCTION_ARGS) {
     float8 *transvalues = NULL;
     float8 N = 0.0;
     float8 sumX = 0.0;
+    float8 sumX2 = 0.0;
 
     transvalues = check_float8_array(transarray, "float8_accum_vec", 3);
     N = transvalues[0];
     sumX = transvalues[1];
+    sumX2 = transvalues[2];
 
     for (i = 0; i < rowCount; i++) {
         uint32 blockIndex = i / blockRowCount;
@@ -417,13 +447,83 @@ float4_accum_vec(PG_FUNCTION_ARGS) {
         bool exists = blockData->existsArray[rowIndex];
 
         if (exists) {
-            sumX = sumX + (float8) DatumGetFloat4(value);
+            float8 newValue = (float8) DatumGetFloat4(value);
+            sumX = sumX + newValue;
+            sumX2 = sumX2 + newValue * newValue;
             N++;
         }
     }
 
     transvalues[0] = N;
     transvalues[1] = sumX;
+    transvalues[2] = sumX2;
+
+    PG_RETURN_ARRAYTYPE_P(transarray);
+}
+
+
+/*
+ * cstore_int4_avg_combine merges a partial avg(int4) state into the combine
+ * aggregate's state. Both states hold a count and a sum, so we add them up.
+ */
+Datum
+cstore_int4_avg_combine(PG_FUNCTION_ARGS) {
+    ArrayType *transarray = NULL;
+    ArrayType *partialarray = PG_GETARG_ARRAYTYPE_P(1);
+    Int8TransTypeData *transdata = NULL;
+    Int8TransTypeData *partialdata = NULL;
+
+    /*
+     * If we're invoked as an aggregate, we can cheat and modify our first
+     * parameter in-place to reduce palloc overhead. Otherwise we need to make
+     * a copy of it before scribbling on it.
+     */
+    if (AggCheckCallContext(fcinfo, NULL)) {
+        transarray = PG_GETARG_ARRAYTYPE_P(0);
+    } else {
+        transarray = PG_GETARG_ARRAYTYPE_P_COPY(0);
+    }
+
+    if (ARR_HASNULL(transarray) ||
+        ARR_SIZE(transarray) != ARR_OVERHEAD_NONULLS(1) + sizeof(Int8TransTypeData) ||
+        ARR_HASNULL(partialarray) ||
+        ARR_SIZE(partialarray) != ARR_OVERHEAD_NONULLS(1) + sizeof(Int8TransTypeData)) {
+        elog(ERROR, "expected 2-element int8 array");
+    }
+
+    transdata = (Int8TransTypeData *) ARR_DATA_PTR(transarray);
+    partialdata = (Int8TransTypeData *) ARR_DATA_PTR(partialarray);
+    transdata->count = transdata->count + partialdata->count;
+    transdata->sum = transdata->sum + partialdata->sum;
+
+    PG_RETURN_ARRAYTYPE_P(transarray);
+}
+
+
+/*
+ * cstore_float8_accum_combine merges a partial float accumulation state into
+ * the combine aggregate's state. Both states hold N, sum(X), and sum(X*X), so
+ * we add them up.
+ */
+Datum
+cstore_float8_accum_combine(PG_FUNCTION_ARGS) {
+    ArrayType *transarray = NULL;
+    ArrayType *partialarray = PG_GETARG_ARRAYTYPE_P(1);
+    float8 *transvalues = NULL;
+    float8 *partialvalues = NULL;
+
+    if (AggCheckCallContext(fcinfo, NULL)) {
+        transarray = PG_GETARG_ARRAYTYPE_P(0);
+    } else {
+        transarray = PG_GETARG_ARRAYTYPE_P_COPY(0);
+    }
+
+    transvalues = check_float8_array(transarray, "cstore_float8_accum_combine", 3);
+    partialvalues = check_float8_array(partialarray, "cstore_float8_accum_combine", 3);
+
+    transvalues[0] = transvalues[0] + partialvalues[0];
+    transvalues[1] = transvalues[1] + partialvalues[1];
+    transvalues[2] = transvalues[2] + partialvalues[2];
 
     PG_RETURN_ARRAYTYPE_P(transarray);
 }